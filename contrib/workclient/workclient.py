@@ -0,0 +1,42 @@
+#!/usr/bin/env python
+#
+# Minimal client for the -workserver push work server: subscribes, authorizes
+# with the node's rpcuser and rpcpassword, prints every job pushed to it, and
+# with --submit sends each job's data straight back, which the server answers
+# as a low difficulty share unless the target is trivial.
+#
+# Usage: workclient.py <rpcuser> <rpcpassword> [host] [port] [--submit]
+#
+
+import json
+import socket
+import sys
+
+args = [a for a in sys.argv[1:] if not a.startswith("--")]
+if len(args) < 2:
+	sys.exit("Usage: workclient.py <rpcuser> <rpcpassword> [host] [port] [--submit]")
+user, password = args[0], args[1]
+host = args[2] if len(args) > 2 else "127.0.0.1"
+port = int(args[3]) if len(args) > 3 else 17225
+submit = "--submit" in sys.argv
+
+sock = socket.create_connection((host, port))
+stream = sock.makefile("r")
+
+def send(id, method, params):
+	sock.sendall((json.dumps({"id": id, "method": method, "params": params}) + "\n").encode())
+
+# Jobs are pushed once both have succeeded
+send(1, "mining.subscribe", [])
+send(2, "mining.authorize", [user, password])
+nextid = 3
+for line in stream:
+	msg = json.loads(line)
+	if msg.get("method") == "mining.notify":
+		job_id, data, target, clean = msg["params"]
+		print("job %s clean=%s target=%s" % (job_id, clean, target))
+		if submit:
+			send(nextid, "mining.submit", [job_id, data])
+			nextid += 1
+	else:
+		print("reply %s: result=%s error=%s" % (msg.get("id"), msg.get("result"), msg.get("error")))
@@ -0,0 +1,118 @@
+// Copyright (c) 2015 The Bitcoin developers
+// Distributed under the MIT/X11 software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "bench.h"
+
+#include <iostream>
+#include <limits>
+
+#include <stdint.h>
+#include <sys/time.h>
+
+using namespace benchmark;
+
+#if defined(__GLIBC__)
+// Count every heap allocation by interposing glibc's malloc family. This also
+// covers operator new and containers that manage raw memory themselves, such
+// as prevector.
+static volatile int64_t nAllocations = 0;
+
+extern "C" void* __libc_malloc(size_t size);
+extern "C" void* __libc_calloc(size_t nmemb, size_t size);
+extern "C" void* __libc_realloc(void* ptr, size_t size);
+
+extern "C" void* malloc(size_t size)
+{
+    __sync_fetch_and_add(&nAllocations, 1);
+    return __libc_malloc(size);
+}
+
+extern "C" void* calloc(size_t nmemb, size_t size)
+{
+    __sync_fetch_and_add(&nAllocations, 1);
+    return __libc_calloc(nmemb, size);
+}
+
+extern "C" void* realloc(void* ptr, size_t size)
+{
+    __sync_fetch_and_add(&nAllocations, 1);
+    return __libc_realloc(ptr, size);
+}
+
+int64_t benchmark::GetAllocationCount()
+{
+    return nAllocations;
+}
+#else
+int64_t benchmark::GetAllocationCount()
+{
+    return 0;
+}
+#endif
+
+std::map<std::string, BenchFunction>& BenchRunner::benchmarks()
+{
+    static std::map<std::string, BenchFunction> benchmarks_map;
+    return benchmarks_map;
+}
+
+static double gettimedouble(void) {
+    struct timeval tv;
+    gettimeofday(&tv, NULL);
+    return tv.tv_usec * 0.000001 + tv.tv_sec;
+}
+
+BenchRunner::BenchRunner(std::string name, BenchFunction func)
+{
+    benchmarks().insert(std::make_pair(name, func));
+}
+
+void
+BenchRunner::RunAll(double elapsedTimeForOne)
+{
+    std::cout << "Benchmark" << "," << "count" << "," << "min" << "," << "max" << "," << "average" << "," << "allocs" << "\n";
+
+    for (std::map<std::string,BenchFunction>::iterator it = benchmarks().begin();
+         it != benchmarks().end(); ++it) {
+
+        State state(it->first, elapsedTimeForOne);
+        BenchFunction& func = it->second;
+        func(state);
+    }
+}
+
+bool State::KeepRunning()
+{
+    double now;
+    if (count == 0) {
+        beginAllocations = GetAllocationCount();
+        beginTime = now = gettimedouble();
+    }
+    else {
+        // timeCheckCount is used to avoid calling gettime most of the time,
+        // so benchmarks that run very quickly get consistent results.
+        if ((count+1)%timeCheckCount != 0) {
+            ++count;
+            return true; // keep going
+        }
+        now = gettimedouble();
+        double elapsedOne = (now - lastTime)/timeCheckCount;
+        if (elapsedOne < minTime) minTime = elapsedOne;
+        if (elapsedOne > maxTime) maxTime = elapsedOne;
+        if (elapsedOne*timeCheckCount < maxElapsed/16) timeCheckCount *= 2;
+    }
+    lastTime = now;
+    ++count;
+
+    if (now - beginTime < maxElapsed) return true; // Keep going
+
+    --count;
+
+    // Output results
+    double average = (now-beginTime)/count;
+    double allocs = (double)(GetAllocationCount() - beginAllocations)/count;
+    std::cout << name << "," << count << "," << minTime << "," << maxTime << "," << average << "," << allocs << "\n";
+
+    return false;
+}
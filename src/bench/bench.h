@@ -0,0 +1,75 @@
+// Copyright (c) 2015 The Bitcoin developers
+// Distributed under the MIT/X11 software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#ifndef BITCOIN_BENCH_BENCH_H
+#define BITCOIN_BENCH_BENCH_H
+
+#include <limits>
+#include <map>
+#include <string>
+
+#include <stdint.h>
+
+#include <boost/function.hpp>
+#include <boost/preprocessor/cat.hpp>
+#include <boost/preprocessor/stringize.hpp>
+
+// Simple micro-benchmarking framework; API mostly modeled after Google's
+// micro-benchmarking library (https://github.com/google/benchmark).
+//
+// Define a benchmark function:
+//
+//   static void CODE_TO_TIME(benchmark::State& state)
+//   {
+//       ... do any setup needed...
+//       while (state.KeepRunning()) {
+//           ... do stuff you want to time...
+//       }
+//       ... do any cleanup needed...
+//   }
+//
+//   BENCHMARK(CODE_TO_TIME);
+
+namespace benchmark {
+
+    // Number of heap allocations made by the process so far. Returns 0 when
+    // allocation counting is not supported on this platform.
+    int64_t GetAllocationCount();
+
+    class State {
+        std::string name;
+        double maxElapsed;
+        double beginTime;
+        double lastTime, minTime, maxTime;
+        int64_t count;
+        int64_t timeCheckCount;
+        int64_t beginAllocations;
+    public:
+        State(std::string _name, double _maxElapsed) : name(_name), maxElapsed(_maxElapsed), count(0), timeCheckCount(1), beginAllocations(0) {
+            minTime = std::numeric_limits<double>::max();
+            maxTime = std::numeric_limits<double>::min();
+        }
+        bool KeepRunning();
+    };
+
+    typedef boost::function<void(State&)> BenchFunction;
+
+    class BenchRunner
+    {
+        // Function-local static so registration does not depend on
+        // static initialization order across translation units.
+        static std::map<std::string, BenchFunction>& benchmarks();
+
+    public:
+        BenchRunner(std::string name, BenchFunction func);
+
+        static void RunAll(double elapsedTimeForOne=1.0);
+    };
+}
+
+// BENCHMARK(foo) expands to:  benchmark::BenchRunner bench_11foo("foo", foo);
+#define BENCHMARK(n) \
+    benchmark::BenchRunner BOOST_PP_CAT(bench_, BOOST_PP_CAT(__LINE__, n))(BOOST_PP_STRINGIZE(n), n);
+
+#endif // BITCOIN_BENCH_BENCH_H
@@ -0,0 +1,168 @@
+// Copyright (c) 2016 The Bitcoin developers
+// Distributed under the MIT/X11 software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "bench.h"
+
+#include "miner.h"
+#include "txdb.h"
+#include "util.h"
+
+#include <boost/filesystem.hpp>
+
+// Confirmed inputs made up on the spot instead of read from a chain
+class CBenchBlockAssembler : public CBlockAssembler
+{
+public:
+    std::map<uint256, CTransaction> mapChain;
+
+protected:
+    bool ReadChainInput(CTxDB& txdb, const COutPoint& prevout, CTxIndex& txindex, CTransaction& txPrev)
+    {
+        std::map<uint256, CTransaction>::const_iterator mi = mapChain.find(prevout.hash);
+        if (mi == mapChain.end())
+            return false;
+        txPrev = (*mi).second;
+        txindex = CTxIndex(CDiskTxPos(1, 1, 2), txPrev.vout.size());
+        return true;
+    }
+};
+
+static CTxDB* ptxdbBench = NULL;
+static uint256 hashBenchTip = 1;
+static CBlockIndex indexBenchTip;
+
+static void Setup()
+{
+    if (ptxdbBench)
+        return;
+    boost::filesystem::path pathTemp = boost::filesystem::temp_directory_path() / boost::filesystem::unique_path("bench_icochain_%%%%-%%%%");
+    boost::filesystem::create_directories(pathTemp);
+    mapArgs["-datadir"] = pathTemp.string();
+    ptxdbBench = new CTxDB("cr+");
+    indexBenchTip.phashBlock = &hashBenchTip;
+    indexBenchTip.nHeight = 1000;
+}
+
+// A pay-to-pubkey-hash spend of one output into one output, paying a fee
+static CTransaction Spend(const CTransaction& txPrev, unsigned int nTime)
+{
+    CTransaction tx;
+    tx.nTime = nTime;
+    tx.vin.resize(1);
+    tx.vin[0].prevout = COutPoint(txPrev.GetHash(), 0);
+    tx.vin[0].scriptSig << std::vector<unsigned char>(72, 0x30) << std::vector<unsigned char>(33, 0x02);
+    tx.vout.resize(1);
+    tx.vout[0].nAssetId = 0;
+    tx.vout[0].nValue = txPrev.vout[0].nValue - CENT;
+    tx.vout[0].scriptPubKey << OP_DUP << OP_HASH160 << std::vector<unsigned char>(20, 0) << OP_EQUALVERIFY << OP_CHECKSIG;
+    return tx;
+}
+
+// Add one pool transaction; every fourth one spends the one before it, the
+// others a confirmed output of their own
+static void AddPoolTx(CBenchBlockAssembler& assembler, CTransaction& txLast, int n)
+{
+    unsigned int nTime = GetAdjustedTime() - 600;
+    CTransaction tx;
+    bool fRoot = n % 4 == 0 || txLast.vout.empty();
+    if (!fRoot)
+        tx = Spend(txLast, nTime);
+    else
+    {
+        CTransaction txRoot;
+        txRoot.nTime = nTime - 600;
+        txRoot.nLockTime = n;
+        txRoot.vout.resize(1);
+        txRoot.vout[0].nAssetId = 0;
+        txRoot.vout[0].nValue = 100 * COIN;
+        txRoot.vout[0].scriptPubKey << OP_TRUE;
+        assembler.mapChain[txRoot.GetHash()] = txRoot;
+        tx = Spend(txRoot, nTime);
+    }
+    CTxMemPoolEntry entry(tx, indexBenchTip.nHeight, nTime);
+    entry.nSigOps = GetLegacySigOpCount(tx);
+    entry.nValueIn = tx.vout[0].nValue + CENT;
+    entry.nFee = CENT;
+    if (fRoot)
+    {
+        // Ten confirmations deep
+        entry.nChainInputValue = entry.nValueIn;
+        entry.dEntryPriority = (double)entry.nValueIn * 10 / entry.nTxSize;
+    }
+    mempool.addUnchecked(tx.GetHash(), tx, entry);
+    txLast = tx;
+}
+
+static void FillPool(CBenchBlockAssembler& assembler, CTransaction& txLast, int nTx)
+{
+    mempool.clear();
+    assembler.mapChain.clear();
+    assembler.Clear();
+    txLast = CTransaction();
+    for (int i = 0; i < nTx; i++)
+        AddPoolTx(assembler, txLast, i);
+}
+
+static void Update(CBenchBlockAssembler& assembler)
+{
+    assembler.Update(*ptxdbBench, &indexBenchTip, GetAdjustedTime(), false, MAX_BLOCK_SIZE - 1000, 27000, 0, MIN_TX_PEERK_FEE);
+}
+
+// A template from scratch, as after every new block
+static void RunFullBuild(benchmark::State& state, int nTx)
+{
+    Setup();
+    LOCK2(cs_main, mempool.cs);
+    CBenchBlockAssembler assembler;
+    CTransaction txLast;
+    FillPool(assembler, txLast, nTx);
+    while (state.KeepRunning()) {
+        assembler.Clear();
+        Update(assembler);
+        assert(assembler.vSelected.size() == (size_t)nTx);
+    }
+    mempool.clear();
+}
+
+// The template of a busy tip, with a new transaction between calls
+static void RunIncremental(benchmark::State& state, int nTx)
+{
+    Setup();
+    LOCK2(cs_main, mempool.cs);
+    CBenchBlockAssembler assembler;
+    CTransaction txLast;
+    FillPool(assembler, txLast, nTx);
+    Update(assembler);
+    int n = nTx;
+    while (state.KeepRunning()) {
+        AddPoolTx(assembler, txLast, n++);
+        Update(assembler);
+    }
+    mempool.clear();
+}
+
+static void BlockTemplateFull1000(benchmark::State& state)
+{
+    RunFullBuild(state, 1000);
+}
+
+static void BlockTemplateFull4000(benchmark::State& state)
+{
+    RunFullBuild(state, 4000);
+}
+
+static void BlockTemplateIncremental1000(benchmark::State& state)
+{
+    RunIncremental(state, 1000);
+}
+
+static void BlockTemplateIncremental4000(benchmark::State& state)
+{
+    RunIncremental(state, 4000);
+}
+
+BENCHMARK(BlockTemplateFull1000);
+BENCHMARK(BlockTemplateFull4000);
+BENCHMARK(BlockTemplateIncremental1000);
+BENCHMARK(BlockTemplateIncremental4000);
@@ -0,0 +1,47 @@
+// Copyright (c) 2016 The Bitcoin developers
+// Distributed under the MIT/X11 software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "bench.h"
+
+#include "main.h"
+#include "serialize.h"
+
+// Build a block of nTx transactions with the shape of ordinary pay-to-pubkey-hash
+// spends: two inputs carrying a signature and pubkey push, two outputs each.
+static void BuildBlock(CBlock& block, int nTx)
+{
+    block.SetNull();
+    for (int i = 0; i < nTx; i++) {
+        CTransaction tx;
+        tx.vin.resize(2);
+        for (unsigned int j = 0; j < tx.vin.size(); j++) {
+            tx.vin[j].prevout = COutPoint(uint256(i * 2 + j + 1), j);
+            tx.vin[j].scriptSig << std::vector<unsigned char>(72, 0x30) << std::vector<unsigned char>(33, 0x02);
+        }
+        tx.vout.resize(2);
+        for (unsigned int j = 0; j < tx.vout.size(); j++) {
+            tx.vout[j].nValue = 1000 + j;
+            tx.vout[j].scriptPubKey << OP_DUP << OP_HASH160 << std::vector<unsigned char>(20, (unsigned char)i) << OP_EQUALVERIFY << OP_CHECKSIG;
+        }
+        block.vtx.push_back(tx);
+    }
+    block.vchBlockSig.resize(72, 0x30);
+}
+
+static void DeserializeBlock(benchmark::State& state)
+{
+    CBlock block;
+    BuildBlock(block, 1000);
+    CDataStream stream(SER_NETWORK, PROTOCOL_VERSION);
+    stream << block;
+
+    while (state.KeepRunning()) {
+        CDataStream ssBlock(stream.begin(), stream.end(), SER_NETWORK, PROTOCOL_VERSION);
+        CBlock blockRead;
+        ssBlock >> blockRead;
+        assert(blockRead.vtx.size() == block.vtx.size());
+    }
+}
+
+BENCHMARK(DeserializeBlock);
@@ -0,0 +1,118 @@
+// Copyright (c) 2016 The Bitcoin developers
+// Distributed under the MIT/X11 software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "bench.h"
+
+#include "util.h"
+#include "wallet.h"
+
+#include <iostream>
+#include <limits>
+
+static CWallet wallet;
+
+// Fixed pseudo random sequence so every run sees the same UTXO sets and targets
+static uint32_t nRandState = 1;
+static uint32_t NextRand()
+{
+    nRandState = nRandState * 1103515245 + 12345;
+    return nRandState >> 8;
+}
+
+static void AddCoin(std::vector<COutput>& vCoins, int64_t nValue)
+{
+    CWalletTx* wtx = new CWalletTx(&wallet);
+    wtx->nLockTime = vCoins.size(); // distinct hashes
+    wtx->vout.resize(1);
+    wtx->vout[0].nValue = nValue;
+    vCoins.push_back(COutput(wtx, 0, 6 * 24));
+}
+
+// Staking reward and payout wallets: many small outputs in whole cents
+static void BuildPayoutCoins(std::vector<COutput>& vCoins, int nCoins)
+{
+    for (int i = 0; i < nCoins; i++)
+        AddCoin(vCoins, (1 + NextRand() % 100) * CENT);
+}
+
+// Ordinary wallets: values spread log-uniformly from 0.01 to 1000
+static void BuildMixedCoins(std::vector<COutput>& vCoins, int nCoins)
+{
+    for (int i = 0; i < nCoins; i++)
+    {
+        int64_t nValue = CENT;
+        for (int nDigits = NextRand() % 5; nDigits > 0; nDigits--)
+            nValue *= 10;
+        AddCoin(vCoins, nValue + NextRand() % nValue);
+    }
+}
+
+// Payments of a few coins, half of them rounded to the cent
+static void BuildTargets(std::vector<int64_t>& vTargets)
+{
+    for (int i = 0; i < 64; i++)
+    {
+        int64_t nTarget = (1 + NextRand() % 20) * COIN + (NextRand() % 100) * CENT;
+        if (i % 2)
+            nTarget += NextRand() % CENT;
+        vTargets.push_back(nTarget);
+    }
+}
+
+static void RunCoinSelection(benchmark::State& state, const std::string& strName, const std::vector<COutput>& vCoins)
+{
+    std::vector<int64_t> vTargets;
+    BuildTargets(vTargets);
+
+    int nSelections = 0, nChangeless = 0;
+    int64_t nInputs = 0, nChange = 0;
+    unsigned int i = 0;
+    while (state.KeepRunning()) {
+        int64_t nTarget = vTargets[i++ % vTargets.size()];
+        std::set<std::pair<const CWalletTx*,unsigned int> > setCoins;
+        int64_t nValue;
+        if (!wallet.SelectCoinsMinConf(nTarget, std::numeric_limits<unsigned int>::max(), 1, 10, vCoins, setCoins, nValue))
+            continue;
+        nSelections++;
+        nInputs += setCoins.size();
+        nChange += nValue - nTarget;
+        if (nValue == nTarget)
+            nChangeless++;
+    }
+
+    // Quality of the selections made while timing: share without change
+    // output, inputs spent and change created per selection
+    if (nSelections > 0)
+        std::cout << strprintf("# %s: %d selections, %.1f%% changeless, %.2f inputs, %s change\n",
+                               strName, nSelections, 100.0 * nChangeless / nSelections,
+                               (double)nInputs / nSelections, FormatMoney(nChange / nSelections));
+}
+
+static void CoinSelectionPayout(benchmark::State& state)
+{
+    static std::vector<COutput> vCoins;
+    if (vCoins.empty())
+        BuildPayoutCoins(vCoins, 2000);
+    RunCoinSelection(state, "CoinSelectionPayout", vCoins);
+}
+
+static void CoinSelectionPayoutLarge(benchmark::State& state)
+{
+    static std::vector<COutput> vCoins;
+    if (vCoins.empty())
+        BuildPayoutCoins(vCoins, 20000);
+    RunCoinSelection(state, "CoinSelectionPayoutLarge", vCoins);
+}
+
+static void CoinSelectionMixed(benchmark::State& state)
+{
+    static std::vector<COutput> vCoins;
+    if (vCoins.empty())
+        BuildMixedCoins(vCoins, 2000);
+    RunCoinSelection(state, "CoinSelectionMixed", vCoins);
+}
+
+BENCHMARK(CoinSelectionPayout);
+BENCHMARK(CoinSelectionPayoutLarge);
+BENCHMARK(CoinSelectionMixed);
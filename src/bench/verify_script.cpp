@@ -0,0 +1,113 @@
+// Copyright (c) 2016 The Bitcoin developers
+// Distributed under the MIT/X11 software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "bench.h"
+
+#include "key.h"
+#include "keystore.h"
+#include "main.h"
+#include "script.h"
+
+// Build a transaction spending one output locked by scriptPubKey, signed by keystore.
+static void BuildSpend(const CKeyStore& keystore, const CScript& scriptPubKey, CTransaction& txFrom, CTransaction& txTo)
+{
+    txFrom.vout.resize(1);
+    txFrom.vout[0].nValue = 1000;
+    txFrom.vout[0].scriptPubKey = scriptPubKey;
+
+    txTo.vin.resize(1);
+    txTo.vin[0].prevout = COutPoint(txFrom.GetHash(), 0);
+    txTo.vout.resize(1);
+    txTo.vout[0].nValue = 1000;
+    txTo.vout[0].scriptPubKey = scriptPubKey;
+
+    SignSignature(keystore, txFrom, txTo, 0);
+}
+
+static void VerifyP2PKH(benchmark::State& state, bool fTemplate)
+{
+    CBasicKeyStore keystore;
+    CKey key;
+    key.MakeNewKey(true);
+    keystore.AddKey(key);
+
+    CScript scriptPubKey;
+    scriptPubKey.SetDestination(key.GetPubKey().GetID());
+    CTransaction txFrom, txTo;
+    BuildSpend(keystore, scriptPubKey, txFrom, txTo);
+
+    // The signature cache is warm after the first pass, so this measures the
+    // script evaluation overhead rather than ECDSA.
+    const CScript& scriptSig = txTo.vin[0].scriptSig;
+    while (state.KeepRunning()) {
+        bool fOk;
+        if (fTemplate)
+            fOk = VerifyScript(scriptSig, scriptPubKey, txTo, 0, STANDARD_SCRIPT_VERIFY_FLAGS, 0);
+        else
+            fOk = VerifyScriptGeneric(scriptSig, scriptPubKey, txTo, 0, STANDARD_SCRIPT_VERIFY_FLAGS, 0);
+        assert(fOk);
+    }
+}
+
+static void VerifyP2SHMultisig(benchmark::State& state, bool fTemplate)
+{
+    CBasicKeyStore keystore;
+    std::vector<CPubKey> pubkeys;
+    for (int i = 0; i < 3; i++) {
+        CKey key;
+        key.MakeNewKey(true);
+        keystore.AddKey(key);
+        pubkeys.push_back(key.GetPubKey());
+    }
+    CScript redeem;
+    redeem.SetMultisig(2, pubkeys);
+    keystore.AddCScript(redeem);
+
+    CScript scriptPubKey;
+    scriptPubKey.SetDestination(redeem.GetID());
+    CTransaction txFrom, txTo;
+    BuildSpend(keystore, scriptPubKey, txFrom, txTo);
+
+    const CScript& scriptSig = txTo.vin[0].scriptSig;
+    while (state.KeepRunning()) {
+        bool fOk;
+        if (fTemplate)
+            fOk = VerifyScript(scriptSig, scriptPubKey, txTo, 0, STANDARD_SCRIPT_VERIFY_FLAGS, 0);
+        else
+            fOk = VerifyScriptGeneric(scriptSig, scriptPubKey, txTo, 0, STANDARD_SCRIPT_VERIFY_FLAGS, 0);
+        assert(fOk);
+    }
+}
+
+// Interpreter overhead without signature checks: shuffle and hash small stack
+// elements, the way hash-lock and arithmetic scripts do.
+static void EvalScriptStackOps(benchmark::State& state)
+{
+    CScript script;
+    for (int i = 0; i < 20; i++)
+        script << std::vector<unsigned char>(20, (unsigned char)i);
+    for (int i = 0; i < 19; i++)
+        script << OP_DUP << OP_HASH160 << OP_SWAP << OP_DROP << OP_NIP;
+    script << OP_SIZE << OP_NIP << OP_1 << OP_ADD;
+
+    CTransaction txTo;
+    txTo.vin.resize(1);
+    txTo.vout.resize(1);
+    while (state.KeepRunning()) {
+        std::vector<stackvaltype> stack;
+        bool fOk = EvalScript(stack, script, txTo, 0, 0, 0);
+        assert(fOk);
+    }
+}
+
+static void VerifyScriptP2PKH(benchmark::State& state) { VerifyP2PKH(state, true); }
+static void EvalScriptP2PKH(benchmark::State& state) { VerifyP2PKH(state, false); }
+static void VerifyScriptP2SHMultisig(benchmark::State& state) { VerifyP2SHMultisig(state, true); }
+static void EvalScriptP2SHMultisig(benchmark::State& state) { VerifyP2SHMultisig(state, false); }
+
+BENCHMARK(VerifyScriptP2PKH);
+BENCHMARK(EvalScriptP2PKH);
+BENCHMARK(VerifyScriptP2SHMultisig);
+BENCHMARK(EvalScriptP2SHMultisig);
+BENCHMARK(EvalScriptStackOps);
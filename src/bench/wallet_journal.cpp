@@ -0,0 +1,90 @@
+// Copyright (c) 2016 The Bitcoin developers
+// Distributed under the MIT/X11 software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "bench.h"
+
+#include "db.h"
+#include "util.h"
+
+#include <boost/filesystem.hpp>
+
+// Wallet file handle as CWalletDB uses it, with the writes made public
+class CBenchWalletDB : public CDB
+{
+public:
+    CBenchWalletDB() : CDB("bench_wallet.dat", "cr+") {}
+
+    bool WriteRecord(int n)
+    {
+        // About the size of a small wallet transaction record
+        return Write(std::make_pair(std::string("tx"), n), std::string(250, 'x'));
+    }
+};
+
+static void SetupDataDir()
+{
+    static bool fDone = false;
+    if (fDone)
+        return;
+    fDone = true;
+    boost::filesystem::path pathTemp = boost::filesystem::temp_directory_path() / boost::filesystem::unique_path("bench_icochain_%%%%-%%%%");
+    boost::filesystem::create_directories(pathTemp);
+    mapArgs["-datadir"] = pathTemp.string();
+}
+
+// One record per handle, as when the wallet saves a single transaction
+static void RunSingleWrites(benchmark::State& state, bool fJournal)
+{
+    SetupDataDir();
+    fWalletJournal = fJournal;
+    int n = 0;
+    while (state.KeepRunning()) {
+        CBenchWalletDB db;
+        db.WriteRecord(n++);
+    }
+    bitdb.Flush(false);
+    fWalletJournal = false;
+}
+
+// A hundred records in one transaction, as when a block pays the wallet many times
+static void RunGroupWrites(benchmark::State& state, bool fJournal)
+{
+    SetupDataDir();
+    fWalletJournal = fJournal;
+    int n = 0;
+    while (state.KeepRunning()) {
+        CBenchWalletDB db;
+        db.TxnBegin();
+        for (int i = 0; i < 100; i++)
+            db.WriteRecord(n++);
+        db.TxnCommit();
+    }
+    bitdb.Flush(false);
+    fWalletJournal = false;
+}
+
+static void WalletWriteBDB(benchmark::State& state)
+{
+    RunSingleWrites(state, false);
+}
+
+static void WalletWriteJournal(benchmark::State& state)
+{
+    RunSingleWrites(state, true);
+}
+
+static void WalletGroupWriteBDB(benchmark::State& state)
+{
+    RunGroupWrites(state, false);
+}
+
+static void WalletGroupWriteJournal(benchmark::State& state)
+{
+    RunGroupWrites(state, true);
+}
+
+BENCHMARK(WalletWriteBDB);
+BENCHMARK(WalletWriteJournal);
+BENCHMARK(WalletGroupWriteBDB);
+BENCHMARK(WalletGroupWriteJournal);
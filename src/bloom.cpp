@@ -0,0 +1,100 @@
+// Copyright (c) 2016 The Bitcoin developers
+// Distributed under the MIT/X11 software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "bloom.h"
+
+#include "util.h"
+
+#include <limits>
+
+#include <math.h>
+
+using namespace std;
+
+// Finalizer of MurmurHash3, enough to spread an already random hash with the salt
+static inline uint64_t Mix64(uint64_t n)
+{
+    n ^= n >> 33;
+    n *= 0xff51afd7ed558ccdULL;
+    n ^= n >> 33;
+    n *= 0xc4ceb9fe1a85ec53ULL;
+    n ^= n >> 33;
+    return n;
+}
+
+CRollingBloomFilter::CRollingBloomFilter(unsigned int nElements, double fpRate)
+{
+    double logFpRate = log(fpRate);
+    // The optimal number of hash functions is log(fpRate) / log(0.5), but
+    // restrict it to the range 1-50
+    nHashFuncs = max(1, min((int)floor(logFpRate / log(0.5) + 0.5), 50));
+    // Each generation holds half of nElements, and three are kept, two of them full
+    nEntriesPerGeneration = (nElements + 1) / 2;
+    uint32_t nMaxElements = nEntriesPerGeneration * 3;
+    // The bits needed for nMaxElements at fpRate with nHashFuncs functions
+    uint32_t nFilterBits = (uint32_t)ceil(-1.0 * nHashFuncs * nMaxElements / log(1.0 - exp(logFpRate / nHashFuncs)));
+    data.resize(((nFilterBits + 63) / 64) * 2);
+    reset();
+}
+
+void CRollingBloomFilter::insert(const uint256& hash)
+{
+    if (nEntriesThisGeneration == nEntriesPerGeneration)
+    {
+        nEntriesThisGeneration = 0;
+        nGeneration++;
+        if (nGeneration == 4)
+            nGeneration = 1;
+        uint64_t nGenerationMask1 = 0 - (uint64_t)(nGeneration & 1);
+        uint64_t nGenerationMask2 = 0 - (uint64_t)(nGeneration >> 1);
+        // Wipe the bits of the generation this one replaces
+        for (unsigned int p = 0; p < data.size(); p += 2)
+        {
+            uint64_t p1 = data[p], p2 = data[p + 1];
+            uint64_t mask = (p1 ^ nGenerationMask1) | (p2 ^ nGenerationMask2);
+            data[p] = p1 & mask;
+            data[p + 1] = p2 & mask;
+        }
+    }
+    nEntriesThisGeneration++;
+
+    // Double hashing: function n is h1 + n * h2
+    uint64_t h1 = Mix64(hash.Get64(0) ^ nTweak[0]);
+    uint64_t h2 = Mix64(hash.Get64(1) ^ nTweak[1]) | 1;
+    uint64_t nPairs = data.size() / 2;
+    for (int n = 0; n < nHashFuncs; n++)
+    {
+        uint64_t h = h1 + n * h2;
+        int bit = h & 0x3F;
+        unsigned int pos = 2 * (unsigned int)(((h >> 32) * nPairs) >> 32);
+        data[pos] = (data[pos] & ~((uint64_t)1 << bit)) | ((uint64_t)(nGeneration & 1)) << bit;
+        data[pos + 1] = (data[pos + 1] & ~((uint64_t)1 << bit)) | ((uint64_t)(nGeneration >> 1)) << bit;
+    }
+}
+
+bool CRollingBloomFilter::contains(const uint256& hash) const
+{
+    uint64_t h1 = Mix64(hash.Get64(0) ^ nTweak[0]);
+    uint64_t h2 = Mix64(hash.Get64(1) ^ nTweak[1]) | 1;
+    uint64_t nPairs = data.size() / 2;
+    for (int n = 0; n < nHashFuncs; n++)
+    {
+        uint64_t h = h1 + n * h2;
+        int bit = h & 0x3F;
+        unsigned int pos = 2 * (unsigned int)(((h >> 32) * nPairs) >> 32);
+        // A bit is set if its generation is not zero
+        if (!(((data[pos] | data[pos + 1]) >> bit) & 1))
+            return false;
+    }
+    return true;
+}
+
+void CRollingBloomFilter::reset()
+{
+    nTweak[0] = GetRand(std::numeric_limits<uint64_t>::max());
+    nTweak[1] = GetRand(std::numeric_limits<uint64_t>::max());
+    nEntriesThisGeneration = 0;
+    nGeneration = 1;
+    fill(data.begin(), data.end(), 0);
+}
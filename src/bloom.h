@@ -0,0 +1,43 @@
+// Copyright (c) 2016 The Bitcoin developers
+// Distributed under the MIT/X11 software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+#ifndef BITCOIN_BLOOM_H
+#define BITCOIN_BLOOM_H
+
+#include "uint256.h"
+
+#include <vector>
+
+#include <stdint.h>
+
+/**
+ * Fixed-memory filter of the hashes inserted most recently.
+ *
+ * Remembers at least the last nElements hashes and at most 1.5 times as many,
+ * with false positives at about fpRate. Elements are stamped with one of three
+ * generations, two bits per filter bit; starting a generation wipes the bits of
+ * the oldest one. Lookups are salted per filter, so peers cannot line up the
+ * misses of different nodes.
+ */
+class CRollingBloomFilter
+{
+public:
+    CRollingBloomFilter(unsigned int nElements, double fpRate);
+
+    void insert(const uint256& hash);
+    bool contains(const uint256& hash) const;
+    void reset();
+
+    size_t GetMemoryUsage() const { return data.size() * sizeof(uint64_t); }
+
+private:
+    unsigned int nEntriesPerGeneration;
+    unsigned int nEntriesThisGeneration;
+    int nGeneration;
+    int nHashFuncs;
+    uint64_t nTweak[2];
+    // Pairs of words: the low and high bit of the generation of 64 filter bits
+    std::vector<uint64_t> data;
+};
+
+#endif // BITCOIN_BLOOM_H
@@ -212,6 +212,34 @@ bool CCryptoKeyStore::AddKeyPubKey(const CKey& key, const CPubKey &pubkey)
     return true;
 }
 
+bool CCryptoKeyStore::EncryptSecrets(const std::vector<CKey>& vKey, const std::vector<CPubKey>& vPubKey, std::vector<std::vector<unsigned char> >& vCryptedSecret) const
+{
+    CKeyingMaterial vMasterKeyCopy;
+    {
+        LOCK(cs_KeyStore);
+        if (!IsCrypted() || IsLocked())
+            return false;
+        vMasterKeyCopy = vMasterKey;
+    }
+
+    vCryptedSecret.resize(vKey.size());
+    for (unsigned int i = 0; i < vKey.size(); i++)
+    {
+        CKeyingMaterial vchSecret(vKey[i].begin(), vKey[i].end());
+        if (!EncryptSecret(vMasterKeyCopy, vchSecret, vPubKey[i].GetHash(), vCryptedSecret[i]))
+            return false;
+    }
+    return true;
+}
+
+void CCryptoKeyStore::RemoveKey(const CKeyID &address)
+{
+    LOCK(cs_KeyStore);
+    if (!IsCrypted())
+        CBasicKeyStore::RemoveKey(address);
+    else
+        mapCryptedKeys.erase(address);
+}
 
 bool CCryptoKeyStore::AddCryptedKey(const CPubKey &vchPubKey, const std::vector<unsigned char> &vchCryptedSecret)
 {
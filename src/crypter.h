@@ -173,6 +173,9 @@ public:
 
     virtual bool AddCryptedKey(const CPubKey &vchPubKey, const std::vector<unsigned char> &vchCryptedSecret);
     bool AddKeyPubKey(const CKey& key, const CPubKey &pubkey);
+    // encrypt the secrets of keys about to be added in one go, holding cs_KeyStore only to copy the master key
+    bool EncryptSecrets(const std::vector<CKey>& vKey, const std::vector<CPubKey>& vPubKey, std::vector<std::vector<unsigned char> >& vCryptedSecret) const;
+    void RemoveKey(const CKeyID &address);
     bool HaveKey(const CKeyID &address) const
     {
         {
@@ -227,7 +227,7 @@ void CDBEnv::CheckpointLSN(const std::string& strFile)
 
 
 CDB::CDB(const std::string& strFilename, const char* pszMode) :
-    pdb(NULL), activeTxn(NULL)
+    pdb(NULL), activeTxn(NULL), pjournal(NULL), pjournalTxn(NULL)
 {
     int ret;
     fReadOnly = (!strchr(pszMode, '+') && !strchr(pszMode, 'w'));
@@ -235,6 +235,22 @@ CDB::CDB(const std::string& strFilename, const char* pszMode) :
         return;
 
     bool fCreate = strchr(pszMode, 'c');
+    if (fWalletJournal)
+    {
+        strFile = strFilename;
+        pjournal = CWalletJournal::Get(strFile);
+        if (!pjournal)
+            throw runtime_error(strprintf("CDB : can't open wallet journal %s", strFile));
+        if (fCreate && !Exists(string("version")))
+        {
+            bool fTmp = fReadOnly;
+            fReadOnly = false;
+            WriteVersion(CLIENT_VERSION);
+            fReadOnly = fTmp;
+        }
+        return;
+    }
+
     unsigned int nFlags = DB_THREAD;
     if (fCreate)
         nFlags |= DB_CREATE;
@@ -291,6 +307,15 @@ CDB::CDB(const std::string& strFilename, const char* pszMode) :
 
 void CDB::Close()
 {
+    if (pjournal)
+    {
+        if (pjournalTxn)
+            TxnAbort();
+        // Everything written through this handle goes to the journal file in one write
+        pjournal->Flush(false);
+        pjournal = NULL;
+        return;
+    }
     if (!pdb)
         return;
     if (activeTxn)
@@ -337,6 +362,17 @@ bool CDBEnv::RemoveDb(const string& strFile)
 
 bool CDB::Rewrite(const string& strFile, const char* pszSkip)
 {
+    if (fWalletJournal)
+    {
+        {
+            CDB db(strFile, "r+");
+            db.WriteVersion(CLIENT_VERSION);
+        }
+        CWalletJournal* pjournal = CWalletJournal::Get(strFile);
+        LogPrintf("Compacting %s...\n", strFile);
+        return pjournal && pjournal->Compact(pszSkip);
+    }
+
     while (true)
     {
         {
@@ -367,7 +403,7 @@ bool CDB::Rewrite(const string& strFile, const char* pszSkip)
                         fSuccess = false;
                     }
 
-                    Dbc* pcursor = db.GetCursor();
+                    CDBCursor* pcursor = db.GetCursor();
                     if (pcursor)
                         while (fSuccess)
                         {
@@ -428,10 +464,82 @@ bool CDB::Rewrite(const string& strFile, const char* pszSkip)
     return false;
 }
 
+bool CDB::MigrateToJournal(const string& strFile)
+{
+    assert(!fWalletJournal);
+    LogPrintf("Migrating %s to a wallet journal...\n", strFile);
+    int64_t nStart = GetTimeMillis();
+
+    // Build the journal aside and move its snapshot into place last, so an
+    // interrupted migration leaves no journal behind and is simply redone
+    filesystem::path pathSnapshot = GetDataDir() / (strFile + ".snapshot");
+    filesystem::path pathTmpSnapshot = GetDataDir() / (strFile + ".migrate.snapshot");
+    filesystem::path pathTmpJournal = GetDataDir() / (strFile + ".migrate.journal");
+    filesystem::remove(pathTmpSnapshot);
+    filesystem::remove(pathTmpJournal);
+
+    bool fSuccess;
+    unsigned int nRecords = 0;
+    {
+        CWalletJournal journal(pathTmpSnapshot, pathTmpJournal);
+        CDB db(strFile, "r");
+        CDBCursor* pcursor = db.GetCursor();
+        fSuccess = pcursor && journal.Open();
+        while (fSuccess)
+        {
+            CDataStream ssKey(SER_DISK, CLIENT_VERSION);
+            CDataStream ssValue(SER_DISK, CLIENT_VERSION);
+            int ret = db.ReadAtCursor(pcursor, ssKey, ssValue, DB_NEXT);
+            if (ret == DB_NOTFOUND)
+                break;
+            else if (ret != 0)
+                fSuccess = false;
+            else
+            {
+                journal.Write(CSerializeData(ssKey.begin(), ssKey.end()), CSerializeData(ssValue.begin(), ssValue.end()), true, NULL);
+                nRecords++;
+            }
+        }
+        if (pcursor)
+            pcursor->close();
+        fSuccess = fSuccess && journal.Compact();
+    }
+
+    filesystem::remove(pathTmpJournal);
+    if (fSuccess)
+    {
+        filesystem::remove(GetDataDir() / (strFile + ".journal"));
+        fSuccess = RenameOver(pathTmpSnapshot, pathSnapshot);
+    }
+    if (!fSuccess)
+    {
+        filesystem::remove(pathTmpSnapshot);
+        return error("CDB::MigrateToJournal() : migration of %s FAILED", strFile);
+    }
+    LogPrintf("Migrated %u records of %s in %dms\n", nRecords, strFile, GetTimeMillis() - nStart);
+
+    // The file is never read again. Move it out of the way so that backups of
+    // it are not mistaken for the live wallet; the caller warns if this fails.
+    {
+        LOCK(bitdb.cs_db);
+        bitdb.CloseDb(strFile);
+        bitdb.CheckpointLSN(strFile);
+        bitdb.mapFileUseCount.erase(strFile);
+    }
+    filesystem::path pathFile = GetDataDir() / strFile;
+    filesystem::path pathPremigration = GetDataDir() / (strFile + ".premigration");
+    if (RenameOver(pathFile, pathPremigration))
+        LogPrintf("Moved %s to %s\n", pathFile.string(), pathPremigration.string());
+    else
+        LogPrintf("CDB::MigrateToJournal() : could not move %s to %s\n", pathFile.string(), pathPremigration.string());
+    return true;
+}
+
 
 void CDBEnv::Flush(bool fShutdown)
 {
     int64_t nStart = GetTimeMillis();
+    CWalletJournal::FlushAll(fShutdown);
     // Flush log data to the actual data file
     //  on all files that are not in use
     LogPrint("db", "Flush(%s)%s\n", fShutdown ? "true" : "false", fDbEnvInit ? "" : " db not started");
@@ -9,6 +9,7 @@
 #include "serialize.h"
 #include "sync.h"
 #include "version.h"
+#include "walletjournal.h"
 
 #include <map>
 #include <string>
@@ -89,7 +90,26 @@ public:
 extern CDBEnv bitdb;
 
 
-/** RAII class that provides access to a Berkeley database */
+/** Cursor over a CDB, on Berkeley DB or on the wallet journal */
+class CDBCursor
+{
+public:
+    Dbc* pdbc;
+    CSerializeData vchKey;   // journal: key of the last record read
+    bool fStarted;
+
+    explicit CDBCursor(Dbc* pdbcIn) : pdbc(pdbcIn), fStarted(false) {}
+
+    void close()
+    {
+        if (pdbc)
+            pdbc->close();
+        delete this;
+    }
+};
+
+
+/** RAII class that provides access to a Berkeley database, or to a CWalletJournal with -walletjournal */
 class CDB
 {
 protected:
@@ -97,6 +117,8 @@ protected:
     std::string strFile;
     DbTxn *activeTxn;
     bool fReadOnly;
+    CWalletJournal* pjournal;
+    CWalletJournalBatch* pjournalTxn;
 
     explicit CDB(const std::string& strFilename, const char* pszMode="r+");
     ~CDB() { Close(); }
@@ -112,13 +134,27 @@ protected:
     template<typename K, typename T>
     bool Read(const K& key, T& value)
     {
-        if (!pdb)
+        if (!pdb && !pjournal)
             return false;
 
         // Key
         CDataStream ssKey(SER_DISK, CLIENT_VERSION);
         ssKey.reserve(1000);
         ssKey << key;
+        if (pjournal)
+        {
+            CSerializeData vchValue;
+            if (!pjournal->Read(CSerializeData(ssKey.begin(), ssKey.end()), vchValue, pjournalTxn))
+                return false;
+            try {
+                CDataStream ssValue(vchValue, SER_DISK, CLIENT_VERSION);
+                ssValue >> value;
+            }
+            catch (std::exception &e) {
+                return false;
+            }
+            return true;
+        }
         Dbt datKey(&ssKey[0], ssKey.size());
 
         // Read
@@ -147,7 +183,7 @@ protected:
     template<typename K, typename T>
     bool Write(const K& key, const T& value, bool fOverwrite=true)
     {
-        if (!pdb)
+        if (!pdb && !pjournal)
             return false;
         if (fReadOnly)
             assert(!"Write called on database in read-only mode");
@@ -162,6 +198,8 @@ protected:
         CDataStream ssValue(SER_DISK, CLIENT_VERSION);
         ssValue.reserve(10000);
         ssValue << value;
+        if (pjournal)
+            return pjournal->Write(CSerializeData(ssKey.begin(), ssKey.end()), CSerializeData(ssValue.begin(), ssValue.end()), fOverwrite, pjournalTxn);
         Dbt datValue(&ssValue[0], ssValue.size());
 
         // Write
@@ -176,7 +214,7 @@ protected:
     template<typename K>
     bool Erase(const K& key)
     {
-        if (!pdb)
+        if (!pdb && !pjournal)
             return false;
         if (fReadOnly)
             assert(!"Erase called on database in read-only mode");
@@ -185,6 +223,8 @@ protected:
         CDataStream ssKey(SER_DISK, CLIENT_VERSION);
         ssKey.reserve(1000);
         ssKey << key;
+        if (pjournal)
+            return pjournal->Erase(CSerializeData(ssKey.begin(), ssKey.end()), pjournalTxn);
         Dbt datKey(&ssKey[0], ssKey.size());
 
         // Erase
@@ -198,13 +238,15 @@ protected:
     template<typename K>
     bool Exists(const K& key)
     {
-        if (!pdb)
+        if (!pdb && !pjournal)
             return false;
 
         // Key
         CDataStream ssKey(SER_DISK, CLIENT_VERSION);
         ssKey.reserve(1000);
         ssKey << key;
+        if (pjournal)
+            return pjournal->Exists(CSerializeData(ssKey.begin(), ssKey.end()), pjournalTxn);
         Dbt datKey(&ssKey[0], ssKey.size());
 
         // Exists
@@ -215,19 +257,45 @@ protected:
         return (ret == 0);
     }
 
-    Dbc* GetCursor()
+    CDBCursor* GetCursor()
     {
+        if (pjournal)
+            return new CDBCursor(NULL);
         if (!pdb)
             return NULL;
         Dbc* pcursor = NULL;
         int ret = pdb->cursor(NULL, &pcursor, 0);
         if (ret != 0)
             return NULL;
-        return pcursor;
+        return new CDBCursor(pcursor);
     }
 
-    int ReadAtCursor(Dbc* pcursor, CDataStream& ssKey, CDataStream& ssValue, unsigned int fFlags=DB_NEXT)
+    int ReadAtCursor(CDBCursor* pcursor, CDataStream& ssKey, CDataStream& ssValue, unsigned int fFlags=DB_NEXT)
     {
+        if (pjournal)
+        {
+            // The journal cursor only walks forward, from the start or from a key
+            if (fFlags == DB_SET_RANGE)
+            {
+                pcursor->vchKey.assign(ssKey.begin(), ssKey.end());
+                pcursor->fStarted = false;
+            }
+            else if (fFlags != DB_NEXT)
+                return 99999;
+            CSerializeData vchValue;
+            if (!pjournal->Seek(pcursor->vchKey, vchValue, pcursor->fStarted, pjournalTxn))
+                return DB_NOTFOUND;
+            pcursor->fStarted = true;
+
+            ssKey.SetType(SER_DISK);
+            ssKey.clear();
+            ssKey.write(&pcursor->vchKey[0], pcursor->vchKey.size());
+            ssValue.SetType(SER_DISK);
+            ssValue.clear();
+            ssValue.write(&vchValue[0], vchValue.size());
+            return 0;
+        }
+
         // Read at cursor
         Dbt datKey;
         if (fFlags == DB_SET || fFlags == DB_SET_RANGE || fFlags == DB_GET_BOTH || fFlags == DB_GET_BOTH_RANGE)
@@ -243,7 +311,7 @@ protected:
         }
         datKey.set_flags(DB_DBT_MALLOC);
         datValue.set_flags(DB_DBT_MALLOC);
-        int ret = pcursor->get(&datKey, &datValue, fFlags);
+        int ret = pcursor->pdbc->get(&datKey, &datValue, fFlags);
         if (ret != 0)
             return ret;
         else if (datKey.get_data() == NULL || datValue.get_data() == NULL)
@@ -268,6 +336,14 @@ protected:
 public:
     bool TxnBegin()
     {
+        if (pjournal)
+        {
+            if (pjournalTxn)
+                return false;
+            pjournalTxn = new CWalletJournalBatch();
+            pjournal->Begin(*pjournalTxn);
+            return true;
+        }
         if (!pdb || activeTxn)
             return false;
         DbTxn* ptxn = bitdb.TxnBegin();
@@ -279,6 +355,13 @@ public:
 
     bool TxnCommit()
     {
+        if (pjournal && pjournalTxn)
+        {
+            bool fOk = pjournal->Commit(*pjournalTxn);
+            delete pjournalTxn;
+            pjournalTxn = NULL;
+            return fOk;
+        }
         if (!pdb || !activeTxn)
             return false;
         int ret = activeTxn->commit(0);
@@ -288,6 +371,13 @@ public:
 
     bool TxnAbort()
     {
+        if (pjournal && pjournalTxn)
+        {
+            pjournal->Abort(*pjournalTxn);
+            delete pjournalTxn;
+            pjournalTxn = NULL;
+            return true;
+        }
         if (!pdb || !activeTxn)
             return false;
         int ret = activeTxn->abort();
@@ -307,6 +397,8 @@ public:
     }
 
     bool static Rewrite(const std::string& strFile, const char* pszSkip = NULL);
+    /** Copy a Berkeley DB wallet file into a new wallet journal, then rename the file to <file>.premigration */
+    bool static MigrateToJournal(const std::string& strFile);
 };
 
 #endif // BITCOIN_DB_H
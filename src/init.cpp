@@ -14,6 +14,7 @@
 #ifdef ENABLE_WALLET
 #include "wallet.h"
 #include "walletdb.h"
+#include "workserver.h"
 #endif
 
 #include <boost/filesystem.hpp>
@@ -76,6 +77,9 @@ volatile bool fRequestShutdown = false;
 void StartShutdown()
 {
     fRequestShutdown = true;
+    // Release RPC calls long-polling for a new block
+    boost::unique_lock<CWaitableCriticalSection> lock(csBestBlock);
+    cvBlockChange.notify_all();
 }
 bool ShutdownRequested()
 {
@@ -93,14 +97,21 @@ void Shutdown()
     mempool.AddTransactionsUpdated(1);
     StopRPCThreads();
 #ifdef ENABLE_WALLET
+    StopWorkServer();
     ShutdownRPCMining();
     if (pwalletMain)
+    {
+        pwalletMain->StopKeyPoolRefill();
         bitdb.Flush(false);
+    }
 #endif
     StopNode();
+    if (GetBoolArg("-persistmempool", true))
+        DumpMempool();
     {
         LOCK(cs_main);
 #ifdef ENABLE_WALLET
+        StopWalletNotifications();
         if (pwalletMain)
             pwalletMain->SetBestChain(CBlockLocator(pindexBest));
 #endif
@@ -187,6 +198,8 @@ std::string HelpMessage()
     strUsage += "  -bantime=<n>           " + _("Number of seconds to keep misbehaving peers from reconnecting (default: 86400)") + "\n";
     strUsage += "  -maxreceivebuffer=<n>  " + _("Maximum per-connection receive buffer, <n>*1000 bytes (default: 5000)") + "\n";
     strUsage += "  -maxsendbuffer=<n>     " + _("Maximum per-connection send buffer, <n>*1000 bytes (default: 1000)") + "\n";
+    strUsage += "  -maxuploadtarget=<n>   " + _("Try to keep upload under <n> MiB per 24h by not serving historical blocks, keeping enough for new blocks (default: 0 = no limit)") + "\n";
+    strUsage += "  -maxpeeruploadrate=<n> " + _("Serve historical blocks to each peer at <n>*1000 bytes per second at most (default: 0 = no limit)") + "\n";
 #ifdef USE_UPNP
 #if USE_UPNP
     strUsage += "  -upnp                  " + _("Use UPnP to map the listening port (default: 1 when listening)") + "\n";
@@ -237,17 +250,32 @@ std::string HelpMessage()
     strUsage += "  -alertnotify=<cmd>     " + _("Execute command when a relevant alert is received (%s in cmd is replaced by message)") + "\n";
     strUsage += "  -upgradewallet         " + _("Upgrade wallet to latest format") + "\n";
     strUsage += "  -keypool=<n>           " + _("Set key pool size to <n> (default: 100)") + "\n";
+    strUsage += "  -keypoolmin=<n>        " + _("Refill the key pool in the background when <n> keys are left (default: half of -keypool)") + "\n";
     strUsage += "  -rescan                " + _("Rescan the block chain for missing wallet transactions") + "\n";
+    strUsage += "  -rescanthreads=<n>     " + _("Number of threads reading blocks during a rescan (default: number of cores, max 16)") + "\n";
     strUsage += "  -salvagewallet         " + _("Attempt to recover private keys from a corrupt wallet.dat") + "\n";
+    strUsage += "  -walletasync           " + _("Apply block and transaction notifications to the wallet on a separate thread (default: 0)") + "\n";
+    strUsage += "  -walletqueuesize=<n>   " + strprintf(_("Notifications -walletasync queues before validation waits for the wallet thread (default: %u)"), DEFAULT_WALLET_QUEUE_SIZE) + "\n";
+    strUsage += "  -walletjournal         " + _("Store the wallet in an append-only journal instead of Berkeley DB, migrating wallet.dat once (default: 0)") + "\n";
     strUsage += "  -checkblocks=<n>       " + _("How many blocks to check at startup (default: 500, 0 = all)") + "\n";
     strUsage += "  -checklevel=<n>        " + _("How thorough the block verification is (0-6, default: 1)") + "\n";
     strUsage += "  -loadblock=<file>      " + _("Imports blocks from external blk000?.dat file") + "\n";
     strUsage += "  -maxorphanblocksmib=<n> " + strprintf(_("Keep at most <n> MiB of unconnectable blocks in memory (default: %u)"), DEFAULT_MAX_ORPHAN_BLOCKS) + "\n";
+    strUsage += "  -maxorphantxmib=<n>    " + strprintf(_("Keep at most <n> MiB of transactions with missing inputs in memory (default: %u)"), DEFAULT_MAX_ORPHAN_TX) + "\n";
+    strUsage += "  -maxmempool=<n>        " + strprintf(_("Keep the transaction memory pool below <n> megabytes, evicting the lowest fee rates (default: %u)"), DEFAULT_MAX_MEMPOOL_SIZE) + "\n";
+    strUsage += "  -mempoolexpiry=<n>     " + strprintf(_("Do not keep transactions in the memory pool longer than <n> hours (default: %u)"), DEFAULT_MEMPOOL_EXPIRY) + "\n";
+    strUsage += "  -persistmempool        " + _("Save the memory pool on shutdown and load it on restart (default: 1)") + "\n";
 
     strUsage += "\n" + _("Block creation options:") + "\n";
     strUsage += "  -blockminsize=<n>      "   + _("Set minimum block size in bytes (default: 0)") + "\n";
     strUsage += "  -blockmaxsize=<n>      "   + _("Set maximum block size in bytes (default: 250000)") + "\n";
     strUsage += "  -blockprioritysize=<n> "   + _("Set maximum size of high-priority/low-fee transactions in bytes (default: 27000)") + "\n";
+#ifdef ENABLE_WALLET
+    strUsage += "  -workserver            "   + _("Push new work to miners over line-delimited JSON on a TCP port (default: 0)") + "\n";
+    strUsage += "  -workserverport=<port> "   + _("Listen for work server connections on <port> (default: JSON-RPC port + 2)") + "\n";
+    strUsage += "  -workserverbind=<addr> "   + _("Listen for work server connections on <addr>, miners log in with the RPC credentials (default: 127.0.0.1)") + "\n";
+    strUsage += "  -workservershare=<n>   "   + _("Accept work server shares <n> times easier than the block target (default: 1)") + "\n";
+#endif
 
     strUsage += "\n" + _("SSL options: (see the Bitcoin Wiki for SSL setup instructions)") + "\n";
     strUsage += "  -rpcssl                                  " + _("Use OpenSSL (https) for JSON-RPC connections") + "\n";
@@ -505,6 +533,12 @@ bool AppInit2(boost::thread_group& threadGroup)
             }
         }
 
+        // A wallet once migrated stays a journal; the wallet.dat it came from is not read again
+        bool fHaveJournal = CWalletJournal::HaveJournal(strWalletFileName);
+
+        if (GetBoolArg("-salvagewallet", false) && fHaveJournal)
+            return InitError(_("-salvagewallet only recovers a wallet.dat, this wallet is kept in a journal"));
+
         if (GetBoolArg("-salvagewallet", false))
         {
             // Recover readable keypairs:
@@ -512,7 +546,7 @@ bool AppInit2(boost::thread_group& threadGroup)
                 return false;
         }
 
-        if (filesystem::exists(GetDataDir() / strWalletFileName))
+        if (!fHaveJournal && filesystem::exists(GetDataDir() / strWalletFileName))
         {
             CDBEnv::VerifyResult r = bitdb.Verify(strWalletFileName, CWalletDB::Recover);
             if (r == CDBEnv::RECOVER_OK)
@@ -526,6 +560,26 @@ bool AppInit2(boost::thread_group& threadGroup)
             if (r == CDBEnv::RECOVER_FAIL)
                 return InitError(_("wallet.dat corrupt, salvage failed"));
         }
+
+        if (GetBoolArg("-walletjournal", false) && !fHaveJournal && filesystem::exists(GetDataDir() / strWalletFileName))
+        {
+            uiInterface.InitMessage(_("Migrating wallet to journal..."));
+            if (!CDB::MigrateToJournal(strWalletFileName))
+                return InitError(_("Error migrating wallet.dat to a wallet journal"));
+            if (!filesystem::exists(GetDataDir() / strWalletFileName))
+                InitWarning(strprintf(_("Warning: %s was migrated to a wallet journal and renamed to %s.premigration in %s."
+                                        " That file no longer changes and is not encrypted along with the wallet;"
+                                        " use backupwallet to make backups."), strWalletFileName, strWalletFileName, strDataDir));
+        }
+        if (fHaveJournal || GetBoolArg("-walletjournal", false))
+        {
+            // Left over from a migration that could not rename it, or put back by hand
+            if (filesystem::exists(GetDataDir() / strWalletFileName))
+                InitWarning(strprintf(_("Warning: %s in %s is not used, the wallet is kept in a journal."
+                                        " It is missing every key and transaction since the migration; move it away"
+                                        " and use backupwallet to make backups."), strWalletFileName, strDataDir));
+        }
+        fWalletJournal = fHaveJournal || GetBoolArg("-walletjournal", false);
     } // (!fDisableWallet)
 #endif // ENABLE_WALLET
     // ********************************************************* Step 6: network initialization
@@ -627,6 +681,8 @@ bool AppInit2(boost::thread_group& threadGroup)
     BOOST_FOREACH(string strDest, mapMultiArgs["-seednode"])
         AddOneShot(strDest);
 
+    CNode::SetMaxOutboundTarget(GetArg("-maxuploadtarget", 0) * 1024 * 1024);
+
     // ********************************************************* Step 7: load blockchain
 
     if (GetBoolArg("-loadblockindextest", false))
@@ -751,6 +807,8 @@ bool AppInit2(boost::thread_group& threadGroup)
         LogPrintf(" wallet      %15dms\n", GetTimeMillis() - nStart);
 
         RegisterWallet(pwalletMain);
+        if (GetBoolArg("-walletasync", false))
+            StartWalletNotifications(threadGroup);
 
         CBlockIndex *pindexRescan = pindexBest;
         if (GetBoolArg("-rescan", false))
@@ -829,6 +887,18 @@ bool AppInit2(boost::thread_group& threadGroup)
 #endif
     if (fServer)
         StartRPCThreads();
+#ifdef ENABLE_WALLET
+    StartWorkServer();
+#endif
+
+    // Reload the memory pool behind the node's back, then save it now and then
+    if (GetBoolArg("-persistmempool", true))
+    {
+        threadGroup.create_thread(boost::bind(&TraceThread<void (*)()>, "loadmempool", &LoadMempool));
+        threadGroup.create_thread(boost::bind(&LoopForever<bool (*)()>, "dumpmempool", &DumpMempool, DUMP_MEMPOOL_INTERVAL * 1000));
+    }
+    else
+        fMempoolLoaded = true;
 
 #ifdef ENABLE_WALLET
     // Mine proof-of-stake blocks in the background
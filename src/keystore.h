@@ -48,6 +48,11 @@ protected:
 
 public:
     bool AddKeyPubKey(const CKey& key, const CPubKey &pubkey);
+    void RemoveKey(const CKeyID &address)
+    {
+        LOCK(cs_KeyStore);
+        mapKeys.erase(address);
+    }
     bool HaveKey(const CKeyID &address) const
     {
         bool result;
@@ -86,6 +91,7 @@ public:
     virtual bool AddCScript(const CScript& redeemScript);
     virtual bool HaveCScript(const CScriptID &hash) const;
     virtual bool GetCScript(const CScriptID &hash, CScript& redeemScriptOut) const;
+    void GetCScripts(std::set<CScriptID> &setScriptID) const;
 };
 
 typedef std::map<CKeyID, std::pair<CPubKey, std::vector<unsigned char> > > CryptedKeyMap;
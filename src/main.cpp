@@ -35,6 +35,10 @@ set<CWallet*> setpwalletRegistered;
 
 CCriticalSection cs_main;
 
+// Notified when the tip changes, for waiters that must not hold cs_main
+CWaitableCriticalSection csBestBlock;
+boost::condition_variable_any cvBlockChange;
+
 CTxMemPool mempool;
 
 map<uint256, CBlockIndex*> mapBlockIndex;
@@ -60,6 +64,7 @@ uint256 hashBestChain = 0;
 CBlockIndex* pindexBest = NULL;
 int64_t nTimeBestReceived = 0;
 bool fImporting = false;
+bool fMempoolLoaded = false;
 bool fReindex = false;
 bool fHaveGUI = false;
 
@@ -74,8 +79,8 @@ multimap<uint256, COrphanBlock*> mapOrphanBlocksByPrev;
 set<pair<COutPoint, unsigned int> > setStakeSeenOrphan;
 size_t nOrphanBlocksSize = 0;
 
-map<uint256, CTransaction> mapOrphanTransactions;
-map<uint256, set<uint256> > mapOrphanTransactionsByPrev;
+map<uint256, COrphanTx> mapOrphanTransactions;
+map<COutPoint, set<uint256> > mapOrphanTransactionsByPrev;
 
 // Constant stuff for coinbase transactions we create:
 CScript COINBASE_FLAGS;
@@ -104,6 +109,150 @@ struct CMainSignals {
     // Tells listeners to broadcast their data.
     boost::signals2::signal<void (bool)> Broadcast;
 } g_signals;
+
+// A SyncTransaction, UpdatedTransaction or SetBestChain notification waiting for the wallet thread.
+// Events only hold immutable copies, so they can be applied without cs_main.
+struct CWalletEvent {
+    enum Type { SYNC_TRANSACTION, UPDATED_TRANSACTION, SET_BEST_CHAIN };
+    Type type;
+    boost::shared_ptr<const CBlock> pblock;       // the block, shared by the events of all its transactions
+    unsigned int nTx;                             // index of the transaction in pblock->vtx
+    boost::shared_ptr<const CTransaction> ptx;    // a transaction outside a block
+    bool fConnect;
+    uint256 hash;
+    CBlockLocator locator;
+
+    explicit CWalletEvent(Type typeIn) : type(typeIn), nTx(0), fConnect(true) {}
+    const CTransaction& GetTransaction() const { return pblock ? pblock->vtx[nTx] : *ptx; }
+};
+
+// With -walletasync, wallet notifications from validation are queued and applied in
+// order by ThreadWalletNotifications() instead of inside ConnectBlock() and
+// AcceptToMemoryPool(). Events are applied holding cs_apply, which keeps batches in
+// order, and each wallet takes its own cs_wallet; validation never waits for them.
+// When the queue is full producers wait for the wallet thread to make room.
+struct CWalletQueue {
+    bool fEnabled;
+    size_t nMaxSize;
+    CCriticalSection cs_apply;
+    boost::mutex mutex;
+    boost::condition_variable cond;
+    boost::condition_variable condSpace;
+    std::deque<CWalletEvent> queue;
+    uint64_t nQueued;
+    uint64_t nApplied;
+    uint64_t nOverflows;
+    bool fStalled;
+
+    CWalletQueue() : fEnabled(false), nMaxSize(0), nQueued(0), nApplied(0), nOverflows(0), fStalled(false) {}
+} walletQueue;
+
+// Events applied per batch by the wallet thread, so a barrier can get in between
+static const unsigned int WALLET_QUEUE_BATCH = 100;
+// How long a producer waits on a full queue for the wallet thread to apply something. If
+// it applies nothing in that time it is likely waiting for a wallet lock the producer
+// holds, and producers stop waiting until it gets going again.
+static const int64_t WALLET_QUEUE_WAIT_MILLIS = 100;
+}
+
+static void ApplyWalletEvents(size_t nMax)
+{
+    LOCK(walletQueue.cs_apply);
+    std::deque<CWalletEvent> events;
+    {
+        boost::unique_lock<boost::mutex> lock(walletQueue.mutex);
+        if (walletQueue.queue.size() <= nMax)
+            events.swap(walletQueue.queue);
+        else
+        {
+            events.assign(walletQueue.queue.begin(), walletQueue.queue.begin() + nMax);
+            walletQueue.queue.erase(walletQueue.queue.begin(), walletQueue.queue.begin() + nMax);
+        }
+    }
+    walletQueue.condSpace.notify_all();
+
+    BOOST_FOREACH(const CWalletEvent& event, events)
+    {
+        if (event.type == CWalletEvent::SYNC_TRANSACTION)
+            g_signals.SyncTransaction(event.GetTransaction(), event.pblock.get(), event.fConnect);
+        else if (event.type == CWalletEvent::UPDATED_TRANSACTION)
+            g_signals.UpdatedTransaction(event.hash);
+        else
+            g_signals.SetBestChain(event.locator);
+    }
+
+    boost::unique_lock<boost::mutex> lock(walletQueue.mutex);
+    walletQueue.nApplied += events.size();
+    if (!events.empty())
+        walletQueue.fStalled = false;
+}
+
+static void QueueWalletEvent(const CWalletEvent& event)
+{
+    {
+        boost::unique_lock<boost::mutex> lock(walletQueue.mutex);
+        // Back-pressure: wait for room while the wallet thread is making progress
+        while (walletQueue.queue.size() >= walletQueue.nMaxSize && !walletQueue.fStalled)
+        {
+            uint64_t nAppliedBefore = walletQueue.nApplied;
+            walletQueue.cond.notify_one();
+            if (!walletQueue.condSpace.timed_wait(lock, boost::posix_time::milliseconds(WALLET_QUEUE_WAIT_MILLIS)) &&
+                walletQueue.nApplied == nAppliedBefore && walletQueue.queue.size() >= walletQueue.nMaxSize)
+                walletQueue.fStalled = true;
+        }
+        if (walletQueue.queue.size() >= walletQueue.nMaxSize)
+            walletQueue.nOverflows++;
+        walletQueue.queue.push_back(event);
+        walletQueue.nQueued++;
+    }
+    walletQueue.cond.notify_one();
+}
+
+void SyncWithWalletQueue()
+{
+    {
+        boost::unique_lock<boost::mutex> lock(walletQueue.mutex);
+        if (walletQueue.nApplied == walletQueue.nQueued)
+            return;
+    }
+    // Whatever the wallet thread has taken is applied once cs_apply is ours, the rest here
+    ApplyWalletEvents(std::numeric_limits<size_t>::max());
+}
+
+void ThreadWalletNotifications()
+{
+    RenameThread("Icochain-walletnotify");
+    while (true)
+    {
+        {
+            boost::unique_lock<boost::mutex> lock(walletQueue.mutex);
+            while (walletQueue.queue.empty())
+                walletQueue.cond.wait(lock);
+        }
+        ApplyWalletEvents(WALLET_QUEUE_BATCH);
+    }
+}
+
+void StartWalletNotifications(boost::thread_group& threadGroup)
+{
+    walletQueue.nMaxSize = std::max((int64_t)1, GetArg("-walletqueuesize", DEFAULT_WALLET_QUEUE_SIZE));
+    walletQueue.fEnabled = true;
+    threadGroup.create_thread(&ThreadWalletNotifications);
+}
+
+void StopWalletNotifications()
+{
+    // The wallet thread is gone by now, apply what it left behind
+    SyncWithWalletQueue();
+    walletQueue.fEnabled = false;
+}
+
+void GetWalletQueueStats(uint64_t& nQueued, uint64_t& nApplied, uint64_t& nOverflows)
+{
+    boost::unique_lock<boost::mutex> lock(walletQueue.mutex);
+    nQueued = walletQueue.nQueued;
+    nApplied = walletQueue.nApplied;
+    nOverflows = walletQueue.nOverflows;
 }
 
 void RegisterWallet(CWalletInterface* pwalletIn) {
@@ -134,7 +283,60 @@ void UnregisterAllWallets() {
 }
 
 void SyncWithWallets(const CTransaction &tx, const CBlock *pblock, bool fConnect) {
-    g_signals.SyncTransaction(tx, pblock, fConnect);
+    if (!walletQueue.fEnabled) {
+        g_signals.SyncTransaction(tx, pblock, fConnect);
+        return;
+    }
+
+    CWalletEvent event(CWalletEvent::SYNC_TRANSACTION);
+    event.fConnect = fConnect;
+    if (pblock) {
+        event.pblock.reset(new CBlock(*pblock));
+        event.nTx = std::find(pblock->vtx.begin(), pblock->vtx.end(), tx) - pblock->vtx.begin();
+        if (event.nTx == pblock->vtx.size())
+            event.pblock.reset();
+    }
+    if (!event.pblock)
+        event.ptx.reset(new CTransaction(tx));
+    QueueWalletEvent(event);
+}
+
+void SyncBlockWithWallets(const CBlock& block, bool fConnect) {
+    if (!walletQueue.fEnabled) {
+        BOOST_FOREACH(const CTransaction& tx, block.vtx)
+            g_signals.SyncTransaction(tx, &block, fConnect);
+        return;
+    }
+
+    // One copy of the block for the events of all its transactions
+    boost::shared_ptr<const CBlock> pblock(new CBlock(block));
+    for (unsigned int i = 0; i < block.vtx.size(); i++) {
+        CWalletEvent event(CWalletEvent::SYNC_TRANSACTION);
+        event.pblock = pblock;
+        event.nTx = i;
+        event.fConnect = fConnect;
+        QueueWalletEvent(event);
+    }
+}
+
+static void UpdatedWalletTransaction(const uint256& hash) {
+    if (!walletQueue.fEnabled) {
+        g_signals.UpdatedTransaction(hash);
+        return;
+    }
+    CWalletEvent event(CWalletEvent::UPDATED_TRANSACTION);
+    event.hash = hash;
+    QueueWalletEvent(event);
+}
+
+static void SetWalletBestChain(const CBlockLocator& locator) {
+    if (!walletQueue.fEnabled) {
+        g_signals.SetBestChain(locator);
+        return;
+    }
+    CWalletEvent event(CWalletEvent::SET_BEST_CHAIN);
+    event.locator = locator;
+    QueueWalletEvent(event);
 }
 
 void ResendWalletTransactions(bool fForce) {
@@ -166,7 +368,17 @@ void UnregisterNodeSignals(CNodeSignals& nodeSignals)
 // mapOrphanTransactions
 //
 
-bool AddOrphanTx(const CTransaction& tx)
+// What each peer has in the orphan pool, so that a peer filling it
+// only pushes out its own orphans
+struct COrphanTxPeer {
+    uint64_t nBytes;
+    set<uint256> setHashes;
+    COrphanTxPeer() : nBytes(0) {}
+};
+static map<CNetAddr, COrphanTxPeer> mapOrphanTxPeers;
+static uint64_t nOrphanTxBytes = 0;
+
+bool AddOrphanTx(const CTransaction& tx, const CNetAddr& addrFrom)
 {
     uint256 hash = tx.GetHash();
     if (mapOrphanTransactions.count(hash))
@@ -177,59 +389,146 @@ bool AddOrphanTx(const CTransaction& tx)
     // large transaction with a missing parent then we assume
     // it will rebroadcast it later, after the parent transaction(s)
     // have been mined or received.
-    // 10,000 orphans, each of which is at most 5,000 bytes big is
-    // at most 500 megabytes of orphans:
+    unsigned int nSize = tx.GetSerializeSize(SER_NETWORK, CTransaction::CURRENT_VERSION);
 
-    size_t nSize = tx.GetSerializeSize(SER_NETWORK, CTransaction::CURRENT_VERSION);
-
-    if (nSize > 5000)
+    if (nSize > MAX_ORPHAN_TX_SIZE)
     {
         LogPrint("mempool", "ignoring large orphan tx (size: %u, hash: %s)\n", nSize, hash.ToString());
         return false;
     }
 
-    mapOrphanTransactions[hash] = tx;
+    COrphanTx& orphan = mapOrphanTransactions[hash];
+    orphan.tx = tx;
+    orphan.addrFrom = addrFrom;
+    orphan.nTxSize = nSize;
+    orphan.nTimeExpire = GetTime() + ORPHAN_TX_EXPIRE_TIME;
     BOOST_FOREACH(const CTxIn& txin, tx.vin)
-        mapOrphanTransactionsByPrev[txin.prevout.hash].insert(hash);
+        mapOrphanTransactionsByPrev[txin.prevout].insert(hash);
+
+    COrphanTxPeer& peer = mapOrphanTxPeers[addrFrom];
+    peer.nBytes += nSize;
+    peer.setHashes.insert(hash);
+    nOrphanTxBytes += nSize;
 
-    LogPrint("mempool", "stored orphan tx %s (mapsz %u)\n", hash.ToString(),
-        mapOrphanTransactions.size());
+    LogPrint("mempool", "stored orphan tx %s (mapsz %u, %u bytes)\n", hash.ToString(),
+        mapOrphanTransactions.size(), nOrphanTxBytes);
     return true;
 }
 
-void static EraseOrphanTx(uint256 hash)
+void EraseOrphanTx(uint256 hash)
 {
-    map<uint256, CTransaction>::iterator it = mapOrphanTransactions.find(hash);
+    map<uint256, COrphanTx>::iterator it = mapOrphanTransactions.find(hash);
     if (it == mapOrphanTransactions.end())
         return;
-    BOOST_FOREACH(const CTxIn& txin, it->second.vin)
+    const COrphanTx& orphan = it->second;
+    BOOST_FOREACH(const CTxIn& txin, orphan.tx.vin)
     {
-        map<uint256, set<uint256> >::iterator itPrev = mapOrphanTransactionsByPrev.find(txin.prevout.hash);
+        map<COutPoint, set<uint256> >::iterator itPrev = mapOrphanTransactionsByPrev.find(txin.prevout);
         if (itPrev == mapOrphanTransactionsByPrev.end())
             continue;
         itPrev->second.erase(hash);
         if (itPrev->second.empty())
             mapOrphanTransactionsByPrev.erase(itPrev);
     }
+
+    map<CNetAddr, COrphanTxPeer>::iterator itPeer = mapOrphanTxPeers.find(orphan.addrFrom);
+    if (itPeer != mapOrphanTxPeers.end())
+    {
+        itPeer->second.nBytes -= orphan.nTxSize;
+        itPeer->second.setHashes.erase(hash);
+        if (itPeer->second.setHashes.empty())
+            mapOrphanTxPeers.erase(itPeer);
+    }
+    nOrphanTxBytes -= orphan.nTxSize;
     mapOrphanTransactions.erase(it);
 }
 
-unsigned int LimitOrphanTxSize(unsigned int nMaxOrphans)
+unsigned int LimitOrphanTxSize(unsigned int nMaxOrphans, uint64_t nMaxBytes)
 {
     unsigned int nEvicted = 0;
-    while (mapOrphanTransactions.size() > nMaxOrphans)
+
+    // Orphans whose parents did not show up in time never will
+    static int64_t nNextSweep = 0;
+    int64_t nNow = GetTime();
+    if (nNextSweep <= nNow)
     {
-        // Evict a random orphan:
-        uint256 randomhash = GetRandHash();
-        map<uint256, CTransaction>::iterator it = mapOrphanTransactions.lower_bound(randomhash);
-        if (it == mapOrphanTransactions.end())
-            it = mapOrphanTransactions.begin();
-        EraseOrphanTx(it->first);
+        nNextSweep = nNow + ORPHAN_TX_EXPIRE_TIME / 4;
+        map<uint256, COrphanTx>::iterator it = mapOrphanTransactions.begin();
+        while (it != mapOrphanTransactions.end())
+        {
+            map<uint256, COrphanTx>::iterator itErase = it++;
+            if (itErase->second.nTimeExpire <= nNow)
+            {
+                EraseOrphanTx(itErase->first);
+                ++nEvicted;
+            }
+        }
+        if (nEvicted > 0)
+            LogPrint("mempool", "expired %u orphan tx\n", nEvicted);
+    }
+
+    while (mapOrphanTransactions.size() > nMaxOrphans || nOrphanTxBytes > nMaxBytes)
+    {
+        // Evict a random orphan of the peer holding the most bytes:
+        map<CNetAddr, COrphanTxPeer>::iterator itPeer = mapOrphanTxPeers.begin();
+        for (map<CNetAddr, COrphanTxPeer>::iterator mi = mapOrphanTxPeers.begin(); mi != mapOrphanTxPeers.end(); ++mi)
+            if (mi->second.nBytes > itPeer->second.nBytes)
+                itPeer = mi;
+        const set<uint256>& setHashes = itPeer->second.setHashes;
+        set<uint256>::const_iterator it = setHashes.lower_bound(GetRandHash());
+        if (it == setHashes.end())
+            it = setHashes.begin();
+        EraseOrphanTx(*it);
         ++nEvicted;
     }
     return nEvicted;
 }
 
+// Queue the orphans spending outputs of a transaction that just made it into the pool
+void static QueueOrphansSpending(const CTransaction& tx, const uint256& hash, set<uint256>& setWork)
+{
+    for (unsigned int i = 0; i < tx.vout.size(); i++)
+    {
+        map<COutPoint, set<uint256> >::iterator itByPrev = mapOrphanTransactionsByPrev.find(COutPoint(hash, i));
+        if (itByPrev != mapOrphanTransactionsByPrev.end())
+            setWork.insert(itByPrev->second.begin(), itByPrev->second.end());
+    }
+}
+
+// Retry a batch of the orphans that parents sent by pfrom may have completed;
+// what they complete in turn joins the same queue
+void static ProcessOrphanWork(CNode* pfrom)
+{
+    AssertLockHeld(cs_main);
+    set<uint256>& setWork = pfrom->setOrphanWork;
+    unsigned int nTried = 0;
+    while (!setWork.empty() && nTried < MAX_ORPHAN_BATCH)
+    {
+        uint256 orphanTxHash = *setWork.begin();
+        setWork.erase(setWork.begin());
+        map<uint256, COrphanTx>::iterator it = mapOrphanTransactions.find(orphanTxHash);
+        if (it == mapOrphanTransactions.end())
+            continue;
+        nTried++;
+
+        CTransaction& orphanTx = it->second.tx;
+        bool fMissingInputs2 = false;
+        if (AcceptToMemoryPool(mempool, orphanTx, true, &fMissingInputs2))
+        {
+            LogPrint("mempool", "   accepted orphan tx %s\n", orphanTxHash.ToString());
+            RelayTransaction(orphanTx, orphanTxHash);
+            QueueOrphansSpending(orphanTx, orphanTxHash, setWork);
+            EraseOrphanTx(orphanTxHash);
+        }
+        else if (!fMissingInputs2)
+        {
+            // invalid or too-little-fee orphan
+            EraseOrphanTx(orphanTxHash);
+            LogPrint("mempool", "   removed orphan tx %s\n", orphanTxHash.ToString());
+        }
+    }
+}
+
 
 
 
@@ -417,7 +716,7 @@ bool AreInputsStandard(const CTransaction& tx, const MapPrevTx& mapInputs)
         // beside "push data" in the scriptSig
         // IsStandard() will have already returned false
         // and this method isn't called.
-        vector<vector<unsigned char> > stack;
+        vector<stackvaltype> stack;
         if (!EvalScript(stack, tx.vin[i].scriptSig, tx, i, SCRIPT_VERIFY_NONE, 0))
             return false;
 
@@ -480,6 +779,28 @@ unsigned int GetP2SHSigOpCount(const CTransaction& tx, const MapPrevTx& inputs)
     return nSigOps;
 }
 
+bool CMerkleTx::SetMerkleBranchInBlock(const CBlock& block)
+{
+    // Update the tx's hashBlock
+    hashBlock = block.GetHash();
+
+    // Locate the transaction
+    for (nIndex = 0; nIndex < (int)block.vtx.size(); nIndex++)
+        if (block.vtx[nIndex] == *(CTransaction*)this)
+            break;
+    if (nIndex == (int)block.vtx.size())
+    {
+        vMerkleBranch.clear();
+        nIndex = -1;
+        LogPrintf("ERROR: SetMerkleBranch() : couldn't find tx in block\n");
+        return false;
+    }
+
+    // Fill in merkle branch
+    vMerkleBranch = block.GetMerkleBranch(nIndex);
+    return true;
+}
+
 int CMerkleTx::SetMerkleBranch(const CBlock* pblock)
 {
     AssertLockHeld(cs_main);
@@ -496,23 +817,8 @@ int CMerkleTx::SetMerkleBranch(const CBlock* pblock)
         pblock = &blockTmp;
     }
 
-    // Update the tx's hashBlock
-    hashBlock = pblock->GetHash();
-
-    // Locate the transaction
-    for (nIndex = 0; nIndex < (int)pblock->vtx.size(); nIndex++)
-        if (pblock->vtx[nIndex] == *(CTransaction*)this)
-            break;
-    if (nIndex == (int)pblock->vtx.size())
-    {
-        vMerkleBranch.clear();
-        nIndex = -1;
-        LogPrintf("ERROR: SetMerkleBranch() : couldn't find tx in block\n");
+    if (!SetMerkleBranchInBlock(*pblock))
         return 0;
-    }
-
-    // Fill in merkle branch
-    vMerkleBranch = pblock->GetMerkleBranch(nIndex);
 
     // Is the tx in a block that's in the main chain
     map<uint256, CBlockIndex*>::iterator mi = mapBlockIndex.find(hashBlock);
@@ -691,7 +997,7 @@ bool GetAssetInformation(int64_t nAssetId, std::string &engName, std::string &se
 }
 
 bool AcceptToMemoryPool(CTxMemPool& pool, CTransaction &tx, bool fLimitFree,
-                        bool* pfMissingInputs)
+                        bool* pfMissingInputs, int64_t nAcceptTime)
 {
     AssertLockHeld(cs_main);
     if (pfMissingInputs)
@@ -719,6 +1025,8 @@ bool AcceptToMemoryPool(CTxMemPool& pool, CTransaction &tx, bool fLimitFree,
     if (pool.exists(hash))
         return false;
 
+    CTxMemPoolEntry entry;
+
     // Check for conflicts with in-memory transactions
     {
     LOCK(pool.cs); // protect pool.mapNextTx
@@ -832,8 +1140,25 @@ bool AcceptToMemoryPool(CTxMemPool& pool, CTransaction &tx, bool fLimitFree,
                           error("AcceptToMemoryPool : too many sigops %s, %d > %d",
                                 hash.ToString(), nSigOps, MAX_TX_SIGOPS));
 
-        int64_t nFees = tx.GetValueIn(0,mapInputs)-tx.GetValueOut(0);
-        unsigned int nSize = ::GetSerializeSize(tx, SER_NETWORK, PROTOCOL_VERSION);
+        // Keep what is learnt here for block templates, eviction and getrawmempool
+        entry = CTxMemPoolEntry(tx, pindexBest->nHeight, nAcceptTime ? nAcceptTime : GetTime());
+        entry.nSigOps = nSigOps;
+        entry.nValueIn = tx.GetValueIn(0,mapInputs);
+        entry.nFee = entry.nValueIn - tx.GetValueOut(0);
+        double dPriority = 0;
+        BOOST_FOREACH(const CTxIn& txin, tx.vin)
+        {
+            if (pool.exists(txin.prevout.hash))
+                continue;
+            const pair<CTxIndex, CTransaction>& input = mapInputs[txin.prevout.hash];
+            int64_t nValue = input.second.vout[txin.prevout.n].nValue;
+            entry.nChainInputValue += nValue;
+            dPriority += (double)nValue * input.first.GetDepthInMainChain();
+        }
+        entry.dEntryPriority = dPriority / entry.nTxSize;
+
+        int64_t nFees = entry.nFee;
+        unsigned int nSize = entry.nTxSize;
 
         // Don't accept it if it can't get into a block
         int64_t txMinFee = GetMinTxChange(tx, nSize);
@@ -842,6 +1167,14 @@ bool AcceptToMemoryPool(CTxMemPool& pool, CTransaction &tx, bool fLimitFree,
                          hash.ToString(),
                          nFees, txMinFee);
 
+        // A full pool would evict it again straight away, so don't spend the
+        // script checks on a fee rate no better than the lowest one kept
+        uint64_t nMaxMempool = GetArg("-maxmempool", DEFAULT_MAX_MEMPOOL_SIZE) * 1000000;
+        if (pool.GetTotalTxSize() + nSize > nMaxMempool && entry.GetFeePerKb() <= pool.GetLowestFeePerKb())
+            return error("AcceptToMemoryPool : memory pool full, fee rate too low %s, %g <= %g",
+                         hash.ToString(),
+                         entry.GetFeePerKb(), pool.GetLowestFeePerKb());
+
         // Continuously rate-limit free transactions
         // This mitigates 'penny-flooding' -- sending thousands of free transactions just to
         // be annoying or make others' transactions take longer to confirm.
@@ -888,7 +1221,20 @@ bool AcceptToMemoryPool(CTxMemPool& pool, CTransaction &tx, bool fLimitFree,
     }
 
     // Store transaction in memory
-    pool.addUnchecked(hash, tx);
+    pool.addUnchecked(hash, tx, entry);
+
+    // Drop what waited too long, then make room by dropping the lowest
+    // fee rates; either may be this one
+    vector<uint256> vEvicted;
+    pool.Expire(GetTime() - GetArg("-mempoolexpiry", DEFAULT_MEMPOOL_EXPIRY) * 60 * 60, vEvicted);
+    if (!vEvicted.empty())
+        LogPrint("mempool", "AcceptToMemoryPool : expired %u transactions\n", vEvicted.size());
+    size_t nExpired = vEvicted.size();
+    pool.TrimToSize(GetArg("-maxmempool", DEFAULT_MAX_MEMPOOL_SIZE) * 1000000, vEvicted);
+    if (vEvicted.size() > nExpired)
+        LogPrint("mempool", "AcceptToMemoryPool : memory pool full, evicted %u transactions\n", vEvicted.size() - nExpired);
+    if (std::find(vEvicted.begin(), vEvicted.end(), hash) != vEvicted.end())
+        return false;
 
     SyncWithWallets(tx, NULL);
 
@@ -958,7 +1304,9 @@ bool CWalletTx::AcceptWalletTransaction(CTxDB& txdb)
 
     {
         // Add previous supporting transactions first
-        BOOST_FOREACH(CMerkleTx& tx, vtxPrev)
+        vector<CMerkleTx> vtxSupporting;
+        GetSupportingTransactions(txdb, vtxSupporting);
+        BOOST_FOREACH(CMerkleTx& tx, vtxSupporting)
         {
             if (!(tx.IsCoinBase() || tx.IsCoinStake()))
             {
@@ -2271,8 +2619,7 @@ bool CBlock::DisconnectBlock(CTxDB& txdb, CBlockIndex* pindex)
     }
 
     // ppcoin: clean up wallet after disconnecting coinstake
-    BOOST_FOREACH(CTransaction& tx, vtx)
-        SyncWithWallets(tx, this, false);
+    SyncBlockWithWallets(*this, false);
 
     return true;
 }
@@ -2632,8 +2979,7 @@ bool CBlock::ConnectBlock(CTxDB& txdb, CBlockIndex* pindex, bool fJustCheck)
     }
 
     // Watch for transactions paying to me
-    BOOST_FOREACH(CTransaction& tx, vtx)
-        SyncWithWallets(tx, this);
+    SyncBlockWithWallets(*this, true);
 
     return true;
 }
@@ -2838,7 +3184,7 @@ bool CBlock::SetBestChain(CTxDB& txdb, CBlockIndex* pindexNew)
     if ((pindexNew->nHeight % 20160) == 0 || (!fIsInitialDownload && (pindexNew->nHeight % 144) == 0))
     {
         const CBlockLocator locator(pindexNew);
-        g_signals.SetBestChain(locator);
+        SetWalletBestChain(locator);
     }
 
     // New best block
@@ -2849,6 +3195,11 @@ bool CBlock::SetBestChain(CTxDB& txdb, CBlockIndex* pindexNew)
     nBestChainTrust = pindexNew->nChainTrust;
     nTimeBestReceived = GetTime();
     mempool.AddTransactionsUpdated(1);
+    PublishChainTipSnapshot();
+    {
+        boost::unique_lock<CWaitableCriticalSection> lock(csBestBlock);
+        cvBlockChange.notify_all();
+    }
 
     uint256 nBestBlockTrust = pindexBest->nHeight != 0 ? (pindexBest->nChainTrust - pindexBest->pprev->nChainTrust) : pindexBest->nChainTrust;
 
@@ -2887,6 +3238,41 @@ bool CBlock::SetBestChain(CTxDB& txdb, CBlockIndex* pindexNew)
     return true;
 }
 
+static CCriticalSection cs_chainTipSnapshot;
+static CChainTipSnapshotRef pchainTipSnapshot;
+
+CChainTipSnapshot::CChainTipSnapshot(const CBlockIndex* pindexIn)
+{
+    pindex = pindexIn;
+    hashBlock = pindexIn->GetBlockHash();
+    nHeight = pindexIn->nHeight;
+    nPowHeight = pindexIn->nPowHeight;
+    nChainTrust = pindexIn->nChainTrust;
+    nMint = pindexIn->nMint;
+    nMoneySupply = pindexIn->nMoneySupply;
+    nPowIncentivePool = pindexIn->nPowIncentivePool;
+    nPosIncentivePool = pindexIn->nPosIncentivePool;
+    nAssetTypeCount = pindexIn->nAssetTypeCount;
+    pindexLastPoW = GetLastBlockIndex(pindexIn, false);
+    pindexLastPoS = GetLastBlockIndex(pindexIn, true);
+    nMempoolTx = mempool.size();
+    nTimeReceived = nTimeBestReceived;
+}
+
+void PublishChainTipSnapshot()
+{
+    // Build outside the lock, readers only ever copy the pointer
+    CChainTipSnapshotRef psnapshot(new CChainTipSnapshot(pindexBest));
+    LOCK(cs_chainTipSnapshot);
+    pchainTipSnapshot = psnapshot;
+}
+
+CChainTipSnapshotRef GetChainTipSnapshot()
+{
+    LOCK(cs_chainTipSnapshot);
+    return pchainTipSnapshot;
+}
+
 // ppcoin: total coin age spent in transaction, in the unit of coin-days.
 // Only those coins meeting minimum age requirement counts. As those
 // transactions not in main chain are not currently indexed so we
@@ -3009,7 +3395,7 @@ bool CBlock::AddToBlockIndex(unsigned int nFile, unsigned int nBlockPos, const u
     {
         // Notify UI to display prev block's coinbase if it was ours
         static uint256 hashPrevBestCoinBase;
-        g_signals.UpdatedTransaction(hashPrevBestCoinBase);
+        UpdatedWalletTransaction(hashPrevBestCoinBase);
         hashPrevBestCoinBase = vtx[0].GetHash();
     }
 
@@ -3548,6 +3934,8 @@ bool LoadBlockIndex(bool fAllowNew)
     CTxDB txdb("cr+");
     if (!txdb.LoadBlockIndex())
         return false;
+    if (pindexBest)
+        PublishChainTipSnapshot();
 
     //
     // Init with genesis block
@@ -3745,6 +4133,152 @@ void ThreadImport(std::vector<boost::filesystem::path> vImportFiles)
     }
 }
 
+// mempool.dat: network magic, version, (transaction, time it entered the pool) pairs, checksum
+static const int MEMPOOL_DUMP_VERSION = 1;
+
+void LoadMempool()
+{
+    // Inputs of the saved transactions may be in blocks still being imported
+    while (fImporting || fReindex)
+        MilliSleep(100);
+
+    int64_t nStart = GetTimeMillis();
+    boost::filesystem::path pathMempool = GetDataDir() / "mempool.dat";
+    vector<pair<CTransaction, int64_t> > vTx;
+    try {
+        FILE *file = fopen(pathMempool.string().c_str(), "rb");
+        CAutoFile filein = CAutoFile(file, SER_DISK, CLIENT_VERSION);
+        if (!filein)
+        {
+            LogPrintf("No mempool.dat to load\n");
+            fMempoolLoaded = true;
+            return;
+        }
+
+        uint64_t nFileSize = boost::filesystem::file_size(pathMempool);
+        if (nFileSize <= sizeof(uint256))
+            throw runtime_error("truncated file");
+        int dataSize = nFileSize - sizeof(uint256);
+        vector<unsigned char> vchData(dataSize);
+        uint256 hashIn;
+        filein.read((char *)&vchData[0], dataSize);
+        filein >> hashIn;
+        filein.fclose();
+
+        CDataStream ssMempool(vchData, SER_DISK, CLIENT_VERSION);
+        if (hashIn != Hash(ssMempool.begin(), ssMempool.end()))
+            throw runtime_error("checksum mismatch");
+
+        unsigned char pchMsgTmp[4];
+        int nVersion;
+        ssMempool >> FLATDATA(pchMsgTmp) >> nVersion;
+        if (memcmp(pchMsgTmp, Params().MessageStart(), sizeof(pchMsgTmp)) || nVersion != MEMPOOL_DUMP_VERSION)
+            throw runtime_error("other network or version");
+        ssMempool >> vTx;
+    }
+    catch (std::exception &e) {
+        // Keep the file for a look, but start over with what is in the pool
+        LogPrintf("LoadMempool() : mempool.dat not loaded: %s\n", e.what());
+        fMempoolLoaded = true;
+        return;
+    }
+
+    // Saved parents first, so each finds its inputs in the chain or the pool
+    int64_t nCutoff = GetTime() - GetArg("-mempoolexpiry", DEFAULT_MEMPOOL_EXPIRY) * 60 * 60;
+    int nAccepted = 0, nFailed = 0, nExpired = 0, nKnown = 0;
+    for (unsigned int i = 0; i < vTx.size(); i++)
+    {
+        // One transaction per cs_main, so the node carries on meanwhile
+        boost::this_thread::interruption_point();
+        CTransaction& tx = vTx[i].first;
+        int64_t nTime = vTx[i].second;
+        if (nTime < nCutoff)
+        {
+            nExpired++;
+            continue;
+        }
+        LOCK(cs_main);
+        if (mempool.exists(tx.GetHash()))
+            nKnown++;
+        else if (AcceptToMemoryPool(mempool, tx, false, NULL, nTime))
+            nAccepted++;
+        else
+            nFailed++;
+    }
+    fMempoolLoaded = true;
+    LogPrintf("Loaded %u transactions from mempool.dat: %d accepted, %d failed, %d expired, %d already there  %dms\n",
+              vTx.size(), nAccepted, nFailed, nExpired, nKnown, GetTimeMillis() - nStart);
+}
+
+bool DumpMempool()
+{
+    // An empty or half loaded pool would overwrite what is still to be loaded
+    if (!fMempoolLoaded)
+        return false;
+
+    int64_t nStart = GetTimeMillis();
+    vector<pair<CTransaction, int64_t> > vTx;
+    {
+        LOCK(mempool.cs);
+        vTx.reserve(mempool.mapTx.size());
+
+        // Parents before children, so that loading finds their inputs
+        set<uint256> setDone;
+        for (map<uint256, CTransaction>::iterator mi = mempool.mapTx.begin(); mi != mempool.mapTx.end(); ++mi)
+        {
+            vector<uint256> vStack(1, (*mi).first);
+            while (!vStack.empty())
+            {
+                uint256 hash = vStack.back();
+                if (setDone.count(hash))
+                {
+                    vStack.pop_back();
+                    continue;
+                }
+                const CTxMemPoolEntry& entry = mempool.mapEntry[hash];
+                bool fParentsDone = true;
+                BOOST_FOREACH(const uint256& hashParent, entry.setParents)
+                {
+                    if (!setDone.count(hashParent))
+                    {
+                        vStack.push_back(hashParent);
+                        fParentsDone = false;
+                    }
+                }
+                if (!fParentsDone)
+                    continue;
+                vStack.pop_back();
+                setDone.insert(hash);
+                vTx.push_back(make_pair(mempool.mapTx[hash], entry.nTime));
+            }
+        }
+    }
+
+    CDataStream ssMempool(SER_DISK, CLIENT_VERSION);
+    ssMempool << FLATDATA(Params().MessageStart()) << MEMPOOL_DUMP_VERSION << vTx;
+    uint256 hash = Hash(ssMempool.begin(), ssMempool.end());
+    ssMempool << hash;
+
+    boost::filesystem::path pathTmp = GetDataDir() / strprintf("mempool.dat.%04x", GetRand(0x10000));
+    FILE *file = fopen(pathTmp.string().c_str(), "wb");
+    CAutoFile fileout = CAutoFile(file, SER_DISK, CLIENT_VERSION);
+    if (!fileout)
+        return error("DumpMempool() : open failed");
+    try {
+        fileout << ssMempool;
+    }
+    catch (std::exception &e) {
+        return error("DumpMempool() : I/O error");
+    }
+    FileCommit(fileout);
+    fileout.fclose();
+    if (!RenameOver(pathTmp, GetDataDir() / "mempool.dat"))
+        return error("DumpMempool() : rename-into-place failed");
+
+    LogPrint("mempool", "Dumped %u transactions to mempool.dat  %dms\n", vTx.size(), GetTimeMillis() - nStart);
+    return true;
+}
+
 
 
 
@@ -3842,6 +4376,92 @@ bool static AlreadyHave(CTxDB& txdb, const CInv& inv)
 
 
 
+// Whether serving a block waits behind everything else and counts against the upload limits
+static bool IsHistoricalBlock(const CBlockIndex* pindex)
+{
+    return pindexBest && pindexBest->GetBlockTime() - pindex->GetBlockTime() > HISTORICAL_BLOCK_AGE;
+}
+
+// requires LOCK(cs_main)
+static void PushBlock(CNode* pfrom, const CInv& inv, CBlockIndex* pindex, bool fHistorical)
+{
+    CBlock block;
+    block.ReadFromDisk(pindex);
+
+    // previous versions could accept sigs with high s
+    if (!IsCanonicalBlockSignature(&block, true)) {
+        bool ret = EnsureLowS(block.vchBlockSig);
+        assert(ret);
+    }
+
+    pfrom->PushMessage("block", block);
+    if (fHistorical)
+    {
+        unsigned int nSize = ::GetSerializeSize(block, SER_NETWORK, PROTOCOL_VERSION);
+        pfrom->uploadBucket.Spend(nSize);
+        pfrom->nHistoricalBytesSent += nSize;
+    }
+
+    // Trigger them to send a getblocks request for the next batch of inventory
+    if (inv.hash == pfrom->hashContinue)
+    {
+        // Bypass PushInventory, this must send even if redundant,
+        // and we want it right after the last block so they don't
+        // wait for other stuff first.
+        vector<CInv> vInv;
+        vInv.push_back(CInv(MSG_BLOCK, hashBestChain));
+        pfrom->PushMessage("inv", vInv);
+        pfrom->hashContinue = 0;
+    }
+}
+
+// Historical blocks only go out with little else queued for the peer, at its upload rate
+// and within the part of the upload target not kept for new blocks. They wait in their own
+// queue, so the peer's other requests and messages are not held up behind them. Blocks
+// requested after a queued one wait behind it too, so the peer gets them in order.
+void static ProcessHistoricalGetData(CNode* pfrom)
+{
+    LOCK(cs_main);
+
+    CInv inv = pfrom->vRecvGetDataHistorical.front();
+    map<uint256, CBlockIndex*>::iterator mi = mapBlockIndex.find(inv.hash);
+    bool fHistorical = mi != mapBlockIndex.end() && IsHistoricalBlock(mi->second);
+    if (!fHistorical)
+    {
+        // Only queued to keep the order, served like any other block
+        if (pfrom->nSendSize >= SendBufferSize())
+            return;
+        pfrom->vRecvGetDataHistorical.pop_front();
+        if (mi != mapBlockIndex.end())
+            PushBlock(pfrom, inv, mi->second, false);
+        g_signals.Inventory(inv.hash);
+        return;
+    }
+
+    if (CNode::OutboundTargetReached(true))
+    {
+        LogPrint("net", "historical block serving limit reached, disconnect peer %s\n", pfrom->addrName);
+        pfrom->fDisconnect = true;
+        return;
+    }
+    int64_t nNow = GetTimeMicros();
+    if (pfrom->nSendSize >= HISTORICAL_SEND_BUFFER)
+    {
+        pfrom->nGetDataDelayUntil = nNow + 10000;
+        return;
+    }
+    if (!pfrom->uploadBucket.CanSpend(nNow))
+    {
+        pfrom->nGetDataDelayUntil = nNow + pfrom->uploadBucket.WaitMicros();
+        return;
+    }
+
+    // One block per pass, like ProcessGetData
+    pfrom->vRecvGetDataHistorical.pop_front();
+    PushBlock(pfrom, inv, mi->second, true);
+    g_signals.Inventory(inv.hash);
+}
+
 void static ProcessGetData(CNode* pfrom)
 {
     std::deque<CInv>::iterator it = pfrom->vRecvGetData.begin();
@@ -3866,28 +4486,17 @@ void static ProcessGetData(CNode* pfrom)
                 map<uint256, CBlockIndex*>::iterator mi = mapBlockIndex.find(inv.hash);
                 if (mi != mapBlockIndex.end())
                 {
-                    CBlock block;
-                    block.ReadFromDisk((*mi).second);
-
-                    // previous versions could accept sigs with high s
-                    if (!IsCanonicalBlockSignature(&block, true)) {
-                        bool ret = EnsureLowS(block.vchBlockSig);
-                        assert(ret);
-                    }
-
-                    pfrom->PushMessage("block", block);
-
-                    // Trigger them to send a getblocks request for the next batch of inventory
-                    if (inv.hash == pfrom->hashContinue)
+                    if (IsHistoricalBlock(mi->second) || !pfrom->vRecvGetDataHistorical.empty())
                     {
-                        // Bypass PushInventory, this must send even if redundant,
-                        // and we want it right after the last block so they don't
-                        // wait for other stuff first.
-                        vector<CInv> vInv;
-                        vInv.push_back(CInv(MSG_BLOCK, hashBestChain));
-                        pfrom->PushMessage("inv", vInv);
-                        pfrom->hashContinue = 0;
+                        // Served by ProcessHistoricalGetData, within bounds and
+                        // after the historical blocks asked for before it
+                        if (pfrom->vRecvGetDataHistorical.size() < MAX_INV_SZ)
+                            pfrom->vRecvGetDataHistorical.push_back(inv);
+                        else
+                            vNotFound.push_back(inv);
+                        continue;
                     }
+                    PushBlock(pfrom, inv, mi->second, false);
                 }
             }
             else if (inv.IsKnownType())
@@ -4280,8 +4889,6 @@ bool static ProcessMessage(CNode* pfrom, string strCommand, CDataStream& vRecv,
 
     else if (strCommand == "tx")
     {
-        vector<uint256> vWorkQueue;
-        vector<uint256> vEraseQueue;
         CTransaction tx;
         vRecv >> tx;
 
@@ -4297,48 +4904,19 @@ bool static ProcessMessage(CNode* pfrom, string strCommand, CDataStream& vRecv,
         if (AcceptToMemoryPool(mempool, tx, true, &fMissingInputs))
         {
             RelayTransaction(tx, inv.hash);
-            vWorkQueue.push_back(inv.hash);
-            vEraseQueue.push_back(inv.hash);
-
-            // Recursively process any orphan transactions that depended on this one
-            for (unsigned int i = 0; i < vWorkQueue.size(); i++)
-            {
-                map<uint256, set<uint256> >::iterator itByPrev = mapOrphanTransactionsByPrev.find(vWorkQueue[i]);
-                if (itByPrev == mapOrphanTransactionsByPrev.end())
-                    continue;
-                for (set<uint256>::iterator mi = itByPrev->second.begin();
-                     mi != itByPrev->second.end();
-                     ++mi)
-                {
-                    const uint256& orphanTxHash = *mi;
-                    CTransaction& orphanTx = mapOrphanTransactions[orphanTxHash];
-                    bool fMissingInputs2 = false;
+            EraseOrphanTx(inv.hash);
 
-                    if (AcceptToMemoryPool(mempool, orphanTx, true, &fMissingInputs2))
-                    {
-                        LogPrint("mempool", "   accepted orphan tx %s\n", orphanTxHash.ToString());
-                        RelayTransaction(orphanTx, orphanTxHash);
-                        vWorkQueue.push_back(orphanTxHash);
-                        vEraseQueue.push_back(orphanTxHash);
-                    }
-                    else if (!fMissingInputs2)
-                    {
-                        // invalid or too-little-fee orphan
-                        vEraseQueue.push_back(orphanTxHash);
-                        LogPrint("mempool", "   removed orphan tx %s\n", orphanTxHash.ToString());
-                    }
-                }
-            }
-
-            BOOST_FOREACH(uint256 hash, vEraseQueue)
-                EraseOrphanTx(hash);
+            // Process the orphan transactions that depended on this one,
+            // a batch now and the rest before this peer's next messages
+            QueueOrphansSpending(tx, inv.hash, pfrom->setOrphanWork);
+            ProcessOrphanWork(pfrom);
         }
         else if (fMissingInputs)
         {
-            AddOrphanTx(tx);
+            AddOrphanTx(tx, pfrom->addr);
 
             // DoS prevention: do not allow mapOrphanTransactions to grow unbounded
-            unsigned int nEvicted = LimitOrphanTxSize(MAX_ORPHAN_TRANSACTIONS);
+            unsigned int nEvicted = LimitOrphanTxSize(MAX_ORPHAN_TRANSACTIONS, GetArg("-maxorphantxmib", DEFAULT_MAX_ORPHAN_TX) << 20);
             if (nEvicted > 0)
                 LogPrint("mempool", "mapOrphan overflow, removed %u tx\n", nEvicted);
         }
@@ -4541,12 +5119,23 @@ bool ProcessMessages(CNode* pfrom)
     //
     bool fOk = true;
 
+    if (!pfrom->vRecvGetDataHistorical.empty() && pfrom->nGetDataDelayUntil <= GetTimeMicros())
+        ProcessHistoricalGetData(pfrom);
+
     if (!pfrom->vRecvGetData.empty())
         ProcessGetData(pfrom);
 
     // this maintains the order of responses
     if (!pfrom->vRecvGetData.empty()) return fOk;
 
+    // and the orphans its transactions completed come before its next ones
+    if (!pfrom->setOrphanWork.empty())
+    {
+        LOCK(cs_main);
+        ProcessOrphanWork(pfrom);
+        if (!pfrom->setOrphanWork.empty()) return fOk;
+    }
+
     std::deque<CNetMessage>::iterator it = pfrom->vRecvMsg.begin();
     while (!pfrom->fDisconnect && it != pfrom->vRecvMsg.end()) {
         // Don't bother if send buffer is too full to respond anyway
@@ -4746,46 +5335,34 @@ bool SendMessages(CNode* pto, bool fSendTrickle)
         // Message: inventory
         //
         vector<CInv> vInv;
-        vector<CInv> vInvWait;
         {
             LOCK(pto->cs_inventory);
-            vInv.reserve(pto->vInventoryToSend.size());
-            vInvWait.reserve(pto->vInventoryToSend.size());
-            BOOST_FOREACH(const CInv& inv, pto->vInventoryToSend)
-            {
-                if (pto->setInventoryKnown.count(inv))
-                    continue;
-
-                // trickle out tx inv to protect privacy
-                if (inv.type == MSG_TX && !fSendTrickle)
-                {
-                    // 1/4 of tx invs blast to all immediately
-                    static uint256 hashSalt;
-                    if (hashSalt == 0)
-                        hashSalt = GetRandHash();
-                    uint256 hashRand = inv.hash ^ hashSalt;
-                    hashRand = Hash(BEGIN(hashRand), END(hashRand));
-                    bool fTrickleWait = ((hashRand & 3) != 0);
 
-                    if (fTrickleWait)
-                    {
-                        vInvWait.push_back(inv);
-                        continue;
-                    }
-                }
+            // Blocks are announced right away, transactions in one batch per peer at
+            // random intervals, which hides where they were first seen
+            int64_t nNowMicros = GetTimeMicros();
+            vector<CInv> vInvNow;
+            vInvNow.swap(pto->vInventoryToSend);
+            if (pto->nNextInvSend < nNowMicros)
+            {
+                pto->nNextInvSend = PoissonNextSend(nNowMicros, pto->fInbound ? INVENTORY_BROADCAST_INTERVAL : INVENTORY_BROADCAST_INTERVAL / 2);
+                vInvNow.insert(vInvNow.end(), pto->vInventoryTxToSend.begin(), pto->vInventoryTxToSend.end());
+                vector<CInv>().swap(pto->vInventoryTxToSend);
+            }
 
-                // returns true if wasn't already contained in the set
-                if (pto->setInventoryKnown.insert(inv).second)
+            vInv.reserve(min(vInvNow.size(), (size_t)1000));
+            BOOST_FOREACH(const CInv& inv, vInvNow)
+            {
+                if (pto->filterInventoryKnown.contains(inv.hash))
+                    continue;
+                pto->filterInventoryKnown.insert(inv.hash);
+                vInv.push_back(inv);
+                if (vInv.size() >= 1000)
                 {
-                    vInv.push_back(inv);
-                    if (vInv.size() >= 1000)
-                    {
-                        pto->PushMessage("inv", vInv);
-                        vInv.clear();
-                    }
+                    pto->PushMessage("inv", vInv);
+                    vInv.clear();
                 }
             }
-            pto->vInventoryToSend = vInvWait;
         }
         if (!vInv.empty())
             pto->PushMessage("inv", vInv);
@@ -4796,6 +5373,16 @@ bool SendMessages(CNode* pto, bool fSendTrickle)
         //
         vector<CInv> vGetData;
         int64_t nNow = GetTime() * 1000000;
+
+        // Forget requests nobody answered, once a minute for all peers
+        static int64_t nLastAskedForExpiry;
+        if (nNow - nLastAskedForExpiry > 60 * 1000000)
+        {
+            nLastAskedForExpiry = nNow;
+            unsigned int nExpired = ExpireAlreadyAskedFor(nNow / 1000000);
+            if (nExpired > 0)
+                LogPrint("net", "mapAlreadyAskedFor: expired %u, %u left\n", nExpired, mapAlreadyAskedFor.size());
+        }
         CTxDB txdb("r");
         while (!pto->mapAskFor.empty() && (*pto->mapAskFor.begin()).first <= nNow)
         {
@@ -4817,6 +5404,12 @@ bool SendMessages(CNode* pto, bool fSendTrickle)
         if (!vGetData.empty())
             pto->PushMessage("getdata", vGetData);
 
+        // For getpeerinfo, which must not read the containers themselves
+        {
+            LOCK(pto->cs_inventory);
+            pto->nAskForSize = pto->mapAskFor.size();
+            pto->nAddrKnownSize = pto->setAddrKnown.size();
+        }
     }
     return true;
 }
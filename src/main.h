@@ -17,6 +17,8 @@
 #include <limits>
 #include <list>
 
+#include <boost/shared_ptr.hpp>
+
 class CBlock;
 class CBlockIndex;
 class CInv;
@@ -53,8 +55,22 @@ static const unsigned int MAX_P2SH_SIGOPS = 15;
 static const unsigned int MAX_TX_SIGOPS = MAX_BLOCK_SIGOPS/5;
 /** The maximum number of orphan transactions kept in memory */
 static const unsigned int MAX_ORPHAN_TRANSACTIONS = MAX_BLOCK_SIZE/100;
+/** Largest orphan transaction kept; a bigger one is expected to be relayed again after its parents */
+static const unsigned int MAX_ORPHAN_TX_SIZE = 5000;
+/** Default for -maxorphantxmib, maximum memory to keep orphan transactions in */
+static const unsigned int DEFAULT_MAX_ORPHAN_TX = 5;
+/** Seconds an orphan transaction waits for its parents */
+static const int64_t ORPHAN_TX_EXPIRE_TIME = 20 * 60;
+/** Orphans retried for one peer before the message handler moves on to the next */
+static const unsigned int MAX_ORPHAN_BATCH = 100;
 /** Default for -maxorphanblocksmib, maximum number of memory to keep orphan blocks */
 static const unsigned int DEFAULT_MAX_ORPHAN_BLOCKS = 40;
+/** Default for -maxmempool, megabytes of transactions kept in the memory pool */
+static const unsigned int DEFAULT_MAX_MEMPOOL_SIZE = 300;
+/** Default for -mempoolexpiry, hours a transaction may stay in the memory pool */
+static const unsigned int DEFAULT_MEMPOOL_EXPIRY = 72;
+/** Seconds between writes of mempool.dat */
+static const int DUMP_MEMPOOL_INTERVAL = 900;
 /** The maximum number of entries in an 'inv' protocol message */
 static const unsigned int MAX_INV_SZ = 50000;
 /** icochain: 0.0001 COIN 每Kbyte的最小手续费，同时也是一笔交易的最低手续费 */
@@ -79,6 +95,8 @@ inline unsigned int GetTargetSpacing(int nHeight)  { return 120; }
 
 extern CScript COINBASE_FLAGS;
 extern CCriticalSection cs_main;
+extern CWaitableCriticalSection csBestBlock;
+extern boost::condition_variable_any cvBlockChange;
 extern CTxMemPool mempool;
 extern std::map<uint256, CBlockIndex*> mapBlockIndex;
 extern std::set<std::pair<COutPoint, unsigned int> > setStakeSeen;
@@ -99,6 +117,7 @@ extern const std::string strMessageMagic;
 extern int64_t nTimeBestReceived;
 extern bool fImporting;
 extern bool fReindex;
+extern bool fMempoolLoaded;
 struct COrphanBlock;
 extern std::map<uint256, COrphanBlock*> mapOrphanBlocks;
 extern bool fHaveGUI;
@@ -126,6 +145,17 @@ void UnregisterWallet(CWalletInterface* pwalletIn);
 void UnregisterAllWallets();
 /** Push an updated transaction to all registered wallets */
 void SyncWithWallets(const CTransaction& tx, const CBlock* pblock = NULL, bool fConnect = true);
+/** SyncWithWallets() for every transaction of a block */
+void SyncBlockWithWallets(const CBlock& block, bool fConnect);
+/** Default bound of the -walletasync notification queue */
+static const int64_t DEFAULT_WALLET_QUEUE_SIZE = 10000;
+/** Queue wallet notifications and apply them on a wallet thread (-walletasync) */
+void StartWalletNotifications(boost::thread_group& threadGroup);
+/** Apply the rest of the queue and call the wallets directly again, once the wallet thread has stopped */
+void StopWalletNotifications();
+/** Apply all queued wallet notifications before returning. Must not be called holding a wallet lock */
+void SyncWithWalletQueue();
+void GetWalletQueueStats(uint64_t& nQueued, uint64_t& nApplied, uint64_t& nOverflows);
 /** Ask wallets to resend their transactions */
 void ResendWalletTransactions(bool fForce = false);
 /** Register with a network node to receive its signals */
@@ -144,6 +174,10 @@ CBlockIndex* FindBlockByHeight(int nHeight);
 bool ProcessMessages(CNode* pfrom);
 bool SendMessages(CNode* pto, bool fSendTrickle);
 void ThreadImport(std::vector<boost::filesystem::path> vImportFiles);
+/** Put the transactions of mempool.dat back into the memory pool */
+void LoadMempool();
+/** Write the memory pool to mempool.dat, once it was loaded */
+bool DumpMempool();
 
 bool CheckProofOfWork(uint256 hash, unsigned int nBits);
 unsigned int GetNextTargetRequired(const CBlockIndex* pindexLast, bool fProofOfStake);
@@ -158,6 +192,10 @@ bool IsConfirmedInNPrevBlocks(const CTxIndex& txindex, const CBlockIndex* pindex
 std::string GetWarnings(std::string strFor);
 bool GetTransaction(const uint256 &hash, CTransaction &tx, uint256 &hashBlock);
 uint256 WantedByOrphan(const COrphanBlock* pblockOrphan);
+bool AddOrphanTx(const CTransaction& tx, const CNetAddr& addrFrom);
+void EraseOrphanTx(uint256 hash);
+/** Drop expired orphans, then those of the peers holding the most bytes until within limits */
+unsigned int LimitOrphanTxSize(unsigned int nMaxOrphans, uint64_t nMaxBytes);
 const CBlockIndex* GetLastBlockIndex(const CBlockIndex* pindex, bool fProofOfStake);
 void ThreadStakeMiner(CWallet *pwallet);
 void ThreadWorkMiner(CWallet *pwallet);
@@ -170,9 +208,9 @@ bool IsLegalAliasPayload(const std::string& alias);
 bool GetMiningStatus();
 bool GetStakingStatus();
 
-/** (try to) add transaction to memory pool **/
+/** (try to) add transaction to memory pool; nAcceptTime is when it first entered a pool, 0 for now **/
 bool AcceptToMemoryPool(CTxMemPool& pool, CTransaction &tx, bool fLimitFree,
-                        bool* pfMissingInputs);
+                        bool* pfMissingInputs, int64_t nAcceptTime = 0);
 
 /** Position on disk for a particular transaction. */
 class CDiskTxPos
@@ -894,6 +932,16 @@ public:
     const CTxOut& GetOutputFor(const CTxIn& input, const MapPrevTx& inputs) const;
 };
 
+/** A transaction spending outputs not known yet, with who sent it */
+struct COrphanTx {
+    CTransaction tx;
+    CNetAddr addrFrom;
+    unsigned int nTxSize;
+    int64_t nTimeExpire;
+};
+extern std::map<uint256, COrphanTx> mapOrphanTransactions;
+extern std::map<COutPoint, std::set<uint256> > mapOrphanTransactionsByPrev;
+
 /** wrapper for CTxOut that provides a more compact serialization */
 class CTxOutCompressor
 {
@@ -983,6 +1031,8 @@ public:
 
 
     int SetMerkleBranch(const CBlock* pblock=NULL);
+    /** The part of SetMerkleBranch() that only needs the block, not the chain */
+    bool SetMerkleBranchInBlock(const CBlock& block);
 
     // Return depth of transaction in blockchain:
     // -1  : not in blockchain, and not in memory pool (conflicted transaction)
@@ -1801,12 +1851,37 @@ public:
     }
 };
 
+/** Immutable summary of the best chain. A new snapshot replaces the old one
+ * every time the tip changes; RPC calls that only need these values read the
+ * current snapshot instead of waiting for cs_main.
+ */
+class CChainTipSnapshot
+{
+public:
+    const CBlockIndex* pindex; // block index entries are never freed
+    uint256 hashBlock;
+    int nHeight;
+    int nPowHeight;
+    uint256 nChainTrust;
+    int64_t nMint;
+    int64_t nMoneySupply;
+    int64_t nPowIncentivePool;
+    int64_t nPosIncentivePool;
+    int nAssetTypeCount;
+    const CBlockIndex* pindexLastPoW; // for the proof-of-work difficulty
+    const CBlockIndex* pindexLastPoS; // for the proof-of-stake difficulty
+    unsigned long nMempoolTx;         // memory pool size when the tip changed
+    int64_t nTimeReceived;
+
+    explicit CChainTipSnapshot(const CBlockIndex* pindexIn);
+};
 
+typedef boost::shared_ptr<const CChainTipSnapshot> CChainTipSnapshotRef;
 
-
-
-
-
+/** Publish a snapshot of pindexBest. Called by whoever just changed the tip (cs_main, or single-threaded startup). */
+void PublishChainTipSnapshot();
+/** The most recently published snapshot, NULL before the block index is loaded. Does not take cs_main. */
+CChainTipSnapshotRef GetChainTipSnapshot();
 
 
 
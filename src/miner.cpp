@@ -106,6 +106,408 @@ public:
     }
 };
 
+CBlockAssembler::CBlockAssembler() : fProofOfStake(false), nBlockMaxSize(0), nBlockPrioritySize(0), nBlockMinSize(0), nMinTxFee(0),
+                                     nFullBuilds(0), nIncrementalBuilds(0)
+{
+    Clear();
+}
+
+void CBlockAssembler::Clear()
+{
+    hashPrevBlock = 0;
+    mapChainInputs.clear();
+    setMissingInputs.clear();
+    ResetSelection();
+}
+
+void CBlockAssembler::ResetSelection()
+{
+    mapTestPool.clear();
+    vSelected.clear();
+    setSelected.clear();
+    fSortedByFee = (nBlockPrioritySize <= 0);
+    fFull = false;
+    nTransactionsUpdated = 0;
+    mapAssetId.clear();
+    mapEngName.clear();
+    mapSecondName.clear();
+    mapSymbol.clear();
+    mapAlias.clear();
+
+    nBlockSize = 1000;
+    nBlockTx = 0;
+    nBlockSigOps = 100;
+    nFees = 0;
+    nTotalPayloadFee = 0;
+    nTotalRegisterFee = 0;
+    nTotalPowDonation = 0;
+    nTotalPosDonation = 0;
+}
+
+bool CBlockAssembler::ReadChainInput(CTxDB& txdb, const COutPoint& prevout, CTxIndex& txindex, CTransaction& txPrev)
+{
+    return txPrev.ReadFromDisk(txdb, prevout, txindex);
+}
+
+// Read the confirmed inputs of tx not read yet on this tip
+bool CBlockAssembler::LoadChainInputs(CTxDB& txdb, const uint256& hash, const CTransaction& tx)
+{
+    if (setMissingInputs.count(hash))
+        return false;
+    BOOST_FOREACH(const CTxIn& txin, tx.vin)
+    {
+        const COutPoint& prevout = txin.prevout;
+        if (mapChainInputs.count(prevout.hash) || mempool.mapTx.count(prevout.hash))
+            continue;
+
+        CTxIndex txindex;
+        CTransaction txPrev;
+        if (!ReadChainInput(txdb, prevout, txindex, txPrev))
+        {
+            // This should never happen; all transactions in the memory
+            // pool should connect to either transactions in the chain
+            // or other transactions in the memory pool.
+            LogPrintf("ERROR: mempool transaction missing input\n");
+            if (fDebug) assert("mempool transaction missing input" == 0);
+            setMissingInputs.insert(hash);
+            return false;
+        }
+        mapChainInputs.insert(make_pair(prevout.hash, make_pair(txindex, txPrev)));
+    }
+    return true;
+}
+
+// FetchInputs() without the disk: confirmed inputs come from mapChainInputs and
+// the others from transactions already in the template
+bool CBlockAssembler::GetInputs(const CTransaction& tx, MapPrevTx& inputs) const
+{
+    BOOST_FOREACH(const CTxIn& txin, tx.vin)
+    {
+        const uint256& hash = txin.prevout.hash;
+        if (inputs.count(hash))
+            continue;
+
+        map<uint256, CTxIndex>::const_iterator mt = mapTestPool.find(hash);
+        MapPrevTx::const_iterator mc = mapChainInputs.find(hash);
+        if (mc != mapChainInputs.end())
+        {
+            inputs[hash] = (*mc).second;
+            // Other outputs of it may have been spent by the template
+            if (mt != mapTestPool.end())
+                inputs[hash].first = (*mt).second;
+        }
+        else if (mt != mapTestPool.end())
+        {
+            map<uint256, CTransaction>::const_iterator mp = mempool.mapTx.find(hash);
+            if (mp == mempool.mapTx.end())
+                return false;
+            inputs[hash] = make_pair((*mt).second, (*mp).second);
+        }
+        else
+            return false;
+
+        const pair<CTxIndex, CTransaction>& input = inputs[hash];
+        if (txin.prevout.n >= input.second.vout.size() || txin.prevout.n >= input.first.vSpent.size())
+            return false;
+    }
+    return true;
+}
+
+bool CBlockAssembler::ConnectTx(CTxDB& txdb, CTransaction& tx, const uint256& hash, const MapPrevTx& inputs, const CBlockIndex* pindexPrev)
+{
+    // ConnectInputs() writes spent flags into mapTestPool input by input; keep
+    // what was there so a failure halfway can be undone
+    map<uint256, pair<bool, CTxIndex> > mapUndo;
+    BOOST_FOREACH(const CTxIn& txin, tx.vin)
+    {
+        if (mapUndo.count(txin.prevout.hash))
+            continue;
+        map<uint256, CTxIndex>::const_iterator mt = mapTestPool.find(txin.prevout.hash);
+        if (mt != mapTestPool.end())
+            mapUndo[txin.prevout.hash] = make_pair(true, (*mt).second);
+        else
+            mapUndo[txin.prevout.hash] = make_pair(false, CTxIndex());
+    }
+
+    // Note that flags: we don't want to set mempool/IsStandard()
+    // policy here, but we still have to ensure that the block we
+    // create only contains transactions that are valid in new blocks.
+    if (!tx.ConnectInputs(txdb, inputs, mapTestPool, CDiskTxPos(1,1,1), pindexPrev, false, true, MANDATORY_SCRIPT_VERIFY_FLAGS))
+    {
+        for (map<uint256, pair<bool, CTxIndex> >::const_iterator it = mapUndo.begin(); it != mapUndo.end(); ++it)
+        {
+            if ((*it).second.first)
+                mapTestPool[(*it).first] = (*it).second.second;
+            else
+                mapTestPool.erase((*it).first);
+        }
+        return false;
+    }
+    mapTestPool[hash] = CTxIndex(CDiskTxPos(1,1,1), tx.vout.size());
+    return true;
+}
+
+// icochain: 注册资产、注册别名、转让别名交易要判断去重，不然区块将无法通过验证
+// fJustCheck 为真时只检查不记录, 交易确定加入区块后再记录
+bool CBlockAssembler::AddUniqueNames(const CTransaction& tx, bool fJustCheck)
+{
+    // 注册资产
+    if(tx.getTxType() == CTransaction::TX_TYPE_REGISTER_ASSET)
+    {
+        std::string engName, secondName, symbol, assetIntro, publisher;
+        int64_t assetId, supply;
+        int suffix;
+        assetId = tx.GetAssetRegisterInfo(engName, secondName, symbol, assetIntro, publisher, supply, suffix);
+
+        if(assetId <= 0)
+            return false;
+
+        // 判断不包含在本区块
+        if(mapAssetId.count(assetId) || mapEngName.count(engName) || mapSecondName.count(secondName) || mapSymbol.count(symbol))
+            return false;
+
+        // 判断不在区块链
+        if(fJustCheck)
+            return !IsExsistAssetMsg(assetId,engName,secondName,symbol);
+
+        mapAssetId[assetId] = 1;
+        mapEngName[engName] = 1;
+        mapSecondName[secondName] = 1;
+        mapSymbol[symbol] = 1;
+    }
+    // 注册别名
+    else if(tx.getTxType() == CTransaction::TX_TYPE_REGISTER_ALIAS)
+    {
+        std::string alias, address;
+        if(!tx.GetAliasPayloadInfo(alias,address))
+            return false;
+
+        // 判断不包含在本区块
+        if(mapAlias.count(alias))
+            return false;
+
+        // 判断不在区块链
+        if(fJustCheck)
+            return !IsExistsAlias(alias);
+
+        mapAlias[alias] = 1;
+    }
+    // 转让别名
+    else if(tx.getTxType() == CTransaction::TX_TYPE_TRANSFER_ALIAS)
+    {
+        std::string alias, address;
+        if(!tx.GetAliasPayloadInfo(alias,address))
+            return false;
+
+        // 判断不包含在本区块，转让和注册别名共用mapAlias
+        if(mapAlias.count(alias))
+            return false;
+
+        // 必须之前被注册过了，存在区块链中
+        if(fJustCheck)
+            return IsExistsAlias(alias);
+
+        mapAlias[alias] = 1;
+    }
+    return true;
+}
+
+void CBlockAssembler::Update(CTxDB& txdb, const CBlockIndex* pindexPrev, unsigned int nCoinbaseTime, bool fProofOfStakeIn,
+                             unsigned int nBlockMaxSizeIn, unsigned int nBlockPrioritySizeIn, unsigned int nBlockMinSizeIn, int64_t nMinTxFeeIn)
+{
+    AssertLockHeld(cs_main);
+    AssertLockHeld(mempool.cs);
+
+    if (pindexPrev->GetBlockHash() != hashPrevBlock || fProofOfStakeIn != fProofOfStake ||
+        nBlockMaxSizeIn != nBlockMaxSize || nBlockPrioritySizeIn != nBlockPrioritySize ||
+        nBlockMinSizeIn != nBlockMinSize || nMinTxFeeIn != nMinTxFee)
+    {
+        fProofOfStake = fProofOfStakeIn;
+        nBlockMaxSize = nBlockMaxSizeIn;
+        nBlockPrioritySize = nBlockPrioritySizeIn;
+        nBlockMinSize = nBlockMinSizeIn;
+        nMinTxFee = nMinTxFeeIn;
+        Clear();
+        hashPrevBlock = pindexPrev->GetBlockHash();
+        nFullBuilds++;
+    }
+    else
+    {
+        // Once full, new arrivals can only get in by pushing out chosen
+        // transactions, and a chosen transaction that left the pool may
+        // have been the parent of others
+        bool fRestart = (fFull && mempool.GetTransactionsUpdated() != nTransactionsUpdated);
+        for (unsigned int i = 0; i < vSelected.size() && !fRestart; i++)
+            if (!mempool.mapTx.count(vSelected[i]))
+                fRestart = true;
+        if (fRestart)
+        {
+            ResetSelection();
+            nFullBuilds++;
+        }
+        else
+            nIncrementalBuilds++;
+    }
+    nTransactionsUpdated = mempool.GetTransactionsUpdated();
+    int nHeight = pindexPrev->nHeight + 1;
+
+    // Priority order to process transactions
+    list<COrphan> vOrphan; // list memory doesn't move
+    map<uint256, vector<COrphan*> > mapDependers;
+
+    // This vector will be sorted into a priority queue:
+    vector<TxPriority> vecPriority;
+    vecPriority.reserve(mempool.mapTx.size() - setSelected.size());
+    for (map<uint256, CTransaction>::iterator mi = mempool.mapTx.begin(); mi != mempool.mapTx.end(); ++mi)
+    {
+        CTransaction& tx = (*mi).second;
+        if (setSelected.count((*mi).first))
+            continue;
+        if (tx.IsCoinBase() || tx.IsCoinStake() || !IsFinalTx(tx, nHeight))
+            continue;
+
+        if (setMissingInputs.count((*mi).first))
+            continue;
+        const CTxMemPoolEntry& entry = mempool.mapEntry[(*mi).first];
+        double dPriority = entry.GetPriority(pindexPrev->nHeight);
+        double dFeePerKb = entry.GetFeePerKb();
+
+        // Has to wait for dependencies
+        COrphan* porphan = NULL;
+        BOOST_FOREACH(const uint256& hashParent, entry.setParents)
+        {
+            if (setSelected.count(hashParent))
+                continue;
+            if (!porphan)
+            {
+                // Use list for automatic deletion
+                vOrphan.push_back(COrphan(&tx));
+                porphan = &vOrphan.back();
+                porphan->dPriority = dPriority;
+                porphan->dFeePerKb = dFeePerKb;
+            }
+            mapDependers[hashParent].push_back(porphan);
+            porphan->setDependsOn.insert(hashParent);
+        }
+        if (!porphan)
+            vecPriority.push_back(TxPriority(dPriority, dFeePerKb, &tx));
+    }
+
+    TxPriorityCompare comparer(fSortedByFee);
+    std::make_heap(vecPriority.begin(), vecPriority.end(), comparer);
+
+    while (!vecPriority.empty())
+    {
+        // Take highest priority transaction off the priority queue:
+        double dPriority = vecPriority.front().get<0>();
+        double dFeePerKb = vecPriority.front().get<1>();
+        CTransaction& tx = *(vecPriority.front().get<2>());
+        uint256 hash = tx.GetHash();
+        const CTxMemPoolEntry& entry = mempool.mapEntry[hash];
+
+        std::pop_heap(vecPriority.begin(), vecPriority.end(), comparer);
+        vecPriority.pop_back();
+
+        // Size limits
+        unsigned int nTxSize = entry.nTxSize;
+        if (nBlockSize + nTxSize >= nBlockMaxSize)
+        {
+            fFull = true;
+            continue;
+        }
+
+        // Limits on sigOps, pay-to-script-hash ones included:
+        unsigned int nTxSigOps = entry.nSigOps;
+        if (nBlockSigOps + nTxSigOps >= MAX_BLOCK_SIGOPS)
+            continue;
+
+        // Timestamp limit
+        if (tx.nTime > GetAdjustedTime() || (fProofOfStake && tx.nTime > nCoinbaseTime))
+            continue;
+
+        // Transaction fee
+        int64_t nMinFee = GetMinTxChange(tx);
+
+        // Skip free transactions if we're past the minimum block size:
+        if (fSortedByFee && (dFeePerKb < nMinTxFee) && (nBlockSize + nTxSize >= nBlockMinSize))
+            continue;
+
+        // Prioritize by fee once past the priority size or we run out of high-priority
+        // transactions:
+        if (!fSortedByFee &&
+            ((nBlockSize + nTxSize >= nBlockPrioritySize) || (dPriority < COIN * 144 / 250)))
+        {
+            fSortedByFee = true;
+            comparer = TxPriorityCompare(fSortedByFee);
+            std::make_heap(vecPriority.begin(), vecPriority.end(), comparer);
+        }
+
+        int64_t nTxFees = entry.nFee;
+        if (nTxFees < nMinFee)
+            continue;
+
+        int64_t nTxPayloadFee  = entry.nPayloadFee;
+        int64_t nTxRegisterFee = entry.nRegisterFee;
+        int64_t nTxPowDonation = entry.nPowDonation;
+        int64_t nTxPosDonation = entry.nPosDonation;
+        int64_t nNotFeeChange = entry.GetNotFeeChange();
+        if(nTxFees < nNotFeeChange)
+            continue;
+
+        if (!AddUniqueNames(tx, true))
+            continue;
+
+        // Connecting shouldn't fail due to dependency on other memory pool transactions
+        // because we're already processing them in order of dependency
+        MapPrevTx mapInputs;
+        if (!LoadChainInputs(txdb, hash, tx) || !GetInputs(tx, mapInputs))
+            continue;
+
+        if (!ConnectTx(txdb, tx, hash, mapInputs, pindexPrev))
+            continue;
+
+        // Added
+        AddUniqueNames(tx, false);
+        vSelected.push_back(hash);
+        setSelected.insert(hash);
+        nBlockSize += nTxSize;
+        ++nBlockTx;
+        nBlockSigOps += nTxSigOps;
+        nFees += nTxFees - nNotFeeChange;
+
+        nTotalPayloadFee  += nTxPayloadFee;
+        nTotalRegisterFee += nTxRegisterFee;
+        nTotalPowDonation += nTxPowDonation;
+        nTotalPosDonation += nTxPosDonation;
+
+        if (fDebug && GetBoolArg("-printpriority", false))
+        {
+            LogPrintf("priority %.1f feeperkb %.1f txid %s\n",
+                   dPriority, dFeePerKb, hash.ToString());
+        }
+
+        // Add transactions that depend on this one to the priority queue
+        if (mapDependers.count(hash))
+        {
+            BOOST_FOREACH(COrphan* porphan, mapDependers[hash])
+            {
+                if (!porphan->setDependsOn.empty())
+                {
+                    porphan->setDependsOn.erase(hash);
+                    if (porphan->setDependsOn.empty())
+                    {
+                        vecPriority.push_back(TxPriority(porphan->dPriority, porphan->dFeePerKb, porphan->ptx));
+                        std::push_heap(vecPriority.begin(), vecPriority.end(), comparer);
+                    }
+                }
+            }
+        }
+    }
+}
+
+static CBlockAssembler assemblerPoW;
+static CBlockAssembler assemblerPoS;
+
 // CreateNewBlock: create new block (without proof-of-work/proof-of-stake)
 CBlock* CreateNewBlock(CReserveKey& reservekey, bool fProofOfStake, int64_t* pFees, int64_t* pPosIncPool)
 {
@@ -183,289 +585,31 @@ CBlock* CreateNewBlock(CReserveKey& reservekey, bool fProofOfStake, int64_t* pFe
     int64_t nTotalPosDonation = 0;
     int64_t nTotalRecovery    = 0;
 
-    std::map<int64_t, int> mapAssetId;
-    std::map<std::string, int> mapEngName;
-    std::map<std::string, int> mapSecondName;
-    std::map<std::string, int> mapSymbol;
-    std::map<std::string, int> mapAlias;
-
     {
         LOCK2(cs_main, mempool.cs);
         CTxDB txdb("r");
 
-        // Priority order to process transactions
-        list<COrphan> vOrphan; // list memory doesn't move
-        map<uint256, vector<COrphan*> > mapDependers;
-
-        // This vector will be sorted into a priority queue:
-        vector<TxPriority> vecPriority;
-        vecPriority.reserve(mempool.mapTx.size());
-        for (map<uint256, CTransaction>::iterator mi = mempool.mapTx.begin(); mi != mempool.mapTx.end(); ++mi)
-        {
-            CTransaction& tx = (*mi).second;
-            if (tx.IsCoinBase() || tx.IsCoinStake() || !IsFinalTx(tx, nHeight))
-                continue;
-
-            COrphan* porphan = NULL;
-            double dPriority = 0;
-            int64_t nTotalIn = 0;
-            bool fMissingInputs = false;
-            BOOST_FOREACH(const CTxIn& txin, tx.vin)
-            {
-                // Read prev transaction
-                CTransaction txPrev;
-                CTxIndex txindex;
-                if (!txPrev.ReadFromDisk(txdb, txin.prevout, txindex))
-                {
-                    // This should never happen; all transactions in the memory
-                    // pool should connect to either transactions in the chain
-                    // or other transactions in the memory pool.
-                    if (!mempool.mapTx.count(txin.prevout.hash))
-                    {
-                        LogPrintf("ERROR: mempool transaction missing input\n");
-                        if (fDebug) assert("mempool transaction missing input" == 0);
-                        fMissingInputs = true;
-                        if (porphan)
-                            vOrphan.pop_back();
-                        break;
-                    }
-
-                    // Has to wait for dependencies
-                    if (!porphan)
-                    {
-                        // Use list for automatic deletion
-                        vOrphan.push_back(COrphan(&tx));
-                        porphan = &vOrphan.back();
-                    }
-                    mapDependers[txin.prevout.hash].push_back(porphan);
-                    porphan->setDependsOn.insert(txin.prevout.hash);
-                   // nTotalIn += mempool.mapTx[txin.prevout.hash].vout[txin.prevout.n].nValue;
-                    nTotalIn += mempool.mapTx[txin.prevout.hash].vout[txin.prevout.n].GetValueByAssetId(0);
-                    continue;
-                }
-                int64_t nValueIn = txPrev.vout[txin.prevout.n].nValue;
-                nTotalIn += nValueIn;
-
-                int nConf = txindex.GetDepthInMainChain();
-                dPriority += (double)nValueIn * nConf;
-            }
-            if (fMissingInputs) continue;
-
-            // Priority is sum(valuein * age) / txsize
-            unsigned int nTxSize = ::GetSerializeSize(tx, SER_NETWORK, PROTOCOL_VERSION);
-            dPriority /= nTxSize;
-
-            // This is a more accurate fee-per-kilobyte than is used by the client code, because the
-            // client code rounds up the size to the nearest 1K. That's good, because it gives an
-            // incentive to create smaller transactions.
-            double dFeePerKb =  double(nTotalIn-tx.GetValueOut(0)) / (double(nTxSize)/1000.0);
-
-            if (porphan)
-            {
-                porphan->dPriority = dPriority;
-                porphan->dFeePerKb = dFeePerKb;
-            }
-            else
-                vecPriority.push_back(TxPriority(dPriority, dFeePerKb, &(*mi).second));
-        }
-
-        // Collect transactions into block
-        map<uint256, CTxIndex> mapTestPool;
-        uint64_t nBlockSize = 1000;
-        uint64_t nBlockTx = 0;
-        int nBlockSigOps = 100;
-        bool fSortedByFee = (nBlockPrioritySize <= 0);
-
-        TxPriorityCompare comparer(fSortedByFee);
-        std::make_heap(vecPriority.begin(), vecPriority.end(), comparer);
-
-        while (!vecPriority.empty())
-        {
-            // Take highest priority transaction off the priority queue:
-            double dPriority = vecPriority.front().get<0>();
-            double dFeePerKb = vecPriority.front().get<1>();
-            CTransaction& tx = *(vecPriority.front().get<2>());
-
-            std::pop_heap(vecPriority.begin(), vecPriority.end(), comparer);
-            vecPriority.pop_back();
-
-            // Size limits
-            unsigned int nTxSize = ::GetSerializeSize(tx, SER_NETWORK, PROTOCOL_VERSION);
-            if (nBlockSize + nTxSize >= nBlockMaxSize)
-                continue;
-
-            // Legacy limits on sigOps:
-            unsigned int nTxSigOps = GetLegacySigOpCount(tx);
-            if (nBlockSigOps + nTxSigOps >= MAX_BLOCK_SIGOPS)
-                continue;
-
-            // Timestamp limit
-            if (tx.nTime > GetAdjustedTime() || (fProofOfStake && tx.nTime > pblock->vtx[0].nTime))
-                continue;
-
-            // Transaction fee
-            int64_t nMinFee = GetMinTxChange(tx);
-
-            // Skip free transactions if we're past the minimum block size:
-            if (fSortedByFee && (dFeePerKb < nMinTxFee) && (nBlockSize + nTxSize >= nBlockMinSize))
-                continue;
-
-            // Prioritize by fee once past the priority size or we run out of high-priority
-            // transactions:
-            if (!fSortedByFee &&
-                ((nBlockSize + nTxSize >= nBlockPrioritySize) || (dPriority < COIN * 144 / 250)))
-            {
-                fSortedByFee = true;
-                comparer = TxPriorityCompare(fSortedByFee);
-                std::make_heap(vecPriority.begin(), vecPriority.end(), comparer);
-            }
-
-            // Connecting shouldn't fail due to dependency on other memory pool transactions
-            // because we're already processing them in order of dependency
-            map<uint256, CTxIndex> mapTestPoolTmp(mapTestPool);
-            MapPrevTx mapInputs;
-            bool fInvalid;
-            if (!tx.FetchInputs(txdb, mapTestPoolTmp, false, true, mapInputs, fInvalid))
-                continue;
-
-            int64_t nTxFees = tx.GetValueIn(0,mapInputs)-tx.GetValueOut(0);
-            if (nTxFees < nMinFee)
-                continue;
-
-            int64_t nTxPayloadFee  = tx.GetPayloadFee();
-            int64_t nTxRegisterFee = tx.GetRegisterFee();
-            int64_t nTxPowDonation = tx.GetPowDonation();
-            int64_t nTxPosDonation = tx.GetPosDonation();
-            int64_t nNotFeeChange = nTxPayloadFee + nTxRegisterFee + nTxPowDonation + nTxPosDonation;
-            if(nTxFees < nNotFeeChange)
-                continue;
-
-            nTxSigOps += GetP2SHSigOpCount(tx, mapInputs);
-            if (nBlockSigOps + nTxSigOps >= MAX_BLOCK_SIGOPS)
-                continue;
-
-            // Note that flags: we don't want to set mempool/IsStandard()
-            // policy here, but we still have to ensure that the block we
-            // create only contains transactions that are valid in new blocks.
-            if (!tx.ConnectInputs(txdb, mapInputs, mapTestPoolTmp, CDiskTxPos(1,1,1), pindexPrev, false, true, MANDATORY_SCRIPT_VERIFY_FLAGS))
-                continue;
-            mapTestPoolTmp[tx.GetHash()] = CTxIndex(CDiskTxPos(1,1,1), tx.vout.size());
-            swap(mapTestPool, mapTestPoolTmp);
-
-            // icochain: 注册资产、注册别名、转让别名交易要判断去重，不然区块将无法通过验证
-            // 注册资产
-            if(tx.getTxType() == CTransaction::TX_TYPE_REGISTER_ASSET)
-            {
-                std::string engName, secondName, symbol, assetIntro, publisher;
-                int64_t assetId, supply;
-                int suffix;
-                assetId = tx.GetAssetRegisterInfo(engName, secondName, symbol, assetIntro, publisher, supply, suffix);
-
-                if(assetId <= 0)
-                    continue;
-
-                // 判断不在区块链
-                if(IsExsistAssetMsg(assetId,engName,secondName,symbol))
-                    continue;
-
-                // 判断不包含在本区块
-                if(mapAssetId.count(assetId))
-                    continue;
-                else
-                    mapAssetId[assetId] = 1;
-
-                if(mapEngName.count(engName))
-                    continue;
-                else
-                    mapEngName[engName] = 1;
-
-                if(mapSecondName.count(secondName))
-                    continue;
-                else
-                    mapSecondName[secondName] = 1;
-
-                if(mapSymbol.count(symbol))
-                    continue;
-                else
-                    mapSymbol[symbol] = 1;
-            }
-            // 注册别名
-            else if(tx.getTxType() == CTransaction::TX_TYPE_REGISTER_ALIAS)
-            {
-                std::string alias, address;
-                if(!tx.GetAliasPayloadInfo(alias,address))
-                    continue;
-
-                // 判断不在区块链
-                if(IsExistsAlias(alias))
-                    continue;
-
-                // 判断不包含在本区块
-                if(mapAlias.count(alias))
-                    continue;
-                else
-                    mapAlias[alias] = 1;
-            }
-            // 转让别名
-            else if(tx.getTxType() == CTransaction::TX_TYPE_TRANSFER_ALIAS)
-            {
-                std::string alias, address;
-                if(!tx.GetAliasPayloadInfo(alias,address))
-                    continue;
-
-                // 必须之前被注册过了，存在区块链中
-                if(!IsExistsAlias(alias))
-                    continue;
-
-                // 判断不包含在本区块，转让和注册别名共用mapAlias
-                if(mapAlias.count(alias))
-                    continue;
-                else
-                    mapAlias[alias] = 1;
-            }
-
-            // Added
-            pblock->vtx.push_back(tx);
-            nBlockSize += nTxSize;
-            ++nBlockTx;
-            nBlockSigOps += nTxSigOps;
-            nFees += nTxFees - nNotFeeChange;
-
-            nTotalPayloadFee  += nTxPayloadFee;
-            nTotalRegisterFee += nTxRegisterFee;
-            nTotalPowDonation += nTxPowDonation;
-            nTotalPosDonation += nTxPosDonation;
-
-            if (fDebug && GetBoolArg("-printpriority", false))
-            {
-                LogPrintf("priority %.1f feeperkb %.1f txid %s\n",
-                       dPriority, dFeePerKb, tx.GetHash().ToString());
-            }
-
-            // Add transactions that depend on this one to the priority queue
-            uint256 hash = tx.GetHash();
-            if (mapDependers.count(hash))
-            {
-                BOOST_FOREACH(COrphan* porphan, mapDependers[hash])
-                {
-                    if (!porphan->setDependsOn.empty())
-                    {
-                        porphan->setDependsOn.erase(hash);
-                        if (porphan->setDependsOn.empty())
-                        {
-                            vecPriority.push_back(TxPriority(porphan->dPriority, porphan->dFeePerKb, porphan->ptx));
-                            std::push_heap(vecPriority.begin(), vecPriority.end(), comparer);
-                        }
-                    }
-                }
-            }
-        }
-
-        nLastBlockTx = nBlockTx;
-        nLastBlockSize = nBlockSize;
+        CBlockAssembler& assembler = fProofOfStake ? assemblerPoS : assemblerPoW;
+        int64_t nStart = GetTimeMicros();
+        assembler.Update(txdb, pindexPrev, pblock->vtx[0].nTime, fProofOfStake,
+                         nBlockMaxSize, nBlockPrioritySize, nBlockMinSize, nMinTxFee);
+        BOOST_FOREACH(const uint256& hash, assembler.vSelected)
+            pblock->vtx.push_back(mempool.mapTx[hash]);
+        LogPrint("miner", "CreateNewBlock(): %u of %u pool transactions in %.2fms (%u full, %u incremental updates)\n",
+                 assembler.vSelected.size(), mempool.mapTx.size(), (GetTimeMicros() - nStart) * 0.001,
+                 assembler.nFullBuilds, assembler.nIncrementalBuilds);
+
+        nFees = assembler.nFees;
+        nTotalPayloadFee  = assembler.nTotalPayloadFee;
+        nTotalRegisterFee = assembler.nTotalRegisterFee;
+        nTotalPowDonation = assembler.nTotalPowDonation;
+        nTotalPosDonation = assembler.nTotalPosDonation;
+
+        nLastBlockTx = assembler.nBlockTx;
+        nLastBlockSize = assembler.nBlockSize;
 
         if (fDebug && GetBoolArg("-printpriority", false))
-            LogPrintf("CreateNewBlock(): total size %u\n", nBlockSize);
+            LogPrintf("CreateNewBlock(): total size %u\n", assembler.nBlockSize);
 
         int64_t nPowIncentivePoolIn = (nTotalPayloadFee + nTotalRegisterFee + nTotalRecovery)/2 + nTotalPowDonation; // POW激励池流入
         nPowIncentivePoolIn += pindexPrev ? pindexPrev->nPowIncentivePool : 0;
@@ -504,6 +648,113 @@ CBlock* CreateNewBlock(CReserveKey& reservekey, bool fProofOfStake, int64_t* pFe
 }
 
 
+static CCriticalSection cs_miningTemplate;
+static CMiningTemplateRef pminingTemplate;
+static CMiningTemplateStats miningTemplateStats;
+// The key every template pays to, kept by CheckMiningTemplateWork() when a block is found
+static CReserveKey* pminingTemplateKey = NULL;
+
+CMiningTemplateRef GetMiningTemplate()
+{
+    AssertLockHeld(cs_main);
+    LOCK(cs_miningTemplate);
+    if (!pwalletMain)
+        return CMiningTemplateRef();
+    miningTemplateStats.nRequests++;
+    if (pminingTemplate && pminingTemplate->pindexPrev == pindexBest &&
+        (pminingTemplate->nTransactionsUpdated == mempool.GetTransactionsUpdated() ||
+         GetTime() - pminingTemplate->nTimeCreated < MINING_TEMPLATE_REFRESH))
+        return pminingTemplate;
+
+    // Store the pool generation before CreateNewBlock, to avoid races
+    unsigned int nTransactionsUpdated = mempool.GetTransactionsUpdated();
+    int64_t nStart = GetTimeMillis();
+    if (!pminingTemplateKey)
+        pminingTemplateKey = new CReserveKey(pwalletMain);
+    auto_ptr<CBlock> pblock(CreateNewBlock(*pminingTemplateKey));
+    if (!pblock.get())
+        return CMiningTemplateRef();
+
+    boost::shared_ptr<CMiningTemplate> ptemplate(new CMiningTemplate());
+    ptemplate->block = *pblock;
+    ptemplate->pindexPrev = pindexBest;
+    ptemplate->nTransactionsUpdated = nTransactionsUpdated;
+    ptemplate->nTimeCreated = GetTime();
+    pminingTemplate = ptemplate;
+
+    miningTemplateStats.nRebuilds++;
+    miningTemplateStats.nLastBuildMillis = GetTimeMillis() - nStart;
+    return pminingTemplate;
+}
+
+bool CheckMiningTemplateWork(CBlock* pblock)
+{
+    // The key only changes under cs_main, so it is the one the templates of this tip pay to
+    LOCK(cs_main);
+    if (!pwalletMain || !pminingTemplateKey)
+        return error("CheckMiningTemplateWork() : no mining template");
+    if (!CheckWork(pblock, *pwalletMain, *pminingTemplateKey))
+        return false;
+
+    // The key is kept now, the next template pays a new one
+    {
+        LOCK(cs_miningTemplate);
+        pminingTemplate.reset();
+    }
+    return true;
+}
+
+void ShutdownMiningTemplate()
+{
+    LOCK2(cs_main, cs_miningTemplate);
+    pminingTemplate.reset();
+    // Returns the key to the pool unless a block paid to it
+    delete pminingTemplateKey;
+    pminingTemplateKey = NULL;
+}
+
+bool WaitForMiningTemplate(const uint256& hashPrevBlock, unsigned int nTransactionsUpdated)
+{
+    {
+        LOCK(cs_miningTemplate);
+        miningTemplateStats.nLongPollWaiters++;
+    }
+
+    int64_t nCheckTxTime = GetTime() + MINING_LONGPOLL_REFRESH;
+    {
+        boost::unique_lock<CWaitableCriticalSection> lock(csBestBlock);
+        while (!ShutdownRequested())
+        {
+            CChainTipSnapshotRef ptip = GetChainTipSnapshot();
+            if (ptip && ptip->hashBlock != hashPrevBlock)
+                break;
+            if (GetTime() >= nCheckTxTime)
+            {
+                if (mempool.GetTransactionsUpdated() != nTransactionsUpdated)
+                    break;
+                // Nothing new in the pool either, look again in a while
+                nCheckTxTime += 10;
+            }
+            cvBlockChange.timed_wait(lock, boost::posix_time::seconds(std::max((int64_t)1, nCheckTxTime - GetTime())));
+        }
+    }
+
+    LOCK(cs_miningTemplate);
+    miningTemplateStats.nLongPollWaiters--;
+    return !ShutdownRequested();
+}
+
+void GetMiningTemplateStats(CMiningTemplateStats& stats)
+{
+    LOCK(cs_miningTemplate);
+    stats = miningTemplateStats;
+    if (pminingTemplate)
+    {
+        stats.nAge = GetTime() - pminingTemplate->nTimeCreated;
+        stats.nTx = pminingTemplate->block.vtx.size() - 1;
+    }
+}
+
 void IncrementExtraNonce(CBlock* pblock, CBlockIndex* pindexPrev, unsigned int& nExtraNonce)
 {
     // Update nExtraNonce
@@ -821,6 +1072,9 @@ void ThreadStakeMiner(CWallet *pwallet)
              MilliSleep(5000);
          }
 
+        // Stake only coins the wallet knows to be unspent at the tip
+        SyncWithWalletQueue();
+
         //
         // Create new block
         //
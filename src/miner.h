@@ -9,9 +9,125 @@
 #include "main.h"
 #include "wallet.h"
 
+class CTxDB;
+
+/** Memory pool transactions chosen for the next block, kept between CreateNewBlock calls.
+ *
+ * Sizes, fees, sigops, priorities and dependencies come from the CTxMemPoolEntry of each
+ * pool transaction; only the confirmed inputs needed to connect a chosen transaction are
+ * read, once per tip. Transactions already chosen stay in the template, so a later call on
+ * the same tip only considers what has not been chosen yet. The selection starts over when
+ * a chosen transaction leaves the pool, or when the template is full and new transactions
+ * came in. Spent flags go straight into mapTestPool; when ConnectInputs() fails halfway,
+ * the few entries it may have touched are put back from an undo log instead of copying the map.
+ */
+class CBlockAssembler
+{
+private:
+    // What the template was built for
+    uint256 hashPrevBlock;
+    bool fProofOfStake;
+    unsigned int nBlockMaxSize;
+    unsigned int nBlockPrioritySize;
+    unsigned int nBlockMinSize;
+    int64_t nMinTxFee;
+
+    // Valid as long as the tip stays
+    MapPrevTx mapChainInputs;
+    std::set<uint256> setMissingInputs;
+
+    // The running selection
+    std::map<uint256, CTxIndex> mapTestPool;
+    std::set<uint256> setSelected;
+    bool fSortedByFee;
+    bool fFull;
+    unsigned int nTransactionsUpdated;
+    std::map<int64_t, int> mapAssetId;
+    std::map<std::string, int> mapEngName;
+    std::map<std::string, int> mapSecondName;
+    std::map<std::string, int> mapSymbol;
+    std::map<std::string, int> mapAlias;
+
+    void ResetSelection();
+    bool LoadChainInputs(CTxDB& txdb, const uint256& hash, const CTransaction& tx);
+    bool GetInputs(const CTransaction& tx, MapPrevTx& inputs) const;
+    bool ConnectTx(CTxDB& txdb, CTransaction& tx, const uint256& hash, const MapPrevTx& inputs, const CBlockIndex* pindexPrev);
+    bool AddUniqueNames(const CTransaction& tx, bool fJustCheck);
+
+protected:
+    /** Read a confirmed input; benchmarks override it to run without a chain */
+    virtual bool ReadChainInput(CTxDB& txdb, const COutPoint& prevout, CTxIndex& txindex, CTransaction& txPrev);
+
+public:
+    std::vector<uint256> vSelected;  // in block order
+    uint64_t nBlockSize;
+    uint64_t nBlockTx;
+    int nBlockSigOps;
+    int64_t nFees;
+    int64_t nTotalPayloadFee;
+    int64_t nTotalRegisterFee;
+    int64_t nTotalPowDonation;
+    int64_t nTotalPosDonation;
+
+    uint64_t nFullBuilds;
+    uint64_t nIncrementalBuilds;
+
+    CBlockAssembler();
+    virtual ~CBlockAssembler() {}
+
+    /** Bring the selection up to date with pindexPrev and the memory pool; needs cs_main and mempool.cs */
+    void Update(CTxDB& txdb, const CBlockIndex* pindexPrev, unsigned int nCoinbaseTime, bool fProofOfStakeIn,
+                unsigned int nBlockMaxSizeIn, unsigned int nBlockPrioritySizeIn, unsigned int nBlockMinSizeIn, int64_t nMinTxFeeIn);
+    /** Drop the caches and the selection, so the next Update() starts from scratch */
+    void Clear();
+};
+
 /* Generate a new block, without valid proof-of-work */
 CBlock* CreateNewBlock(CReserveKey& reservekey, bool fProofOfStake=false, int64_t* pFees = 0, int64_t* pPosIncPool = 0);
 
+/** A proof-of-work block template shared by getwork, getworkex and getblocktemplate */
+class CMiningTemplate
+{
+public:
+    CBlock block;
+    const CBlockIndex* pindexPrev;
+    unsigned int nTransactionsUpdated;  // memory pool generation it was built from
+    int64_t nTimeCreated;
+};
+
+typedef boost::shared_ptr<const CMiningTemplate> CMiningTemplateRef;
+
+/** Seconds a template is kept while only the memory pool changes */
+static const int64_t MINING_TEMPLATE_REFRESH = 5;
+/** Seconds a long poll waits for the memory pool before answering with a new template */
+static const int64_t MINING_LONGPOLL_REFRESH = 60;
+
+class CMiningTemplateStats
+{
+public:
+    uint64_t nRebuilds;
+    uint64_t nRequests;
+    int64_t nAge;           // seconds since the current template was built, -1 if none
+    int64_t nLastBuildMillis;
+    unsigned int nTx;
+    int nLongPollWaiters;
+
+    CMiningTemplateStats() : nRebuilds(0), nRequests(0), nAge(-1), nLastBuildMillis(0), nTx(0), nLongPollWaiters(0) {}
+};
+
+/** The current template, rebuilt when the tip has changed, or when the memory pool has and
+ * the template is MINING_TEMPLATE_REFRESH seconds old. Its coinbase pays a key the template code
+ * reserves from the wallet. NULL if it could not be built. Needs cs_main. */
+CMiningTemplateRef GetMiningTemplate();
+/** CheckWork() for a block built from a mining template, keeping the key it pays to */
+bool CheckMiningTemplateWork(CBlock* pblock);
+/** Drop the template and return its key to the pool */
+void ShutdownMiningTemplate();
+/** Wait, without cs_main, until the tip is no longer hashPrevBlock, or the memory pool has moved
+ * on from nTransactionsUpdated and MINING_LONGPOLL_REFRESH seconds have passed. False on shutdown. */
+bool WaitForMiningTemplate(const uint256& hashPrevBlock, unsigned int nTransactionsUpdated);
+void GetMiningTemplateStats(CMiningTemplateStats& stats);
+
 /** Modify the extranonce in a block */
 void IncrementExtraNonce(CBlock* pblock, CBlockIndex* pindexPrev, unsigned int& nExtraNonce);
 
@@ -14,6 +14,8 @@
 #include <string.h>
 #endif
 
+#include <math.h>
+
 #ifdef USE_UPNP
 #include <miniupnpc/miniwget.h>
 #include <miniupnpc/miniupnpc.h>
@@ -312,6 +314,9 @@ uint64_t CNode::nTotalBytesRecv = 0;
 uint64_t CNode::nTotalBytesSent = 0;
 CCriticalSection CNode::cs_totalBytesRecv;
 CCriticalSection CNode::cs_totalBytesSent;
+uint64_t CNode::nMaxOutboundLimit = 0;
+uint64_t CNode::nMaxOutboundTotalBytesSentInCycle = 0;
+int64_t CNode::nMaxOutboundCycleStartTime = 0;
 
 CNode* FindNode(const CNetAddr& ip)
 {
@@ -526,6 +531,19 @@ void CNode::copyStats(CNodeStats &stats)
     
     // Leave string empty if addrLocal invalid (not filled in yet)
     stats.addrLocal = addrLocal.IsValid() ? addrLocal.ToString() : "";
+
+    // Estimated from the element sizes, with about 32 bytes more for every tree node
+    {
+        LOCK(cs_inventory);
+        stats.nInvKnownMem = filterInventoryKnown.GetMemoryUsage();
+        stats.nInvQueueMem = (vInventoryToSend.capacity() + vInventoryTxToSend.capacity()) * sizeof(CInv);
+        stats.nAskForMem = nAskForSize * (32 + sizeof(int64_t) + sizeof(CInv));
+        stats.nAddrKnownMem = nAddrKnownSize * (32 + 2 * sizeof(CAddress));
+    }
+
+    X(nHistoricalBytesSent);
+    stats.nUploadRate = uploadBucket.nRate;
+    stats.nUploadTokens = uploadBucket.nTokens;
 }
 #undef X
 
@@ -1443,7 +1461,9 @@ void ThreadMessageHandler()
 
                     if (pnode->nSendSize < SendBufferSize())
                     {
-                        if (!pnode->vRecvGetData.empty() || (!pnode->vRecvMsg.empty() && pnode->vRecvMsg[0].complete()))
+                        if (!pnode->vRecvGetData.empty() ||
+                            (!pnode->vRecvGetDataHistorical.empty() && pnode->nGetDataDelayUntil <= GetTimeMicros()) ||
+                            !pnode->setOrphanWork.empty() || (!pnode->vRecvMsg.empty() && pnode->vRecvMsg[0].complete()))
                         {
                             fSleep = false;
                         }
@@ -1709,24 +1729,77 @@ void RelayTransaction(const CTransaction& tx, const uint256& hash)
     RelayTransaction(tx, hash, ss);
 }
 
+// Keep a transaction for peers that ask for it; cs_mapRelay must be held
+static void AddToRelay(const CInv& inv, const CDataStream& ss)
+{
+    // Expire old relay messages
+    while (!vRelayExpiration.empty() && vRelayExpiration.front().first < GetTime())
+    {
+        mapRelay.erase(vRelayExpiration.front().second);
+        vRelayExpiration.pop_front();
+    }
+
+    // Save original serialized message so newer versions are preserved
+    mapRelay.insert(std::make_pair(inv, ss));
+    vRelayExpiration.push_back(std::make_pair(GetTime() + 15 * 60, inv));
+}
+
 void RelayTransaction(const CTransaction& tx, const uint256& hash, const CDataStream& ss)
 {
     CInv inv(MSG_TX, hash);
     {
         LOCK(cs_mapRelay);
-        // Expire old relay messages
-        while (!vRelayExpiration.empty() && vRelayExpiration.front().first < GetTime())
+        AddToRelay(inv, ss);
+    }
+
+    RelayInventory(inv);
+}
+
+void RelayTransactions(const std::vector<CTransaction>& vtx)
+{
+    vector<CInv> vInv;
+    vInv.reserve(vtx.size());
+    {
+        LOCK(cs_mapRelay);
+        BOOST_FOREACH(const CTransaction& tx, vtx)
         {
-            mapRelay.erase(vRelayExpiration.front().second);
-            vRelayExpiration.pop_front();
+            CDataStream ss(SER_NETWORK, PROTOCOL_VERSION);
+            ss.reserve(1000);
+            ss << tx;
+            vInv.push_back(CInv(MSG_TX, tx.GetHash()));
+            AddToRelay(vInv.back(), ss);
         }
-
-        // Save original serialized message so newer versions are preserved
-        mapRelay.insert(std::make_pair(inv, ss));
-        vRelayExpiration.push_back(std::make_pair(GetTime() + 15 * 60, inv));
     }
 
-    RelayInventory(inv);
+    LOCK(cs_vNodes);
+    BOOST_FOREACH(CNode* pnode, vNodes)
+        pnode->PushInventory(vInv);
+}
+
+// Exponentially distributed delays make the announcements of a transaction to
+// different peers independent of each other
+int64_t PoissonNextSend(int64_t nNow, int nAverageIntervalSeconds)
+{
+    return nNow + (int64_t)(log1p(GetRand(1ULL << 48) * -0.0000000000000035527136788 /* -1/2^48 */) * nAverageIntervalSeconds * -1000000.0 + 0.5);
+}
+
+// requires LOCK(cs_main), which guards mapAlreadyAskedFor
+unsigned int ExpireAlreadyAskedFor(int64_t nNow)
+{
+    int64_t nCutoff = (nNow - ALREADY_ASKED_FOR_EXPIRY) * 1000000;
+    unsigned int nErased = 0;
+    map<CInv, int64_t>::iterator it = mapAlreadyAskedFor.begin();
+    while (it != mapAlreadyAskedFor.end())
+    {
+        if (it->second < nCutoff)
+        {
+            mapAlreadyAskedFor.erase(it++);
+            nErased++;
+        }
+        else
+            ++it;
+    }
+    return nErased;
 }
 
 void CNode::RecordBytesRecv(uint64_t bytes)
@@ -1739,6 +1812,62 @@ void CNode::RecordBytesSent(uint64_t bytes)
 {
     LOCK(cs_totalBytesSent);
     nTotalBytesSent += bytes;
+
+    int64_t nNow = GetTime();
+    if (nMaxOutboundCycleStartTime + MAX_UPLOAD_TIMEFRAME < nNow)
+    {
+        // timeframe expired, start a new cycle
+        nMaxOutboundCycleStartTime = nNow;
+        nMaxOutboundTotalBytesSentInCycle = 0;
+    }
+    nMaxOutboundTotalBytesSentInCycle += bytes;
+}
+
+void CNode::SetMaxOutboundTarget(uint64_t nLimit)
+{
+    LOCK(cs_totalBytesSent);
+    nMaxOutboundLimit = nLimit;
+    nMaxOutboundCycleStartTime = 0;
+    nMaxOutboundTotalBytesSentInCycle = 0;
+}
+
+uint64_t CNode::GetMaxOutboundTarget()
+{
+    LOCK(cs_totalBytesSent);
+    return nMaxOutboundLimit;
+}
+
+int64_t CNode::GetMaxOutboundTimeLeftInCycle()
+{
+    LOCK(cs_totalBytesSent);
+    if (nMaxOutboundLimit == 0)
+        return 0;
+    if (nMaxOutboundCycleStartTime == 0)
+        return MAX_UPLOAD_TIMEFRAME;
+    return max((int64_t)0, nMaxOutboundCycleStartTime + MAX_UPLOAD_TIMEFRAME - GetTime());
+}
+
+bool CNode::OutboundTargetReached(bool fHistoricalBlockServingLimit)
+{
+    LOCK(cs_totalBytesSent);
+    if (nMaxOutboundLimit == 0)
+        return false;
+
+    if (fHistoricalBlockServingLimit)
+    {
+        // Keep enough for a full block every block interval until the cycle ends
+        uint64_t nBuffer = GetMaxOutboundTimeLeftInCycle() / GetTargetSpacing(nBestHeight) * (uint64_t)MAX_BLOCK_SIZE_GEN;
+        return nBuffer >= nMaxOutboundLimit || nMaxOutboundTotalBytesSentInCycle >= nMaxOutboundLimit - nBuffer;
+    }
+    return nMaxOutboundTotalBytesSentInCycle >= nMaxOutboundLimit;
+}
+
+uint64_t CNode::GetOutboundTargetBytesLeft()
+{
+    LOCK(cs_totalBytesSent);
+    if (nMaxOutboundLimit == 0)
+        return 0;
+    return (nMaxOutboundTotalBytesSentInCycle >= nMaxOutboundLimit) ? 0 : nMaxOutboundLimit - nMaxOutboundTotalBytesSentInCycle;
 }
 
 uint64_t CNode::GetTotalBytesRecv()
@@ -16,6 +16,7 @@
 #include <arpa/inet.h>
 #endif
 
+#include "bloom.h"
 #include "mruset.h"
 #include "netbase.h"
 #include "protocol.h"
@@ -32,8 +33,27 @@ static const int PING_INTERVAL = 2 * 60;
 /** Time after which to disconnect, after waiting for a ping response (or inactivity). */
 static const int TIMEOUT_INTERVAL = 20 * 60;
 
+/** Inventory a peer is assumed to know is remembered for at least this many hashes, */
+static const unsigned int INVENTORY_KNOWN_MAX = 10000;
+/** with this rate of inventory wrongly taken as known and not announced. */
+static const double INVENTORY_KNOWN_FP_RATE = 0.00001;
+/** Average delay between transaction announcements to an inbound peer (in seconds), half that for outbound. */
+static const int INVENTORY_BROADCAST_INTERVAL = 5;
+/** Requests of inventory that never came are forgotten after this long (in seconds). */
+static const int64_t ALREADY_ASKED_FOR_EXPIRY = 15 * 60;
+/** Blocks this much older than the tip (in seconds) are historical: they are served after
+ *  everything else, at the peer's upload rate and within -maxuploadtarget. */
+static const int64_t HISTORICAL_BLOCK_AGE = 7 * 24 * 60 * 60;
+/** Historical blocks wait while more than this many bytes are queued for the peer. */
+static const unsigned int HISTORICAL_SEND_BUFFER = 200000;
+/** -maxuploadtarget is counted over cycles of this length (in seconds). */
+static const int64_t MAX_UPLOAD_TIMEFRAME = 24 * 60 * 60;
+/** A peer can be sent this many seconds of its upload rate at once. */
+static const int64_t PEER_UPLOAD_BURST = 10;
+
 inline unsigned int ReceiveFloodSize() { return 1000*GetArg("-maxreceivebuffer", 5*1000); }
 inline unsigned int SendBufferSize() { return 1000*GetArg("-maxsendbuffer", 1*1000); }
+inline int64_t PeerUploadRate() { return 1000*GetArg("-maxpeeruploadrate", 0); }
 
 void AddOneShot(std::string strDest);
 bool RecvLine(SOCKET hSocket, std::string& strLine);
@@ -48,6 +68,8 @@ bool BindListenPort(const CService &bindAddr, std::string& strError=REF(std::str
 void StartNode(boost::thread_group& threadGroup);
 bool StopNode();
 void SocketSendData(CNode *pnode);
+int64_t PoissonNextSend(int64_t nNow, int nAverageIntervalSeconds);
+unsigned int ExpireAlreadyAskedFor(int64_t nNow);
 
 // Signals for message handling
 struct CNodeSignals
@@ -129,6 +151,67 @@ public:
     double dPingTime;
     double dPingWait;
     std::string addrLocal;
+    // Memory held for relay to this peer, in bytes
+    uint64_t nInvKnownMem;
+    uint64_t nInvQueueMem;
+    uint64_t nAskForMem;
+    uint64_t nAddrKnownMem;
+    uint64_t nHistoricalBytesSent;
+    int64_t nUploadRate;
+    int64_t nUploadTokens;
+};
+
+
+/** Bytes a peer may be sent: refilled at nRate per second up to nBurst, no limit
+ *  when nRate is 0. Spending may overdraw it; nothing more is allowed until the
+ *  refills have paid that back. */
+class CTokenBucket
+{
+public:
+    int64_t nRate;
+    int64_t nBurst;
+    int64_t nTokens;
+    int64_t nLastRefill; // usec
+
+    CTokenBucket(int64_t nRateIn = 0, int64_t nBurstIn = 0) : nRate(nRateIn), nBurst(nBurstIn), nTokens(nBurstIn), nLastRefill(0) {}
+
+    void Refill(int64_t nNowMicros)
+    {
+        if (nRate == 0 || nNowMicros <= nLastRefill)
+            return;
+        int64_t nElapsed = nNowMicros - nLastRefill;
+        if (nElapsed >= (nBurst - nTokens) * 1000000 / nRate)
+            nTokens = nBurst;
+        else
+        {
+            // Time too short for a whole byte is credited by a later refill
+            int64_t nGain = nElapsed * nRate / 1000000;
+            if (nGain == 0)
+                return;
+            nTokens += nGain;
+        }
+        nLastRefill = nNowMicros;
+    }
+
+    bool CanSpend(int64_t nNowMicros)
+    {
+        Refill(nNowMicros);
+        return nRate == 0 || nTokens > 0;
+    }
+
+    void Spend(int64_t nBytes)
+    {
+        if (nRate != 0)
+            nTokens -= nBytes;
+    }
+
+    // Microseconds until CanSpend() after the last refill
+    int64_t WaitMicros() const
+    {
+        if (nRate == 0 || nTokens > 0)
+            return 0;
+        return (1 - nTokens) * 1000000 / nRate + 1;
+    }
 };
 
 
@@ -191,6 +274,7 @@ public:
     CCriticalSection cs_vSend;
 
     std::deque<CInv> vRecvGetData;
+    std::deque<CInv> vRecvGetDataHistorical;
     std::deque<CNetMessage> vRecvMsg;
     CCriticalSection cs_vRecvMsg;
     uint64_t nRecvBytes;
@@ -235,10 +319,23 @@ public:
     std::set<uint256> setKnown;
 
     // inventory based relay
-    mruset<CInv> setInventoryKnown;
+    CRollingBloomFilter filterInventoryKnown;
     std::vector<CInv> vInventoryToSend;
+    // Transactions wait for the next announcement to this peer, at nNextInvSend (in usec)
+    std::vector<CInv> vInventoryTxToSend;
+    int64_t nNextInvSend;
     CCriticalSection cs_inventory;
     std::multimap<int64_t, CInv> mapAskFor;
+    // Sizes of mapAskFor and setAddrKnown for copyStats(), which cannot read those
+    // containers safely; SendMessages updates them under cs_inventory
+    uint64_t nAskForSize;
+    uint64_t nAddrKnownSize;
+    // Upload of historical blocks: limited by uploadBucket, vRecvGetDataHistorical waits until nGetDataDelayUntil (in usec)
+    CTokenBucket uploadBucket;
+    uint64_t nHistoricalBytesSent;
+    int64_t nGetDataDelayUntil;
+    // Orphans that transactions from this node may have completed, retried by the message handler
+    std::set<uint256> setOrphanWork;
 
     // Ping time measurement:
     // The pong reply we're expecting, or 0 if no pong expected.
@@ -250,7 +347,8 @@ public:
     // Whether a ping is requested.
     bool fPingQueued;
 
-    CNode(SOCKET hSocketIn, CAddress addrIn, std::string addrNameIn = "", bool fInboundIn=false) : ssSend(SER_NETWORK, INIT_PROTO_VERSION), setAddrKnown(5000)
+    CNode(SOCKET hSocketIn, CAddress addrIn, std::string addrNameIn = "", bool fInboundIn=false) : ssSend(SER_NETWORK, INIT_PROTO_VERSION), setAddrKnown(5000),
+        filterInventoryKnown(INVENTORY_KNOWN_MAX, INVENTORY_KNOWN_FP_RATE)
     {
         nServices = 0;
         hSocket = hSocketIn;
@@ -281,7 +379,12 @@ public:
         fStartSync = false;
         fGetAddr = false;
         nMisbehavior = 0;
-        setInventoryKnown.max_size(SendBufferSize() / 1000);
+        nNextInvSend = 0;
+        nAskForSize = 0;
+        nAddrKnownSize = 0;
+        uploadBucket = CTokenBucket(PeerUploadRate(), PeerUploadRate() * PEER_UPLOAD_BURST);
+        nHistoricalBytesSent = 0;
+        nGetDataDelayUntil = 0;
         nPingNonceSent = 0;
         nPingUsecStart = 0;
         nPingUsecTime = 0;
@@ -308,6 +411,11 @@ private:
     static uint64_t nTotalBytesRecv;
     static uint64_t nTotalBytesSent;
 
+    // Upload target, guarded by cs_totalBytesSent
+    static uint64_t nMaxOutboundLimit;
+    static uint64_t nMaxOutboundTotalBytesSentInCycle;
+    static int64_t nMaxOutboundCycleStartTime;
+
     CNode(const CNode&);
     void operator=(const CNode&);
 
@@ -372,19 +480,36 @@ public:
     {
         {
             LOCK(cs_inventory);
-            setInventoryKnown.insert(inv);
+            filterInventoryKnown.insert(inv.hash);
         }
     }
 
+    // requires LOCK(cs_inventory)
+    void QueueInventory(const CInv& inv)
+    {
+        if (filterInventoryKnown.contains(inv.hash))
+            return;
+        if (inv.type == MSG_TX)
+            vInventoryTxToSend.push_back(inv);
+        else
+            vInventoryToSend.push_back(inv);
+    }
+
     void PushInventory(const CInv& inv)
     {
         {
             LOCK(cs_inventory);
-            if (!setInventoryKnown.count(inv))
-                vInventoryToSend.push_back(inv);
+            QueueInventory(inv);
         }
     }
 
+    void PushInventory(const std::vector<CInv>& vInv)
+    {
+        LOCK(cs_inventory);
+        BOOST_FOREACH(const CInv& inv, vInv)
+            QueueInventory(inv);
+    }
+
     void AskFor(const CInv& inv)
     {
         // We're using mapAskFor as a priority queue,
@@ -653,6 +778,14 @@ public:
 
     static uint64_t GetTotalBytesRecv();
     static uint64_t GetTotalBytesSent();
+
+    // Upload target: bytes per MAX_UPLOAD_TIMEFRAME, 0 for none. A new target starts a new cycle.
+    static void SetMaxOutboundTarget(uint64_t nLimit);
+    static uint64_t GetMaxOutboundTarget();
+    // With fHistoricalBlockServingLimit, whether the part of the target not kept for new blocks is used up
+    static bool OutboundTargetReached(bool fHistoricalBlockServingLimit);
+    static uint64_t GetOutboundTargetBytesLeft();
+    static int64_t GetMaxOutboundTimeLeftInCycle();
 };
 
 inline void RelayInventory(const CInv& inv)
@@ -668,6 +801,8 @@ inline void RelayInventory(const CInv& inv)
 class CTransaction;
 void RelayTransaction(const CTransaction& tx, const uint256& hash);
 void RelayTransaction(const CTransaction& tx, const uint256& hash, const CDataStream& ss);
+/** Relay transactions as one inventory, in the order given */
+void RelayTransactions(const std::vector<CTransaction>& vtx);
 
 /** Access to the (IP) address database (peers.dat) */
 class CAddrDB
@@ -13,6 +13,14 @@ using namespace std;
 
 extern void TxToJSON(const CTransaction& tx, const uint256 hashBlock, json_spirit::Object& entry);
 
+CChainTipSnapshotRef GetChainTipSnapshotOrThrow()
+{
+    CChainTipSnapshotRef ptip = GetChainTipSnapshot();
+    if (!ptip)
+        throw JSONRPCError(RPC_CLIENT_IN_INITIAL_DOWNLOAD, "Block index not loaded yet");
+    return ptip;
+}
+
 double GetDifficulty(const CBlockIndex* blockindex)
 {
     // Floating point number that is a multiple of the minimum difficulty,
@@ -103,7 +111,8 @@ double GetPoSKernelPS()
     return result;
 }
 
-Object blockToJSON(const CBlock& block, const CBlockIndex* blockindex, bool fPrintTransactionDetail)
+// Block fields that come before the "tx" array
+static Object BlockHeaderToJSON(const CBlock& block, const CBlockIndex* blockindex)
 {
     Object result;
     result.push_back(Pair("hash", block.GetHash().GetHex()));
@@ -135,7 +144,13 @@ Object blockToJSON(const CBlock& block, const CBlockIndex* blockindex, bool fPri
     result.push_back(Pair("modifier", strprintf("%016x", blockindex->nStakeModifier)));
     result.push_back(Pair("modifierv2", blockindex->bnStakeModifierV2.GetHex()));
 
-    Array txinfo;
+    return result;
+}
+
+// The "tx" array of a block, written to a json_spirit::Array or a CJSONStreamWriter
+template<typename T>
+static void BlockTxToJSON(const CBlock& block, bool fPrintTransactionDetail, T& txinfo)
+{
     BOOST_FOREACH (const CTransaction& tx, block.vtx)
     {
         if (fPrintTransactionDetail)
@@ -150,6 +165,14 @@ Object blockToJSON(const CBlock& block, const CBlockIndex* blockindex, bool fPri
         else
             txinfo.push_back(tx.GetHash().GetHex());
     }
+}
+
+Object blockToJSON(const CBlock& block, const CBlockIndex* blockindex, bool fPrintTransactionDetail)
+{
+    Object result = BlockHeaderToJSON(block, blockindex);
+
+    Array txinfo;
+    BlockTxToJSON(block, fPrintTransactionDetail, txinfo);
 
     result.push_back(Pair("tx", txinfo));
 
@@ -166,7 +189,7 @@ Value getbestblockhash(const Array& params, bool fHelp)
             "getbestblockhash\n"
             "Returns the hash of the best block in the longest block chain.");
 
-    return hashBestChain.GetHex();
+    return GetChainTipSnapshotOrThrow()->hashBlock.GetHex();
 }
 
 Value getblockcount(const Array& params, bool fHelp)
@@ -176,7 +199,7 @@ Value getblockcount(const Array& params, bool fHelp)
             "getblockcount\n"
             "Returns the number of blocks in the longest block chain.");
 
-    return nBestHeight;
+    return GetChainTipSnapshotOrThrow()->nHeight;
 }
 
 
@@ -187,23 +210,73 @@ Value getdifficulty(const Array& params, bool fHelp)
             "getdifficulty\n"
             "Returns the difficulty as a multiple of the minimum difficulty.");
 
+    CChainTipSnapshotRef ptip = GetChainTipSnapshotOrThrow();
+
     Object obj;
-    obj.push_back(Pair("proof-of-work",        GetDifficulty()));
-    obj.push_back(Pair("proof-of-stake",       GetDifficulty(GetLastBlockIndex(pindexBest, true))));
+    obj.push_back(Pair("proof-of-work",        GetDifficulty(ptip->pindexLastPoW)));
+    obj.push_back(Pair("proof-of-stake",       GetDifficulty(ptip->pindexLastPoS)));
     return obj;
 }
 
 
+// What the memory pool recorded about a transaction when it was accepted
+static Object MempoolEntryToJSON(const CTxMemPoolEntry& entry, int nBestHeightIn)
+{
+    Object info;
+    info.push_back(Pair("size", (int)entry.nTxSize));
+    info.push_back(Pair("sigops", (int)entry.nSigOps));
+    info.push_back(Pair("fee", ValueFromAmount(entry.nFee)));
+    info.push_back(Pair("minerfee", ValueFromAmount(entry.GetMinerFee())));
+    info.push_back(Pair("payloadfee", ValueFromAmount(entry.nPayloadFee)));
+    info.push_back(Pair("registerfee", ValueFromAmount(entry.nRegisterFee)));
+    info.push_back(Pair("powdonation", ValueFromAmount(entry.nPowDonation)));
+    info.push_back(Pair("posdonation", ValueFromAmount(entry.nPosDonation)));
+    info.push_back(Pair("valuein", ValueFromAmount(entry.nValueIn)));
+    info.push_back(Pair("time", entry.nTime));
+    info.push_back(Pair("height", entry.nHeight));
+    info.push_back(Pair("startingpriority", entry.GetPriority(entry.nHeight)));
+    info.push_back(Pair("currentpriority", entry.GetPriority(nBestHeightIn)));
+    Array depends;
+    BOOST_FOREACH(const uint256& hash, entry.setParents)
+        depends.push_back(hash.ToString());
+    info.push_back(Pair("depends", depends));
+    Array spentby;
+    BOOST_FOREACH(const uint256& hash, entry.setChildren)
+        spentby.push_back(hash.ToString());
+    info.push_back(Pair("spentby", spentby));
+    return info;
+}
+
 Value getrawmempool(const Array& params, bool fHelp)
 {
-    if (fHelp || params.size() != 0)
+    if (fHelp || params.size() > 1)
         throw runtime_error(
-            "getrawmempool\n"
-            "Returns all transaction ids in memory pool.");
+            "getrawmempool [verbose=false]\n"
+            "Returns all transaction ids in memory pool.\n"
+            "With verbose true, returns an object keyed by transaction id with the size, sigops,\n"
+            "fees, donations, input value, arrival time and height, priorities and the in-pool\n"
+            "parents (depends) and children (spentby) recorded for each transaction.");
+
+    bool fVerbose = false;
+    if (params.size() > 0)
+        fVerbose = params[0].get_bool();
 
     vector<uint256> vtxid;
     mempool.queryHashes(vtxid);
 
+    if (fVerbose)
+    {
+        int nBestHeightNow = nBestHeight;
+        Object o;
+        BOOST_FOREACH(const uint256& hash, vtxid)
+        {
+            CTxMemPoolEntry entry;
+            if (mempool.lookup(hash, entry))
+                o.push_back(Pair(hash.ToString(), MempoolEntryToJSON(entry, nBestHeightNow)));
+        }
+        return o;
+    }
+
     Array a;
     BOOST_FOREACH(const uint256& hash, vtxid)
         a.push_back(hash.ToString());
@@ -211,6 +284,53 @@ Value getrawmempool(const Array& params, bool fHelp)
     return a;
 }
 
+void getrawmempool_stream(const Array& params, CJSONStreamWriter& writer)
+{
+    if (params.size() > 1)
+        getrawmempool(params, true);
+
+    bool fVerbose = false;
+    if (params.size() > 0)
+        fVerbose = params[0].get_bool();
+
+    vector<uint256> vtxid;
+    mempool.queryHashes(vtxid);
+
+    if (fVerbose)
+    {
+        int nBestHeightNow = nBestHeight;
+        writer.beginObject();
+        BOOST_FOREACH(const uint256& hash, vtxid)
+        {
+            CTxMemPoolEntry entry;
+            if (mempool.lookup(hash, entry))
+                writer.pair(hash.ToString(), MempoolEntryToJSON(entry, nBestHeightNow));
+        }
+        writer.endObject();
+        return;
+    }
+
+    writer.beginArray();
+    BOOST_FOREACH(const uint256& hash, vtxid)
+        writer.value(hash.ToString());
+    writer.endArray();
+}
+
+Value savemempool(const Array& params, bool fHelp)
+{
+    if (fHelp || params.size() != 0)
+        throw runtime_error(
+            "savemempool\n"
+            "Writes the memory pool to mempool.dat in the data directory.");
+
+    if (!fMempoolLoaded)
+        throw JSONRPCError(RPC_MISC_ERROR, "The memory pool is still being loaded");
+    if (!DumpMempool())
+        throw JSONRPCError(RPC_MISC_ERROR, "Unable to write mempool.dat");
+
+    return Value::null;
+}
+
 Value getblockhash(const Array& params, bool fHelp)
 {
     if (fHelp || params.size() != 1)
@@ -247,6 +367,40 @@ Value getblock(const Array& params, bool fHelp)
     return blockToJSON(block, pblockindex, params.size() > 1 ? params[1].get_bool() : false);
 }
 
+void getblock_stream(const Array& params, CJSONStreamWriter& writer)
+{
+    if (params.size() < 1 || params.size() > 2)
+        getblock(params, true);
+
+    std::string strHash = params[0].get_str();
+    uint256 hash(strHash);
+
+    // The block and its header fields are read under cs_main, the
+    // transactions are written after it is released
+    CBlock block;
+    Object header;
+    {
+        LOCK(cs_main);
+        if (mapBlockIndex.count(hash) == 0)
+            throw JSONRPCError(RPC_INVALID_ADDRESS_OR_KEY, "Block not found");
+
+        CBlockIndex* pblockindex = mapBlockIndex[hash];
+        block.ReadFromDisk(pblockindex, true);
+        header = BlockHeaderToJSON(block, pblockindex);
+    }
+
+    // Same members as blockToJSON(), one transaction at a time
+    writer.beginObject();
+    writer.members(header);
+    writer.key("tx");
+    writer.beginArray();
+    BlockTxToJSON(block, params.size() > 1 ? params[1].get_bool() : false, writer);
+    writer.endArray();
+    if (block.IsProofOfStake())
+        writer.pair("signature", HexStr(block.vchBlockSig.begin(), block.vchBlockSig.end()));
+    writer.endObject();
+}
+
 Value getblockbynumber(const Array& params, bool fHelp)
 {
     if (fHelp || params.size() < 1 || params.size() > 2)
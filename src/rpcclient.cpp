@@ -118,6 +118,7 @@ static const CRPCConvertParam vRPCConvertParams[] =
     { "listreceivedbyaccount", 1 },
     { "getbalance", 1 },
     { "getblock", 1 },
+    { "getrawmempool", 0 },
     { "getasset", 0 },
     { "getblockbynumber", 0 },
     { "getblockbynumber", 1 },
@@ -142,6 +143,8 @@ static const CRPCConvertParam vRPCConvertParams[] =
     { "sendalert", 6 },
     { "sendmany", 1 },
     { "sendmany", 2 },
+    { "sendassetpayout", 0 },
+    { "sendassetpayout", 1 },
     { "reservebalance", 0 },
     { "reservebalance", 1 },
     { "addmultisigaddress", 0 },
@@ -154,6 +157,7 @@ static const CRPCConvertParam vRPCConvertParams[] =
     { "createrawtransaction", 1 },
     { "signrawtransaction", 1 },
     { "signrawtransaction", 2 },
+    { "sendrawtransactions", 0 },
     { "keypoolrefill", 0 },
     { "importprivkey", 2 },
     { "checkkernel", 0 },
@@ -11,6 +11,7 @@
 #include "init.h"
 #include "miner.h"
 #include "kernel.h"
+#include "workserver.h"
 
 #include <boost/assign/list_of.hpp>
 
@@ -21,7 +22,8 @@ using namespace boost::assign;
 extern volatile bool fEnableMining;
 extern volatile bool fEnableStaking;
 
-// Key used by getwork/getblocktemplate miners.
+// Key used by checkkernel and submitblock for proof-of-stake blocks; getwork, getworkex
+// and getblocktemplate pay the key of the mining template (miner.cpp).
 // Allocated in InitRPCMining, free'd in ShutdownRPCMining
 static CReserveKey* pMiningKey = NULL;
 
@@ -30,12 +32,13 @@ void InitRPCMining()
     if (!pwalletMain)
         return;
 
-    // getwork/getblocktemplate mining rewards paid here:
+    // checkkernel/submitblock staking rewards paid here:
     pMiningKey = new CReserveKey(pwalletMain);
 }
 
 void ShutdownRPCMining()
 {
+    ShutdownMiningTemplate();
     if (!pMiningKey)
         return;
 
@@ -188,6 +191,31 @@ Value getmininginfo(const Array& params, bool fHelp)
     obj.push_back(Pair("errors",         GetWarnings("statusbar")));
     obj.push_back(Pair("pooledtx",       (uint64_t)mempool.size()));
 
+    CMiningTemplateStats stats;
+    GetMiningTemplateStats(stats);
+    Object tmpl;
+    tmpl.push_back(Pair("rebuilds",        stats.nRebuilds));
+    tmpl.push_back(Pair("requests",        stats.nRequests));
+    tmpl.push_back(Pair("age",             stats.nAge));
+    tmpl.push_back(Pair("buildms",         stats.nLastBuildMillis));
+    tmpl.push_back(Pair("tx",              (uint64_t)stats.nTx));
+    tmpl.push_back(Pair("longpollwaiters", stats.nLongPollWaiters));
+    obj.push_back(Pair("template",       tmpl));
+
+    CWorkServerStats workstats;
+    if (GetWorkServerStats(workstats))
+    {
+        Object work;
+        work.push_back(Pair("connections", workstats.nConnections));
+        work.push_back(Pair("notifies",    workstats.nNotifies));
+        work.push_back(Pair("jobs",        workstats.sessions.nJobs));
+        work.push_back(Pair("shares",      workstats.sessions.nShares));
+        work.push_back(Pair("stale",       workstats.sessions.nStale));
+        work.push_back(Pair("rejected",    workstats.sessions.nRejected));
+        work.push_back(Pair("blocks",      workstats.sessions.nBlocks));
+        obj.push_back(Pair("workserver", work));
+    }
+
     weight.push_back(Pair("minimum",     (uint64_t)nWeight));
     weight.push_back(Pair("maximum",     (uint64_t)0));
     weight.push_back(Pair("combined",    (uint64_t)nWeight));
@@ -319,6 +347,54 @@ Value checkkernel(const Array& params, bool fHelp)
     return result;
 }
 
+typedef map<uint256, pair<CBlock*, CScript> > mapNewBlock_t;
+
+typedef vector<pair<CBlock*, int64_t> > vNewBlock_t; // with the time each copy was made
+
+// Work on a superseded template stays valid this long (seconds), well above the
+// time a miner takes to return a solution
+static const int64_t GETWORK_WORK_EXPIRY = 120;
+// Bound on the copies held for one tip, whatever their age
+static const unsigned int GETWORK_BLOCKS_KEPT = 100;
+
+// Our own copy of a new template for getwork(ex), to vary the coinbase of. All copies go
+// when the tip changes. Otherwise a copy goes, with the work handed out on it, once it
+// was superseded more than GETWORK_WORK_EXPIRY seconds ago or more than
+// GETWORK_BLOCKS_KEPT are held.
+static CBlock* NewGetWorkBlock(const CBlock& blockTemplate, bool fNewTip, mapNewBlock_t& mapNewBlock, vNewBlock_t& vNewBlock)
+{
+    int64_t nNow = GetTime();
+    if (fNewTip)
+    {
+        // Deallocate old blocks since they're obsolete now
+        mapNewBlock.clear();
+        BOOST_FOREACH(const PAIRTYPE(CBlock*, int64_t)& item, vNewBlock)
+            delete item.first;
+        vNewBlock.clear();
+    }
+    // The copy after the oldest was made when the oldest was superseded; the
+    // newest one is superseded just now
+    while (vNewBlock.size() >= GETWORK_BLOCKS_KEPT ||
+           (vNewBlock.size() > 1 && vNewBlock[1].second < nNow - GETWORK_WORK_EXPIRY))
+    {
+        CBlock* pblockOld = vNewBlock.front().first;
+        vNewBlock.erase(vNewBlock.begin());
+        mapNewBlock_t::iterator it = mapNewBlock.begin();
+        while (it != mapNewBlock.end())
+        {
+            if (it->second.first == pblockOld)
+                mapNewBlock.erase(it++);
+            else
+                ++it;
+        }
+        delete pblockOld;
+    }
+
+    CBlock* pblock = new CBlock(blockTemplate);
+    vNewBlock.push_back(make_pair(pblock, nNow));
+    return pblock;
+}
+
 Value getworkex(const Array& params, bool fHelp)
 {
     if (fHelp || params.size() > 2)
@@ -336,37 +412,23 @@ Value getworkex(const Array& params, bool fHelp)
     //if (pindexBest->nHeight >= Params().LastPOWBlock())
     //    throw JSONRPCError(RPC_MISC_ERROR, "No more PoW blocks");
 
-    typedef map<uint256, pair<CBlock*, CScript> > mapNewBlock_t;
     static mapNewBlock_t mapNewBlock;
-    static vector<CBlock*> vNewBlock;
+    static vNewBlock_t vNewBlock;
 
     if (params.size() == 0)
     {
         // Update block
-        static unsigned int nTransactionsUpdatedLast;
+        static CMiningTemplateRef ptemplate;
         static CBlockIndex* pindexPrev;
-        static int64_t nStart;
         static CBlock* pblock;
-        if (pindexPrev != pindexBest ||
-            (mempool.GetTransactionsUpdated() != nTransactionsUpdatedLast && GetTime() - nStart > 60))
+        CMiningTemplateRef ptemplateNew = GetMiningTemplate();
+        if (!ptemplateNew)
+            throw JSONRPCError(-7, "Out of memory");
+        if (ptemplateNew != ptemplate)
         {
-            if (pindexPrev != pindexBest)
-            {
-                // Deallocate old blocks since they're obsolete now
-                mapNewBlock.clear();
-                BOOST_FOREACH(CBlock* pblock, vNewBlock)
-                    delete pblock;
-                vNewBlock.clear();
-            }
-            nTransactionsUpdatedLast = mempool.GetTransactionsUpdated();
+            pblock = NewGetWorkBlock(ptemplateNew->block, pindexPrev != pindexBest, mapNewBlock, vNewBlock);
+            ptemplate = ptemplateNew;
             pindexPrev = pindexBest;
-            nStart = GetTime();
-
-            // Create new block
-            pblock = CreateNewBlock(*pMiningKey);
-            if (!pblock)
-                throw JSONRPCError(-7, "Out of memory");
-            vNewBlock.push_back(pblock);
         }
 
         // Update nTime
@@ -430,7 +492,10 @@ Value getworkex(const Array& params, bool fHelp)
 
         // Get saved block
         if (!mapNewBlock.count(pdata->hashMerkleRoot))
+        {
+            LogPrintf("getworkex : stale or unknown work submitted, merkle root %s\n", pdata->hashMerkleRoot.ToString());
             return false;
+        }
         CBlock* pblock = mapNewBlock[pdata->hashMerkleRoot].first;
 
         pblock->nTime = pdata->nTime;
@@ -443,8 +508,7 @@ Value getworkex(const Array& params, bool fHelp)
 
         pblock->hashMerkleRoot = pblock->BuildMerkleTree();
 
-        assert(pwalletMain != NULL);
-        return CheckWork(pblock, *pwalletMain, *pMiningKey);
+        return CheckMiningTemplateWork(pblock);
     }
 }
 
@@ -470,45 +534,23 @@ Value getwork(const Array& params, bool fHelp)
     //if (pindexBest->nHeight >= Params().LastPOWBlock())
     //    throw JSONRPCError(RPC_MISC_ERROR, "No more PoW blocks");
 
-    typedef map<uint256, pair<CBlock*, CScript> > mapNewBlock_t;
     static mapNewBlock_t mapNewBlock;    // FIXME: thread safety
-    static vector<CBlock*> vNewBlock;
+    static vNewBlock_t vNewBlock;
 
     if (params.size() == 0)
     {
         // Update block
-        static unsigned int nTransactionsUpdatedLast;
+        static CMiningTemplateRef ptemplate;
         static CBlockIndex* pindexPrev;
-        static int64_t nStart;
         static CBlock* pblock;
-        if (pindexPrev != pindexBest ||
-            (mempool.GetTransactionsUpdated() != nTransactionsUpdatedLast && GetTime() - nStart > 60))
+        CMiningTemplateRef ptemplateNew = GetMiningTemplate();
+        if (!ptemplateNew)
+            throw JSONRPCError(RPC_OUT_OF_MEMORY, "Out of memory");
+        if (ptemplateNew != ptemplate)
         {
-            if (pindexPrev != pindexBest)
-            {
-                // Deallocate old blocks since they're obsolete now
-                mapNewBlock.clear();
-                BOOST_FOREACH(CBlock* pblock, vNewBlock)
-                    delete pblock;
-                vNewBlock.clear();
-            }
-
-            // Clear pindexPrev so future getworks make a new block, despite any failures from here on
-            pindexPrev = NULL;
-
-            // Store the pindexBest used before CreateNewBlock, to avoid races
-            nTransactionsUpdatedLast = mempool.GetTransactionsUpdated();
-            CBlockIndex* pindexPrevNew = pindexBest;
-            nStart = GetTime();
-
-            // Create new block
-            pblock = CreateNewBlock(*pMiningKey);
-            if (!pblock)
-                throw JSONRPCError(RPC_OUT_OF_MEMORY, "Out of memory");
-            vNewBlock.push_back(pblock);
-
-            // Need to update only after we know CreateNewBlock succeeded
-            pindexPrev = pindexPrevNew;
+            pblock = NewGetWorkBlock(ptemplateNew->block, pindexPrev != pindexBest, mapNewBlock, vNewBlock);
+            ptemplate = ptemplateNew;
+            pindexPrev = pindexBest;
         }
 
         // Update nTime
@@ -551,7 +593,10 @@ Value getwork(const Array& params, bool fHelp)
 
         // Get saved block
         if (!mapNewBlock.count(pdata->hashMerkleRoot))
+        {
+            LogPrintf("getwork : stale or unknown work submitted, merkle root %s\n", pdata->hashMerkleRoot.ToString());
             return false;
+        }
         CBlock* pblock = mapNewBlock[pdata->hashMerkleRoot].first;
 
         pblock->nTime = pdata->nTime;
@@ -559,8 +604,7 @@ Value getwork(const Array& params, bool fHelp)
         pblock->vtx[0].vin[0].scriptSig = mapNewBlock[pdata->hashMerkleRoot].second;
         pblock->hashMerkleRoot = pblock->BuildMerkleTree();
 
-        assert(pwalletMain != NULL);
-        return CheckWork(pblock, *pwalletMain, *pMiningKey);
+        return CheckMiningTemplateWork(pblock);
     }
 }
 
@@ -585,9 +629,11 @@ Value getblocktemplate(const Array& params, bool fHelp)
             "  \"sizelimit\" : limit of block size\n"
             "  \"bits\" : compressed target of next block\n"
             "  \"height\" : height of the next block\n"
+            "  \"longpollid\" : pass back as \"longpollid\" to wait for the next template\n"
             "See https://en.bitcoin.it/wiki/BIP_0022 for full specification.");
 
     std::string strMode = "template";
+    Value lpval = Value::null;
     if (params.size() > 0)
     {
         const Object& oparam = params[0].get_obj();
@@ -600,6 +646,7 @@ Value getblocktemplate(const Array& params, bool fHelp)
         }
         else
             throw JSONRPCError(RPC_INVALID_PARAMETER, "Invalid mode");
+        lpval = find_value(oparam, "longpollid");
     }
 
     if (strMode != "template")
@@ -614,81 +661,81 @@ Value getblocktemplate(const Array& params, bool fHelp)
     //if (pindexBest->nHeight >= Params().LastPOWBlock())
     //    throw JSONRPCError(RPC_MISC_ERROR, "No more PoW blocks");
 
-    // Update block
-    static unsigned int nTransactionsUpdatedLast;
-    static CBlockIndex* pindexPrev;
-    static int64_t nStart;
-    static CBlock* pblock;
-    if (pindexPrev != pindexBest ||
-        (mempool.GetTransactionsUpdated() != nTransactionsUpdatedLast && GetTime() - nStart > 5))
+    if (lpval.type() == str_type)
     {
-        // Clear pindexPrev so future calls make a new block, despite any failures from here on
-        pindexPrev = NULL;
-
-        // Store the pindexBest used before CreateNewBlock, to avoid races
-        nTransactionsUpdatedLast = mempool.GetTransactionsUpdated();
-        CBlockIndex* pindexPrevNew = pindexBest;
-        nStart = GetTime();
-
-        // Create new block
-        if(pblock)
-        {
-            delete pblock;
-            pblock = NULL;
-        }
-        pblock = CreateNewBlock(*pMiningKey);
-        if (!pblock)
-            throw JSONRPCError(RPC_OUT_OF_MEMORY, "Out of memory");
-
-        // Need to update only after we know CreateNewBlock succeeded
-        pindexPrev = pindexPrevNew;
+        // Long poll: the id is the tip and memory pool generation the caller's template came from
+        const std::string& lpstr = lpval.get_str();
+        if (lpstr.size() < 64)
+            throw JSONRPCError(RPC_INVALID_PARAMETER, "Invalid longpollid");
+        uint256 hashWatchedChain(lpstr.substr(0, 64));
+        unsigned int nTransactionsUpdatedWatched = atoi64(lpstr.substr(64));
+
+        // Wait without cs_main, so blocks and transactions can still arrive
+        if (!WaitForMiningTemplate(hashWatchedChain, nTransactionsUpdatedWatched))
+            throw JSONRPCError(RPC_CLIENT_NOT_CONNECTED, "Shutting down");
     }
+    else if (lpval.type() != null_type)
+        throw JSONRPCError(RPC_INVALID_PARAMETER, "Invalid longpollid");
 
-    // Update nTime
-    pblock->UpdateTime(pindexPrev);
-    pblock->nNonce = 0;
+    LOCK(cs_main);
+    if (!pwalletMain)
+        throw JSONRPCError(RPC_WALLET_ERROR, "Wallet disabled");
 
-    Array transactions;
-    map<uint256, int64_t> setTxIndex;
-    int i = 0;
-    CTxDB txdb("r");
-    BOOST_FOREACH (CTransaction& tx, pblock->vtx)
+    // Update block
+    CMiningTemplateRef ptemplate = GetMiningTemplate();
+    if (!ptemplate)
+        throw JSONRPCError(RPC_OUT_OF_MEMORY, "Out of memory");
+    const CBlock* pblock = &ptemplate->block;
+    const CBlockIndex* pindexPrev = ptemplate->pindexPrev;
+
+    // The transaction list is the same for everyone served from one template (guarded by cs_main)
+    static CMiningTemplateRef ptemplateTransactions;
+    static Array transactions;
+    if (ptemplateTransactions != ptemplate)
     {
-        uint256 txHash = tx.GetHash();
-        setTxIndex[txHash] = i++;
+        transactions.clear();
+        map<uint256, int64_t> setTxIndex;
+        int i = 0;
+        CTxDB txdb("r");
+        BOOST_FOREACH (CTransaction tx, pblock->vtx)
+        {
+            uint256 txHash = tx.GetHash();
+            setTxIndex[txHash] = i++;
 
-        if (tx.IsCoinBase() || tx.IsCoinStake())
-            continue;
+            if (tx.IsCoinBase() || tx.IsCoinStake())
+                continue;
 
-        Object entry;
+            Object entry;
 
-        CDataStream ssTx(SER_NETWORK, PROTOCOL_VERSION);
-        ssTx << tx;
-        entry.push_back(Pair("data", HexStr(ssTx.begin(), ssTx.end())));
+            CDataStream ssTx(SER_NETWORK, PROTOCOL_VERSION);
+            ssTx << tx;
+            entry.push_back(Pair("data", HexStr(ssTx.begin(), ssTx.end())));
 
-        entry.push_back(Pair("hash", txHash.GetHex()));
+            entry.push_back(Pair("hash", txHash.GetHex()));
 
-        MapPrevTx mapInputs;
-        map<uint256, CTxIndex> mapUnused;
-        bool fInvalid = false;
-        if (tx.FetchInputs(txdb, mapUnused, false, false, mapInputs, fInvalid))
-        {
-            entry.push_back(Pair("fee", (int64_t)(tx.GetValueIn(0,mapInputs) - tx.GetValueOut(0))));
-
-            Array deps;
-            BOOST_FOREACH (MapPrevTx::value_type& inp, mapInputs)
+            MapPrevTx mapInputs;
+            map<uint256, CTxIndex> mapUnused;
+            bool fInvalid = false;
+            if (tx.FetchInputs(txdb, mapUnused, false, false, mapInputs, fInvalid))
             {
-                if (setTxIndex.count(inp.first))
-                    deps.push_back(setTxIndex[inp.first]);
+                entry.push_back(Pair("fee", (int64_t)(tx.GetValueIn(0,mapInputs) - tx.GetValueOut(0))));
+
+                Array deps;
+                BOOST_FOREACH (MapPrevTx::value_type& inp, mapInputs)
+                {
+                    if (setTxIndex.count(inp.first))
+                        deps.push_back(setTxIndex[inp.first]);
+                }
+                entry.push_back(Pair("depends", deps));
+
+                int64_t nSigOps = GetLegacySigOpCount(tx);
+                nSigOps += GetP2SHSigOpCount(tx, mapInputs);
+                entry.push_back(Pair("sigops", nSigOps));
             }
-            entry.push_back(Pair("depends", deps));
 
-            int64_t nSigOps = GetLegacySigOpCount(tx);
-            nSigOps += GetP2SHSigOpCount(tx, mapInputs);
-            entry.push_back(Pair("sigops", nSigOps));
+            transactions.push_back(entry);
         }
-
-        transactions.push_back(entry);
+        ptemplateTransactions = ptemplate;
     }
 
     Object aux;
@@ -716,9 +763,10 @@ Value getblocktemplate(const Array& params, bool fHelp)
     result.push_back(Pair("noncerange", "00000000ffffffff"));
     result.push_back(Pair("sigoplimit", (int64_t)MAX_BLOCK_SIGOPS));
     result.push_back(Pair("sizelimit", (int64_t)MAX_BLOCK_SIZE));
-    result.push_back(Pair("curtime", (int64_t)pblock->nTime));
+    result.push_back(Pair("curtime", max((int64_t)pblock->GetBlockTime(), GetAdjustedTime())));
     result.push_back(Pair("bits", strprintf("%08x", pblock->nBits)));
     result.push_back(Pair("height", (int64_t)(pindexPrev->nHeight+1)));
+    result.push_back(Pair("longpollid", pindexPrev->GetBlockHash().GetHex() + i64tostr(ptemplate->nTransactionsUpdated)));
 
     return result;
 }
@@ -37,6 +37,11 @@ Value getinfo(const Array& params, bool fHelp)
     proxyType proxy;
     GetProxy(NET_IPV4, proxy);
 
+    // Chain state comes from the published snapshot, as for getblockcount.
+    // getinfo still runs under cs_main: the wallet totals below need the
+    // depth of every wallet transaction.
+    CChainTipSnapshotRef ptip = GetChainTipSnapshotOrThrow();
+
     Object obj, diff;
     obj.push_back(Pair("version",       FormatFullVersion()));
     obj.push_back(Pair("protocolversion",(int)PROTOCOL_VERSION));
@@ -48,26 +53,27 @@ Value getinfo(const Array& params, bool fHelp)
         obj.push_back(Pair("stake",         ValueFromAmount(pwalletMain->GetStake())));
     }
 #endif
-    obj.push_back(Pair("blocks",        (int)nBestHeight));
-    obj.push_back(Pair("powblocks",     (int)pindexBest->nPowHeight));
-    obj.push_back(Pair("posblocks",     (int)(nBestHeight-pindexBest->nPowHeight)));
+    obj.push_back(Pair("blocks",        (int)ptip->nHeight));
+    obj.push_back(Pair("powblocks",     (int)ptip->nPowHeight));
+    obj.push_back(Pair("posblocks",     (int)(ptip->nHeight-ptip->nPowHeight)));
     obj.push_back(Pair("timeoffset",    (int64_t)GetTimeOffset()));
-    obj.push_back(Pair("assettypes",     (int)pindexBest->nAssetTypeCount));
-    obj.push_back(Pair("mint",               ValueFromAmount(pindexBest->nMint)));   // icochain: 激励池
-    obj.push_back(Pair("powincentivepool",   ValueFromAmount(pindexBest->nPowIncentivePool)));
-    obj.push_back(Pair("posincentivepool",   ValueFromAmount(pindexBest->nPosIncentivePool)));
-    obj.push_back(Pair("moneysupply",   ValueFromAmount(pindexBest->nMoneySupply)));
+    obj.push_back(Pair("assettypes",     (int)ptip->nAssetTypeCount));
+    obj.push_back(Pair("mint",               ValueFromAmount(ptip->nMint)));   // icochain: 激励池
+    obj.push_back(Pair("powincentivepool",   ValueFromAmount(ptip->nPowIncentivePool)));
+    obj.push_back(Pair("posincentivepool",   ValueFromAmount(ptip->nPosIncentivePool)));
+    obj.push_back(Pair("moneysupply",   ValueFromAmount(ptip->nMoneySupply)));
     obj.push_back(Pair("connections",   (int)vNodes.size()));
     obj.push_back(Pair("proxy",         (proxy.IsValid() ? proxy.ToStringIPPort() : string())));
     obj.push_back(Pair("ip",            GetLocalAddress(NULL).ToStringIP()));
 
-    diff.push_back(Pair("proof-of-work",  GetDifficulty()));
-    diff.push_back(Pair("proof-of-stake", GetDifficulty(GetLastBlockIndex(pindexBest, true))));
+    diff.push_back(Pair("proof-of-work",  GetDifficulty(ptip->pindexLastPoW)));
+    diff.push_back(Pair("proof-of-stake", GetDifficulty(ptip->pindexLastPoS)));
     obj.push_back(Pair("difficulty",    diff));
 
     obj.push_back(Pair("testnet",       TestNet()));
 #ifdef ENABLE_WALLET
     if (pwalletMain) {
+        LOCK(pwalletMain->cs_wallet);
         obj.push_back(Pair("keypoololdest", (int64_t)pwalletMain->GetOldestKeyPoolTime()));
         obj.push_back(Pair("keypoolsize",   (int)pwalletMain->GetKeyPoolSize()));
     }
@@ -75,6 +81,28 @@ Value getinfo(const Array& params, bool fHelp)
     obj.push_back(Pair("mininput",      ValueFromAmount(nMinimumInputValue)));
     if (pwalletMain && pwalletMain->IsCrypted())
         obj.push_back(Pair("unlocked_until", (int64_t)nWalletUnlockTime));
+    if (pwalletMain) {
+        // How often the wallet filter spared IsMine() and mapWallet searches
+        CWalletMineFilterStats stats = pwalletMain->mineFilter.GetStats();
+        Object filter;
+        filter.push_back(Pair("keys",           (uint64_t)stats.nKeys));
+        filter.push_back(Pair("scripts",        (uint64_t)stats.nScripts));
+        filter.push_back(Pair("coins",          (uint64_t)stats.nCoins));
+        filter.push_back(Pair("outputchecks",   stats.nOutputChecks));
+        filter.push_back(Pair("outputsrejected", stats.nOutputsRejected));
+        filter.push_back(Pair("falsepositives", stats.nFalsePositives));
+        filter.push_back(Pair("inputchecks",    stats.nInputChecks));
+        filter.push_back(Pair("inputsrejected", stats.nInputsRejected));
+        obj.push_back(Pair("isminefilter",  filter));
+
+        uint64_t nQueued, nApplied, nOverflows;
+        GetWalletQueueStats(nQueued, nApplied, nOverflows);
+        Object queue;
+        queue.push_back(Pair("queued",          nQueued));
+        queue.push_back(Pair("pending",         nQueued - nApplied));
+        queue.push_back(Pair("overflows",       nOverflows));
+        obj.push_back(Pair("walletqueue",   queue));
+    }
 #endif
     obj.push_back(Pair("errors",        GetWarnings("statusbar")));
     return obj;
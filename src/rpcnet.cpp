@@ -66,7 +66,10 @@ Value getpeerinfo(const Array& params, bool fHelp)
     if (fHelp || params.size() != 0)
         throw runtime_error(
             "getpeerinfo\n"
-            "Returns data about each connected network node.");
+            "Returns data about each connected network node.\n"
+            "relaymem estimates the bytes held to relay to the node.\n"
+            "uploadtokens are the bytes of historical blocks the node can be sent now at its\n"
+            "uploadrate (bytes per second), shown with -maxpeeruploadrate.");
 
     vector<CNodeStats> vstats;
     CopyNodeStats(vstats);
@@ -96,6 +99,19 @@ Value getpeerinfo(const Array& params, bool fHelp)
         obj.push_back(Pair("banscore", stats.nMisbehavior));
         obj.push_back(Pair("syncnode", stats.fSyncNode));
 
+        Object relaymem;
+        relaymem.push_back(Pair("inventoryknown", (int64_t)stats.nInvKnownMem));
+        relaymem.push_back(Pair("inventoryqueue", (int64_t)stats.nInvQueueMem));
+        relaymem.push_back(Pair("askfor", (int64_t)stats.nAskForMem));
+        relaymem.push_back(Pair("addrknown", (int64_t)stats.nAddrKnownMem));
+        obj.push_back(Pair("relaymem", relaymem));
+        obj.push_back(Pair("historicalbytessent", (int64_t)stats.nHistoricalBytesSent));
+        if (stats.nUploadRate > 0)
+        {
+            obj.push_back(Pair("uploadrate", stats.nUploadRate));
+            obj.push_back(Pair("uploadtokens", stats.nUploadTokens));
+        }
+
         ret.push_back(obj);
     }
 
@@ -305,11 +321,20 @@ Value getnettotals(const Array& params, bool fHelp)
         throw runtime_error(
             "getnettotals\n"
             "Returns information about network traffic, including bytes in, bytes out,\n"
-            "and current time.");
+            "current time and the state of the -maxuploadtarget cycle.");
 
     Object obj;
     obj.push_back(Pair("totalbytesrecv", CNode::GetTotalBytesRecv()));
     obj.push_back(Pair("totalbytessent", CNode::GetTotalBytesSent()));
     obj.push_back(Pair("timemillis", GetTimeMillis()));
+
+    Object uploadTarget;
+    uploadTarget.push_back(Pair("timeframe", MAX_UPLOAD_TIMEFRAME));
+    uploadTarget.push_back(Pair("target", CNode::GetMaxOutboundTarget()));
+    uploadTarget.push_back(Pair("targetreached", CNode::OutboundTargetReached(false)));
+    uploadTarget.push_back(Pair("servehistoricalblocks", !CNode::OutboundTargetReached(true)));
+    uploadTarget.push_back(Pair("bytesleftincycle", CNode::GetOutboundTargetBytesLeft()));
+    uploadTarget.push_back(Pair("timeleftincycle", CNode::GetMaxOutboundTimeLeftInCycle()));
+    obj.push_back(Pair("uploadtarget", uploadTarget));
     return obj;
 }
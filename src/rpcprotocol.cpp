@@ -55,6 +55,16 @@ static string rfc1123Time()
     return DateTimeStrFormat("%a, %d %b %Y %H:%M:%S +0000", GetTime());
 }
 
+static const char* HTTPStatusString(int nStatus)
+{
+    if (nStatus == HTTP_OK) return "OK";
+    if (nStatus == HTTP_BAD_REQUEST) return "Bad Request";
+    if (nStatus == HTTP_FORBIDDEN) return "Forbidden";
+    if (nStatus == HTTP_NOT_FOUND) return "Not Found";
+    if (nStatus == HTTP_INTERNAL_SERVER_ERROR) return "Internal Server Error";
+    return "";
+}
+
 string HTTPReply(int nStatus, const string& strMsg, bool keepalive)
 {
     if (nStatus == HTTP_UNAUTHORIZED)
@@ -74,13 +84,6 @@ string HTTPReply(int nStatus, const string& strMsg, bool keepalive)
             "</HEAD>\r\n"
             "<BODY><H1>401 Unauthorized.</H1></BODY>\r\n"
             "</HTML>\r\n", rfc1123Time(), FormatFullVersion());
-    const char *cStatus;
-         if (nStatus == HTTP_OK) cStatus = "OK";
-    else if (nStatus == HTTP_BAD_REQUEST) cStatus = "Bad Request";
-    else if (nStatus == HTTP_FORBIDDEN) cStatus = "Forbidden";
-    else if (nStatus == HTTP_NOT_FOUND) cStatus = "Not Found";
-    else if (nStatus == HTTP_INTERNAL_SERVER_ERROR) cStatus = "Internal Server Error";
-    else cStatus = "";
     return strprintf(
             "HTTP/1.1 %d %s\r\n"
             "Date: %s\r\n"
@@ -91,7 +94,7 @@ string HTTPReply(int nStatus, const string& strMsg, bool keepalive)
             "\r\n"
             "%s",
         nStatus,
-        cStatus,
+        HTTPStatusString(nStatus),
         rfc1123Time(),
         keepalive ? "keep-alive" : "close",
         strMsg.size(),
@@ -99,6 +102,69 @@ string HTTPReply(int nStatus, const string& strMsg, bool keepalive)
         strMsg);
 }
 
+string HTTPReplyChunkedHeader(int nStatus, bool keepalive)
+{
+    return strprintf(
+            "HTTP/1.1 %d %s\r\n"
+            "Date: %s\r\n"
+            "Connection: %s\r\n"
+            "Transfer-Encoding: chunked\r\n"
+            "Content-Type: application/json\r\n"
+            "Server: Icochain-json-rpc/%s\r\n"
+            "\r\n",
+        nStatus,
+        HTTPStatusString(nStatus),
+        rfc1123Time(),
+        keepalive ? "keep-alive" : "close",
+        FormatFullVersion());
+}
+
+CHTTPChunkedStreambuf::CHTTPChunkedStreambuf(std::ostream& streamIn, const string& strHeaderIn, size_t nChunkSize) :
+    stream(streamIn), strHeader(strHeaderIn), vBuffer(nChunkSize), fStarted(false)
+{
+    setp(&vBuffer[0], &vBuffer[0] + vBuffer.size());
+}
+
+void CHTTPChunkedStreambuf::SendChunk()
+{
+    size_t nSize = pptr() - pbase();
+    if (nSize == 0)
+        return;
+    if (!fStarted)
+    {
+        stream << strHeader;
+        fStarted = true;
+    }
+    stream << strprintf("%x\r\n", nSize);
+    stream.write(pbase(), nSize);
+    stream << "\r\n";
+    if (!stream)
+        throw runtime_error("CHTTPChunkedStreambuf : connection lost");
+    setp(&vBuffer[0], &vBuffer[0] + vBuffer.size());
+}
+
+CHTTPChunkedStreambuf::int_type CHTTPChunkedStreambuf::overflow(int_type c)
+{
+    SendChunk();
+    if (!traits_type::eq_int_type(c, traits_type::eof()))
+    {
+        *pptr() = traits_type::to_char_type(c);
+        pbump(1);
+    }
+    return traits_type::not_eof(c);
+}
+
+void CHTTPChunkedStreambuf::finish()
+{
+    SendChunk();
+    if (!fStarted)
+    {
+        stream << strHeader;
+        fStarted = true;
+    }
+    stream << "0\r\n\r\n" << std::flush;
+}
+
 bool ReadHTTPRequestLine(std::basic_istream<char>& stream, int &proto,
                          string& http_method, string& http_uri)
 {
@@ -175,6 +241,37 @@ int ReadHTTPHeaders(std::basic_istream<char>& stream, map<string, string>& mapHe
 }
 
 
+static bool ReadHTTPChunkedBody(std::basic_istream<char>& stream, string& strMessageRet)
+{
+    while (true)
+    {
+        // chunk-size [; chunk-extension] CRLF
+        string str;
+        std::getline(stream, str);
+        if (!stream)
+            return false;
+        unsigned int nChunk = 0;
+        if (sscanf(str.c_str(), "%x", &nChunk) != 1)
+            return false;
+        if (nChunk == 0)
+            break;
+        if (nChunk > MAX_SIZE || strMessageRet.size() + nChunk > MAX_SIZE)
+            return false;
+
+        size_t nPos = strMessageRet.size();
+        strMessageRet.resize(nPos + nChunk);
+        stream.read(&strMessageRet[nPos], nChunk);
+        std::getline(stream, str); // CRLF after the chunk data
+        if (!stream)
+            return false;
+    }
+
+    // Skip trailer headers up to the final empty line
+    map<string, string> mapTrailers;
+    ReadHTTPHeaders(stream, mapTrailers);
+    return true;
+}
+
 int ReadHTTPMessage(std::basic_istream<char>& stream, map<string,
                     string>& mapHeadersRet, string& strMessageRet,
                     int nProto)
@@ -188,7 +285,12 @@ int ReadHTTPMessage(std::basic_istream<char>& stream, map<string,
         return HTTP_INTERNAL_SERVER_ERROR;
 
     // Read message
-    if (nLen > 0)
+    if (mapHeadersRet["transfer-encoding"] == "chunked")
+    {
+        if (!ReadHTTPChunkedBody(stream, strMessageRet))
+            return HTTP_INTERNAL_SERVER_ERROR;
+    }
+    else if (nLen > 0)
     {
         vector<char> vch(nLen);
         stream.read(&vch[0], nLen);
@@ -252,3 +354,69 @@ Object JSONRPCError(int code, const string& message)
     error.push_back(Pair("message", message));
     return error;
 }
+
+//
+// Streaming JSON output
+//
+
+void CJSONStreamWriter::separator()
+{
+    if (fAfterKey)
+    {
+        fAfterKey = false;
+        return;
+    }
+    if (!vEmpty.empty())
+    {
+        if (!vEmpty.back())
+            stream << ',';
+        vEmpty.back() = false;
+    }
+}
+
+void CJSONStreamWriter::beginObject()
+{
+    separator();
+    stream << '{';
+    vEmpty.push_back(true);
+}
+
+void CJSONStreamWriter::endObject()
+{
+    assert(!vEmpty.empty() && !fAfterKey);
+    vEmpty.pop_back();
+    stream << '}';
+}
+
+void CJSONStreamWriter::beginArray()
+{
+    separator();
+    stream << '[';
+    vEmpty.push_back(true);
+}
+
+void CJSONStreamWriter::endArray()
+{
+    assert(!vEmpty.empty() && !fAfterKey);
+    vEmpty.pop_back();
+    stream << ']';
+}
+
+void CJSONStreamWriter::key(const string& strKey)
+{
+    separator();
+    stream << '"' << add_esc_chars(strKey) << "\":";
+    fAfterKey = true;
+}
+
+void CJSONStreamWriter::value(const Value& val)
+{
+    separator();
+    write_stream(val, stream, false);
+}
+
+void CJSONStreamWriter::members(const Object& obj)
+{
+    BOOST_FOREACH(const Pair& p, obj)
+        pair(p.name_, p.value_);
+}
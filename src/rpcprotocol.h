@@ -11,7 +11,9 @@
 #include <list>
 #include <map>
 #include <stdint.h>
+#include <streambuf>
 #include <string>
+#include <vector>
 #include <boost/iostreams/concepts.hpp>
 #include <boost/iostreams/stream.hpp>
 #include <boost/asio.hpp>
@@ -125,8 +127,69 @@ private:
     boost::asio::ssl::stream<typename Protocol::socket>& stream;
 };
 
+/** Output stream buffer that sends everything written to it as the body of
+ *  a chunked HTTP/1.1 reply. Data is sent in pieces of nChunkSize bytes, and
+ *  the status line and headers (strHeader) only go out with the first piece.
+ *  Until started() is true nothing has reached the client, so the caller can
+ *  still discard the output and send an ordinary reply instead.
+ */
+class CHTTPChunkedStreambuf : public std::streambuf
+{
+public:
+    CHTTPChunkedStreambuf(std::ostream& streamIn, const std::string& strHeaderIn, size_t nChunkSize = 64 * 1024);
+
+    bool started() const { return fStarted; }
+
+    // Send any buffered data followed by the terminating zero-length chunk
+    void finish();
+
+protected:
+    int_type overflow(int_type c);
+
+private:
+    std::ostream& stream;
+    std::string strHeader;
+    std::vector<char> vBuffer;
+    bool fStarted;
+
+    void SendChunk();
+};
+
+/** Writes JSON text to an output stream as it is produced, so large results
+ *  never have to exist as a json_spirit tree or a single string. The output is
+ *  identical to json_spirit's compact write_string().
+ */
+class CJSONStreamWriter
+{
+public:
+    explicit CJSONStreamWriter(std::ostream& streamIn) : stream(streamIn), fAfterKey(false) {}
+
+    void beginObject();
+    void endObject();
+    void beginArray();
+    void endArray();
+
+    // Name of the next member of the current object
+    void key(const std::string& strKey);
+    void value(const json_spirit::Value& val);
+    void pair(const std::string& strKey, const json_spirit::Value& val) { key(strKey); value(val); }
+    // Write all members of obj into the current object
+    void members(const json_spirit::Object& obj);
+
+    // Lets code that fills a json_spirit::Array write array elements directly
+    void push_back(const json_spirit::Value& val) { value(val); }
+
+private:
+    std::ostream& stream;
+    std::vector<bool> vEmpty; // for each open object/array: nothing written yet
+    bool fAfterKey;
+
+    void separator();
+};
+
 std::string HTTPPost(const std::string& strMsg, const std::map<std::string,std::string>& mapRequestHeaders);
 std::string HTTPReply(int nStatus, const std::string& strMsg, bool keepalive);
+std::string HTTPReplyChunkedHeader(int nStatus, bool keepalive);
 bool ReadHTTPRequestLine(std::basic_istream<char>& stream, int &proto,
                          std::string& http_method, std::string& http_uri);
 int ReadHTTPStatus(std::basic_istream<char>& stream, int &proto);
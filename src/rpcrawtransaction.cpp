@@ -194,28 +194,18 @@ Value getrawtransaction(const Array& params, bool fHelp)
 }
 
 #ifdef ENABLE_WALLET
-Value listunspent(const Array& params, bool fHelp)
+static void ListUnspentParams(const Array& params, int& nMinDepth, int& nMaxDepth, set<CBitcoinAddress>& setAddress)
 {
-    if (fHelp || params.size() > 3)
-        throw runtime_error(
-            "listunspent [minconf=1] [maxconf=9999999]  [\"address\",...]\n"
-            "Returns array of unspent transaction outputs\n"
-            "with between minconf and maxconf (inclusive) confirmations.\n"
-            "Optionally filtered to only include txouts paid to specified addresses.\n"
-            "Results are an array of Objects, each of which has:\n"
-            "{txid, vout, scriptPubKey, amount, confirmations}");
-
     RPCTypeCheck(params, list_of(int_type)(int_type)(array_type));
 
-    int nMinDepth = 1;
+    nMinDepth = 1;
     if (params.size() > 0)
         nMinDepth = params[0].get_int();
 
-    int nMaxDepth = 9999999;
+    nMaxDepth = 9999999;
     if (params.size() > 1)
         nMaxDepth = params[1].get_int();
 
-    set<CBitcoinAddress> setAddress;
     if (params.size() > 2)
     {
         Array inputs = params[2].get_array();
@@ -229,8 +219,11 @@ Value listunspent(const Array& params, bool fHelp)
            setAddress.insert(address);
         }
     }
+}
 
-    Array results;
+// Outputs listunspent reports, in AvailableCoins() order. Requires cs_main and cs_wallet.
+static void ListUnspentOutputs(int nMinDepth, int nMaxDepth, const set<CBitcoinAddress>& setAddress, vector<COutput>& vOutputs)
+{
     vector<COutput> vecOutputs;
     assert(pwalletMain != NULL);
     pwalletMain->AvailableCoins(vecOutputs, false);
@@ -249,36 +242,104 @@ Value listunspent(const Array& params, bool fHelp)
                 continue;
         }
 
-        int64_t nValue = out.tx->vout[out.i].nValue;
-        const CScript& pk = out.tx->vout[out.i].scriptPubKey;
-        Object entry;
-        entry.push_back(Pair("txid", out.tx->GetHash().GetHex()));
-        entry.push_back(Pair("vout", out.i));
+        vOutputs.push_back(out);
+    }
+}
+
+// One listunspent entry. Requires cs_wallet.
+static Object UnspentToJSON(const CWalletTx& wtx, int i, int nDepth)
+{
+    int64_t nValue = wtx.vout[i].nValue;
+    const CScript& pk = wtx.vout[i].scriptPubKey;
+    Object entry;
+    entry.push_back(Pair("txid", wtx.GetHash().GetHex()));
+    entry.push_back(Pair("vout", i));
+    CTxDestination address;
+    if (ExtractDestination(wtx.vout[i].scriptPubKey, address))
+    {
+        entry.push_back(Pair("address", CBitcoinAddress(address).ToString()));
+        if (pwalletMain->mapAddressBook.count(address))
+            entry.push_back(Pair("account", pwalletMain->mapAddressBook[address]));
+    }
+    entry.push_back(Pair("scriptPubKey", HexStr(pk.begin(), pk.end())));
+    if (pk.IsPayToScriptHash())
+    {
         CTxDestination address;
-        if (ExtractDestination(out.tx->vout[out.i].scriptPubKey, address))
+        if (ExtractDestination(pk, address))
         {
-            entry.push_back(Pair("address", CBitcoinAddress(address).ToString()));
-            if (pwalletMain->mapAddressBook.count(address))
-                entry.push_back(Pair("account", pwalletMain->mapAddressBook[address]));
+            const CScriptID& hash = boost::get<CScriptID>(address);
+            CScript redeemScript;
+            if (pwalletMain->GetCScript(hash, redeemScript))
+                entry.push_back(Pair("redeemScript", HexStr(redeemScript.begin(), redeemScript.end())));
         }
-        entry.push_back(Pair("scriptPubKey", HexStr(pk.begin(), pk.end())));
-        if (pk.IsPayToScriptHash())
+    }
+    entry.push_back(Pair("amount",ValueFromAmount(nValue)));
+    entry.push_back(Pair("confirmations",nDepth));
+    return entry;
+}
+
+Value listunspent(const Array& params, bool fHelp)
+{
+    if (fHelp || params.size() > 3)
+        throw runtime_error(
+            "listunspent [minconf=1] [maxconf=9999999]  [\"address\",...]\n"
+            "Returns array of unspent transaction outputs\n"
+            "with between minconf and maxconf (inclusive) confirmations.\n"
+            "Optionally filtered to only include txouts paid to specified addresses.\n"
+            "Results are an array of Objects, each of which has:\n"
+            "{txid, vout, scriptPubKey, amount, confirmations}");
+
+    int nMinDepth, nMaxDepth;
+    set<CBitcoinAddress> setAddress;
+    ListUnspentParams(params, nMinDepth, nMaxDepth, setAddress);
+
+    vector<COutput> vOutputs;
+    ListUnspentOutputs(nMinDepth, nMaxDepth, setAddress, vOutputs);
+
+    Array results;
+    BOOST_FOREACH(const COutput& out, vOutputs)
+        results.push_back(UnspentToJSON(*out.tx, out.i, out.nDepth));
+    return results;
+}
+
+void listunspent_stream(const Array& params, CJSONStreamWriter& writer)
+{
+    if (params.size() > 3)
+        listunspent(params, true);
+
+    int nMinDepth, nMaxDepth;
+    set<CBitcoinAddress> setAddress;
+    ListUnspentParams(params, nMinDepth, nMaxDepth, setAddress);
+
+    // Only the outpoints are kept between batches; an output spent or
+    // dropped from the wallet in the meantime is skipped
+    vector<COutPoint> vOutPoints;
+    {
+        LOCK2(cs_main, pwalletMain->cs_wallet);
+        vector<COutput> vOutputs;
+        ListUnspentOutputs(nMinDepth, nMaxDepth, setAddress, vOutputs);
+        vOutPoints.reserve(vOutputs.size());
+        BOOST_FOREACH(const COutput& out, vOutputs)
+            vOutPoints.push_back(COutPoint(out.tx->GetHash(), out.i));
+    }
+
+    writer.beginArray();
+    for (unsigned int nBatch = 0; nBatch < vOutPoints.size(); nBatch += RPC_STREAM_BATCH)
+    {
+        Array entries;
         {
-            CTxDestination address;
-            if (ExtractDestination(pk, address))
+            LOCK2(cs_main, pwalletMain->cs_wallet);
+            for (unsigned int n = nBatch; n < vOutPoints.size() && n < nBatch + RPC_STREAM_BATCH; n++)
             {
-                const CScriptID& hash = boost::get<CScriptID>(address);
-                CScript redeemScript;
-                if (pwalletMain->GetCScript(hash, redeemScript))
-                    entry.push_back(Pair("redeemScript", HexStr(redeemScript.begin(), redeemScript.end())));
+                map<uint256, CWalletTx>::const_iterator mi = pwalletMain->mapWallet.find(vOutPoints[n].hash);
+                if (mi != pwalletMain->mapWallet.end() && !(*mi).second.IsSpent(vOutPoints[n].n))
+                    entries.push_back(UnspentToJSON((*mi).second, vOutPoints[n].n, (*mi).second.GetDepthInMainChain()));
             }
         }
-        entry.push_back(Pair("amount",ValueFromAmount(nValue)));
-        entry.push_back(Pair("confirmations",out.nDepth));
-        results.push_back(entry);
+        BOOST_FOREACH(const Value& entry, entries)
+            writer.value(entry);
     }
-
-    return results;
+    writer.endArray();
 }
 #endif
 
@@ -650,3 +711,136 @@ Value sendrawtransaction(const Array& params, bool fHelp)
 
     return hashTx.GetHex();
 }
+
+// A raw transaction of a sendrawtransactions batch, decoded by the worker threads
+struct CRawTxDecode
+{
+    string strHex;
+    CTransaction tx;
+    uint256 hash;
+    bool fDecoded;
+};
+
+static void DecodeRawTx(vector<CRawTxDecode>* pvDecode, unsigned int i)
+{
+    CRawTxDecode& decode = (*pvDecode)[i];
+    decode.fDecoded = false;
+    if (!IsHex(decode.strHex))
+        return;
+    vector<unsigned char> txData(ParseHex(decode.strHex));
+    CDataStream ssData(txData, SER_NETWORK, PROTOCOL_VERSION);
+    try {
+        ssData >> decode.tx;
+    }
+    catch (std::exception &e) {
+        return;
+    }
+    decode.hash = decode.tx.GetHash();
+    decode.fDecoded = true;
+}
+
+Value sendrawtransactions(const Array& params, bool fHelp)
+{
+    if (fHelp || params.size() != 1)
+        throw runtime_error(
+            "sendrawtransactions [\"hexstring\",...]\n"
+            "Submits raw transactions (serialized, hex-encoded) to local node and network.\n"
+            "Transactions spending others of the batch may come in any order. Returns, in the\n"
+            "order given, an object per transaction with its \"txid\" and a \"result\" of\n"
+            "accepted, known (already in the memory pool, relayed again), duplicate (earlier\n"
+            "in the batch), in block, missing inputs, rejected or decode failed.");
+
+    RPCTypeCheck(params, list_of(array_type));
+    const Array& vHex = params[0].get_array();
+
+    vector<CRawTxDecode> vDecode(vHex.size());
+    for (unsigned int i = 0; i < vHex.size(); i++)
+    {
+        if (vHex[i].type() != str_type)
+            throw JSONRPCError(RPC_TYPE_ERROR, strprintf("Expected hex string at position %u", i));
+        vDecode[i].strHex = vHex[i].get_str();
+    }
+
+    ParallelFor(vDecode.size(), 256, boost::bind(&DecodeRawTx, &vDecode, _1));
+
+    // Parents in the batch go before what spends them
+    vector<string> vResult(vDecode.size());
+    map<uint256, unsigned int> mapIndex;
+    for (unsigned int i = 0; i < vDecode.size(); i++)
+    {
+        if (!vDecode[i].fDecoded)
+            vResult[i] = "decode failed";
+        else if (!mapIndex.insert(make_pair(vDecode[i].hash, i)).second)
+            vResult[i] = "duplicate";
+    }
+    vector<unsigned int> vOrder;
+    vOrder.reserve(mapIndex.size());
+    vector<bool> vDone(vDecode.size(), false);
+    for (map<uint256, unsigned int>::iterator it = mapIndex.begin(); it != mapIndex.end(); ++it)
+    {
+        vector<unsigned int> vStack(1, it->second);
+        while (!vStack.empty())
+        {
+            unsigned int i = vStack.back();
+            if (vDone[i])
+            {
+                vStack.pop_back();
+                continue;
+            }
+            bool fParentsDone = true;
+            BOOST_FOREACH(const CTxIn& txin, vDecode[i].tx.vin)
+            {
+                map<uint256, unsigned int>::iterator mi = mapIndex.find(txin.prevout.hash);
+                if (mi != mapIndex.end() && !vDone[mi->second])
+                {
+                    vStack.push_back(mi->second);
+                    fParentsDone = false;
+                }
+            }
+            if (!fParentsDone)
+                continue;
+            vStack.pop_back();
+            vDone[i] = true;
+            vOrder.push_back(i);
+        }
+    }
+
+    vector<CTransaction> vRelay;
+    vRelay.reserve(vOrder.size());
+    {
+        LOCK(cs_main);
+        CTxDB txdb("r");
+        BOOST_FOREACH(unsigned int i, vOrder)
+        {
+            CRawTxDecode& decode = vDecode[i];
+            bool fMissingInputs = false;
+            if (mempool.exists(decode.hash))
+                vResult[i] = "known";
+            else if (AcceptToMemoryPool(mempool, decode.tx, true, &fMissingInputs))
+                vResult[i] = "accepted";
+            else
+            {
+                if (fMissingInputs)
+                    vResult[i] = "missing inputs";
+                else if (txdb.ContainsTx(decode.hash))
+                    vResult[i] = "in block";
+                else
+                    vResult[i] = "rejected";
+                continue;
+            }
+            vRelay.push_back(decode.tx);
+        }
+    }
+    RelayTransactions(vRelay);
+
+    Array results;
+    for (unsigned int i = 0; i < vDecode.size(); i++)
+    {
+        Object result;
+        if (vDecode[i].fDecoded)
+            result.push_back(Pair("txid", vDecode[i].hash.GetHex()));
+        result.push_back(Pair("result", vResult[i]));
+        results.push_back(result);
+    }
+    return results;
+}
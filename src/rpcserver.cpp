@@ -216,89 +216,109 @@ Value stop(const Array& params, bool fHelp)
 
 
 static const CRPCCommand vRPCCommands[] =
-{ //  name                      actor (function)         okSafeMode threadSafe reqWallet
-  //  ------------------------  -----------------------  ---------- ---------- ---------
-    { "help",                   &help,                   true,      true,      false },
-    { "stop",                   &stop,                   true,      true,      false },
-    { "getbestblockhash",       &getbestblockhash,       true,      false,     false },
-    { "getblockcount",          &getblockcount,          true,      false,     false },
-    { "getconnectioncount",     &getconnectioncount,     true,      false,     false },
-    { "getpeerinfo",            &getpeerinfo,            true,      false,     false },
-    { "addnode",                &addnode,                true,      true,      false },
-    { "getaddednodeinfo",       &getaddednodeinfo,       true,      true,      false },
-    { "ping",                   &ping,                   true,      false,     false },
-    { "getnettotals",           &getnettotals,           true,      true,      false },
-    { "getdifficulty",          &getdifficulty,          true,      false,     false },
-    { "getinfo",                &getinfo,                true,      false,     false },
-    { "getrawmempool",          &getrawmempool,          true,      false,     false },
-    { "getblock",               &getblock,               false,     false,     false },
-    { "getblockbynumber",       &getblockbynumber,       false,     false,     false },
-    { "getblockhash",           &getblockhash,           false,     false,     false },
-    { "getrawtransaction",      &getrawtransaction,      false,     false,     false },
-    { "createrawtransaction",   &createrawtransaction,   false,     false,     false },
-    { "decoderawtransaction",   &decoderawtransaction,   false,     false,     false },
-    { "decodescript",           &decodescript,           false,     false,     false },
-    { "signrawtransaction",     &signrawtransaction,     false,     false,     false },
-    { "sendrawtransaction",     &sendrawtransaction,     false,     false,     false },
-    { "getcheckpoint",          &getcheckpoint,          true,      false,     false },
-    { "sendalert",              &sendalert,              false,     false,     false },
-    { "validateaddress",        &validateaddress,        true,      false,     false },
-    { "validatepubkey",         &validatepubkey,         true,      false,     false },
-    { "verifymessage",          &verifymessage,          false,     false,     false },
+{ //  name                      actor (function)         okSafeMode threadSafe reqWallet chainSnapshot
+  //  ------------------------  -----------------------  ---------- ---------- --------- -------------
+    { "help",                   &help,                   true,      true,      false,    false },
+    { "stop",                   &stop,                   true,      true,      false,    false },
+    { "getbestblockhash",       &getbestblockhash,       true,      false,     false,    true  },
+    { "getblockcount",          &getblockcount,          true,      false,     false,    true  },
+    { "getconnectioncount",     &getconnectioncount,     true,      false,     false,    false },
+    { "getpeerinfo",            &getpeerinfo,            true,      false,     false,    false },
+    { "addnode",                &addnode,                true,      true,      false,    false },
+    { "getaddednodeinfo",       &getaddednodeinfo,       true,      true,      false,    false },
+    { "ping",                   &ping,                   true,      false,     false,    false },
+    { "getnettotals",           &getnettotals,           true,      true,      false,    false },
+    { "getdifficulty",          &getdifficulty,          true,      false,     false,    true  },
+    { "getinfo",                &getinfo,                true,      false,     false,    false },
+    { "getrawmempool",          &getrawmempool,          true,      false,     false,    false },
+    { "savemempool",            &savemempool,            true,      true,      false,    false },
+    { "getblock",               &getblock,               false,     false,     false,    false },
+    { "getblockbynumber",       &getblockbynumber,       false,     false,     false,    false },
+    { "getblockhash",           &getblockhash,           false,     false,     false,    false },
+    { "getrawtransaction",      &getrawtransaction,      false,     false,     false,    false },
+    { "createrawtransaction",   &createrawtransaction,   false,     false,     false,    false },
+    { "decoderawtransaction",   &decoderawtransaction,   false,     false,     false,    false },
+    { "decodescript",           &decodescript,           false,     false,     false,    false },
+    { "signrawtransaction",     &signrawtransaction,     false,     false,     false,    false },
+    { "sendrawtransaction",     &sendrawtransaction,     false,     false,     false,    false },
+    { "sendrawtransactions",    &sendrawtransactions,    false,     true,      false,    false },
+    { "getcheckpoint",          &getcheckpoint,          true,      false,     false,    false },
+    { "sendalert",              &sendalert,              false,     false,     false,    false },
+    { "validateaddress",        &validateaddress,        true,      false,     false,    false },
+    { "validatepubkey",         &validatepubkey,         true,      false,     false,    false },
+    { "verifymessage",          &verifymessage,          false,     false,     false,    false },
 
 #ifdef ENABLE_WALLET
-    { "setmining",              &setmining,              true,      false,     false},
-    { "setstaking",             &setstaking,             true,      false,     false},
-    { "getmininginfo",          &getmininginfo,          true,      false,     false},
-    { "getstakinginfo",         &getstakinginfo,         true,      false,     false},
-    { "getnewaddress",          &getnewaddress,          true,      false,     true },
-    { "getnewpubkey",           &getnewpubkey,           true,      false,     true },
-    { "getaccountaddress",      &getaccountaddress,      true,      false,     true },
-    { "setaccount",             &setaccount,             true,      false,     true },
-    { "getaccount",             &getaccount,             false,     false,     true },
-    { "getaddressesbyaccount",  &getaddressesbyaccount,  true,      false,     true },
-    { "sendtoaddress",          &sendtoaddress,          false,     false,     true },
-    { "getreceivedbyaddress",   &getreceivedbyaddress,   false,     false,     true },
-    { "getreceivedbyaccount",   &getreceivedbyaccount,   false,     false,     true },
-    { "listreceivedbyaddress",  &listreceivedbyaddress,  false,     false,     true },
-    { "listreceivedbyaccount",  &listreceivedbyaccount,  false,     false,     true },
-    { "backupwallet",           &backupwallet,           true,      false,     true },
-    { "keypoolrefill",          &keypoolrefill,          true,      false,     true },
-    { "walletpassphrase",       &walletpassphrase,       true,      false,     true },
-    { "walletpassphrasechange", &walletpassphrasechange, false,     false,     true },
-    { "walletlock",             &walletlock,             true,      false,     true },
-    { "encryptwallet",          &encryptwallet,          false,     false,     true },
-    { "getbalance",             &getbalance,             false,     false,     true },
-    { "move",                   &movecmd,                false,     false,     true },
-    { "sendfrom",               &sendfrom,               false,     false,     true },
-    { "sendmany",               &sendmany,               false,     false,     true },
-    { "addmultisigaddress",     &addmultisigaddress,     false,     false,     true },
-    { "addredeemscript",        &addredeemscript,        false,     false,     true },
-    { "getasset",               &getasset,               false,     false,     false },
-    { "gettransaction",         &gettransaction,         false,     false,     true },
-    { "listtransactions",       &listtransactions,       false,     false,     true },
-    { "listaddressgroupings",   &listaddressgroupings,   false,     false,     true },
-    { "signmessage",            &signmessage,            false,     false,     true },
-    { "getwork",                &getwork,                true,      false,     true },
-    { "getworkex",              &getworkex,              true,      false,     true },
-    { "listaccounts",           &listaccounts,           false,     false,     true },
-    { "getblocktemplate",       &getblocktemplate,       true,      false,     false},
-    { "submitblock",            &submitblock,            false,     false,     false},
-    { "listsinceblock",         &listsinceblock,         false,     false,     true },
-    { "dumpprivkey",            &dumpprivkey,            false,     false,     true },
-    { "dumpwallet",             &dumpwallet,             true,      false,     true },
-    { "importprivkey",          &importprivkey,          false,     false,     true },
-    { "importwallet",           &importwallet,           false,     false,     true },
-    { "listunspent",            &listunspent,            false,     false,     true },
-    { "settxfee",               &settxfee,               false,     false,     true },
-    { "getsubsidy",             &getsubsidy,             true,      true,      false },
-    { "getstakesubsidy",        &getstakesubsidy,        true,      true,      false },
-    { "reservebalance",         &reservebalance,         false,     true,      true },
-    { "checkwallet",            &checkwallet,            false,     true,      true },
-    { "repairwallet",           &repairwallet,           false,     true,      true },
-    { "resendtx",               &resendtx,               false,     true,      true },
-    { "makekeypair",            &makekeypair,            false,     true,      false },
-    { "checkkernel",            &checkkernel,            true,      false,     true },
+    { "setmining",              &setmining,              true,      false,     false,    false },
+    { "setstaking",             &setstaking,             true,      false,     false,    false },
+    { "getmininginfo",          &getmininginfo,          true,      false,     false,    false },
+    { "getstakinginfo",         &getstakinginfo,         true,      false,     false,    false },
+    { "getnewaddress",          &getnewaddress,          true,      false,     true,     false },
+    { "getnewpubkey",           &getnewpubkey,           true,      false,     true,     false },
+    { "getaccountaddress",      &getaccountaddress,      true,      false,     true,     false },
+    { "setaccount",             &setaccount,             true,      false,     true,     false },
+    { "getaccount",             &getaccount,             false,     false,     true,     false },
+    { "getaddressesbyaccount",  &getaddressesbyaccount,  true,      false,     true,     false },
+    { "sendtoaddress",          &sendtoaddress,          false,     false,     true,     false },
+    { "getreceivedbyaddress",   &getreceivedbyaddress,   false,     false,     true,     false },
+    { "getreceivedbyaccount",   &getreceivedbyaccount,   false,     false,     true,     false },
+    { "listreceivedbyaddress",  &listreceivedbyaddress,  false,     false,     true,     false },
+    { "listreceivedbyaccount",  &listreceivedbyaccount,  false,     false,     true,     false },
+    { "backupwallet",           &backupwallet,           true,      false,     true,     false },
+    { "keypoolrefill",          &keypoolrefill,          true,      true,      true,     false },
+    { "walletpassphrase",       &walletpassphrase,       true,      false,     true,     false },
+    { "walletpassphrasechange", &walletpassphrasechange, false,     false,     true,     false },
+    { "walletlock",             &walletlock,             true,      false,     true,     false },
+    { "encryptwallet",          &encryptwallet,          false,     false,     true,     false },
+    { "getbalance",             &getbalance,             false,     false,     true,     false },
+    { "move",                   &movecmd,                false,     false,     true,     false },
+    { "sendfrom",               &sendfrom,               false,     false,     true,     false },
+    { "sendmany",               &sendmany,               false,     false,     true,     false },
+    { "sendassetpayout",        &sendassetpayout,        false,     false,     true,     false },
+    { "addmultisigaddress",     &addmultisigaddress,     false,     false,     true,     false },
+    { "addredeemscript",        &addredeemscript,        false,     false,     true,     false },
+    { "getasset",               &getasset,               false,     false,     false,    false },
+    { "gettransaction",         &gettransaction,         false,     false,     true,     false },
+    { "listtransactions",       &listtransactions,       false,     false,     true,     false },
+    { "listaddressgroupings",   &listaddressgroupings,   false,     false,     true,     false },
+    { "signmessage",            &signmessage,            false,     false,     true,     false },
+    { "getwork",                &getwork,                true,      false,     true,     false },
+    { "getworkex",              &getworkex,              true,      false,     true,     false },
+    { "listaccounts",           &listaccounts,           false,     false,     true,     false },
+    { "getblocktemplate",       &getblocktemplate,       true,      true,      false,    false },
+    { "submitblock",            &submitblock,            false,     false,     false,    false },
+    { "listsinceblock",         &listsinceblock,         false,     false,     true,     false },
+    { "dumpprivkey",            &dumpprivkey,            false,     false,     true,     false },
+    { "dumpwallet",             &dumpwallet,             true,      false,     true,     false },
+    { "importprivkey",          &importprivkey,          false,     true,      true,     false },
+    { "importwallet",           &importwallet,           false,     true,      true,     false },
+    { "getrescaninfo",          &getrescaninfo,          true,      true,      true,     false },
+    { "listunspent",            &listunspent,            false,     false,     true,     false },
+    { "settxfee",               &settxfee,               false,     false,     true,     false },
+    { "getsubsidy",             &getsubsidy,             true,      true,      false,    false },
+    { "getstakesubsidy",        &getstakesubsidy,        true,      true,      false,    false },
+    { "reservebalance",         &reservebalance,         false,     true,      true,     false },
+    { "checkwallet",            &checkwallet,            false,     true,      true,     false },
+    { "repairwallet",           &repairwallet,           false,     true,      true,     false },
+    { "resendtx",               &resendtx,               false,     true,      true,     false },
+    { "getwalletmemoryinfo",    &getwalletmemoryinfo,    true,      true,      true,     false },
+    { "makekeypair",            &makekeypair,            false,     true,      false,    false },
+    { "checkkernel",            &checkkernel,            true,      false,     true,     false },
+#endif
+};
+
+// Commands that can write their result directly to the connection. Each must
+// also be in vRPCCommands, which supplies the help text and flags; the actor
+// does its own locking and never holds cs_main or cs_wallet while writing.
+static const CRPCStreamCommand vRPCStreamCommands[] =
+{ //  name                      actor (function)
+  //  ------------------------  -----------------------
+    { "getblock",               &getblock_stream         },
+    { "getrawmempool",          &getrawmempool_stream    },
+#ifdef ENABLE_WALLET
+    { "listtransactions",       &listtransactions_stream },
+    { "listsinceblock",         &listsinceblock_stream   },
+    { "listunspent",            &listunspent_stream      },
 #endif
 };
 
@@ -312,6 +332,14 @@ CRPCTable::CRPCTable()
         pcmd = &vRPCCommands[vcidx];
         mapCommands[pcmd->name] = pcmd;
     }
+    for (vcidx = 0; vcidx < (sizeof(vRPCStreamCommands) / sizeof(vRPCStreamCommands[0])); vcidx++)
+    {
+        const CRPCStreamCommand *pcmd;
+
+        pcmd = &vRPCStreamCommands[vcidx];
+        assert(mapCommands.count(pcmd->name));
+        mapStreamCommands[pcmd->name] = pcmd;
+    }
 }
 
 const CRPCCommand *CRPCTable::operator[](string name) const
@@ -322,6 +350,11 @@ const CRPCCommand *CRPCTable::operator[](string name) const
     return (*it).second;
 }
 
+bool CRPCTable::canStream(const string &method) const
+{
+    return mapStreamCommands.count(method) > 0;
+}
+
 
 bool HTTPAuthorized(map<string, string>& mapHeaders)
 {
@@ -703,6 +736,40 @@ static Object JSONRPCExecOne(const Value& req)
     return rpc_result;
 }
 
+// Execute a request through its streaming implementation, sending the reply
+// with chunked transfer encoding. Errors raised before any data has been sent
+// are rethrown so the caller can send an ordinary error reply; afterwards the
+// HTTP status is already out, and false is returned so the caller drops the
+// connection and the client sees an incomplete reply.
+static bool JSONRPCExecStream(std::ostream& stream, const JSONRequest& jreq, bool fKeepAlive)
+{
+    CHTTPChunkedStreambuf buf(stream, HTTPReplyChunkedHeader(HTTP_OK, fKeepAlive));
+    try
+    {
+        std::ostream os(&buf);
+        os.exceptions(std::ios_base::badbit);
+        CJSONStreamWriter writer(os);
+
+        // Same layout as JSONRPCReply()
+        writer.beginObject();
+        writer.key("result");
+        tableRPC.executeStream(jreq.strMethod, jreq.params, writer);
+        writer.pair("error", Value::null);
+        writer.pair("id", jreq.id);
+        writer.endObject();
+        os << "\n";
+        buf.finish();
+    }
+    catch (...)
+    {
+        if (!buf.started())
+            throw;
+        LogPrintf("ThreadRPCServer %s failed after reply started\n", jreq.strMethod);
+        return false;
+    }
+    return true;
+}
+
 static string JSONRPCExecBatch(const Array& vReq)
 {
     Array ret;
@@ -768,6 +835,14 @@ void ServiceConnection(AcceptedConnection *conn)
             if (valRequest.type() == obj_type) {
                 jreq.parse(valRequest);
 
+                // Large results go straight to HTTP/1.1 clients in chunks
+                if (nProto >= 1 && tableRPC.canStream(jreq.strMethod))
+                {
+                    if (!JSONRPCExecStream(conn->stream(), jreq, fRun))
+                        break;
+                    continue;
+                }
+
                 Value result = tableRPC.execute(jreq.strMethod, jreq.params);
 
                 // Send reply
@@ -794,7 +869,7 @@ void ServiceConnection(AcceptedConnection *conn)
     }
 }
 
-json_spirit::Value CRPCTable::execute(const std::string &strMethod, const json_spirit::Array &params) const
+const CRPCCommand* CRPCTable::checkCommand(const std::string &strMethod) const
 {
     // Find method
     const CRPCCommand *pcmd = tableRPC[strMethod];
@@ -811,12 +886,24 @@ json_spirit::Value CRPCTable::execute(const std::string &strMethod, const json_s
         !pcmd->okSafeMode)
         throw JSONRPCError(RPC_FORBIDDEN_BY_SAFE_MODE, string("Safe mode: ") + strWarning);
 
+    return pcmd;
+}
+
+json_spirit::Value CRPCTable::execute(const std::string &strMethod, const json_spirit::Array &params) const
+{
+    const CRPCCommand *pcmd = checkCommand(strMethod);
+
     try
     {
+#ifdef ENABLE_WALLET
+        // Let wallet commands see every block and transaction validated before the call
+        if (pcmd->reqWallet)
+            SyncWithWalletQueue();
+#endif
         // Execute
         Value result;
         {
-            if (pcmd->threadSafe)
+            if (pcmd->threadSafe || pcmd->chainSnapshot)
                 result = pcmd->actor(params, false);
 #ifdef ENABLE_WALLET
             else if (!pwalletMain) {
@@ -841,4 +928,27 @@ json_spirit::Value CRPCTable::execute(const std::string &strMethod, const json_s
     }
 }
 
+void CRPCTable::executeStream(const std::string &strMethod, const json_spirit::Array &params, CJSONStreamWriter &writer) const
+{
+    const CRPCCommand *pcmd = checkCommand(strMethod);
+    map<string, const CRPCStreamCommand*>::const_iterator it = mapStreamCommands.find(strMethod);
+    assert(it != mapStreamCommands.end());
+    rpcstreamfn_type actor = it->second->actor;
+
+    try
+    {
+#ifdef ENABLE_WALLET
+        if (pcmd->reqWallet)
+            SyncWithWalletQueue();
+#endif
+        // Streaming actors take cs_main and cs_wallet themselves, a batch of
+        // items at a time, and release them before writing to the connection
+        actor(params, writer);
+    }
+    catch (std::exception& e)
+    {
+        throw JSONRPCError(RPC_MISC_ERROR, e.what());
+    }
+}
+
 const CRPCTable tableRPC;
@@ -12,7 +12,10 @@
 #include <list>
 #include <map>
 
+#include <boost/shared_ptr.hpp>
+
 class CBlockIndex;
+class CChainTipSnapshot;
 
 void StartRPCThreads();
 void StopRPCThreads();
@@ -39,6 +42,18 @@ void RPCRunLater(const std::string& name, boost::function<void(void)> func, int6
 
 typedef json_spirit::Value(*rpcfn_type)(const json_spirit::Array& params, bool fHelp);
 
+/*
+  Writes the result of a command straight to the reply stream instead of
+  returning a json_spirit tree. Used for commands whose results can be large.
+  Must produce the same JSON as the command's rpcfn_type actor. It is called
+  without locks and takes cs_main/cs_wallet only to prepare up to
+  RPC_STREAM_BATCH items at a time, releasing them before each write, so a
+  slow client never holds up validation.
+*/
+typedef void(*rpcstreamfn_type)(const json_spirit::Array& params, CJSONStreamWriter& writer);
+
+static const unsigned int RPC_STREAM_BATCH = 100;
+
 class CRPCCommand
 {
 public:
@@ -47,6 +62,14 @@ public:
     bool okSafeMode;
     bool threadSafe;
     bool reqWallet;
+    bool chainSnapshot; // reads chain state only from GetChainTipSnapshot(), runs without cs_main
+};
+
+class CRPCStreamCommand
+{
+public:
+    std::string name;
+    rpcstreamfn_type actor;
 };
 
 /**
@@ -56,11 +79,17 @@ class CRPCTable
 {
 private:
     std::map<std::string, const CRPCCommand*> mapCommands;
+    std::map<std::string, const CRPCStreamCommand*> mapStreamCommands;
+
+    const CRPCCommand* checkCommand(const std::string &method) const;
 public:
     CRPCTable();
     const CRPCCommand* operator[](std::string name) const;
     std::string help(std::string name) const;
 
+    // Whether method has a streaming implementation
+    bool canStream(const std::string &method) const;
+
     /**
      * Execute a method.
      * @param method   Method to execute
@@ -69,6 +98,13 @@ public:
      * @throws an exception (json_spirit::Value) when an error happens.
      */
     json_spirit::Value execute(const std::string &method, const json_spirit::Array &params) const;
+
+    /**
+     * Execute a method through its streaming implementation, writing the
+     * result to writer. Same checks and errors as execute(); the actor takes
+     * the locks it needs only while it reads chain or wallet state.
+     */
+    void executeStream(const std::string &method, const json_spirit::Array &params, CJSONStreamWriter &writer) const;
 };
 
 extern const CRPCTable tableRPC;
@@ -80,6 +116,7 @@ extern int64_t nWalletUnlockTime;
 extern int64_t AmountFromValue(const json_spirit::Value& value);
 extern json_spirit::Value ValueFromAmount(int64_t amount);
 extern double GetDifficulty(const CBlockIndex* blockindex = NULL);
+extern boost::shared_ptr<const CChainTipSnapshot> GetChainTipSnapshotOrThrow();
 
 extern double GetPoWMHashPS();
 extern double GetPoSKernelPS();
@@ -107,6 +144,7 @@ extern json_spirit::Value dumpwallet(const json_spirit::Array& params, bool fHel
 extern json_spirit::Value importwallet(const json_spirit::Array& params, bool fHelp);
 extern json_spirit::Value dumpprivkey(const json_spirit::Array& params, bool fHelp); // in rpcdump.cpp
 extern json_spirit::Value importprivkey(const json_spirit::Array& params, bool fHelp);
+extern json_spirit::Value getrescaninfo(const json_spirit::Array& params, bool fHelp);
 
 extern json_spirit::Value sendalert(const json_spirit::Array& params, bool fHelp);
 
@@ -139,6 +177,7 @@ extern json_spirit::Value getbalance(const json_spirit::Array& params, bool fHel
 extern json_spirit::Value movecmd(const json_spirit::Array& params, bool fHelp);
 extern json_spirit::Value sendfrom(const json_spirit::Array& params, bool fHelp);
 extern json_spirit::Value sendmany(const json_spirit::Array& params, bool fHelp);
+extern json_spirit::Value sendassetpayout(const json_spirit::Array& params, bool fHelp);
 extern json_spirit::Value addmultisigaddress(const json_spirit::Array& params, bool fHelp);
 extern json_spirit::Value addredeemscript(const json_spirit::Array& params, bool fHelp);
 extern json_spirit::Value listreceivedbyaddress(const json_spirit::Array& params, bool fHelp);
@@ -161,6 +200,7 @@ extern json_spirit::Value reservebalance(const json_spirit::Array& params, bool
 extern json_spirit::Value checkwallet(const json_spirit::Array& params, bool fHelp);
 extern json_spirit::Value repairwallet(const json_spirit::Array& params, bool fHelp);
 extern json_spirit::Value resendtx(const json_spirit::Array& params, bool fHelp);
+extern json_spirit::Value getwalletmemoryinfo(const json_spirit::Array& params, bool fHelp);
 extern json_spirit::Value makekeypair(const json_spirit::Array& params, bool fHelp);
 extern json_spirit::Value validatepubkey(const json_spirit::Array& params, bool fHelp);
 extern json_spirit::Value getnewpubkey(const json_spirit::Array& params, bool fHelp);
@@ -172,15 +212,23 @@ extern json_spirit::Value decoderawtransaction(const json_spirit::Array& params,
 extern json_spirit::Value decodescript(const json_spirit::Array& params, bool fHelp);
 extern json_spirit::Value signrawtransaction(const json_spirit::Array& params, bool fHelp);
 extern json_spirit::Value sendrawtransaction(const json_spirit::Array& params, bool fHelp);
+extern json_spirit::Value sendrawtransactions(const json_spirit::Array& params, bool fHelp);
 
 extern json_spirit::Value getbestblockhash(const json_spirit::Array& params, bool fHelp); // in rpcblockchain.cpp
 extern json_spirit::Value getblockcount(const json_spirit::Array& params, bool fHelp); // in rpcblockchain.cpp
 extern json_spirit::Value getdifficulty(const json_spirit::Array& params, bool fHelp);
 extern json_spirit::Value settxfee(const json_spirit::Array& params, bool fHelp);
 extern json_spirit::Value getrawmempool(const json_spirit::Array& params, bool fHelp);
+extern json_spirit::Value savemempool(const json_spirit::Array& params, bool fHelp);
 extern json_spirit::Value getblockhash(const json_spirit::Array& params, bool fHelp);
 extern json_spirit::Value getblock(const json_spirit::Array& params, bool fHelp);
 extern json_spirit::Value getblockbynumber(const json_spirit::Array& params, bool fHelp);
 extern json_spirit::Value getcheckpoint(const json_spirit::Array& params, bool fHelp);
 
+extern void getblock_stream(const json_spirit::Array& params, CJSONStreamWriter& writer); // streaming actors
+extern void getrawmempool_stream(const json_spirit::Array& params, CJSONStreamWriter& writer);
+extern void listtransactions_stream(const json_spirit::Array& params, CJSONStreamWriter& writer);
+extern void listsinceblock_stream(const json_spirit::Array& params, CJSONStreamWriter& writer);
+extern void listunspent_stream(const json_spirit::Array& params, CJSONStreamWriter& writer);
+
 #endif
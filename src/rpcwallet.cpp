@@ -89,9 +89,6 @@ Value getnewpubkey(const Array& params, bool fHelp)
     if (params.size() > 0)
         strAccount = AccountFromValue(params[0]);
 
-    if (!pwalletMain->IsLocked())
-        pwalletMain->TopUpKeyPool();
-
     // Generate a new key that is added to wallet
     CPubKey newKey;
     if (!pwalletMain->GetKeyFromPool(newKey))
@@ -118,9 +115,6 @@ Value getnewaddress(const Array& params, bool fHelp)
     if (params.size() > 0)
         strAccount = AccountFromValue(params[0]);
 
-    if (!pwalletMain->IsLocked())
-        pwalletMain->TopUpKeyPool();
-
     // Generate a new key that is added to wallet
     CPubKey newKey;
     if (!pwalletMain->GetKeyFromPool(newKey))
@@ -569,7 +563,11 @@ Value movecmd(const Array& params, bool fHelp)
     debit.nTime = nNow;
     debit.strOtherAccount = strTo;
     debit.strComment = strComment;
-    walletdb.WriteAccountingEntry(debit);
+    if (!walletdb.WriteAccountingEntry(debit))
+    {
+        walletdb.TxnAbort();
+        throw JSONRPCError(RPC_DATABASE_ERROR, "database error");
+    }
 
     // Credit
     CAccountingEntry credit;
@@ -579,11 +577,19 @@ Value movecmd(const Array& params, bool fHelp)
     credit.nTime = nNow;
     credit.strOtherAccount = strFrom;
     credit.strComment = strComment;
-    walletdb.WriteAccountingEntry(credit);
+    if (!walletdb.WriteAccountingEntry(credit))
+    {
+        walletdb.TxnAbort();
+        throw JSONRPCError(RPC_DATABASE_ERROR, "database error");
+    }
 
     if (!walletdb.TxnCommit())
         throw JSONRPCError(RPC_DATABASE_ERROR, "database error");
 
+    // Only entries that reached the database go into the activity log
+    pwalletMain->IndexAccountingEntry(debit);
+    pwalletMain->IndexAccountingEntry(credit);
+
     return true;
 }
 
@@ -701,6 +707,76 @@ Value sendmany(const Array& params, bool fHelp)
     return wtx.GetHash().GetHex();
 }
 
+// icochain: 向大量地址分发同一种资产
+Value sendassetpayout(const Array& params, bool fHelp)
+{
+    if (fHelp || params.size() < 2 || params.size() > 3)
+        throw runtime_error(
+            "sendassetpayout <assetid> {address:amount,...} [comment]\n"
+            "Pays asset <assetid> to every address, in as many transactions as the list needs.\n"
+            "Every transaction is signed and checked before any is recorded, and they are recorded together.\n"
+            "Returns the txids and the total fee, and the txids the memory pool refused, if any."
+            + HelpRequiringPassphrase());
+
+    int64_t nAssetId = params[0].get_int64();
+    if (nAssetId <= 0)
+        throw JSONRPCError(RPC_INVALID_PARAMETER, "Invalid parameter, assetid must be positive, use sendmany for ICS");
+    Object sendTo = params[1].get_obj();
+
+    set<CBitcoinAddress> setAddress;
+    vector<pair<CScript, int64_t> > vecSend;
+    vecSend.reserve(sendTo.size());
+    BOOST_FOREACH(const Pair& s, sendTo)
+    {
+        CBitcoinAddress address(s.name_);
+        if (!address.IsValid())
+            throw JSONRPCError(RPC_INVALID_ADDRESS_OR_KEY, string("Invalid Icochain address: ")+s.name_);
+
+        if (setAddress.count(address))
+            throw JSONRPCError(RPC_INVALID_PARAMETER, string("Invalid parameter, duplicated address: ")+s.name_);
+        setAddress.insert(address);
+
+        CScript scriptPubKey;
+        scriptPubKey.SetDestination(address.Get());
+        vecSend.push_back(make_pair(scriptPubKey, AmountFromValue(s.value_)));
+    }
+
+    EnsureWalletIsUnlocked();
+
+    CReserveKey keyChange(pwalletMain);
+    vector<CWalletTx> vwtx;
+    int64_t nFeeRequired = 0;
+    string strFailReason;
+    if (!pwalletMain->CreateAssetPayout(nAssetId, vecSend, vwtx, keyChange, nFeeRequired, strFailReason))
+        throw JSONRPCError(RPC_WALLET_ERROR, strFailReason);
+    if (params.size() > 2 && params[2].type() != null_type && !params[2].get_str().empty())
+    {
+        BOOST_FOREACH(CWalletTx& wtx, vwtx)
+            wtx.mapValue["comment"] = params[2].get_str();
+    }
+    if (!pwalletMain->CommitTransactions(vwtx, keyChange))
+    {
+        LOCK(pwalletMain->cs_wallet);
+        if (!pwalletMain->mapWallet.count(vwtx[0].GetHash()))
+            throw JSONRPCError(RPC_WALLET_ERROR, "Transaction commit failed");
+    }
+
+    // Recorded ones the memory pool refused are rebroadcast with the other wallet transactions
+    Array txids, notrelayed;
+    BOOST_FOREACH(const CWalletTx& wtx, vwtx)
+    {
+        txids.push_back(wtx.GetHash().GetHex());
+        if (!mempool.exists(wtx.GetHash()))
+            notrelayed.push_back(wtx.GetHash().GetHex());
+    }
+    Object result;
+    result.push_back(Pair("txids", txids));
+    result.push_back(Pair("fee", ValueFromAmount(nFeeRequired)));
+    if (!notrelayed.empty())
+        result.push_back(Pair("notrelayed", notrelayed));
+    return result;
+}
+
 Value addmultisigaddress(const Array& params, bool fHelp)
 {
     if (fHelp || params.size() < 2 || params.size() > 3)
@@ -939,7 +1015,9 @@ static void MaybePushAddress(Object & entry, const CTxDestination &dest)
         entry.push_back(Pair("address", addr.ToString()));
 }
 
-void ListTransactions(const int64_t nAssetId, const CWalletTx& wtx, const string& strAccount, int nMinDepth, bool fLong, Array& ret)
+// Entries for wtx, appended to a json_spirit::Array or written to a CJSONStreamWriter
+template<typename T>
+static void ListTransactions(const int64_t nAssetId, const CWalletTx& wtx, const string& strAccount, int nMinDepth, bool fLong, T& ret)
 {
     int64_t nFee;
     string strSentAccount;
@@ -1028,23 +1106,18 @@ void AcentryToJSON(const CAccountingEntry& acentry, const string& strAccount, Ar
     }
 }
 
-Value listtransactions(const Array& params, bool fHelp)
+static void ListTransactionsParams(const Array& params, string& strAccount, int& nCount, int& nFrom, int64_t& nAssetId)
 {
-    if (fHelp || params.size() > 4)
-        throw runtime_error(
-            "listtransactions [account] [count=10] [from=0]\n"
-            "Returns up to [count] most recent transactions skipping the first [from] transactions for account [account].");
-
-    string strAccount = "*";
+    strAccount = "*";
     if (params.size() > 0)
         strAccount = params[0].get_str();
-    int nCount = 10;
+    nCount = 10;
     if (params.size() > 1)
         nCount = params[1].get_int();
-    int nFrom = 0;
+    nFrom = 0;
     if (params.size() > 2)
         nFrom = params[2].get_int();
-    int64_t nAssetId = -1;
+    nAssetId = -1;
     if (params.size() > 3)
         nAssetId = params[3].get_int64();
 
@@ -1052,21 +1125,34 @@ Value listtransactions(const Array& params, bool fHelp)
         throw JSONRPCError(RPC_INVALID_PARAMETER, "Negative count");
     if (nFrom < 0)
         throw JSONRPCError(RPC_INVALID_PARAMETER, "Negative from");
+}
 
-    Array ret;
+// Append the listtransactions entries of one activity log item to ret
+static void TxItemToJSON(const CWallet::TxPair& item, const string& strAccount, int64_t nAssetId, Array& ret)
+{
+    CWalletTx *const pwtx = item.first;
+    if (pwtx != 0)
+        ListTransactions(nAssetId, *pwtx, strAccount, 0, true, ret);
+    CAccountingEntry *const pacentry = item.second;
+    if (pacentry != 0 && (nAssetId == -1 || nAssetId == 0)) // icochain: 转账记录只涉及ICS
+        AcentryToJSON(*pacentry, strAccount, ret);
+}
 
-    std::list<CAccountingEntry> acentries;
-    CWallet::TxItems txOrdered = pwalletMain->OrderedTxItems(acentries, strAccount);
+// Collect the entries listtransactions returns, newest first. On return the
+// requested page is ret[nFrom, nFrom+nCount).
+static void ListRecentTransactions(const Array& params, Array& ret, int& nFrom, int& nCount)
+{
+    string strAccount;
+    int64_t nAssetId;
+    ListTransactionsParams(params, strAccount, nCount, nFrom, nAssetId);
+
+    // Only the newest entries of the account's or asset's index are visited
+    const CWallet::TxItems& txOrdered = pwalletMain->OrderedTxItems(strAccount, nAssetId);
 
     // iterate backwards until we have nCount items to return:
-    for (CWallet::TxItems::reverse_iterator it = txOrdered.rbegin(); it != txOrdered.rend(); ++it)
+    for (CWallet::TxItems::const_reverse_iterator it = txOrdered.rbegin(); it != txOrdered.rend(); ++it)
     {
-        CWalletTx *const pwtx = (*it).second.first;
-        if (pwtx != 0)
-            ListTransactions(nAssetId, *pwtx, strAccount, 0, true, ret);
-        CAccountingEntry *const pacentry = (*it).second.second;
-        if (pacentry != 0)
-            AcentryToJSON(*pacentry, strAccount, ret);
+        TxItemToJSON((*it).second, strAccount, nAssetId, ret);
 
         if ((int)ret.size() >= (nCount+nFrom)) break;
     }
@@ -1076,6 +1162,20 @@ Value listtransactions(const Array& params, bool fHelp)
         nFrom = ret.size();
     if ((nFrom + nCount) > (int)ret.size())
         nCount = ret.size() - nFrom;
+}
+
+Value listtransactions(const Array& params, bool fHelp)
+{
+    if (fHelp || params.size() > 4)
+        throw runtime_error(
+            "listtransactions [account] [count=10] [from=0] [assetid=-1]\n"
+            "Returns up to [count] most recent transactions skipping the first [from] transactions for account [account].\n"
+            "With [assetid] only entries of that asset are returned, -1 for all assets.");
+
+    Array ret;
+    int nFrom, nCount;
+    ListRecentTransactions(params, ret, nFrom, nCount);
+
     Array::iterator first = ret.begin();
     std::advance(first, nFrom);
     Array::iterator last = ret.begin();
@@ -1089,6 +1189,77 @@ Value listtransactions(const Array& params, bool fHelp)
     return ret;
 }
 
+void listtransactions_stream(const Array& params, CJSONStreamWriter& writer)
+{
+    if (params.size() > 4)
+        listtransactions(params, true);
+
+    string strAccount;
+    int nCount, nFrom;
+    int64_t nAssetId;
+    ListTransactionsParams(params, strAccount, nCount, nFrom, nAssetId);
+
+    // Entries are numbered newest first, as in ListRecentTransactions(). Count
+    // back to the oldest item that reaches into the page [nFrom, nFrom+nCount),
+    // keeping what is needed to find each item again: the transaction's hash,
+    // or a copy of the accounting entry (hash 0).
+    vector<pair<uint256, CAccountingEntry> > vItems; // newest first
+    int nEnd = 0; // number of entries of the items in vItems
+    {
+        LOCK2(cs_main, pwalletMain->cs_wallet);
+        const CWallet::TxItems& txOrdered = pwalletMain->OrderedTxItems(strAccount, nAssetId);
+        for (CWallet::TxItems::const_reverse_iterator it = txOrdered.rbegin(); it != txOrdered.rend(); ++it)
+        {
+            Array entries;
+            TxItemToJSON((*it).second, strAccount, nAssetId, entries);
+            nEnd += entries.size();
+            if ((*it).second.first)
+                vItems.push_back(make_pair((*it).second.first->GetHash(), CAccountingEntry()));
+            else
+                vItems.push_back(make_pair(uint256(0), *(*it).second.second));
+            if (nEnd >= nFrom + nCount)
+                break;
+        }
+    }
+
+    // Then write the page oldest to newest, a batch of items at a time
+    writer.beginArray();
+    vector<pair<uint256, CAccountingEntry> >::reverse_iterator itItem = vItems.rbegin();
+    while (itItem != vItems.rend() && nEnd > nFrom)
+    {
+        vector<Array> vEntries;
+        {
+            LOCK2(cs_main, pwalletMain->cs_wallet);
+            for (; itItem != vItems.rend() && vEntries.size() < RPC_STREAM_BATCH; ++itItem)
+            {
+                vEntries.push_back(Array());
+                CWalletTx* pwtx = NULL;
+                if ((*itItem).first != 0)
+                {
+                    map<uint256, CWalletTx>::iterator mi = pwalletMain->mapWallet.find((*itItem).first);
+                    if (mi == pwalletMain->mapWallet.end())
+                        continue;
+                    pwtx = &(*mi).second;
+                }
+                CWallet::TxPair item(pwtx, pwtx ? (CAccountingEntry*)0 : &(*itItem).second);
+                TxItemToJSON(item, strAccount, nAssetId, vEntries.back());
+            }
+        }
+
+        BOOST_FOREACH(const Array& entries, vEntries)
+        {
+            int nBegin = nEnd - entries.size();
+            for (int i = nEnd - 1; i >= nBegin; i--)
+            {
+                if (i >= nFrom && i < nFrom + nCount)
+                    writer.value(entries[i - nBegin]);
+            }
+            nEnd = nBegin;
+        }
+    }
+    writer.endArray();
+}
+
 Value listaccounts(const Array& params, bool fHelp)
 {
     if (fHelp || params.size() > 1)
@@ -1144,13 +1315,10 @@ Value listaccounts(const Array& params, bool fHelp)
     return ret;
 }
 
-Value listsinceblock(const Array& params, bool fHelp)
+// Collect the wallet transactions listsinceblock reports, in mapWallet order,
+// and return its "lastblock". Requires cs_main and cs_wallet.
+static uint256 ListSinceBlock(const Array& params, vector<uint256>& vHashes)
 {
-    if (fHelp)
-        throw runtime_error(
-            "listsinceblock [blockhash] [target-confirmations]\n"
-            "Get all transactions in blocks since block [blockhash], or all transactions if omitted");
-
     CBlockIndex *pindex = NULL;
     int target_confirms = 1;
 
@@ -1172,14 +1340,12 @@ Value listsinceblock(const Array& params, bool fHelp)
 
     int depth = pindex ? (1 + nBestHeight - pindex->nHeight) : -1;
 
-    Array transactions;
-
     for (map<uint256, CWalletTx>::iterator it = pwalletMain->mapWallet.begin(); it != pwalletMain->mapWallet.end(); it++)
     {
-        CWalletTx tx = (*it).second;
+        const CWalletTx& tx = (*it).second;
 
         if (depth == -1 || tx.GetDepthInMainChain() < depth)
-            ListTransactions(-1, tx, "*", 0, true, transactions);
+            vHashes.push_back((*it).first);
     }
 
     uint256 lastblock;
@@ -1200,6 +1366,23 @@ Value listsinceblock(const Array& params, bool fHelp)
         lastblock = block ? block->GetBlockHash() : 0;
     }
 
+    return lastblock;
+}
+
+Value listsinceblock(const Array& params, bool fHelp)
+{
+    if (fHelp)
+        throw runtime_error(
+            "listsinceblock [blockhash] [target-confirmations]\n"
+            "Get all transactions in blocks since block [blockhash], or all transactions if omitted");
+
+    vector<uint256> vHashes;
+    uint256 lastblock = ListSinceBlock(params, vHashes);
+
+    Array transactions;
+    BOOST_FOREACH(const uint256& hash, vHashes)
+        ListTransactions(-1, pwalletMain->mapWallet[hash], "*", 0, true, transactions);
+
     Object ret;
     ret.push_back(Pair("transactions", transactions));
     ret.push_back(Pair("lastblock", lastblock.GetHex()));
@@ -1207,6 +1390,38 @@ Value listsinceblock(const Array& params, bool fHelp)
     return ret;
 }
 
+void listsinceblock_stream(const Array& params, CJSONStreamWriter& writer)
+{
+    vector<uint256> vHashes;
+    uint256 lastblock;
+    {
+        LOCK2(cs_main, pwalletMain->cs_wallet);
+        lastblock = ListSinceBlock(params, vHashes);
+    }
+
+    writer.beginObject();
+    writer.key("transactions");
+    writer.beginArray();
+    for (unsigned int nBatch = 0; nBatch < vHashes.size(); nBatch += RPC_STREAM_BATCH)
+    {
+        Array entries;
+        {
+            LOCK2(cs_main, pwalletMain->cs_wallet);
+            for (unsigned int n = nBatch; n < vHashes.size() && n < nBatch + RPC_STREAM_BATCH; n++)
+            {
+                map<uint256, CWalletTx>::const_iterator mi = pwalletMain->mapWallet.find(vHashes[n]);
+                if (mi != pwalletMain->mapWallet.end())
+                    ListTransactions(-1, (*mi).second, "*", 0, true, entries);
+            }
+        }
+        BOOST_FOREACH(const Value& entry, entries)
+            writer.value(entry);
+    }
+    writer.endArray();
+    writer.pair("lastblock", lastblock.GetHex());
+    writer.endObject();
+}
+
 Value getasset(const Array& params, bool fHelp)
 {
     if (fHelp || params.size() != 1)
@@ -1328,8 +1543,10 @@ Value keypoolrefill(const Array& params, bool fHelp)
 
     EnsureWalletIsUnlocked();
 
+    // Runs without cs_wallet, which is only taken to commit each batch of keys
     pwalletMain->TopUpKeyPool(nSize);
 
+    LOCK(pwalletMain->cs_wallet);
     if (pwalletMain->GetKeyPoolSize() < nSize)
         throw JSONRPCError(RPC_WALLET_ERROR, "Error refreshing keypool.");
 
@@ -1375,7 +1592,7 @@ Value walletpassphrase(const Array& params, bool fHelp)
             "walletpassphrase <passphrase> <timeout>\n"
             "Stores the wallet decryption key in memory for <timeout> seconds.");
 
-    pwalletMain->TopUpKeyPool();
+    pwalletMain->StartKeyPoolRefill();
 
     int64_t nSleepTime = params[1].get_int64();
     LOCK(cs_nWalletUnlockTime);
@@ -1579,6 +1796,27 @@ Value resendtx(const Array& params, bool fHelp)
     return Value::null;
 }
 
+Value getwalletmemoryinfo(const Array& params, bool fHelp)
+{
+    if (fHelp || params.size() > 0)
+        throw runtime_error(
+            "getwalletmemoryinfo\n"
+            "Returns an estimate of the memory held by wallet transactions.\n");
+
+    CWalletMemoryUsage usage;
+    pwalletMain->GetMemoryUsage(usage);
+
+    Object result;
+    result.push_back(Pair("transactions",    usage.nTransactions));
+    result.push_back(Pair("txbytes",         usage.nTxBytes));
+    result.push_back(Pair("mapvaluebytes",   usage.nMapValueBytes));
+    result.push_back(Pair("supportingtxs",   usage.nSupportingTxs));
+    result.push_back(Pair("supportingbytes", usage.nSupportingBytes));
+    result.push_back(Pair("totalbytes",      usage.GetTotal()));
+    result.push_back(Pair("bytespertx",      usage.nTransactions ? usage.GetTotal() / usage.nTransactions : 0));
+    return result;
+}
+
 // ppcoin: make a public-private key pair
 Value makekeypair(const Array& params, bool fHelp)
 {
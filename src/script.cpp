@@ -20,25 +20,15 @@ using namespace boost;
 
 bool CheckSig(vector<unsigned char> vchSig, const vector<unsigned char> &vchPubKey, const CScript &scriptCode, const CTransaction& txTo, unsigned int nIn, int nHashType, int flags);
 
-static const valtype vchFalse(0);
-static const valtype vchZero(0);
-static const valtype vchTrue(1, 1);
-static const CBigNum bnZero(0);
-static const CBigNum bnOne(1);
-static const CBigNum bnFalse(0);
-static const CBigNum bnTrue(1);
-static const size_t nDefaultMaxNumSize = 4;
-
-
-CBigNum CastToBigNum(const valtype& vch, const size_t nMaxNumSize = nDefaultMaxNumSize)
-{
-    if (vch.size() > nMaxNumSize)
-        throw runtime_error("CastToBigNum() : overflow");
-    // Get rid of extra leading zeros
-    return CBigNum(CBigNum(vch).getvch());
-}
-
-bool CastToBool(const valtype& vch)
+static const stackvaltype vchFalse(0);
+static const stackvaltype vchZero(0);
+static const stackvaltype vchTrue(1, 1);
+static const CScriptNum bnZero(0);
+static const CScriptNum bnOne(1);
+static const CScriptNum bnFalse(0);
+static const CScriptNum bnTrue(1);
+
+bool CastToBool(const stackvaltype& vch)
 {
     for (unsigned int i = 0; i < vch.size(); i++)
     {
@@ -60,7 +50,7 @@ bool CastToBool(const valtype& vch)
 // resize process. MakeSameSize() is currently only used by the disabled
 // opcodes OP_AND, OP_OR, and OP_XOR.
 //
-void MakeSameSize(valtype& vch1, valtype& vch2)
+void MakeSameSize(stackvaltype& vch1, stackvaltype& vch2)
 {
     // Lengthen the shorter one
     if (vch1.size() < vch2.size())
@@ -87,7 +77,7 @@ void MakeSameSize(valtype& vch1, valtype& vch2)
 //
 #define stacktop(i)  (stack.at(stack.size()+(i)))
 #define altstacktop(i)  (altstack.at(altstack.size()+(i)))
-static inline void popstack(vector<valtype>& stack)
+static inline void popstack(vector<stackvaltype>& stack)
 {
     if (stack.empty())
         throw runtime_error("popstack() : stack empty");
@@ -360,7 +350,7 @@ bool static CheckPubKeyEncoding(const valtype &vchSig) {
     return true;
 }
 
-static bool CheckLockTime(const CTransaction& txTo, unsigned int nIn, const CBigNum& nLockTime)
+static bool CheckLockTime(const CTransaction& txTo, unsigned int nIn, const CScriptNum& nLockTime)
 {
     // There are two times of nLockTime: lock-by-blockheight
     // and lock-by-blocktime, distinguished by whether
@@ -396,16 +386,15 @@ static bool CheckLockTime(const CTransaction& txTo, unsigned int nIn, const CBig
     return true;
 }
 
-bool EvalScript(vector<vector<unsigned char> >& stack, const CScript& script, const CTransaction& txTo, unsigned int nIn, unsigned int flags, int nHashType)
+bool EvalScript(vector<stackvaltype>& stack, const CScript& script, const CTransaction& txTo, unsigned int nIn, unsigned int flags, int nHashType)
 {
-    CAutoBN_CTX pctx;
     CScript::const_iterator pc = script.begin();
     CScript::const_iterator pend = script.end();
     CScript::const_iterator pbegincodehash = script.begin();
     opcodetype opcode;
-    valtype vchPushValue;
+    stackvaltype vchPushValue;
     vector<bool> vfExec;
-    vector<valtype> altstack;
+    vector<stackvaltype> altstack;
     if (script.size() > 10000)
         return false;
     int nOpCount = 0;
@@ -471,8 +460,8 @@ bool EvalScript(vector<vector<unsigned char> >& stack, const CScript& script, co
                 case OP_16:
                 {
                     // ( -- value)
-                    CBigNum bn((int)opcode - (int)(OP_1 - 1));
-                    stack.push_back(bn.getvch());
+                    CScriptNum bn((int)opcode - (int)(OP_1 - 1));
+                    stack.push_back(bn.getstackval());
                 }
                 break;
 
@@ -510,7 +499,7 @@ bool EvalScript(vector<vector<unsigned char> >& stack, const CScript& script, co
                     // Thus as a special case we tell CScriptNum to accept up
                     // to 5-byte bignums, which are good until 2**32-1, the
                     // same limit as the nLockTime field itself.
-                    const CBigNum nLockTime = CastToBigNum(stacktop(-1), 5);
+                    const CScriptNum nLockTime(stacktop(-1), 5);
 
                     // In the rare event that the argument may be < 0 due to
                     // some arithmetic being done first, you can always use
@@ -542,7 +531,7 @@ bool EvalScript(vector<vector<unsigned char> >& stack, const CScript& script, co
                     {
                         if (stack.size() < 1)
                             return false;
-                        valtype& vch = stacktop(-1);
+                        stackvaltype& vch = stacktop(-1);
                         fValue = CastToBool(vch);
                         if (opcode == OP_NOTIF)
                             fValue = !fValue;
@@ -625,8 +614,8 @@ bool EvalScript(vector<vector<unsigned char> >& stack, const CScript& script, co
                     // (x1 x2 -- x1 x2 x1 x2)
                     if (stack.size() < 2)
                         return false;
-                    valtype vch1 = stacktop(-2);
-                    valtype vch2 = stacktop(-1);
+                    stackvaltype vch1 = stacktop(-2);
+                    stackvaltype vch2 = stacktop(-1);
                     stack.push_back(vch1);
                     stack.push_back(vch2);
                 }
@@ -637,9 +626,9 @@ bool EvalScript(vector<vector<unsigned char> >& stack, const CScript& script, co
                     // (x1 x2 x3 -- x1 x2 x3 x1 x2 x3)
                     if (stack.size() < 3)
                         return false;
-                    valtype vch1 = stacktop(-3);
-                    valtype vch2 = stacktop(-2);
-                    valtype vch3 = stacktop(-1);
+                    stackvaltype vch1 = stacktop(-3);
+                    stackvaltype vch2 = stacktop(-2);
+                    stackvaltype vch3 = stacktop(-1);
                     stack.push_back(vch1);
                     stack.push_back(vch2);
                     stack.push_back(vch3);
@@ -651,8 +640,8 @@ bool EvalScript(vector<vector<unsigned char> >& stack, const CScript& script, co
                     // (x1 x2 x3 x4 -- x1 x2 x3 x4 x1 x2)
                     if (stack.size() < 4)
                         return false;
-                    valtype vch1 = stacktop(-4);
-                    valtype vch2 = stacktop(-3);
+                    stackvaltype vch1 = stacktop(-4);
+                    stackvaltype vch2 = stacktop(-3);
                     stack.push_back(vch1);
                     stack.push_back(vch2);
                 }
@@ -663,8 +652,8 @@ bool EvalScript(vector<vector<unsigned char> >& stack, const CScript& script, co
                     // (x1 x2 x3 x4 x5 x6 -- x3 x4 x5 x6 x1 x2)
                     if (stack.size() < 6)
                         return false;
-                    valtype vch1 = stacktop(-6);
-                    valtype vch2 = stacktop(-5);
+                    stackvaltype vch1 = stacktop(-6);
+                    stackvaltype vch2 = stacktop(-5);
                     stack.erase(stack.end()-6, stack.end()-4);
                     stack.push_back(vch1);
                     stack.push_back(vch2);
@@ -686,7 +675,7 @@ bool EvalScript(vector<vector<unsigned char> >& stack, const CScript& script, co
                     // (x - 0 | x x)
                     if (stack.size() < 1)
                         return false;
-                    valtype vch = stacktop(-1);
+                    stackvaltype vch = stacktop(-1);
                     if (CastToBool(vch))
                         stack.push_back(vch);
                 }
@@ -695,8 +684,8 @@ bool EvalScript(vector<vector<unsigned char> >& stack, const CScript& script, co
                 case OP_DEPTH:
                 {
                     // -- stacksize
-                    CBigNum bn(stack.size());
-                    stack.push_back(bn.getvch());
+                    CScriptNum bn(stack.size());
+                    stack.push_back(bn.getstackval());
                 }
                 break;
 
@@ -714,7 +703,7 @@ bool EvalScript(vector<vector<unsigned char> >& stack, const CScript& script, co
                     // (x -- x x)
                     if (stack.size() < 1)
                         return false;
-                    valtype vch = stacktop(-1);
+                    stackvaltype vch = stacktop(-1);
                     stack.push_back(vch);
                 }
                 break;
@@ -733,7 +722,7 @@ bool EvalScript(vector<vector<unsigned char> >& stack, const CScript& script, co
                     // (x1 x2 -- x1 x2 x1)
                     if (stack.size() < 2)
                         return false;
-                    valtype vch = stacktop(-2);
+                    stackvaltype vch = stacktop(-2);
                     stack.push_back(vch);
                 }
                 break;
@@ -745,11 +734,11 @@ bool EvalScript(vector<vector<unsigned char> >& stack, const CScript& script, co
                     // (xn ... x2 x1 x0 n - ... x2 x1 x0 xn)
                     if (stack.size() < 2)
                         return false;
-                    int n = CastToBigNum(stacktop(-1)).getint();
+                    int n = CScriptNum(stacktop(-1)).getint();
                     popstack(stack);
                     if (n < 0 || n >= (int)stack.size())
                         return false;
-                    valtype vch = stacktop(-n-1);
+                    stackvaltype vch = stacktop(-n-1);
                     if (opcode == OP_ROLL)
                         stack.erase(stack.end()-n-1);
                     stack.push_back(vch);
@@ -782,7 +771,7 @@ bool EvalScript(vector<vector<unsigned char> >& stack, const CScript& script, co
                     // (x1 x2 -- x2 x1 x2)
                     if (stack.size() < 2)
                         return false;
-                    valtype vch = stacktop(-1);
+                    stackvaltype vch = stacktop(-1);
                     stack.insert(stack.end()-2, vch);
                 }
                 break;
@@ -796,8 +785,8 @@ bool EvalScript(vector<vector<unsigned char> >& stack, const CScript& script, co
                     // (x1 x2 -- out)
                     if (stack.size() < 2)
                         return false;
-                    valtype& vch1 = stacktop(-2);
-                    valtype& vch2 = stacktop(-1);
+                    stackvaltype& vch1 = stacktop(-2);
+                    stackvaltype& vch2 = stacktop(-1);
                     vch1.insert(vch1.end(), vch2.begin(), vch2.end());
                     popstack(stack);
                     if (stacktop(-1).size() > MAX_SCRIPT_ELEMENT_SIZE)
@@ -810,9 +799,9 @@ bool EvalScript(vector<vector<unsigned char> >& stack, const CScript& script, co
                     // (in begin size -- out)
                     if (stack.size() < 3)
                         return false;
-                    valtype& vch = stacktop(-3);
-                    int nBegin = CastToBigNum(stacktop(-2)).getint();
-                    int nEnd = nBegin + CastToBigNum(stacktop(-1)).getint();
+                    stackvaltype& vch = stacktop(-3);
+                    int nBegin = CScriptNum(stacktop(-2)).getint();
+                    int nEnd = nBegin + CScriptNum(stacktop(-1)).getint();
                     if (nBegin < 0 || nEnd < nBegin)
                         return false;
                     if (nBegin > (int)vch.size())
@@ -832,8 +821,8 @@ bool EvalScript(vector<vector<unsigned char> >& stack, const CScript& script, co
                     // (in size -- out)
                     if (stack.size() < 2)
                         return false;
-                    valtype& vch = stacktop(-2);
-                    int nSize = CastToBigNum(stacktop(-1)).getint();
+                    stackvaltype& vch = stacktop(-2);
+                    int nSize = CScriptNum(stacktop(-1)).getint();
                     if (nSize < 0)
                         return false;
                     if (nSize > (int)vch.size())
@@ -851,8 +840,8 @@ bool EvalScript(vector<vector<unsigned char> >& stack, const CScript& script, co
                     // (in -- in size)
                     if (stack.size() < 1)
                         return false;
-                    CBigNum bn(stacktop(-1).size());
-                    stack.push_back(bn.getvch());
+                    CScriptNum bn(stacktop(-1).size());
+                    stack.push_back(bn.getstackval());
                 }
                 break;
 
@@ -865,7 +854,7 @@ bool EvalScript(vector<vector<unsigned char> >& stack, const CScript& script, co
                     // (in - out)
                     if (stack.size() < 1)
                         return false;
-                    valtype& vch = stacktop(-1);
+                    stackvaltype& vch = stacktop(-1);
                     for (unsigned int i = 0; i < vch.size(); i++)
                         vch[i] = ~vch[i];
                 }
@@ -883,8 +872,8 @@ bool EvalScript(vector<vector<unsigned char> >& stack, const CScript& script, co
                     // (x1 x2 - out)
                     if (stack.size() < 2)
                         return false;
-                    valtype& vch1 = stacktop(-2);
-                    valtype& vch2 = stacktop(-1);
+                    stackvaltype& vch1 = stacktop(-2);
+                    stackvaltype& vch2 = stacktop(-1);
                     MakeSameSize(vch1, vch2); // <-- NOT SAFE FOR SIGNED VALUES
                     if (opcode == OP_AND)
                     {
@@ -912,8 +901,8 @@ bool EvalScript(vector<vector<unsigned char> >& stack, const CScript& script, co
                     // (x1 x2 - bool)
                     if (stack.size() < 2)
                         return false;
-                    valtype& vch1 = stacktop(-2);
-                    valtype& vch2 = stacktop(-1);
+                    stackvaltype& vch1 = stacktop(-2);
+                    stackvaltype& vch2 = stacktop(-1);
                     bool fEqual = (vch1 == vch2);
                     // OP_NOTEQUAL is disabled because it would be too easy to say
                     // something like n != 1 and have some wiseguy pass in 1 with extra
@@ -939,8 +928,6 @@ bool EvalScript(vector<vector<unsigned char> >& stack, const CScript& script, co
                 //
                 case OP_1ADD:
                 case OP_1SUB:
-                case OP_2MUL:
-                case OP_2DIV:
                 case OP_NEGATE:
                 case OP_ABS:
                 case OP_NOT:
@@ -949,13 +936,11 @@ bool EvalScript(vector<vector<unsigned char> >& stack, const CScript& script, co
                     // (in -- out)
                     if (stack.size() < 1)
                         return false;
-                    CBigNum bn = CastToBigNum(stacktop(-1));
+                    CScriptNum bn(stacktop(-1));
                     switch (opcode)
                     {
                     case OP_1ADD:       bn += bnOne; break;
                     case OP_1SUB:       bn -= bnOne; break;
-                    case OP_2MUL:       bn <<= 1; break;
-                    case OP_2DIV:       bn >>= 1; break;
                     case OP_NEGATE:     bn = -bn; break;
                     case OP_ABS:        if (bn < bnZero) bn = -bn; break;
                     case OP_NOT:        bn = (bn == bnZero); break;
@@ -963,17 +948,12 @@ bool EvalScript(vector<vector<unsigned char> >& stack, const CScript& script, co
                     default:            assert(!"invalid opcode"); break;
                     }
                     popstack(stack);
-                    stack.push_back(bn.getvch());
+                    stack.push_back(bn.getstackval());
                 }
                 break;
 
                 case OP_ADD:
                 case OP_SUB:
-                case OP_MUL:
-                case OP_DIV:
-                case OP_MOD:
-                case OP_LSHIFT:
-                case OP_RSHIFT:
                 case OP_BOOLAND:
                 case OP_BOOLOR:
                 case OP_NUMEQUAL:
@@ -989,9 +969,9 @@ bool EvalScript(vector<vector<unsigned char> >& stack, const CScript& script, co
                     // (x1 x2 -- out)
                     if (stack.size() < 2)
                         return false;
-                    CBigNum bn1 = CastToBigNum(stacktop(-2));
-                    CBigNum bn2 = CastToBigNum(stacktop(-1));
-                    CBigNum bn;
+                    CScriptNum bn1(stacktop(-2));
+                    CScriptNum bn2(stacktop(-1));
+                    CScriptNum bn(0);
                     switch (opcode)
                     {
                     case OP_ADD:
@@ -1002,33 +982,6 @@ bool EvalScript(vector<vector<unsigned char> >& stack, const CScript& script, co
                         bn = bn1 - bn2;
                         break;
 
-                    case OP_MUL:
-                        if (!BN_mul(&bn, &bn1, &bn2, pctx))
-                            return false;
-                        break;
-
-                    case OP_DIV:
-                        if (!BN_div(&bn, NULL, &bn1, &bn2, pctx))
-                            return false;
-                        break;
-
-                    case OP_MOD:
-                        if (!BN_mod(&bn, &bn1, &bn2, pctx))
-                            return false;
-                        break;
-
-                    case OP_LSHIFT:
-                        if (bn2 < bnZero || bn2 > CBigNum(2048))
-                            return false;
-                        bn = bn1 << bn2.getulong();
-                        break;
-
-                    case OP_RSHIFT:
-                        if (bn2 < bnZero || bn2 > CBigNum(2048))
-                            return false;
-                        bn = bn1 >> bn2.getulong();
-                        break;
-
                     case OP_BOOLAND:             bn = (bn1 != bnZero && bn2 != bnZero); break;
                     case OP_BOOLOR:              bn = (bn1 != bnZero || bn2 != bnZero); break;
                     case OP_NUMEQUAL:            bn = (bn1 == bn2); break;
@@ -1044,7 +997,7 @@ bool EvalScript(vector<vector<unsigned char> >& stack, const CScript& script, co
                     }
                     popstack(stack);
                     popstack(stack);
-                    stack.push_back(bn.getvch());
+                    stack.push_back(bn.getstackval());
 
                     if (opcode == OP_NUMEQUALVERIFY)
                     {
@@ -1061,9 +1014,9 @@ bool EvalScript(vector<vector<unsigned char> >& stack, const CScript& script, co
                     // (x min max -- out)
                     if (stack.size() < 3)
                         return false;
-                    CBigNum bn1 = CastToBigNum(stacktop(-3));
-                    CBigNum bn2 = CastToBigNum(stacktop(-2));
-                    CBigNum bn3 = CastToBigNum(stacktop(-1));
+                    CScriptNum bn1(stacktop(-3));
+                    CScriptNum bn2(stacktop(-2));
+                    CScriptNum bn3(stacktop(-1));
                     bool fValue = (bn2 <= bn1 && bn1 < bn3);
                     popstack(stack);
                     popstack(stack);
@@ -1085,8 +1038,8 @@ bool EvalScript(vector<vector<unsigned char> >& stack, const CScript& script, co
                     // (in -- hash)
                     if (stack.size() < 1)
                         return false;
-                    valtype& vch = stacktop(-1);
-                    valtype vchHash((opcode == OP_RIPEMD160 || opcode == OP_SHA1 || opcode == OP_HASH160) ? 20 : 32);
+                    stackvaltype& vch = stacktop(-1);
+                    stackvaltype vchHash((opcode == OP_RIPEMD160 || opcode == OP_SHA1 || opcode == OP_HASH160) ? 20 : 32);
                     if (opcode == OP_RIPEMD160)
                         RIPEMD160(&vch[0], vch.size(), &vchHash[0]);
                     else if (opcode == OP_SHA1)
@@ -1095,7 +1048,7 @@ bool EvalScript(vector<vector<unsigned char> >& stack, const CScript& script, co
                         SHA256(&vch[0], vch.size(), &vchHash[0]);
                     else if (opcode == OP_HASH160)
                     {
-                        uint160 hash160 = Hash160(vch);
+                        uint160 hash160 = Hash160(vch.begin(), vch.end());
                         memcpy(&vchHash[0], &hash160, sizeof(hash160));
                     }
                     else if (opcode == OP_HASH256)
@@ -1122,8 +1075,8 @@ bool EvalScript(vector<vector<unsigned char> >& stack, const CScript& script, co
                     if (stack.size() < 2)
                         return false;
 
-                    valtype& vchSig    = stacktop(-2);
-                    valtype& vchPubKey = stacktop(-1);
+                    valtype vchSig(stacktop(-2).begin(), stacktop(-2).end());
+                    valtype vchPubKey(stacktop(-1).begin(), stacktop(-1).end());
 
                     // Subset of script starting at the most recent codeseparator
                     CScript scriptCode(pbegincodehash, pend);
@@ -1159,7 +1112,7 @@ bool EvalScript(vector<vector<unsigned char> >& stack, const CScript& script, co
                     if ((int)stack.size() < i)
                         return false;
 
-                    int nKeysCount = CastToBigNum(stacktop(-i)).getint();
+                    int nKeysCount = CScriptNum(stacktop(-i)).getint();
                     if (nKeysCount < 0 || nKeysCount > 20)
                         return false;
                     nOpCount += nKeysCount;
@@ -1170,7 +1123,7 @@ bool EvalScript(vector<vector<unsigned char> >& stack, const CScript& script, co
                     if ((int)stack.size() < i)
                         return false;
 
-                    int nSigsCount = CastToBigNum(stacktop(-i)).getint();
+                    int nSigsCount = CScriptNum(stacktop(-i)).getint();
                     if (nSigsCount < 0 || nSigsCount > nKeysCount)
                         return false;
                     int isig = ++i;
@@ -1184,15 +1137,15 @@ bool EvalScript(vector<vector<unsigned char> >& stack, const CScript& script, co
                     // Drop the signatures, since there's no way for a signature to sign itself
                     for (int k = 0; k < nSigsCount; k++)
                     {
-                        valtype& vchSig = stacktop(-isig-k);
-                        scriptCode.FindAndDelete(CScript(vchSig));
+                        const stackvaltype& vchSig = stacktop(-isig-k);
+                        scriptCode.FindAndDelete(CScript(valtype(vchSig.begin(), vchSig.end())));
                     }
 
                     bool fSuccess = true;
                     while (fSuccess && nSigsCount > 0)
                     {
-                        valtype& vchSig    = stacktop(-isig);
-                        valtype& vchPubKey = stacktop(-ikey);
+                        valtype vchSig(stacktop(-isig).begin(), stacktop(-isig).end());
+                        valtype vchPubKey(stacktop(-ikey).begin(), stacktop(-ikey).end());
 
                         if ((flags & SCRIPT_VERIFY_STRICTENC) && (!CheckSignatureEncoding(vchSig, flags) || !CheckPubKeyEncoding(vchPubKey)))
                             return false;
@@ -1836,10 +1789,225 @@ bool ExtractDestinations(const CScript& scriptPubKey, txnouttype& typeRet, vecto
     return true;
 }
 
+//
+// Fast path for the standard script templates.
+//
+// Push-only scriptSigs are parsed in place and the P2PKH, P2PK and multisig
+// scriptPubKeys (bare or wrapped in P2SH) are checked directly against the
+// parsed pushes, without building an EvalScript stack. Every step mirrors
+// what EvalScript would do with the same inputs, so the verdict is identical
+// under any combination of SCRIPT_VERIFY_* flags. Anything unusual falls back
+// to the generic interpreter.
+//
+static const unsigned int MAX_TEMPLATE_PUSHES = 20;
+
+class CPushRef
+{
+public:
+    CScript::const_iterator pbegin;
+    CScript::const_iterator pend;
+
+    unsigned int size() const { return pend - pbegin; }
+    valtype get() const { return valtype(pbegin, pend); }
+};
+
+static bool ParsePushes(const CScript& script, CPushRef* vPush, unsigned int& nPush)
+{
+    nPush = 0;
+    if (script.size() > 10000)
+        return false;
+    CScript::const_iterator pc = script.begin();
+    while (pc < script.end())
+    {
+        CScript::const_iterator pstart = pc;
+        opcodetype opcode;
+        if (!script.GetOp(pc, opcode))
+            return false;
+        if (opcode > OP_PUSHDATA4 || nPush >= MAX_TEMPLATE_PUSHES)
+            return false;
+        unsigned int nHeader = 1;
+        if (opcode == OP_PUSHDATA1)
+            nHeader = 2;
+        else if (opcode == OP_PUSHDATA2)
+            nHeader = 3;
+        else if (opcode == OP_PUSHDATA4)
+            nHeader = 5;
+        vPush[nPush].pbegin = pstart + nHeader;
+        vPush[nPush].pend = pc;
+        if (vPush[nPush].size() > MAX_SCRIPT_ELEMENT_SIZE)
+            return false;
+        nPush++;
+    }
+    return true;
+}
+
+static bool CheckSigPush(const CPushRef& sig, const CPushRef& pubkey, const CScript& script,
+                         const CTransaction& txTo, unsigned int nIn, unsigned int flags, int nHashType)
+{
+    valtype vchSig = sig.get();
+    valtype vchPubKey = pubkey.get();
+
+    CScript scriptCode(script);
+    scriptCode.FindAndDelete(CScript(vchSig));
+
+    return CheckSignatureEncoding(vchSig, flags) && CheckPubKeyEncoding(vchPubKey) &&
+        CheckSig(vchSig, vchPubKey, scriptCode, txTo, nIn, nHashType, flags);
+}
+
+static bool EvalMultisigTemplate(const CPushRef* vStack, unsigned int nStack, const CScript& script,
+                                 const CTransaction& txTo, unsigned int nIn, unsigned int flags, int nHashType, bool& fResult)
+{
+    // OP_m [pubkey ...] OP_n OP_CHECKMULTISIG with n matching the number of keys
+    if (script.size() < 3 || script.back() != OP_CHECKMULTISIG)
+        return false;
+    opcodetype opM = (opcodetype)script[0];
+    opcodetype opN = (opcodetype)script[script.size() - 2];
+    if (opM < OP_1 || opM > OP_16 || opN < OP_1 || opN > OP_16)
+        return false;
+
+    CPushRef vKeys[16];
+    int nKeys = 0;
+    CScript::const_iterator pc = script.begin() + 1;
+    CScript::const_iterator pkeysend = script.end() - 2;
+    while (pc < pkeysend)
+    {
+        unsigned int nSize = *pc;
+        if (nSize < 1 || nSize >= OP_PUSHDATA1 || nKeys >= 16 || (unsigned int)(pkeysend - pc) <= nSize)
+            return false;
+        vKeys[nKeys].pbegin = pc + 1;
+        vKeys[nKeys].pend = pc + 1 + nSize;
+        nKeys++;
+        pc += 1 + nSize;
+    }
+    if (pc != pkeysend || nKeys != CScript::DecodeOP_N(opN))
+        return false;
+
+    // Same evaluation order as OP_CHECKMULTISIG in EvalScript
+    int nKeysCount = nKeys;
+    int nSigsCount = CScript::DecodeOP_N(opM);
+    fResult = false;
+    if (nSigsCount > nKeysCount || (int)nStack < nSigsCount + 1)
+        return true;
+
+    CScript scriptCode(script);
+    for (int k = 0; k < nSigsCount; k++)
+        scriptCode.FindAndDelete(CScript(vStack[nStack - 1 - k].get()));
+
+    int isig = nStack - 1;
+    int ikey = nKeys - 1;
+    int nDummy = nStack - 1 - nSigsCount;
+    bool fSuccess = true;
+    while (fSuccess && nSigsCount > 0)
+    {
+        valtype vchSig = vStack[isig].get();
+        valtype vchPubKey = vKeys[ikey].get();
+
+        if ((flags & SCRIPT_VERIFY_STRICTENC) && (!CheckSignatureEncoding(vchSig, flags) || !CheckPubKeyEncoding(vchPubKey)))
+            return true;
+
+        bool fOk = CheckSignatureEncoding(vchSig, flags) && CheckPubKeyEncoding(vchPubKey) &&
+            CheckSig(vchSig, vchPubKey, scriptCode, txTo, nIn, nHashType, flags);
+
+        if (fOk)
+        {
+            isig--;
+            nSigsCount--;
+        }
+        ikey--;
+        nKeysCount--;
+
+        if (nSigsCount > nKeysCount)
+            fSuccess = false;
+    }
+
+    if ((flags & SCRIPT_VERIFY_NULLDUMMY) && vStack[nDummy].size())
+    {
+        error("CHECKMULTISIG dummy argument not null");
+        return true;
+    }
+
+    fResult = fSuccess;
+    return true;
+}
+
+static bool EvalTemplate(const CPushRef* vStack, unsigned int nStack, const CScript& script,
+                         const CTransaction& txTo, unsigned int nIn, unsigned int flags, int nHashType, bool& fResult)
+{
+    // Pay to pubkey hash: OP_DUP OP_HASH160 <20 bytes> OP_EQUALVERIFY OP_CHECKSIG
+    if (script.size() == 25 && script[0] == OP_DUP && script[1] == OP_HASH160 && script[2] == 20 &&
+        script[23] == OP_EQUALVERIFY && script[24] == OP_CHECKSIG)
+    {
+        fResult = false;
+        if (nStack < 2)
+            return true;
+        const CPushRef& pubkey = vStack[nStack - 1];
+        uint160 hash = Hash160(pubkey.pbegin, pubkey.pend);
+        if (memcmp(&hash, &script[3], 20) != 0)
+            return true;
+        fResult = CheckSigPush(vStack[nStack - 2], pubkey, script, txTo, nIn, flags, nHashType);
+        return true;
+    }
+
+    // Pay to pubkey: <pubkey> OP_CHECKSIG
+    if (script.size() >= 3 && script[0] < OP_PUSHDATA1 && script.size() == (unsigned int)script[0] + 2 &&
+        script.back() == OP_CHECKSIG)
+    {
+        fResult = false;
+        if (nStack < 1)
+            return true;
+        CPushRef pubkey;
+        pubkey.pbegin = script.begin() + 1;
+        pubkey.pend = script.end() - 1;
+        fResult = CheckSigPush(vStack[nStack - 1], pubkey, script, txTo, nIn, flags, nHashType);
+        return true;
+    }
+
+    return EvalMultisigTemplate(vStack, nStack, script, txTo, nIn, flags, nHashType, fResult);
+}
+
+bool VerifyScriptTemplate(const CScript& scriptSig, const CScript& scriptPubKey, const CTransaction& txTo, unsigned int nIn,
+                          unsigned int flags, int nHashType, bool& fResult)
+{
+    CPushRef vPush[MAX_TEMPLATE_PUSHES];
+    unsigned int nPush;
+    if (!ParsePushes(scriptSig, vPush, nPush))
+        return false;
+
+    if (scriptPubKey.IsPayToScriptHash())
+    {
+        if (nPush < 1)
+        {
+            fResult = false;
+            return true;
+        }
+        const CPushRef& redeem = vPush[nPush - 1];
+        uint160 hash = Hash160(redeem.pbegin, redeem.pend);
+        if (memcmp(&hash, &scriptPubKey[2], 20) != 0)
+        {
+            fResult = false;
+            return true;
+        }
+        CScript subscript(redeem.pbegin, redeem.pend);
+        return EvalTemplate(vPush, nPush - 1, subscript, txTo, nIn, flags, nHashType, fResult);
+    }
+
+    return EvalTemplate(vPush, nPush, scriptPubKey, txTo, nIn, flags, nHashType, fResult);
+}
+
 bool VerifyScript(const CScript& scriptSig, const CScript& scriptPubKey, const CTransaction& txTo, unsigned int nIn,
                   unsigned int flags, int nHashType)
 {
-    vector<vector<unsigned char> > stack, stackCopy;
+    bool fResult;
+    if (VerifyScriptTemplate(scriptSig, scriptPubKey, txTo, nIn, flags, nHashType, fResult))
+        return fResult;
+
+    return VerifyScriptGeneric(scriptSig, scriptPubKey, txTo, nIn, flags, nHashType);
+}
+
+bool VerifyScriptGeneric(const CScript& scriptSig, const CScript& scriptPubKey, const CTransaction& txTo, unsigned int nIn,
+                         unsigned int flags, int nHashType)
+{
+    vector<stackvaltype> stack, stackCopy;
     if (!EvalScript(stack, scriptSig, txTo, nIn, flags, nHashType))
         return false;
 
@@ -1859,7 +2027,7 @@ bool VerifyScript(const CScript& scriptSig, const CScript& scriptPubKey, const C
         if (!scriptSig.IsPushOnly()) // scriptSig must be literals-only
             return false;            // or validation fails
 
-        const valtype& pubKeySerialized = stackCopy.back();
+        const stackvaltype& pubKeySerialized = stackCopy.back();
         CScript pubKey2(pubKeySerialized.begin(), pubKeySerialized.end());
         popstack(stackCopy);
 
@@ -1901,7 +2069,7 @@ bool SignSignature(const CKeyStore &keystore, const CScript& fromPubKey, CTransa
         bool fSolved =
             Solver(keystore, subscript, hash2, nHashType, txin.scriptSig, subType) && subType != TX_SCRIPTHASH;
         // Append serialized subscript whether or not it is completely signed:
-        txin.scriptSig << static_cast<valtype>(subscript);
+        txin.scriptSig << valtype(subscript.begin(), subscript.end());
         if (!fSolved) return false;
     }
 
@@ -2049,12 +2217,18 @@ CScript CombineSignatures(CScript scriptPubKey, const CTransaction& txTo, unsign
     vector<vector<unsigned char> > vSolutions;
     Solver(scriptPubKey, txType, vSolutions);
 
-    vector<valtype> stack1;
+    vector<stackvaltype> stack1;
     EvalScript(stack1, scriptSig1, CTransaction(), 0, SCRIPT_VERIFY_NONE, 0);
-    vector<valtype> stack2;
+    vector<stackvaltype> stack2;
     EvalScript(stack2, scriptSig2, CTransaction(), 0, SCRIPT_VERIFY_NONE, 0);
 
-    return CombineSignatures(scriptPubKey, txTo, nIn, txType, vSolutions, stack1, stack2);
+    vector<valtype> sigs1, sigs2;
+    BOOST_FOREACH(const stackvaltype& v, stack1)
+        sigs1.push_back(valtype(v.begin(), v.end()));
+    BOOST_FOREACH(const stackvaltype& v, stack2)
+        sigs2.push_back(valtype(v.begin(), v.end()));
+
+    return CombineSignatures(scriptPubKey, txTo, nIn, txType, vSolutions, sigs1, sigs2);
 }
 
 unsigned int CScript::GetSigOpCount(bool fAccurate) const
@@ -2109,9 +2283,9 @@ bool CScript::IsPayToScriptHash() const
 {
     // Extra-fast test for pay-to-script-hash CScripts:
     return (this->size() == 23 &&
-            this->at(0) == OP_HASH160 &&
-            this->at(1) == 0x14 &&
-            this->at(22) == OP_EQUAL);
+            (*this)[0] == OP_HASH160 &&
+            (*this)[1] == 0x14 &&
+            (*this)[22] == OP_EQUAL);
 }
 
 bool CScript::HasCanonicalPushes() const
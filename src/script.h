@@ -6,9 +6,12 @@
 #ifndef H_BITCOIN_SCRIPT
 #define H_BITCOIN_SCRIPT
 
+#include <limits>
+#include <stdexcept>
 #include <string>
 #include <vector>
 
+#include <assert.h>
 #include <stdint.h>
 
 #include <boost/foreach.hpp>
@@ -16,10 +19,16 @@
 
 #include "keystore.h"
 #include "bignum.h"
+#include "prevector.h"
 #include "util.h"
 
 typedef std::vector<unsigned char> valtype;
 
+/** Element of the script interpreter stacks. Like CScriptBase, values of up to
+ *  28 bytes (numbers, booleans, hashes) are stored inline.
+ */
+typedef prevector<28, unsigned char> stackvaltype;
+
 class CTransaction;
 
 static const unsigned int MAX_SCRIPT_ELEMENT_SIZE = 520; // bytes
@@ -259,22 +268,196 @@ const char* GetOpName(opcodetype opcode);
 
 
 
+class scriptnum_error : public std::runtime_error
+{
+public:
+    explicit scriptnum_error(const std::string& str) : std::runtime_error(str) {}
+};
+
+/** Script number with the exact semantics the interpreter had when it used
+ *  CBigNum, backed by an int64_t instead of an OpenSSL BIGNUM.
+ *
+ *  Numeric opcodes only accept operands of up to 4 bytes, i.e. in the range
+ *  [-2^31+1, 2^31-1], but their results may overflow that range. Such results
+ *  are still valid stack elements as long as they are not used in a later
+ *  numeric operation, which is why the value is kept in 64 bits. Decoding an
+ *  operand that is too long throws scriptnum_error.
+ *
+ *  Encoding is little-endian sign-magnitude with the minimal number of bytes;
+ *  zero is the empty vector. Non-minimal encodings (extra zero bytes, negative
+ *  zero) are accepted on input and normalised.
+ */
+class CScriptNum
+{
+public:
+    static const size_t nDefaultMaxNumSize = 4;
+
+    explicit CScriptNum(const int64_t& n)
+    {
+        m_value = n;
+    }
+
+    explicit CScriptNum(const std::vector<unsigned char>& vch, const size_t nMaxNumSize = nDefaultMaxNumSize)
+    {
+        if (vch.size() > nMaxNumSize)
+            throw scriptnum_error("CScriptNum() : overflow");
+        m_value = set_vch(vch.begin(), vch.end());
+    }
+
+    explicit CScriptNum(const stackvaltype& vch, const size_t nMaxNumSize = nDefaultMaxNumSize)
+    {
+        if (vch.size() > nMaxNumSize)
+            throw scriptnum_error("CScriptNum() : overflow");
+        m_value = set_vch(vch.begin(), vch.end());
+    }
+
+    inline bool operator==(const int64_t& rhs) const    { return m_value == rhs; }
+    inline bool operator!=(const int64_t& rhs) const    { return m_value != rhs; }
+    inline bool operator<=(const int64_t& rhs) const    { return m_value <= rhs; }
+    inline bool operator< (const int64_t& rhs) const    { return m_value <  rhs; }
+    inline bool operator>=(const int64_t& rhs) const    { return m_value >= rhs; }
+    inline bool operator> (const int64_t& rhs) const    { return m_value >  rhs; }
+
+    inline bool operator==(const CScriptNum& rhs) const { return operator==(rhs.m_value); }
+    inline bool operator!=(const CScriptNum& rhs) const { return operator!=(rhs.m_value); }
+    inline bool operator<=(const CScriptNum& rhs) const { return operator<=(rhs.m_value); }
+    inline bool operator< (const CScriptNum& rhs) const { return operator< (rhs.m_value); }
+    inline bool operator>=(const CScriptNum& rhs) const { return operator>=(rhs.m_value); }
+    inline bool operator> (const CScriptNum& rhs) const { return operator> (rhs.m_value); }
+
+    inline CScriptNum operator+(const int64_t& rhs) const    { return CScriptNum(m_value + rhs); }
+    inline CScriptNum operator-(const int64_t& rhs) const    { return CScriptNum(m_value - rhs); }
+    inline CScriptNum operator+(const CScriptNum& rhs) const { return operator+(rhs.m_value); }
+    inline CScriptNum operator-(const CScriptNum& rhs) const { return operator-(rhs.m_value); }
+
+    inline CScriptNum& operator+=(const CScriptNum& rhs)     { return operator+=(rhs.m_value); }
+    inline CScriptNum& operator-=(const CScriptNum& rhs)     { return operator-=(rhs.m_value); }
+
+    inline CScriptNum operator-() const
+    {
+        assert(m_value != std::numeric_limits<int64_t>::min());
+        return CScriptNum(-m_value);
+    }
+
+    inline CScriptNum& operator=(const int64_t& rhs)
+    {
+        m_value = rhs;
+        return *this;
+    }
+
+    inline CScriptNum& operator+=(const int64_t& rhs)
+    {
+        assert(rhs == 0 || (rhs > 0 && m_value <= std::numeric_limits<int64_t>::max() - rhs) ||
+                           (rhs < 0 && m_value >= std::numeric_limits<int64_t>::min() - rhs));
+        m_value += rhs;
+        return *this;
+    }
+
+    inline CScriptNum& operator-=(const int64_t& rhs)
+    {
+        assert(rhs == 0 || (rhs > 0 && m_value >= std::numeric_limits<int64_t>::min() + rhs) ||
+                           (rhs < 0 && m_value <= std::numeric_limits<int64_t>::max() + rhs));
+        m_value -= rhs;
+        return *this;
+    }
+
+    // Saturates at the int range, like CBigNum::getint()
+    int getint() const
+    {
+        if (m_value > std::numeric_limits<int>::max())
+            return std::numeric_limits<int>::max();
+        else if (m_value < std::numeric_limits<int>::min())
+            return std::numeric_limits<int>::min();
+        return m_value;
+    }
+
+    int64_t getint64() const
+    {
+        return m_value;
+    }
+
+    std::vector<unsigned char> getvch() const
+    {
+        std::vector<unsigned char> vch;
+        serialize(m_value, vch);
+        return vch;
+    }
+
+    stackvaltype getstackval() const
+    {
+        stackvaltype vch;
+        serialize(m_value, vch);
+        return vch;
+    }
+
+    template<typename T>
+    static void serialize(const int64_t& value, T& result)
+    {
+        result.clear();
+        if (value == 0)
+            return;
+
+        const bool neg = value < 0;
+        uint64_t absvalue = neg ? -(uint64_t)value : (uint64_t)value;
+
+        while (absvalue)
+        {
+            result.push_back(absvalue & 0xff);
+            absvalue >>= 8;
+        }
+
+        // - If the most significant byte is >= 0x80 and the value is positive, push a
+        //   new zero-byte to make the significant byte < 0x80 again.
+        // - If the most significant byte is >= 0x80 and the value is negative, push a
+        //   new 0x80 byte that will be popped off when converting to an integral.
+        // - If the most significant byte is < 0x80 and the value is negative, add
+        //   0x80 to it, since it will be subtracted and interpreted as a negative when
+        //   converting to an integral.
+        if (result.back() & 0x80)
+            result.push_back(neg ? 0x80 : 0);
+        else if (neg)
+            result.back() |= 0x80;
+    }
+
+private:
+    template<typename Iterator>
+    static int64_t set_vch(Iterator first, Iterator last)
+    {
+        if (first == last)
+            return 0;
+
+        int64_t result = 0;
+        size_t nSize = last - first;
+        for (size_t i = 0; i != nSize; ++i)
+            result |= static_cast<int64_t>(first[i]) << 8*i;
+
+        // If the input vector's most significant byte is 0x80, remove it from
+        // the result's msb and return a negative.
+        if (first[nSize - 1] & 0x80)
+            return -((int64_t)(result & ~(0x80ULL << (8 * (nSize - 1)))));
+
+        return result;
+    }
+
+    int64_t m_value;
+};
+
 inline std::string ValueString(const std::vector<unsigned char>& vch)
 {
     if (vch.size() <= 4)
-        return strprintf("%d", CBigNum(vch).getint());
+        return strprintf("%d", CScriptNum(vch).getint());
     else
         return HexStr(vch);
 }
 
-inline std::string StackString(const std::vector<std::vector<unsigned char> >& vStack)
+inline std::string StackString(const std::vector<stackvaltype>& vStack)
 {
     std::string str;
-    BOOST_FOREACH(const std::vector<unsigned char>& vch, vStack)
+    BOOST_FOREACH(const stackvaltype& vch, vStack)
     {
         if (!str.empty())
             str += " ";
-        str += ValueString(vch);
+        str += ValueString(std::vector<unsigned char>(vch.begin(), vch.end()));
     }
     return str;
 }
@@ -287,7 +470,7 @@ inline std::string StackString(const std::vector<std::vector<unsigned char> >& v
 
 
 /** Serialized script, used inside transaction inputs and outputs */
-class CScript : public std::vector<unsigned char>
+class CScript : public CScriptBase
 {
 protected:
     CScript& push_int64(int64_t n)
@@ -298,8 +481,7 @@ protected:
         }
         else
         {
-            CBigNum bn(n);
-            *this << bn.getvch();
+            *this << CScriptNum(n).getvch();
         }
         return *this;
     }
@@ -310,6 +492,10 @@ protected:
         {
             push_back(n + (OP_1 - 1));
         }
+        else if (n <= (uint64_t)std::numeric_limits<int64_t>::max())
+        {
+            *this << CScriptNum((int64_t)n).getvch();
+        }
         else
         {
             CBigNum bn(n);
@@ -320,11 +506,9 @@ protected:
 
 public:
     CScript() { }
-    CScript(const CScript& b) : std::vector<unsigned char>(b.begin(), b.end()) { }
-    CScript(const_iterator pbegin, const_iterator pend) : std::vector<unsigned char>(pbegin, pend) { }
-#ifndef _MSC_VER
-    CScript(const unsigned char* pbegin, const unsigned char* pend) : std::vector<unsigned char>(pbegin, pend) { }
-#endif
+    CScript(const CScript& b) : CScriptBase(b.begin(), b.end()) { }
+    CScript(const_iterator pbegin, const_iterator pend) : CScriptBase(pbegin, pend) { }
+    CScript(std::vector<unsigned char>::const_iterator pbegin, std::vector<unsigned char>::const_iterator pend) : CScriptBase(pbegin, pend) { }
 
     CScript& operator+=(const CScript& b)
     {
@@ -406,6 +590,12 @@ public:
         return *this;
     }
 
+    CScript& operator<<(const CScriptNum& b)
+    {
+        *this << b.getvch();
+        return *this;
+    }
+
     CScript& operator<<(const std::vector<unsigned char>& b)
     {
         if (b.size() < OP_PUSHDATA1)
@@ -454,7 +644,7 @@ public:
     bool GetOp(iterator& pc, opcodetype& opcodeRet)
     {
          const_iterator pc2 = pc;
-         bool fRet = GetOp2(pc2, opcodeRet, NULL);
+         bool fRet = GetOp2(pc2, opcodeRet, (std::vector<unsigned char>*)NULL);
          pc = begin() + (pc2 - begin());
          return fRet;
     }
@@ -466,10 +656,17 @@ public:
 
     bool GetOp(const_iterator& pc, opcodetype& opcodeRet) const
     {
-        return GetOp2(pc, opcodeRet, NULL);
+        return GetOp2(pc, opcodeRet, (std::vector<unsigned char>*)NULL);
+    }
+
+    // Read the pushed data straight into an interpreter stack element
+    bool GetOp(const_iterator& pc, opcodetype& opcodeRet, stackvaltype& vchRet) const
+    {
+        return GetOp2(pc, opcodeRet, &vchRet);
     }
 
-    bool GetOp2(const_iterator& pc, opcodetype& opcodeRet, std::vector<unsigned char>* pvchRet) const
+    template<typename T>
+    bool GetOp2(const_iterator& pc, opcodetype& opcodeRet, T* pvchRet) const
     {
         opcodeRet = OP_INVALIDOPCODE;
         if (pvchRet)
@@ -625,13 +822,13 @@ public:
 
     CScriptID GetID() const
     {
-        return CScriptID(Hash160(*this));
+        return CScriptID(Hash160(begin(), end()));
     }
 
     void clear()
     {
-        // The default std::vector::clear() does not release memory.
-        std::vector<unsigned char>().swap(*this);
+        // The default prevector::clear() does not release memory
+        CScriptBase().swap(*this);
     }
 };
 
@@ -712,7 +909,7 @@ public:
 bool IsDERSignature(const valtype &vchSig, bool haveHashType = true);
 bool IsLowDERSignature(const valtype &vchSig, bool haveHashType = true);
 bool IsCompressedOrUncompressedPubKey(const valtype &vchPubKey);
-bool EvalScript(std::vector<std::vector<unsigned char> >& stack, const CScript& script, const CTransaction& txTo, unsigned int nIn, unsigned int flags, int nHashType);
+bool EvalScript(std::vector<stackvaltype>& stack, const CScript& script, const CTransaction& txTo, unsigned int nIn, unsigned int flags, int nHashType);
 bool Solver(const CScript& scriptPubKey, txnouttype& typeRet, std::vector<std::vector<unsigned char> >& vSolutionsRet);
 int ScriptSigArgsExpected(txnouttype t, const std::vector<std::vector<unsigned char> >& vSolutions);
 bool IsStandard(const CScript& scriptPubKey, txnouttype& whichType);
@@ -725,6 +922,13 @@ bool SignSignature(const CKeyStore& keystore, const CScript& fromPubKey, CTransa
 bool SignSignature(const CKeyStore& keystore, const CTransaction& txFrom, CTransaction& txTo, unsigned int nIn, int nHashType=SIGHASH_ALL);
 bool VerifyScript(const CScript& scriptSig, const CScript& scriptPubKey, const CTransaction& txTo, unsigned int nIn,
                    unsigned int flags, int nHashType);
+// Verify P2PKH, P2PK and bare/P2SH multisig spends without running EvalScript.
+// Returns false if the scripts do not match a known template; otherwise
+// fResult holds the same verdict VerifyScriptGeneric would return.
+bool VerifyScriptTemplate(const CScript& scriptSig, const CScript& scriptPubKey, const CTransaction& txTo, unsigned int nIn,
+                          unsigned int flags, int nHashType, bool& fResult);
+bool VerifyScriptGeneric(const CScript& scriptSig, const CScript& scriptPubKey, const CTransaction& txTo, unsigned int nIn,
+                         unsigned int flags, int nHashType);
 bool VerifySignature(const CTransaction& txFrom, const CTransaction& txTo, unsigned int nIn, unsigned int flags, int nHashType);
 
 // Given two sets of signatures for scriptPubKey, possibly with OP_0 placeholders,
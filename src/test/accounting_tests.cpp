@@ -24,6 +24,7 @@ GetResults(CWalletDB& walletdb, std::map<int64, CAccountingEntry>& results)
 
 BOOST_AUTO_TEST_CASE(acc_orderupgrade)
 {
+    LOCK(pwalletMain->cs_wallet);
     CWalletDB walletdb(pwalletMain->strWalletFile);
     std::vector<CWalletTx*> vpwtx;
     CWalletTx wtx;
@@ -35,7 +36,7 @@ BOOST_AUTO_TEST_CASE(acc_orderupgrade)
     ae.nTime = 1333333333;
     ae.strOtherAccount = "b";
     ae.strComment = "";
-    walletdb.WriteAccountingEntry(ae);
+    pwalletMain->AddAccountingEntry(ae, walletdb);
 
     wtx.mapValue["comment"] = "z";
     pwalletMain->AddToWallet(wtx);
@@ -45,7 +46,7 @@ BOOST_AUTO_TEST_CASE(acc_orderupgrade)
 
     ae.nTime = 1333333336;
     ae.strOtherAccount = "c";
-    walletdb.WriteAccountingEntry(ae);
+    pwalletMain->AddAccountingEntry(ae, walletdb);
 
     GetResults(walletdb, results);
 
@@ -61,7 +62,7 @@ BOOST_AUTO_TEST_CASE(acc_orderupgrade)
     ae.nTime = 1333333330;
     ae.strOtherAccount = "d";
     ae.nOrderPos = pwalletMain->IncOrderPosNext();
-    walletdb.WriteAccountingEntry(ae);
+    pwalletMain->AddAccountingEntry(ae, walletdb);
 
     GetResults(walletdb, results);
 
@@ -103,7 +104,7 @@ BOOST_AUTO_TEST_CASE(acc_orderupgrade)
     ae.nTime = 1333333334;
     ae.strOtherAccount = "e";
     ae.nOrderPos = -1;
-    walletdb.WriteAccountingEntry(ae);
+    pwalletMain->AddAccountingEntry(ae, walletdb);
 
     GetResults(walletdb, results);
 
@@ -120,4 +121,56 @@ BOOST_AUTO_TEST_CASE(acc_orderupgrade)
     BOOST_CHECK(6 == vpwtx[1]->nOrderPos);
 }
 
+BOOST_AUTO_TEST_CASE(acc_orderedindex)
+{
+    LOCK(pwalletMain->cs_wallet);
+    CWalletDB walletdb(pwalletMain->strWalletFile);
+
+    CKey key;
+    key.MakeNewKey(true);
+    CTxDestination dest = key.GetPubKey().GetID();
+    pwalletMain->SetAddressBookName(dest, "label");
+
+    CWalletTx wtx;
+    wtx.vout.resize(1);
+    wtx.vout[0].nValue = 1;
+    wtx.vout[0].nAssetId = 7;
+    wtx.vout[0].scriptPubKey.SetDestination(dest);
+    pwalletMain->AddToWallet(wtx);
+    CWalletTx* pwtx = &pwalletMain->mapWallet[wtx.GetHash()];
+
+    CAccountingEntry ae;
+    ae.strAccount = "label";
+    ae.nCreditDebit = 1;
+    ae.nTime = 1333333337;
+    ae.strOtherAccount = "";
+    ae.nOrderPos = pwalletMain->IncOrderPosNext(&walletdb);
+    pwalletMain->AddAccountingEntry(ae, walletdb);
+
+    // Asset index: only the transaction paying asset 7
+    const CWallet::TxItems& txAsset = pwalletMain->OrderedTxItems("*", 7);
+    BOOST_CHECK(txAsset.size() == 1);
+    BOOST_CHECK(txAsset.begin()->second.first == pwtx);
+    BOOST_CHECK(pwalletMain->OrderedTxItems("*", 8).empty());
+
+    // Account index: the labelled output and the move, newest last
+    const CWallet::TxItems& txLabel = pwalletMain->OrderedTxItems("label");
+    BOOST_CHECK(txLabel.size() == 2);
+    BOOST_CHECK(txLabel.begin()->second.first == pwtx);
+    BOOST_CHECK(txLabel.rbegin()->second.second == &pwalletMain->laccentries.back());
+
+    // Relabelling moves the transaction to the new account
+    pwalletMain->SetAddressBookName(dest, "other");
+    BOOST_CHECK(pwalletMain->OrderedTxItems("label").size() == 1);
+    BOOST_CHECK(pwalletMain->OrderedTxItems("other").size() == 1);
+
+    // The full log holds everything exactly once
+    BOOST_CHECK(pwalletMain->OrderedTxItems().size() == pwalletMain->mapWallet.size() + pwalletMain->laccentries.size());
+
+    pwalletMain->EraseFromWallet(wtx.GetHash());
+    BOOST_CHECK(pwalletMain->OrderedTxItems("*", 7).empty());
+    BOOST_CHECK(pwalletMain->OrderedTxItems("other").empty());
+    BOOST_CHECK(pwalletMain->OrderedTxItems().size() == pwalletMain->mapWallet.size() + pwalletMain->laccentries.size());
+}
+
 BOOST_AUTO_TEST_SUITE_END()
@@ -0,0 +1,50 @@
+#include <boost/test/unit_test.hpp>
+
+#include "bloom.h"
+#include "util.h"
+
+#include <vector>
+
+using namespace std;
+
+BOOST_AUTO_TEST_SUITE(bloom_tests)
+
+BOOST_AUTO_TEST_CASE(rolling_bloom)
+{
+    CRollingBloomFilter filter(1000, 0.001);
+    vector<uint256> vHashes;
+    for (int i = 0; i < 3000; i++)
+    {
+        vHashes.push_back(GetRandHash());
+        filter.insert(vHashes.back());
+
+        // The last 1000 are always there
+        if (i >= 1000)
+            BOOST_CHECK(filter.contains(vHashes[i - 999]));
+    }
+    BOOST_CHECK(filter.contains(vHashes.back()));
+
+    // The first ones have rolled out, but for false positives
+    int nOld = 0;
+    for (int i = 0; i < 1000; i++)
+        if (filter.contains(vHashes[i]))
+            nOld++;
+    BOOST_CHECK(nOld < 10);
+
+    int nFalse = 0;
+    for (int i = 0; i < 10000; i++)
+        if (filter.contains(GetRandHash()))
+            nFalse++;
+    BOOST_CHECK(nFalse < 50);
+
+    // Fixed memory whatever goes in
+    size_t nMem = filter.GetMemoryUsage();
+    for (int i = 0; i < 10000; i++)
+        filter.insert(GetRandHash());
+    BOOST_CHECK_EQUAL(filter.GetMemoryUsage(), nMem);
+
+    filter.reset();
+    BOOST_CHECK(!filter.contains(vHashes.back()));
+}
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -0,0 +1,137 @@
+#include <boost/test/unit_test.hpp>
+
+#include "main.h"
+#include "txmempool.h"
+
+using namespace std;
+
+// A spend of output 0 of txPrev paying nFee
+static CTransaction Spend(const CTransaction& txPrev, int64_t nFee)
+{
+    CTransaction tx;
+    tx.vin.resize(1);
+    tx.vin[0].prevout = COutPoint(txPrev.GetHash(), 0);
+    tx.vin[0].scriptSig << OP_1;
+    tx.vout.resize(1);
+    tx.vout[0].nAssetId = 0;
+    tx.vout[0].nValue = txPrev.vout[0].nValue - nFee;
+    tx.vout[0].scriptPubKey << OP_TRUE;
+    return tx;
+}
+
+static CTransaction Confirmed(int n)
+{
+    CTransaction tx;
+    tx.nLockTime = n;
+    tx.vout.resize(1);
+    tx.vout[0].nAssetId = 0;
+    tx.vout[0].nValue = 10 * COIN;
+    tx.vout[0].scriptPubKey << OP_TRUE;
+    return tx;
+}
+
+static void Add(CTxMemPool& pool, CTransaction& tx, int64_t nFee, int64_t nTime = 1400000000)
+{
+    CTxMemPoolEntry entry(tx, 100, nTime);
+    entry.nFee = nFee;
+    pool.addUnchecked(tx.GetHash(), tx, entry);
+}
+
+BOOST_AUTO_TEST_SUITE(mempool_tests)
+
+BOOST_AUTO_TEST_CASE(mempool_links)
+{
+    CTxMemPool pool;
+    CTransaction txParent = Spend(Confirmed(1), CENT);
+    CTransaction txChild = Spend(txParent, CENT);
+    uint256 hashParent = txParent.GetHash();
+    uint256 hashChild = txChild.GetHash();
+
+    Add(pool, txParent, CENT);
+    Add(pool, txChild, CENT);
+    BOOST_CHECK(pool.mapEntry[hashParent].setChildren.count(hashChild));
+    BOOST_CHECK(pool.mapEntry[hashChild].setParents.count(hashParent));
+    BOOST_CHECK_EQUAL(pool.GetTotalTxSize(), pool.mapEntry[hashParent].nTxSize + pool.mapEntry[hashChild].nTxSize);
+
+    // Mined parent: the child now spends a confirmed transaction
+    pool.remove(txParent);
+    BOOST_CHECK_EQUAL(pool.size(), 1U);
+    BOOST_CHECK(pool.mapEntry[hashChild].setParents.empty());
+
+    // Disconnected again: back in the pool below its child
+    Add(pool, txParent, CENT);
+    BOOST_CHECK(pool.mapEntry[hashParent].setChildren.count(hashChild));
+    BOOST_CHECK(pool.mapEntry[hashChild].setParents.count(hashParent));
+
+    pool.remove(txParent, true);
+    BOOST_CHECK_EQUAL(pool.size(), 0U);
+    BOOST_CHECK(pool.mapEntry.empty());
+    BOOST_CHECK_EQUAL(pool.GetTotalTxSize(), 0U);
+}
+
+BOOST_AUTO_TEST_CASE(mempool_trim)
+{
+    CTxMemPool pool;
+    CTransaction txHigh = Spend(Confirmed(1), 10 * CENT);
+    CTransaction txLow = Spend(Confirmed(2), CENT);
+    CTransaction txLowChild = Spend(txLow, 20 * CENT);
+    Add(pool, txHigh, 10 * CENT);
+    Add(pool, txLow, CENT);
+    Add(pool, txLowChild, 20 * CENT);
+
+    // Nothing to do under the limit
+    vector<uint256> vRemoved;
+    pool.TrimToSize(pool.GetTotalTxSize(), vRemoved);
+    BOOST_CHECK(vRemoved.empty());
+
+    // The lowest fee rate goes first, taking what spends it along
+    pool.TrimToSize(pool.GetTotalTxSize() - 1, vRemoved);
+    BOOST_CHECK_EQUAL(vRemoved.size(), 2U);
+    BOOST_CHECK_EQUAL(pool.size(), 1U);
+    BOOST_CHECK(pool.exists(txHigh.GetHash()));
+    BOOST_CHECK_EQUAL(pool.GetTotalTxSize(), pool.mapEntry[txHigh.GetHash()].nTxSize);
+
+    pool.TrimToSize(0, vRemoved);
+    BOOST_CHECK_EQUAL(pool.size(), 0U);
+}
+
+BOOST_AUTO_TEST_CASE(mempool_expire)
+{
+    CTxMemPool pool;
+    CTransaction txOld = Spend(Confirmed(1), CENT);
+    CTransaction txOldChild = Spend(txOld, CENT);
+    CTransaction txNew = Spend(Confirmed(2), CENT);
+    Add(pool, txOld, CENT, 1000);
+    Add(pool, txOldChild, CENT, 3000);
+    Add(pool, txNew, CENT, 2000);
+
+    vector<uint256> vRemoved;
+    pool.Expire(1000, vRemoved);
+    BOOST_CHECK(vRemoved.empty());
+
+    // A child goes with its parent, however young
+    pool.Expire(1500, vRemoved);
+    BOOST_CHECK_EQUAL(vRemoved.size(), 2U);
+    BOOST_CHECK_EQUAL(pool.size(), 1U);
+    BOOST_CHECK(pool.exists(txNew.GetHash()));
+
+    pool.Expire(2001, vRemoved);
+    BOOST_CHECK_EQUAL(pool.size(), 0U);
+    BOOST_CHECK_EQUAL(vRemoved.size(), 3U);
+}
+
+BOOST_AUTO_TEST_CASE(mempool_entry)
+{
+    CTransaction tx = Spend(Confirmed(1), CENT);
+    CTxMemPoolEntry entry(tx, 100, 1400000000);
+    entry.nFee = CENT;
+    entry.nChainInputValue = 10 * COIN;
+    entry.dEntryPriority = 1000;
+    BOOST_CHECK_EQUAL(entry.nTxSize, ::GetSerializeSize(tx, SER_NETWORK, PROTOCOL_VERSION));
+    BOOST_CHECK_EQUAL(entry.GetMinerFee(), CENT);
+    BOOST_CHECK_EQUAL(entry.GetPriority(100), 1000.0);
+    // Priority ages with the confirmed inputs
+    BOOST_CHECK_EQUAL(entry.GetPriority(110), 1000.0 + 10.0 * 10 * COIN / entry.nTxSize);
+}
+
+BOOST_AUTO_TEST_SUITE_END()
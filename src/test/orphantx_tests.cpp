@@ -0,0 +1,102 @@
+#include <boost/test/unit_test.hpp>
+
+#include "main.h"
+
+using namespace std;
+
+// An orphan spending a made-up parent
+static CTransaction Orphan(int n, unsigned int nScriptSize = 10)
+{
+    CTransaction tx;
+    tx.vin.resize(1);
+    tx.vin[0].prevout = COutPoint(GetRandHash(), n);
+    tx.vin[0].scriptSig = CScript() << vector<unsigned char>(nScriptSize, 0x01);
+    tx.vout.resize(1);
+    tx.vout[0].nAssetId = 0;
+    tx.vout[0].nValue = COIN;
+    tx.vout[0].scriptPubKey << OP_TRUE;
+    return tx;
+}
+
+static void ClearOrphans()
+{
+    while (!mapOrphanTransactions.empty())
+        EraseOrphanTx(mapOrphanTransactions.begin()->first);
+}
+
+static unsigned int CountFrom(const CNetAddr& addr)
+{
+    unsigned int n = 0;
+    for (map<uint256, COrphanTx>::iterator it = mapOrphanTransactions.begin(); it != mapOrphanTransactions.end(); ++it)
+        if (it->second.addrFrom == addr)
+            n++;
+    return n;
+}
+
+BOOST_AUTO_TEST_SUITE(orphantx_tests)
+
+BOOST_AUTO_TEST_CASE(orphantx_index)
+{
+    ClearOrphans();
+    CNetAddr addr("1.2.3.4");
+    CTransaction tx = Orphan(0);
+    uint256 hash = tx.GetHash();
+    BOOST_CHECK(AddOrphanTx(tx, addr));
+    BOOST_CHECK(!AddOrphanTx(tx, addr));
+    BOOST_CHECK_EQUAL(mapOrphanTransactions[hash].nTxSize, ::GetSerializeSize(tx, SER_NETWORK, PROTOCOL_VERSION));
+    BOOST_CHECK(mapOrphanTransactionsByPrev[tx.vin[0].prevout].count(hash));
+
+    // Keyed by outpoint: another output of the same parent is not this orphan's
+    BOOST_CHECK(!mapOrphanTransactionsByPrev.count(COutPoint(tx.vin[0].prevout.hash, 1)));
+
+    EraseOrphanTx(hash);
+    BOOST_CHECK(mapOrphanTransactions.empty());
+    BOOST_CHECK(mapOrphanTransactionsByPrev.empty());
+
+    // Too big to keep
+    BOOST_CHECK(!AddOrphanTx(Orphan(0, MAX_ORPHAN_TX_SIZE), addr));
+    BOOST_CHECK(mapOrphanTransactions.empty());
+}
+
+BOOST_AUTO_TEST_CASE(orphantx_limits)
+{
+    ClearOrphans();
+    CNetAddr addrFlood("1.2.3.4");
+    CNetAddr addrOther("5.6.7.8");
+    for (int i = 0; i < 10; i++)
+        BOOST_CHECK(AddOrphanTx(Orphan(i), addrOther));
+    for (int i = 0; i < 50; i++)
+        BOOST_CHECK(AddOrphanTx(Orphan(i), addrFlood));
+
+    // The count limit: the flooding peer pays
+    BOOST_CHECK_EQUAL(LimitOrphanTxSize(40, 1000000), 20U);
+    BOOST_CHECK_EQUAL(CountFrom(addrOther), 10U);
+    BOOST_CHECK_EQUAL(CountFrom(addrFlood), 30U);
+
+    // The byte limit: evicting goes on until the peers hold about the same
+    uint64_t nBytes = 0;
+    for (map<uint256, COrphanTx>::iterator it = mapOrphanTransactions.begin(); it != mapOrphanTransactions.end(); ++it)
+        nBytes += it->second.nTxSize;
+    BOOST_CHECK_EQUAL(LimitOrphanTxSize(1000, nBytes / 2), 20U);
+    BOOST_CHECK_EQUAL(CountFrom(addrOther), 10U);
+    BOOST_CHECK_EQUAL(CountFrom(addrFlood), 10U);
+
+    BOOST_CHECK_EQUAL(LimitOrphanTxSize(0, 1000000), 20U);
+    BOOST_CHECK(mapOrphanTransactionsByPrev.empty());
+}
+
+BOOST_AUTO_TEST_CASE(orphantx_expire)
+{
+    ClearOrphans();
+    CNetAddr addr("1.2.3.4");
+    SetMockTime(GetTime());
+    for (int i = 0; i < 5; i++)
+        BOOST_CHECK(AddOrphanTx(Orphan(i), addr));
+
+    SetMockTime(GetTime() + ORPHAN_TX_EXPIRE_TIME + 1);
+    BOOST_CHECK_EQUAL(LimitOrphanTxSize(100, 1000000), 5U);
+    BOOST_CHECK(mapOrphanTransactions.empty());
+    SetMockTime(0);
+}
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -0,0 +1,104 @@
+#include <vector>
+#include <boost/test/unit_test.hpp>
+
+#include "prevector.h"
+#include "script.h"
+#include "serialize.h"
+#include "util.h"
+
+using namespace std;
+
+#define NUM_TESTS 64
+#define NUM_ACTIONS 200
+
+typedef prevector<28, unsigned char> pretype;
+typedef vector<unsigned char> realtype;
+
+class prevector_tester
+{
+private:
+    pretype pre;
+    realtype real;
+
+    void check()
+    {
+        BOOST_REQUIRE_EQUAL(pre.size(), real.size());
+        BOOST_CHECK(pre.size() <= 28 ? pre.allocated_memory() == 0 : pre.allocated_memory() >= pre.size());
+        for (unsigned int i = 0; i < real.size(); i++)
+            BOOST_CHECK_EQUAL(pre[i], real[i]);
+        BOOST_CHECK(realtype(pre.begin(), pre.end()) == real);
+
+        pretype copy(pre);
+        BOOST_CHECK(copy == pre);
+
+        // Serialized form must match std::vector byte for byte
+        CDataStream ssPre(SER_DISK, 0), ssReal(SER_DISK, 0);
+        ssPre << pre;
+        ssReal << real;
+        BOOST_CHECK(ssPre.str() == ssReal.str());
+        pretype unser;
+        ssPre >> unser;
+        BOOST_CHECK(unser == pre);
+    }
+
+public:
+    void push_back(unsigned char c) { pre.push_back(c); real.push_back(c); check(); }
+    void pop_back() { if (real.empty()) return; pre.pop_back(); real.pop_back(); check(); }
+    void resize(unsigned int n, unsigned char c) { pre.resize(n, c); real.resize(n, c); check(); }
+    void insert(unsigned int pos, unsigned char c) { pre.insert(pre.begin() + pos, c); real.insert(real.begin() + pos, c); check(); }
+    void insert(unsigned int pos, unsigned int n, unsigned char c) { pre.insert(pre.begin() + pos, n, c); real.insert(real.begin() + pos, n, c); check(); }
+    void insert_range(unsigned int pos, const realtype& v) { pre.insert(pre.begin() + pos, v.begin(), v.end()); real.insert(real.begin() + pos, v.begin(), v.end()); check(); }
+    void erase(unsigned int first, unsigned int last) { pre.erase(pre.begin() + first, pre.begin() + last); real.erase(real.begin() + first, real.begin() + last); check(); }
+    void shrink_to_fit() { pre.shrink_to_fit(); check(); }
+    void swap() { pretype tmp(real.begin(), real.end()); tmp.swap(pre); check(); }
+    void clear() { pre.clear(); real.clear(); check(); }
+    unsigned int size() const { return real.size(); }
+};
+
+BOOST_AUTO_TEST_SUITE(prevector_tests)
+
+// Test that a prevector behaves like a vector across the direct/indirect boundary
+BOOST_AUTO_TEST_CASE(prevector_like_vector)
+{
+    for (int nTest = 0; nTest < NUM_TESTS; nTest++)
+    {
+        prevector_tester test;
+        for (int nAction = 0; nAction < NUM_ACTIONS; nAction++)
+        {
+            unsigned char c = GetRandInt(256);
+            unsigned int pos = GetRandInt(test.size() + 1);
+            switch (GetRandInt(11))
+            {
+            case 0: test.push_back(c); break;
+            case 1: test.pop_back(); break;
+            case 2: test.resize(GetRandInt(70), c); break;
+            case 3: test.insert(pos, c); break;
+            case 4: test.insert(pos, GetRandInt(40), c); break;
+            case 5: test.insert_range(pos, realtype(GetRandInt(50), c)); break;
+            case 6: test.erase(pos, pos + GetRandInt(test.size() - pos + 1)); break;
+            case 7: test.shrink_to_fit(); break;
+            case 8: test.swap(); break;
+            case 9: if (GetRandInt(8) == 0) test.clear(); break;
+            case 10: test.insert_range(pos, realtype(1, c)); break;
+            }
+        }
+    }
+}
+
+// Scripts up to the inline capacity must not touch the heap
+BOOST_AUTO_TEST_CASE(prevector_script_inline)
+{
+    BOOST_CHECK_EQUAL(sizeof(pretype), 32U);
+
+    CScript script;
+    script << OP_DUP << OP_HASH160 << vector<unsigned char>(20, 0x01) << OP_EQUALVERIFY << OP_CHECKSIG;
+    BOOST_CHECK_EQUAL(script.size(), 25U);
+    BOOST_CHECK_EQUAL(script.allocated_memory(), 0U);
+
+    script << vector<unsigned char>(33, 0x02);
+    BOOST_CHECK(script.allocated_memory() >= script.size());
+    script.clear();
+    BOOST_CHECK_EQUAL(script.allocated_memory(), 0U);
+}
+
+BOOST_AUTO_TEST_SUITE_END()
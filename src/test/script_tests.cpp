@@ -0,0 +1,232 @@
+#include <algorithm>
+#include <vector>
+#include <boost/test/unit_test.hpp>
+#include <boost/foreach.hpp>
+
+#include "main.h"
+#include "script.h"
+#include "key.h"
+#include "keystore.h"
+
+using namespace std;
+
+// Every combination of the SCRIPT_VERIFY_* flags defined in script.h
+static const unsigned int ALL_VERIFY_FLAGS = (SCRIPT_VERIFY_CHECKLOCKTIMEVERIFY << 1) - 1;
+
+static CScript
+PushAll(const vector<valtype>& values)
+{
+    CScript result;
+    BOOST_FOREACH(const valtype& v, values)
+        result << v;
+    return result;
+}
+
+static vector<valtype>
+Pushes(const CScript& script)
+{
+    vector<valtype> values;
+    CScript::const_iterator pc = script.begin();
+    opcodetype opcode;
+    valtype vch;
+    while (script.GetOp(pc, opcode, vch))
+        values.push_back(vch);
+    return values;
+}
+
+// Check the template fast path against the generic interpreter under every flag
+// combination. Returns the number of flag combinations the fast path handled.
+static int
+CheckDifferential(const CScript& scriptSig, const CScript& scriptPubKey, const CTransaction& txTo, unsigned int nIn)
+{
+    int nHandled = 0;
+    for (unsigned int flags = 0; flags <= ALL_VERIFY_FLAGS; flags++)
+    {
+        bool fGeneric = VerifyScriptGeneric(scriptSig, scriptPubKey, txTo, nIn, flags, 0);
+        bool fFast;
+        if (VerifyScriptTemplate(scriptSig, scriptPubKey, txTo, nIn, flags, 0, fFast))
+        {
+            BOOST_CHECK_MESSAGE(fFast == fGeneric, strprintf("fast=%d generic=%d flags=%x scriptSig=%s scriptPubKey=%s",
+                                                             fFast, fGeneric, flags, scriptSig.ToString(), scriptPubKey.ToString()));
+            nHandled++;
+        }
+        BOOST_CHECK_EQUAL(VerifyScript(scriptSig, scriptPubKey, txTo, nIn, flags, 0), fGeneric);
+    }
+    return nHandled;
+}
+
+// Run the differential check over a signed scriptSig and a set of mangled variants.
+static void
+CheckVariants(const CScript& scriptSig, const CScript& scriptPubKey, const CTransaction& txTo, unsigned int nIn, bool fP2SH)
+{
+    const int nAll = ALL_VERIFY_FLAGS + 1;
+    BOOST_CHECK_EQUAL(CheckDifferential(scriptSig, scriptPubKey, txTo, nIn), nAll);
+    BOOST_CHECK(VerifyScript(scriptSig, scriptPubKey, txTo, nIn, STANDARD_SCRIPT_VERIFY_FLAGS, 0));
+
+    vector<valtype> vPush = Pushes(scriptSig);
+    valtype vchRedeem;
+    if (fP2SH)
+    {
+        vchRedeem = vPush.back();
+        vPush.pop_back();
+    }
+    vector<vector<valtype> > vVariants;
+
+    // Corrupt, truncate, re-type and empty each element in turn
+    for (unsigned int i = 0; i < vPush.size(); i++)
+    {
+        vector<valtype> v = vPush;
+        if (!v[i].empty())
+        {
+            v[i][v[i].size() / 2] ^= 0x01;
+            vVariants.push_back(v);
+
+            v = vPush;
+            v[i].back() = 0x05;
+            vVariants.push_back(v);
+
+            v = vPush;
+            v[i].back() = SIGHASH_ALL | SIGHASH_ANYONECANPAY;
+            vVariants.push_back(v);
+
+            v = vPush;
+            v[i].resize(v[i].size() - 1);
+            vVariants.push_back(v);
+        }
+        v = vPush;
+        v[i].push_back(0x00);
+        vVariants.push_back(v);
+
+        v = vPush;
+        v[i].clear();
+        vVariants.push_back(v);
+
+        v = vPush;
+        v.erase(v.begin() + i);
+        vVariants.push_back(v);
+    }
+
+    // Extra and reordered elements
+    {
+        vector<valtype> v = vPush;
+        v.insert(v.begin(), valtype(1, 0x01));
+        vVariants.push_back(v);
+
+        v = vPush;
+        v.push_back(valtype());
+        vVariants.push_back(v);
+
+        v = vPush;
+        reverse(v.begin(), v.end());
+        vVariants.push_back(v);
+
+        vVariants.push_back(vector<valtype>());
+    }
+
+    BOOST_FOREACH(vector<valtype>& v, vVariants)
+    {
+        if (fP2SH)
+            v.push_back(vchRedeem);
+        BOOST_CHECK_EQUAL(CheckDifferential(PushAll(v), scriptPubKey, txTo, nIn), nAll);
+    }
+
+    // Non-push scriptSigs are always left to the generic interpreter
+    CScript scriptNonPush = scriptSig;
+    scriptNonPush << OP_NOP;
+    BOOST_CHECK_EQUAL(CheckDifferential(scriptNonPush, scriptPubKey, txTo, nIn), 0);
+}
+
+BOOST_AUTO_TEST_SUITE(script_tests)
+
+BOOST_AUTO_TEST_CASE(script_template_differential)
+{
+    CBasicKeyStore keystore;
+    CKey key[4];
+    vector<CPubKey> pubkeys;
+    for (int i = 0; i < 4; i++)
+    {
+        key[i].MakeNewKey(i % 2 == 0);
+        keystore.AddKey(key[i]);
+        pubkeys.push_back(key[i].GetPubKey());
+    }
+
+    CScript scriptMulti;
+    scriptMulti.SetMultisig(2, vector<CPubKey>(pubkeys.begin(), pubkeys.begin() + 3));
+    CScript scriptMulti1of1;
+    scriptMulti1of1.SetMultisig(1, vector<CPubKey>(pubkeys.begin() + 3, pubkeys.end()));
+    CScript scriptPubKeyHash;
+    scriptPubKeyHash.SetDestination(pubkeys[1].GetID());
+
+    vector<CScript> vScriptPubKey;
+    vector<bool> vP2SH;
+
+    CScript s;
+    s.SetDestination(pubkeys[0].GetID());
+    vScriptPubKey.push_back(s); vP2SH.push_back(false);
+    s = CScript() << pubkeys[1] << OP_CHECKSIG;
+    vScriptPubKey.push_back(s); vP2SH.push_back(false);
+    vScriptPubKey.push_back(scriptMulti); vP2SH.push_back(false);
+    vScriptPubKey.push_back(scriptMulti1of1); vP2SH.push_back(false);
+
+    BOOST_FOREACH(const CScript& redeem, vector<CScript>(vScriptPubKey.begin(), vScriptPubKey.end()))
+    {
+        keystore.AddCScript(redeem);
+        s.SetDestination(redeem.GetID());
+        vScriptPubKey.push_back(s); vP2SH.push_back(true);
+    }
+
+    CTransaction txFrom;
+    BOOST_FOREACH(const CScript& scriptPubKey, vScriptPubKey)
+    {
+        CTxOut txout;
+        txout.nValue = 1000;
+        txout.scriptPubKey = scriptPubKey;
+        txFrom.vout.push_back(txout);
+    }
+
+    CTransaction txTo;
+    for (unsigned int i = 0; i < txFrom.vout.size(); i++)
+    {
+        CTxIn txin;
+        txin.prevout = COutPoint(txFrom.GetHash(), i);
+        txTo.vin.push_back(txin);
+    }
+    CTxOut txout;
+    txout.nValue = 1000;
+    txout.scriptPubKey = scriptPubKeyHash;
+    txTo.vout.push_back(txout);
+
+    for (unsigned int i = 0; i < txTo.vin.size(); i++)
+        BOOST_CHECK_MESSAGE(SignSignature(keystore, txFrom, txTo, i), strprintf("SignSignature %d", i));
+
+    for (unsigned int i = 0; i < txTo.vin.size(); i++)
+        CheckVariants(txTo.vin[i].scriptSig, vScriptPubKey[i], txTo, i, vP2SH[i]);
+
+    // Signatures checked against the wrong input never verify
+    for (unsigned int i = 1; i < txTo.vin.size(); i++)
+        CheckDifferential(txTo.vin[i - 1].scriptSig, vScriptPubKey[i], txTo, i);
+}
+
+BOOST_AUTO_TEST_CASE(script_template_unrecognised)
+{
+    CTransaction txTo;
+    txTo.vin.resize(1);
+    txTo.vout.resize(1);
+
+    // Non-standard scriptPubKeys fall back to EvalScript
+    CScript scriptSig = CScript() << OP_0;
+    bool fResult;
+    BOOST_CHECK(!VerifyScriptTemplate(scriptSig, CScript() << OP_DROP << OP_TRUE, txTo, 0, 0, 0, fResult));
+    BOOST_CHECK(VerifyScript(scriptSig, CScript() << OP_DROP << OP_TRUE, txTo, 0, 0, 0));
+    BOOST_CHECK(!VerifyScriptTemplate(scriptSig, CScript() << OP_1 << OP_2 << OP_CHECKMULTISIG, txTo, 0, 0, 0, fResult));
+
+    // Multisig with a key count that does not match the pushes
+    CKey key;
+    key.MakeNewKey(true);
+    CScript scriptBadMulti = CScript() << OP_1 << key.GetPubKey() << OP_2 << OP_CHECKMULTISIG;
+    BOOST_CHECK(!VerifyScriptTemplate(scriptSig, scriptBadMulti, txTo, 0, 0, 0, fResult));
+    BOOST_CHECK_EQUAL(VerifyScript(scriptSig, scriptBadMulti, txTo, 0, 0, 0),
+                      VerifyScriptGeneric(scriptSig, scriptBadMulti, txTo, 0, 0, 0));
+}
+
+BOOST_AUTO_TEST_SUITE_END()
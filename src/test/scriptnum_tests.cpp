@@ -0,0 +1,162 @@
+#include <boost/test/unit_test.hpp>
+#include <limits>
+#include <vector>
+
+#include "bignum.h"
+#include "script.h"
+#include "util.h"
+
+using namespace std;
+
+// CScriptNum replaced CBigNum in EvalScript. These tests check it against the
+// CBigNum operations the interpreter used to perform, so any difference in
+// encoding, decoding or arithmetic shows up as a consensus failure here.
+
+static const int64_t values[] = { 0, 1, -1, -2, 127, 128, -255, 256, (1LL << 15) - 1, -(1LL << 16),
+                                  (1LL << 24) - 1, (1LL << 31), 1 - (1LL << 32), 1LL << 40,
+                                  std::numeric_limits<int>::max(), std::numeric_limits<int>::min(),
+                                  std::numeric_limits<int64_t>::max(), std::numeric_limits<int64_t>::min() + 1 };
+
+// The old CastToBigNum(): decode and strip non-minimal encodings
+static CBigNum CastToBigNum(const vector<unsigned char>& vch)
+{
+    return CBigNum(CBigNum(vch).getvch());
+}
+
+static bool verify(const CBigNum& bignum, const CScriptNum& scriptnum)
+{
+    return bignum.getvch() == scriptnum.getvch() && bignum.getint() == scriptnum.getint();
+}
+
+static void CheckDecode(const vector<unsigned char>& vch)
+{
+    CBigNum bignum = CastToBigNum(vch);
+    CScriptNum scriptnum(vch, vch.size());
+    BOOST_CHECK_MESSAGE(verify(bignum, scriptnum), HexStr(vch));
+
+    // The stack encoding is the same as the vector one
+    stackvaltype stackval(vch.begin(), vch.end());
+    BOOST_CHECK(CScriptNum(stackval, vch.size()) == scriptnum);
+    BOOST_CHECK(scriptnum.getstackval() == stackvaltype(scriptnum.getvch().begin(), scriptnum.getvch().end()));
+}
+
+// Unary numeric opcodes, as formerly implemented with CBigNum
+static void CheckUnary(const vector<unsigned char>& vch)
+{
+    const CBigNum bnZero(0), bnOne(1);
+    CBigNum bignum = CastToBigNum(vch);
+    CScriptNum scriptnum(vch);
+
+    BOOST_CHECK(verify(bignum + bnOne, scriptnum + 1));
+    BOOST_CHECK(verify(bignum - bnOne, scriptnum - 1));
+    BOOST_CHECK(verify(-bignum, -scriptnum));
+    BOOST_CHECK(verify(bignum < bnZero ? -bignum : bignum, scriptnum < 0 ? -scriptnum : scriptnum));
+    BOOST_CHECK(verify(CBigNum(bignum == bnZero), CScriptNum(scriptnum == 0)));
+    BOOST_CHECK(verify(CBigNum(bignum != bnZero), CScriptNum(scriptnum != 0)));
+}
+
+// Binary numeric opcodes, as formerly implemented with CBigNum
+static void CheckBinary(const vector<unsigned char>& vch1, const vector<unsigned char>& vch2)
+{
+    const CBigNum bnZero(0);
+    CBigNum bn1 = CastToBigNum(vch1), bn2 = CastToBigNum(vch2);
+    CScriptNum sn1(vch1), sn2(vch2);
+
+    BOOST_CHECK(verify(bn1 + bn2, sn1 + sn2));
+    BOOST_CHECK(verify(bn1 - bn2, sn1 - sn2));
+    BOOST_CHECK(verify(CBigNum(bn1 != bnZero && bn2 != bnZero), CScriptNum(sn1 != 0 && sn2 != 0)));
+    BOOST_CHECK(verify(CBigNum(bn1 != bnZero || bn2 != bnZero), CScriptNum(sn1 != 0 || sn2 != 0)));
+    BOOST_CHECK((bn1 == bn2) == (sn1 == sn2));
+    BOOST_CHECK((bn1 != bn2) == (sn1 != sn2));
+    BOOST_CHECK((bn1 < bn2) == (sn1 < sn2));
+    BOOST_CHECK((bn1 > bn2) == (sn1 > sn2));
+    BOOST_CHECK((bn1 <= bn2) == (sn1 <= sn2));
+    BOOST_CHECK((bn1 >= bn2) == (sn1 >= sn2));
+    BOOST_CHECK(verify(bn1 < bn2 ? bn1 : bn2, sn1 < sn2 ? sn1 : sn2));
+    BOOST_CHECK(verify(bn1 > bn2 ? bn1 : bn2, sn1 > sn2 ? sn1 : sn2));
+}
+
+static vector<unsigned char> RandomVch(unsigned int nMaxSize)
+{
+    vector<unsigned char> vch(GetRandInt(nMaxSize + 1));
+    for (unsigned int i = 0; i < vch.size(); i++)
+        vch[i] = GetRandInt(256);
+    // Favour the interesting top byte values: sign bit, negative zero padding
+    if (!vch.empty() && GetRandInt(4) == 0)
+        vch.back() = GetRandInt(2) ? 0x80 : 0x00;
+    return vch;
+}
+
+BOOST_AUTO_TEST_SUITE(scriptnum_tests)
+
+BOOST_AUTO_TEST_CASE(scriptnum_creation)
+{
+    for (unsigned int i = 0; i < sizeof(values) / sizeof(values[0]); i++)
+    {
+        CBigNum bignum(values[i]);
+        CScriptNum scriptnum(values[i]);
+        BOOST_CHECK_MESSAGE(verify(bignum, scriptnum), strprintf("%d", values[i]));
+
+        vector<unsigned char> vch = bignum.getvch();
+        if (vch.size() <= 8)
+            CheckDecode(vch);
+
+        // Pushing a number encodes it the same way
+        BOOST_CHECK(CScript() << values[i] == CScript() << bignum || (values[i] >= -1 && values[i] <= 16));
+    }
+}
+
+// Every encoding of up to two bytes, including the non-minimal ones
+BOOST_AUTO_TEST_CASE(scriptnum_exhaustive)
+{
+    vector<unsigned char> vch;
+    CheckDecode(vch);
+    CheckUnary(vch);
+    for (unsigned int n = 0; n < 0x100; n++)
+    {
+        vch.assign(1, n);
+        CheckDecode(vch);
+        CheckUnary(vch);
+    }
+    for (unsigned int n = 0; n < 0x10000; n++)
+    {
+        vch.resize(2);
+        vch[0] = n & 0xff;
+        vch[1] = n >> 8;
+        CheckDecode(vch);
+        CheckUnary(vch);
+        CheckBinary(vch, vector<unsigned char>(1, n & 0xff));
+    }
+}
+
+BOOST_AUTO_TEST_CASE(scriptnum_random)
+{
+    for (int i = 0; i < 100000; i++)
+    {
+        vector<unsigned char> vch1 = RandomVch(4);
+        vector<unsigned char> vch2 = RandomVch(4);
+        CheckDecode(vch1);
+        CheckUnary(vch1);
+        CheckBinary(vch1, vch2);
+
+        // CHECKLOCKTIMEVERIFY accepts 5-byte operands
+        CheckDecode(RandomVch(5));
+    }
+}
+
+BOOST_AUTO_TEST_CASE(scriptnum_overflow)
+{
+    vector<unsigned char> vch(5, 0x01);
+    BOOST_CHECK_THROW(CScriptNum sn(vch), scriptnum_error);
+    BOOST_CHECK_EQUAL(CScriptNum(vch, 5).getint64(), 0x0101010101LL);
+    BOOST_CHECK_EQUAL(CScriptNum(vch, 5).getint(), std::numeric_limits<int>::max());
+
+    // Results may exceed four bytes but are still pushed in full
+    CScriptNum sn(vector<unsigned char>(4, 0xff));
+    BOOST_CHECK_EQUAL(sn.getint64(), -0x7fffffffLL);
+    BOOST_CHECK_EQUAL((sn - sn).getvch().size(), 0U);
+    BOOST_CHECK_EQUAL((sn + sn).getvch().size(), 5U);
+    BOOST_CHECK_THROW(CScriptNum((sn + sn).getvch()), scriptnum_error);
+}
+
+BOOST_AUTO_TEST_SUITE_END()
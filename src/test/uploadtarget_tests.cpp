@@ -0,0 +1,75 @@
+#include <boost/test/unit_test.hpp>
+
+#include "main.h"
+#include "net.h"
+#include "util.h"
+
+using namespace std;
+
+BOOST_AUTO_TEST_SUITE(uploadtarget_tests)
+
+BOOST_AUTO_TEST_CASE(upload_token_bucket)
+{
+    int64_t nNow = 1400000000LL * 1000000;
+
+    CTokenBucket unlimited;
+    unlimited.Spend(MAX_BLOCK_SIZE);
+    BOOST_CHECK(unlimited.CanSpend(nNow));
+    BOOST_CHECK_EQUAL(unlimited.WaitMicros(), 0);
+
+    // 1000 bytes per second, 10000 at once
+    CTokenBucket bucket(1000, 10000);
+    BOOST_CHECK(bucket.CanSpend(nNow));
+    BOOST_CHECK_EQUAL(bucket.nTokens, 10000);
+
+    // A block bigger than the burst still goes, and is paid back before the next
+    bucket.Spend(25000);
+    BOOST_CHECK(!bucket.CanSpend(nNow));
+    BOOST_CHECK(!bucket.CanSpend(nNow + 15 * 1000000));
+    BOOST_CHECK_EQUAL(bucket.nTokens, 0);
+    int64_t nWait = bucket.WaitMicros();
+    BOOST_CHECK(nWait > 0 && nWait <= 1000 + 1);
+    BOOST_CHECK(bucket.CanSpend(nNow + 15 * 1000000 + nWait));
+
+    // Idle time refills no more than the burst
+    BOOST_CHECK(bucket.CanSpend(nNow + 3600 * 1000000LL));
+    BOOST_CHECK_EQUAL(bucket.nTokens, 10000);
+}
+
+BOOST_AUTO_TEST_CASE(upload_target_cycle)
+{
+    int64_t nStart = GetTime();
+    SetMockTime(nStart);
+
+    CNode::SetMaxOutboundTarget(0);
+    CNode::RecordBytesSent(1000000000);
+    BOOST_CHECK(!CNode::OutboundTargetReached(false));
+    BOOST_CHECK(!CNode::OutboundTargetReached(true));
+
+    // A full day of new blocks is kept out of what historical blocks may use
+    uint64_t nBuffer = MAX_UPLOAD_TIMEFRAME / GetTargetSpacing(nBestHeight) * (uint64_t)MAX_BLOCK_SIZE_GEN;
+    uint64_t nTarget = nBuffer + 100000000;
+    CNode::SetMaxOutboundTarget(nTarget);
+    BOOST_CHECK_EQUAL(CNode::GetMaxOutboundTimeLeftInCycle(), MAX_UPLOAD_TIMEFRAME);
+    CNode::RecordBytesSent(60000000);
+    BOOST_CHECK(!CNode::OutboundTargetReached(true));
+    CNode::RecordBytesSent(60000000);
+    BOOST_CHECK(CNode::OutboundTargetReached(true));
+    BOOST_CHECK(!CNode::OutboundTargetReached(false));
+    BOOST_CHECK_EQUAL(CNode::GetOutboundTargetBytesLeft(), nTarget - 120000000);
+
+    // Less is kept as the cycle runs out
+    SetMockTime(nStart + MAX_UPLOAD_TIMEFRAME / 2);
+    BOOST_CHECK(!CNode::OutboundTargetReached(true));
+
+    // and a new cycle starts from nothing
+    SetMockTime(nStart + MAX_UPLOAD_TIMEFRAME + 1);
+    CNode::RecordBytesSent(1000);
+    BOOST_CHECK_EQUAL(CNode::GetOutboundTargetBytesLeft(), nTarget - 1000);
+    BOOST_CHECK_EQUAL(CNode::GetMaxOutboundTimeLeftInCycle(), MAX_UPLOAD_TIMEFRAME);
+
+    CNode::SetMaxOutboundTarget(0);
+    SetMockTime(0);
+}
+
+BOOST_AUTO_TEST_SUITE_END()
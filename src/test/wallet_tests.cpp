@@ -1,7 +1,9 @@
 #include <boost/test/unit_test.hpp>
 
+#include "init.h"
 #include "main.h"
 #include "wallet.h"
+#include "walletdb.h"
 
 // how many times to run all the tests to have a chance to catch errors that only show up with particular random shuffles
 #define RUN_TESTS 100
@@ -292,4 +294,351 @@ BOOST_AUTO_TEST_CASE(coin_selection_tests)
     }
 }
 
+BOOST_AUTO_TEST_CASE(bnb_selection_tests)
+{
+    vector<pair<int64_t, pair<const CWalletTx*,unsigned int> > > vValue;
+    vector<char> vfBest;
+    int64_t values[] = { 9, 7, 5, 5, 5, 3, 2 };
+    for (unsigned int i = 0; i < sizeof(values) / sizeof(values[0]); i++)
+        vValue.push_back(make_pair(values[i] * CENT, make_pair((const CWalletTx*)NULL, i)));
+
+    // Exact matches use as few coins as possible
+    BOOST_CHECK(SelectCoinsBnB(vValue, 14 * CENT, vfBest));
+    BOOST_CHECK_EQUAL(count(vfBest.begin(), vfBest.end(), true), 2);
+    BOOST_CHECK(SelectCoinsBnB(vValue, 36 * CENT, vfBest));
+    BOOST_CHECK_EQUAL(count(vfBest.begin(), vfBest.end(), true), 7);
+    BOOST_CHECK(SelectCoinsBnB(vValue, 1 * CENT + 9 * CENT, vfBest));
+    BOOST_CHECK_EQUAL(count(vfBest.begin(), vfBest.end(), true), 2);
+
+    // No exact match: leave it to the knapsack solver
+    BOOST_CHECK(!SelectCoinsBnB(vValue, 1 * CENT, vfBest));
+    BOOST_CHECK(!SelectCoinsBnB(vValue, 37 * CENT, vfBest));
+    BOOST_CHECK(!SelectCoinsBnB(vValue, 14 * CENT + 1, vfBest));
+
+    // SelectCoinsMinConf prefers the changeless match over a single larger coin
+    empty_wallet();
+    add_coin(6*CENT); add_coin(4*CENT); add_coin(3*CENT); add_coin(20*CENT);
+    CoinSet setCoinsRet;
+    int64_t nValueRet;
+    BOOST_CHECK(wallet.SelectCoinsMinConf(10*CENT, std::numeric_limits<unsigned int>::max(), 1, 6, vCoins, setCoinsRet, nValueRet));
+    BOOST_CHECK_EQUAL(nValueRet, 10*CENT);
+    BOOST_CHECK_EQUAL(setCoinsRet.size(), 2U);
+    empty_wallet();
+}
+
+BOOST_AUTO_TEST_CASE(unspent_index_tests)
+{
+    LOCK(wallet.cs_wallet);
+
+    CKey key;
+    key.MakeNewKey(true);
+    BOOST_CHECK(wallet.AddKeyPubKey(key, key.GetPubKey()));
+    CScript scriptMine;
+    scriptMine.SetDestination(key.GetPubKey().GetID());
+
+    CTransaction tx;
+    tx.vout.resize(3);
+    tx.vout[0].nValue = 1;
+    tx.vout[0].scriptPubKey = scriptMine;
+    tx.vout[1].nValue = 2;
+    tx.vout[1].nAssetId = 7;
+    tx.vout[1].scriptPubKey = scriptMine;
+    tx.vout[2].nValue = 3;
+    tx.vout[2].nAssetId = 7;
+    tx.vout[2].scriptPubKey = CScript() << OP_TRUE;
+    CWalletTx wtx(&wallet, tx);
+
+    // Only our outputs are indexed, by asset
+    wallet.UpdateUnspentIndex(wtx);
+    BOOST_CHECK_EQUAL(wallet.mapUnspentByAsset.size(), 2U);
+    BOOST_CHECK_EQUAL(wallet.mapUnspentByAsset[0].size(), 1U);
+    BOOST_CHECK_EQUAL(wallet.mapUnspentByAsset[7].size(), 1U);
+    BOOST_CHECK(wallet.mapUnspentByAsset[7].begin()->first == COutPoint(tx.GetHash(), 1));
+    BOOST_CHECK(wallet.mapUnspentByAsset[7].begin()->second == &wtx);
+
+    // Spent outputs and their empty partitions are dropped
+    wtx.MarkSpent(1);
+    wallet.UpdateUnspentIndex(wtx);
+    BOOST_CHECK(!wallet.mapUnspentByAsset.count(7));
+    wtx.MarkUnspent(1);
+    wallet.UpdateUnspentIndex(wtx);
+    BOOST_CHECK(wallet.mapUnspentByAsset.count(7));
+
+    wallet.UpdateUnspentIndex(wtx, false);
+    BOOST_CHECK(wallet.mapUnspentByAsset.empty());
+}
+
+BOOST_AUTO_TEST_CASE(scan_filter_tests)
+{
+    CBasicKeyStore keystore;
+    CKey key, keyOther;
+    key.MakeNewKey(true);
+    keyOther.MakeNewKey(false);
+    keystore.AddKey(key);
+    CScript scriptRedeem;
+    scriptRedeem.SetMultisig(1, std::vector<CPubKey>(1, key.GetPubKey()));
+    keystore.AddCScript(scriptRedeem);
+
+    CWalletScanFilter filter(keystore);
+    CTxOut txout;
+
+    // Keys and scripts of the keystore match
+    txout.scriptPubKey.SetDestination(key.GetPubKey().GetID());
+    BOOST_CHECK(filter.IsRelevant(txout));
+    txout.scriptPubKey = CScript() << key.GetPubKey() << OP_CHECKSIG;
+    BOOST_CHECK(filter.IsRelevant(txout));
+    txout.scriptPubKey.SetDestination(scriptRedeem.GetID());
+    BOOST_CHECK(filter.IsRelevant(txout));
+
+    // Other keys and scripts do not, whatever the key format
+    txout.scriptPubKey.SetDestination(keyOther.GetPubKey().GetID());
+    BOOST_CHECK(!filter.IsRelevant(txout));
+    txout.scriptPubKey = CScript() << keyOther.GetPubKey() << OP_CHECKSIG;
+    BOOST_CHECK(!filter.IsRelevant(txout));
+    txout.scriptPubKey.SetDestination(CScriptID(keyOther.GetPubKey().GetID()));
+    BOOST_CHECK(!filter.IsRelevant(txout));
+    txout.scriptPubKey = CScript();
+    BOOST_CHECK(!filter.IsRelevant(txout));
+    txout.scriptPubKey = CScript() << OP_RETURN << std::vector<unsigned char>(20, 1);
+    BOOST_CHECK(!filter.IsRelevant(txout));
+
+    // Bare multisig is left to IsMine()
+    txout.scriptPubKey = scriptRedeem;
+    BOOST_CHECK(filter.IsRelevant(txout));
+
+    // A transaction is relevant if any output is
+    CTransaction tx;
+    tx.vout.resize(2);
+    tx.vout[0].scriptPubKey.SetDestination(keyOther.GetPubKey().GetID());
+    BOOST_CHECK(!filter.IsRelevant(tx));
+    tx.vout[1].scriptPubKey.SetDestination(key.GetPubKey().GetID());
+    BOOST_CHECK(filter.IsRelevant(tx));
+}
+
+BOOST_AUTO_TEST_CASE(mine_filter_tests)
+{
+    CWalletMineFilter filter;
+    CKey key, keyOther;
+    key.MakeNewKey(true);
+    keyOther.MakeNewKey(true);
+    CTxOut txout;
+    txout.scriptPubKey.SetDestination(key.GetPubKey().GetID());
+
+    // Keys count from the moment they are added
+    BOOST_CHECK(!filter.MayBeMine(txout));
+    filter.AddKey(key.GetPubKey().GetID());
+    BOOST_CHECK(filter.MayBeMine(txout));
+    txout.scriptPubKey.SetDestination(keyOther.GetPubKey().GetID());
+    BOOST_CHECK(!filter.MayBeMine(txout));
+
+    // Inputs only pass if they spend a coin of the wallet
+    COutPoint outpoint(GetRandHash(), 1);
+    BOOST_CHECK(!filter.MayBeMine(outpoint));
+    filter.AddCoin(outpoint);
+    BOOST_CHECK(filter.MayBeMine(outpoint));
+    BOOST_CHECK(!filter.MayBeMine(COutPoint(outpoint.hash, 0)));
+    filter.RemoveCoin(outpoint);
+    BOOST_CHECK(!filter.MayBeMine(outpoint));
+
+    filter.CountFalsePositive();
+    CWalletMineFilterStats stats = filter.GetStats();
+    BOOST_CHECK_EQUAL(stats.nKeys, 1U);
+    BOOST_CHECK_EQUAL(stats.nCoins, 0U);
+    BOOST_CHECK_EQUAL(stats.nOutputChecks, 3U);
+    BOOST_CHECK_EQUAL(stats.nOutputsRejected, 2U);
+    BOOST_CHECK_EQUAL(stats.nInputChecks, 4U);
+    BOOST_CHECK_EQUAL(stats.nInputsRejected, 3U);
+    BOOST_CHECK_EQUAL(stats.nFalsePositives, 1U);
+}
+
+BOOST_AUTO_TEST_CASE(supporting_tx_tests)
+{
+    CWallet wallet;
+    LOCK(wallet.cs_wallet);
+
+    CWalletTx wtxParent(&wallet);
+    wtxParent.vout.resize(1);
+    wtxParent.vout[0].nValue = COIN;
+    uint256 hashParent = wtxParent.GetHash();
+    wallet.mapWallet[hashParent] = wtxParent;
+
+    CMerkleTx txForeign;
+    txForeign.nLockTime = 1;
+    txForeign.vout.resize(1);
+
+    CWalletTx wtx(&wallet);
+    wtx.vin.push_back(CTxIn(COutPoint(hashParent, 0)));
+    wtx.vin.push_back(CTxIn(COutPoint(txForeign.GetHash(), 0)));
+    wtx.vtxPrev.push_back(txForeign);
+    wallet.mapWallet[wtx.GetHash()] = wtx;
+
+    // Wallet parents are referenced in place, others come from the copies
+    BOOST_CHECK(wtx.GetSupportingTransaction(hashParent) == &wallet.mapWallet[hashParent]);
+    const CMerkleTx* ptx = wtx.GetSupportingTransaction(txForeign.GetHash());
+    BOOST_CHECK(ptx != NULL && ptx->GetHash() == txForeign.GetHash());
+    BOOST_CHECK(wtx.GetSupportingTransaction(GetRandHash()) == NULL);
+
+    CWalletMemoryUsage usage;
+    wallet.GetMemoryUsage(usage);
+    BOOST_CHECK_EQUAL(usage.nTransactions, 2U);
+    BOOST_CHECK_EQUAL(usage.nSupportingTxs, 1U);
+    BOOST_CHECK(usage.nSupportingBytes >= sizeof(CMerkleTx));
+    BOOST_CHECK(usage.nTxBytes >= 2 * sizeof(CWalletTx));
+}
+
+static CWalletTx* payout_coin(CWallet& wallet, int64_t nAssetId, int64_t nValue)
+{
+    static int i;
+    CWalletTx* wtx = new CWalletTx(&wallet);
+    wtx->nTime = 1;
+    wtx->nLockTime = i++;
+    wtx->vout.push_back(CTxOut(nAssetId, nValue, CScript() << OP_TRUE));
+    return wtx;
+}
+
+BOOST_AUTO_TEST_CASE(asset_payout_tests)
+{
+    CWallet wallet;
+    const int64_t nAssetId = 1002;
+    vector<COutput> vAssetCoins, vFeeCoins;
+    for (int i = 0; i < 40; i++)
+        vAssetCoins.push_back(COutput(payout_coin(wallet, nAssetId, 10 * COIN), 0, 6*24));
+    for (int i = 0; i < 20; i++)
+        vFeeCoins.push_back(COutput(payout_coin(wallet, 0, COIN), 0, 6*24));
+
+    vector<pair<CScript, int64_t> > vecSend;
+    for (int i = 0; i < 300; i++)
+    {
+        CScript script;
+        script.SetDestination(CKeyID(uint160(i + 1)));
+        vecSend.push_back(make_pair(script, COIN + i));
+    }
+    CScript scriptChange;
+    scriptChange.SetDestination(CKeyID(uint160(1000)));
+
+    vector<CWalletTx> vwtx;
+    vector<vector<pair<const CWalletTx*,unsigned int> > > vTxCoins;
+    int64_t nFee = 0;
+    string strFailReason;
+    BOOST_CHECK(wallet.BuildAssetPayout(nAssetId, vecSend, vAssetCoins, vFeeCoins, scriptChange,
+                                        vwtx, vTxCoins, nFee, strFailReason, 2000));
+
+    // The list is split, in order, and no coin is spent twice
+    BOOST_CHECK(vwtx.size() > 1);
+    BOOST_CHECK_EQUAL(vwtx.size(), vTxCoins.size());
+    set<COutPoint> setSpent;
+    unsigned int nPayee = 0;
+    int64_t nFeeSum = 0;
+    for (unsigned int i = 0; i < vwtx.size(); i++)
+    {
+        const CWalletTx& wtx = vwtx[i];
+        BOOST_CHECK_EQUAL(wtx.vin.size(), vTxCoins[i].size());
+        int64_t nIn = 0;
+        BOOST_FOREACH(const CTxIn& txin, wtx.vin)
+        {
+            BOOST_CHECK(setSpent.insert(txin.prevout).second);
+            BOOST_FOREACH(const COutput& out, vFeeCoins)
+                if (out.tx->GetHash() == txin.prevout.hash)
+                    nIn += out.tx->vout[0].nValue;
+        }
+
+        // Fee change first, asset change second, then the payees
+        BOOST_CHECK(wtx.vout.size() >= 2);
+        BOOST_CHECK(wtx.vout[0].scriptPubKey == scriptChange);
+        BOOST_CHECK_EQUAL(wtx.vout[0].nAssetId, 0);
+        unsigned int nFirstPayee = 1;
+        if (wtx.vout[1].scriptPubKey == scriptChange)
+        {
+            BOOST_CHECK_EQUAL(wtx.vout[1].nAssetId, nAssetId);
+            nFirstPayee = 2;
+        }
+        for (unsigned int j = nFirstPayee; j < wtx.vout.size(); j++, nPayee++)
+        {
+            BOOST_CHECK(wtx.vout[j].scriptPubKey == vecSend[nPayee].first);
+            BOOST_CHECK_EQUAL(wtx.vout[j].nValue, vecSend[nPayee].second);
+            BOOST_CHECK_EQUAL(wtx.vout[j].nAssetId, nAssetId);
+        }
+        BOOST_CHECK_EQUAL(wtx.GetAssetId(), nAssetId);
+        nFeeSum += nIn - wtx.vout[0].nValue;
+    }
+    BOOST_CHECK_EQUAL(nPayee, vecSend.size());
+    BOOST_CHECK_EQUAL(nFeeSum, nFee);
+
+    // Indivisible assets move one coin per transaction, not enough asset fails
+    BOOST_CHECK(!wallet.BuildAssetPayout(1001, vecSend, vAssetCoins, vFeeCoins, scriptChange,
+                                         vwtx, vTxCoins, nFee, strFailReason));
+    BOOST_CHECK(vwtx.empty());
+    vecSend[0].second = 1000 * COIN;
+    BOOST_CHECK(!wallet.BuildAssetPayout(nAssetId, vecSend, vAssetCoins, vFeeCoins, scriptChange,
+                                         vwtx, vTxCoins, nFee, strFailReason, 2000));
+    BOOST_CHECK(vwtx.empty());
+
+    BOOST_FOREACH(COutput& out, vAssetCoins)
+        delete out.tx;
+    BOOST_FOREACH(COutput& out, vFeeCoins)
+        delete out.tx;
+}
+
+static void MakeKeys(unsigned int nKeys, vector<CKey>& vKey, vector<CPubKey>& vPubKey)
+{
+    vKey.resize(nKeys);
+    vPubKey.resize(nKeys);
+    for (unsigned int i = 0; i < nKeys; i++)
+    {
+        vKey[i].MakeNewKey(true);
+        vPubKey[i] = vKey[i].GetPubKey();
+    }
+}
+
+static bool PaysWallet(const CPubKey& pubkey)
+{
+    CScript script;
+    script.SetDestination(pubkey.GetID());
+    return pwalletMain->IsMine(CTxOut(0, 1, script));
+}
+
+BOOST_AUTO_TEST_CASE(keypool_batch_tests)
+{
+    LOCK(pwalletMain->cs_wallet);
+    vector<vector<unsigned char> > vNoCrypted;
+    unsigned int nPool = pwalletMain->GetKeyPoolSize();
+
+    // A committed batch is in the pool, the keystore and the scan filter
+    vector<CKey> vKey;
+    vector<CPubKey> vPubKey;
+    MakeKeys(3, vKey, vPubKey);
+    BOOST_CHECK(pwalletMain->AddKeysToPool(vKey, vPubKey, vNoCrypted));
+    BOOST_CHECK_EQUAL(pwalletMain->GetKeyPoolSize(), nPool + 3);
+    BOOST_FOREACH(const CPubKey& pubkey, vPubKey)
+    {
+        BOOST_CHECK(pwalletMain->HaveKey(pubkey.GetID()));
+        BOOST_CHECK(pwalletMain->mapKeyMetadata.count(pubkey.GetID()));
+        BOOST_CHECK(PaysWallet(pubkey));
+    }
+    CWalletDB walletdb(pwalletMain->strWalletFile);
+    CKeyPool keypool;
+    int64_t nLast = *pwalletMain->setKeyPool.rbegin();
+    BOOST_CHECK(walletdb.ReadPool(nLast, keypool));
+    BOOST_CHECK(keypool.vchPubKey == vPubKey[2]);
+
+    // A batch that fails half way, here on a key the wallet has already, is aborted and
+    // leaves nothing behind
+    vector<CKey> vKeyAbort;
+    vector<CPubKey> vPubKeyAbort;
+    MakeKeys(2, vKeyAbort, vPubKeyAbort);
+    vKeyAbort.push_back(vKey[0]);
+    vPubKeyAbort.push_back(vPubKey[0]);
+    BOOST_CHECK(!pwalletMain->AddKeysToPool(vKeyAbort, vPubKeyAbort, vNoCrypted));
+    BOOST_CHECK_EQUAL(pwalletMain->GetKeyPoolSize(), nPool + 3);
+    for (unsigned int i = 0; i < 2; i++)
+    {
+        BOOST_CHECK(!pwalletMain->HaveKey(vPubKeyAbort[i].GetID()));
+        BOOST_CHECK(!pwalletMain->mapKeyMetadata.count(vPubKeyAbort[i].GetID()));
+        BOOST_CHECK(!PaysWallet(vPubKeyAbort[i]));
+        BOOST_CHECK(!walletdb.ReadPool(nLast + 1 + i, keypool));
+    }
+    BOOST_CHECK(pwalletMain->HaveKey(vPubKey[0].GetID()));
+    BOOST_CHECK(PaysWallet(vPubKey[0]));
+}
+
 BOOST_AUTO_TEST_SUITE_END()
@@ -0,0 +1,258 @@
+#include <boost/test/unit_test.hpp>
+
+#include <boost/filesystem.hpp>
+
+#include "util.h"
+#include "walletjournal.h"
+
+using namespace std;
+
+static CSerializeData Data(const string& str)
+{
+    return CSerializeData(str.begin(), str.end());
+}
+
+static string ReadString(CWalletJournal& journal, const string& strKey)
+{
+    CSerializeData value;
+    if (!journal.Read(Data(strKey), value))
+        return "<missing>";
+    return string(value.begin(), value.end());
+}
+
+struct JournalFiles
+{
+    boost::filesystem::path pathDir;
+    boost::filesystem::path pathSnapshot;
+    boost::filesystem::path pathJournal;
+
+    JournalFiles()
+    {
+        pathDir = boost::filesystem::temp_directory_path() / boost::filesystem::unique_path("test_walletjournal_%%%%-%%%%");
+        boost::filesystem::create_directories(pathDir);
+        pathSnapshot = pathDir / "wallet.dat.snapshot";
+        pathJournal = pathDir / "wallet.dat.journal";
+    }
+
+    ~JournalFiles()
+    {
+        boost::filesystem::remove_all(pathDir);
+    }
+};
+
+BOOST_FIXTURE_TEST_SUITE(walletjournal_tests, JournalFiles)
+
+BOOST_AUTO_TEST_CASE(journal_replay)
+{
+    {
+        CWalletJournal journal(pathSnapshot, pathJournal);
+        BOOST_CHECK(journal.Open());
+        BOOST_CHECK(journal.Write(Data("a"), Data("1"), true, NULL));
+        BOOST_CHECK(journal.Write(Data("b"), Data("2"), true, NULL));
+        BOOST_CHECK(!journal.Write(Data("b"), Data("3"), false, NULL));
+        BOOST_CHECK(journal.Write(Data("c"), Data("3"), true, NULL));
+        BOOST_CHECK(journal.Erase(Data("a"), NULL));
+        BOOST_CHECK(journal.Erase(Data("missing"), NULL));
+        BOOST_CHECK(journal.Flush(false));
+    }
+
+    CWalletJournal journal(pathSnapshot, pathJournal);
+    BOOST_CHECK(journal.Open());
+    BOOST_CHECK_EQUAL(journal.size(), 2U);
+    BOOST_CHECK(!journal.Exists(Data("a")));
+    BOOST_CHECK_EQUAL(ReadString(journal, "b"), "2");
+    BOOST_CHECK_EQUAL(ReadString(journal, "c"), "3");
+}
+
+BOOST_AUTO_TEST_CASE(journal_torn_batch)
+{
+    {
+        CWalletJournal journal(pathSnapshot, pathJournal);
+        BOOST_CHECK(journal.Open());
+        BOOST_CHECK(journal.Write(Data("a"), Data("1"), true, NULL));
+        BOOST_CHECK(journal.Flush(true));
+        BOOST_CHECK(journal.Write(Data("b"), Data("2"), true, NULL));
+        BOOST_CHECK(journal.Flush(true));
+    }
+
+    // Cut the last batch short, as a crash in the middle of its write would
+    boost::filesystem::resize_file(pathJournal, boost::filesystem::file_size(pathJournal) - 1);
+    {
+        CWalletJournal journal(pathSnapshot, pathJournal);
+        BOOST_CHECK(journal.Open());
+        BOOST_CHECK_EQUAL(ReadString(journal, "a"), "1");
+        BOOST_CHECK(!journal.Exists(Data("b")));
+
+        // New batches are not lost behind the garbage
+        BOOST_CHECK(journal.Write(Data("c"), Data("3"), true, NULL));
+    }
+
+    CWalletJournal journal(pathSnapshot, pathJournal);
+    BOOST_CHECK(journal.Open());
+    BOOST_CHECK_EQUAL(journal.size(), 2U);
+    BOOST_CHECK_EQUAL(ReadString(journal, "c"), "3");
+}
+
+BOOST_AUTO_TEST_CASE(journal_batches)
+{
+    {
+        CWalletJournal journal(pathSnapshot, pathJournal);
+        BOOST_CHECK(journal.Open());
+        BOOST_CHECK(journal.Write(Data("a"), Data("1"), true, NULL));
+
+        CWalletJournalBatch batchAbort;
+        journal.Begin(batchAbort);
+        BOOST_CHECK(journal.Write(Data("a"), Data("2"), true, &batchAbort));
+        BOOST_CHECK(journal.Write(Data("b"), Data("2"), true, &batchAbort));
+        BOOST_CHECK(journal.Erase(Data("a"), &batchAbort));
+        BOOST_CHECK(!journal.Exists(Data("a"), &batchAbort));
+        BOOST_CHECK_EQUAL(ReadString(journal, "b"), "<missing>");
+        journal.Abort(batchAbort);
+        BOOST_CHECK_EQUAL(ReadString(journal, "a"), "1");
+        BOOST_CHECK(!journal.Exists(Data("b")));
+
+        CWalletJournalBatch batch;
+        journal.Begin(batch);
+        BOOST_CHECK(journal.Write(Data("c"), Data("3"), true, &batch));
+        BOOST_CHECK(journal.Write(Data("d"), Data("4"), true, &batch));
+        // The snapshot leaves out the open batch, which still commits after it
+        BOOST_CHECK(journal.Compact());
+        BOOST_CHECK(!journal.Exists(Data("c")));
+        BOOST_CHECK(journal.Commit(batch));
+    }
+
+    CWalletJournal journal(pathSnapshot, pathJournal);
+    BOOST_CHECK(journal.Open());
+    BOOST_CHECK_EQUAL(journal.size(), 3U);
+    BOOST_CHECK_EQUAL(ReadString(journal, "a"), "1");
+    BOOST_CHECK_EQUAL(ReadString(journal, "d"), "4");
+}
+
+// Handles only see what other handles have committed
+BOOST_AUTO_TEST_CASE(journal_batch_isolation)
+{
+    CWalletJournal journal(pathSnapshot, pathJournal);
+    BOOST_CHECK(journal.Open());
+    BOOST_CHECK(journal.Write(Data("a"), Data("1"), true, NULL));
+
+    CWalletJournalBatch batch1, batch2;
+    journal.Begin(batch1);
+    journal.Begin(batch2);
+    BOOST_CHECK(journal.Write(Data("a"), Data("2"), true, &batch1));
+    BOOST_CHECK(journal.Write(Data("b"), Data("2"), false, &batch1));
+    BOOST_CHECK(!journal.Write(Data("b"), Data("3"), false, &batch1));
+
+    // No dirty reads
+    CSerializeData value;
+    BOOST_CHECK(journal.Read(Data("a"), value, &batch2));
+    BOOST_CHECK(value == Data("1"));
+    BOOST_CHECK(!journal.Exists(Data("b"), &batch2));
+    BOOST_CHECK(journal.Write(Data("b"), Data("4"), false, &batch2));
+    BOOST_CHECK(journal.Write(Data("c"), Data("4"), true, &batch2));
+    BOOST_CHECK(journal.Commit(batch2));
+
+    // Aborting batch1 leaves the writes batch2 committed meanwhile alone
+    BOOST_CHECK(journal.Read(Data("a"), value, &batch1));
+    BOOST_CHECK(value == Data("2"));
+    journal.Abort(batch1);
+    BOOST_CHECK_EQUAL(ReadString(journal, "a"), "1");
+    BOOST_CHECK_EQUAL(ReadString(journal, "b"), "4");
+    BOOST_CHECK_EQUAL(ReadString(journal, "c"), "4");
+}
+
+BOOST_AUTO_TEST_CASE(journal_compact)
+{
+    {
+        CWalletJournal journal(pathSnapshot, pathJournal);
+        BOOST_CHECK(journal.Open());
+        for (int i = 0; i < 100; i++)
+            BOOST_CHECK(journal.Write(Data(strprintf("pool%03d", i)), Data("key"), true, NULL));
+        BOOST_CHECK(journal.Write(Data("name"), Data("x"), true, NULL));
+        BOOST_CHECK(journal.Flush(false));
+        uint64_t nJournal = boost::filesystem::file_size(pathJournal);
+
+        BOOST_CHECK(journal.Compact("pool"));
+        BOOST_CHECK(boost::filesystem::file_size(pathJournal) < nJournal);
+        BOOST_CHECK_EQUAL(journal.size(), 1U);
+        BOOST_CHECK(journal.Write(Data("name"), Data("y"), true, NULL));
+    }
+
+    CWalletJournal journal(pathSnapshot, pathJournal);
+    BOOST_CHECK(journal.Open());
+    BOOST_CHECK_EQUAL(journal.size(), 1U);
+    BOOST_CHECK_EQUAL(ReadString(journal, "name"), "y");
+}
+
+// Compaction can stop anywhere: a directory in the place of the temporary file stops it before
+// the snapshot rename, or after it but before the journal reset. The dropped records must not
+// come back either way.
+BOOST_AUTO_TEST_CASE(journal_compact_crash)
+{
+    boost::filesystem::path pathSnapshotTmp = pathSnapshot.string() + ".new";
+    boost::filesystem::path pathJournalTmp = pathJournal.string() + ".new";
+    {
+        CWalletJournal journal(pathSnapshot, pathJournal);
+        BOOST_CHECK(journal.Open());
+        for (int i = 0; i < 10; i++)
+            BOOST_CHECK(journal.Write(Data(strprintf("pool%03d", i)), Data("key"), true, NULL));
+        BOOST_CHECK(journal.Write(Data("name"), Data("x"), true, NULL));
+        BOOST_CHECK(journal.Flush(true));
+
+        boost::filesystem::create_directory(pathSnapshotTmp);
+        BOOST_CHECK(!journal.Compact("pool000"));
+        boost::filesystem::remove(pathSnapshotTmp);
+    }
+    {
+        CWalletJournal journal(pathSnapshot, pathJournal);
+        BOOST_CHECK(journal.Open());
+        BOOST_CHECK_EQUAL(journal.size(), 10U);
+        BOOST_CHECK(!journal.Exists(Data("pool000")));
+
+        boost::filesystem::create_directory(pathJournalTmp);
+        BOOST_CHECK(!journal.Compact("pool"));
+        boost::filesystem::remove(pathJournalTmp);
+    }
+
+    CWalletJournal journal(pathSnapshot, pathJournal);
+    BOOST_CHECK(journal.Open());
+    BOOST_CHECK_EQUAL(journal.size(), 1U);
+    BOOST_CHECK_EQUAL(ReadString(journal, "name"), "x");
+}
+
+// Cursors walk keys in unsigned byte order, like the Berkeley DB btree
+BOOST_AUTO_TEST_CASE(journal_seek)
+{
+    CWalletJournal journal(pathSnapshot, pathJournal);
+    BOOST_CHECK(journal.Open());
+    BOOST_CHECK(journal.Write(Data("b"), Data("2"), true, NULL));
+    BOOST_CHECK(journal.Write(Data("\xff"), Data("3"), true, NULL));
+    BOOST_CHECK(journal.Write(Data("a"), Data("1"), true, NULL));
+
+    CSerializeData key, value;
+    vector<string> vKeys;
+    for (bool fAfter = false; journal.Seek(key, value, fAfter); fAfter = true)
+        vKeys.push_back(string(key.begin(), key.end()));
+    BOOST_CHECK_EQUAL(vKeys.size(), 3U);
+    BOOST_CHECK(vKeys[0] == "a" && vKeys[1] == "b" && vKeys[2] == "\xff");
+
+    key = Data("aa");
+    BOOST_CHECK(journal.Seek(key, value, false));
+    BOOST_CHECK(key == Data("b"));
+
+    // A batch sees its own writes and erases
+    CWalletJournalBatch batch;
+    journal.Begin(batch);
+    BOOST_CHECK(journal.Write(Data("ab"), Data("4"), true, &batch));
+    BOOST_CHECK(journal.Erase(Data("b"), &batch));
+    BOOST_CHECK(journal.Write(Data("\xff"), Data("5"), true, &batch));
+    vKeys.clear();
+    key.clear();
+    for (bool fAfter = false; journal.Seek(key, value, fAfter, &batch); fAfter = true)
+        vKeys.push_back(string(key.begin(), key.end()));
+    BOOST_CHECK_EQUAL(vKeys.size(), 3U);
+    BOOST_CHECK(vKeys[0] == "a" && vKeys[1] == "ab" && vKeys[2] == "\xff");
+    BOOST_CHECK(value == Data("5"));
+    journal.Abort(batch);
+}
+
+BOOST_AUTO_TEST_SUITE_END()
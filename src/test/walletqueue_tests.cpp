@@ -0,0 +1,92 @@
+#include <boost/test/unit_test.hpp>
+
+#include <boost/thread.hpp>
+
+#include "main.h"
+#include "util.h"
+
+using namespace std;
+
+BOOST_AUTO_TEST_SUITE(walletqueue_tests)
+
+// Records what the wallet thread applies, slowly enough for the queue to fill up
+class CRecordingWallet : public CWalletInterface
+{
+public:
+    vector<uint256> vTx;
+    vector<const CBlock*> vBlock;
+
+protected:
+    void SyncTransaction(const CTransaction &tx, const CBlock *pblock, bool fConnect)
+    {
+        MilliSleep(1);
+        vTx.push_back(tx.GetHash());
+        vBlock.push_back(pblock);
+    }
+    void EraseFromWallet(const uint256 &hash) {}
+    void SetBestChain(const CBlockLocator &locator) {}
+    void UpdatedTransaction(const uint256 &hash) {}
+    void Inventory(const uint256 &hash) {}
+    void ResendWalletTransactions(bool fForce) {}
+};
+
+static CTransaction MakeTx(int n)
+{
+    CTransaction tx;
+    tx.nLockTime = n;
+    tx.vout.resize(1);
+    tx.vout[0].nValue = n;
+    return tx;
+}
+
+BOOST_AUTO_TEST_CASE(walletqueue_order_and_barrier)
+{
+    CRecordingWallet wallet;
+    RegisterWallet(&wallet);
+    mapArgs["-walletqueuesize"] = "4";
+    boost::thread_group threads;
+    StartWalletNotifications(threads);
+
+    vector<uint256> vExpected;
+    for (int i = 0; i < 20; i++)
+    {
+        CTransaction tx = MakeTx(i);
+        SyncWithWallets(tx);
+        vExpected.push_back(tx.GetHash());
+    }
+    CBlock block;
+    for (int i = 20; i < 40; i++)
+    {
+        block.vtx.push_back(MakeTx(i));
+        vExpected.push_back(block.vtx.back().GetHash());
+    }
+    SyncBlockWithWallets(block, true);
+    CTransaction txLast = MakeTx(40);
+    SyncWithWallets(txLast);
+    vExpected.push_back(txLast.GetHash());
+
+    // Everything queued before the barrier has been applied when it returns, in order
+    SyncWithWalletQueue();
+    BOOST_CHECK(wallet.vTx == vExpected);
+    uint64_t nQueued, nApplied, nOverflows;
+    GetWalletQueueStats(nQueued, nApplied, nOverflows);
+    BOOST_CHECK_EQUAL(nQueued, nApplied);
+
+    // The producers waited for room instead of letting the queue grow
+    BOOST_CHECK_EQUAL(nOverflows, 0U);
+
+    // The transactions of a block share one copy of it, loose ones have none
+    BOOST_CHECK(wallet.vBlock[0] == NULL);
+    BOOST_CHECK(wallet.vBlock[20] != NULL && wallet.vBlock[20] != &block);
+    for (int i = 20; i < 40; i++)
+        BOOST_CHECK(wallet.vBlock[i] == wallet.vBlock[20]);
+    BOOST_CHECK(wallet.vBlock[40] == NULL);
+
+    threads.interrupt_all();
+    threads.join_all();
+    StopWalletNotifications();
+    UnregisterWallet(&wallet);
+    mapArgs.erase("-walletqueuesize");
+}
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -0,0 +1,249 @@
+#include <boost/test/unit_test.hpp>
+
+#include "bignum.h"
+#include "rpcprotocol.h"
+#include "util.h"
+#include "workserver.h"
+
+using namespace std;
+using namespace json_spirit;
+
+// Jobs on a made-up tip, at a target one hash in 512 meets
+class CTestWorkSource : public CWorkSource
+{
+public:
+    uint256 hashTip;
+    unsigned int nBits;
+    int nJobs;
+    vector<CBlock> vBlocks;
+
+    CTestWorkSource() : hashTip(1), nBits(0x1f7fffff), nJobs(0) {}
+
+    bool CreateJob(CBlock& block)
+    {
+        block.SetNull();
+        block.nVersion = 1;
+        block.hashPrevBlock = hashTip;
+        block.nTime = 1400000000;
+        block.nBits = nBits;
+        CTransaction txCoinbase;
+        txCoinbase.vin.resize(1);
+        txCoinbase.vin[0].prevout.SetNull();
+        txCoinbase.vin[0].scriptSig = CScript() << ++nJobs;
+        txCoinbase.vout.resize(1);
+        txCoinbase.vout[0].nAssetId = 0;
+        block.vtx.push_back(txCoinbase);
+        block.hashMerkleRoot = block.BuildMerkleTree();
+        return true;
+    }
+
+    bool IsCurrent(const uint256& hashPrevBlock)
+    {
+        return hashPrevBlock == hashTip;
+    }
+
+    bool SubmitBlock(CBlock& block)
+    {
+        vBlocks.push_back(block);
+        return true;
+    }
+
+    bool Authorize(const string& strUser, const string& strPassword)
+    {
+        return strUser == "miner" && strPassword == "secret";
+    }
+};
+
+static Object ReadLine(const string& strLine)
+{
+    Value val;
+    BOOST_REQUIRE(read_string(strLine, val));
+    BOOST_REQUIRE(val.type() == obj_type);
+    return val.get_obj();
+}
+
+static int ErrorCode(const string& strLine)
+{
+    Object reply = ReadLine(strLine);
+    const Value& error = find_value(reply, "error");
+    if (error.type() != obj_type)
+        return 0;
+    return find_value(error.get_obj(), "code").get_int();
+}
+
+// The data of a mining.notify with another nonce, as a miner sends it back
+static string WithNonce(const string& strData, unsigned int nNonce)
+{
+    vector<unsigned char> vchData = ParseHex(strData);
+    BOOST_REQUIRE_EQUAL(vchData.size(), 128U);
+    nNonce = ByteReverse(nNonce);
+    memcpy(&vchData[76], &nNonce, 4);
+    return HexStr(vchData.begin(), vchData.end());
+}
+
+static string Submit(CWorkSession& session, const string& strJobId, const string& strData)
+{
+    vector<string> vSend;
+    BOOST_CHECK(session.ProcessLine("{\"id\": 2, \"method\": \"mining.submit\", \"params\": [\"" + strJobId + "\", \"" + strData + "\"]}", vSend));
+    BOOST_REQUIRE_EQUAL(vSend.size(), 1U);
+    return vSend[0];
+}
+
+// The nonce of a share, a block or neither, depending on which targets its hash meets
+static unsigned int FindNonce(CTestWorkSource& source, const string& strData, bool fShare, bool fBlock)
+{
+    vector<unsigned char> vchData = ParseHex(strData);
+    for (unsigned int i = 0; i < 128/4; i++)
+        ((unsigned int*)&vchData[0])[i] = ByteReverse(((unsigned int*)&vchData[0])[i]);
+    CBlock header;
+    memcpy(&header.nVersion, &vchData[0], 4);
+    memcpy(header.hashPrevBlock.begin(), &vchData[4], 32);
+    memcpy(header.hashMerkleRoot.begin(), &vchData[36], 32);
+    memcpy(&header.nTime, &vchData[68], 4);
+    memcpy(&header.nBits, &vchData[72], 4);
+
+    CBigNum bnTarget;
+    bnTarget.SetCompact(header.nBits);
+    for (header.nNonce = 0; ; header.nNonce++)
+    {
+        CBigNum bnHash(header.GetPoWHash());
+        if ((bnHash <= bnTarget) == fBlock && (bnHash <= bnTarget * 2) == fShare)
+            return header.nNonce;
+    }
+}
+
+// Subscribe and log in; the reply to mining.authorize is followed by the first job
+static Object Login(CWorkSession& session)
+{
+    vector<string> vSend;
+    BOOST_CHECK(session.ProcessLine("{\"id\": 1, \"method\": \"mining.subscribe\"}", vSend));
+    BOOST_CHECK(session.ProcessLine("{\"id\": 2, \"method\": \"mining.authorize\", \"params\": [\"miner\", \"secret\"]}", vSend));
+    BOOST_REQUIRE_EQUAL(vSend.size(), 3U);
+    return ReadLine(vSend[2]);
+}
+
+BOOST_AUTO_TEST_SUITE(workserver_tests)
+
+BOOST_AUTO_TEST_CASE(workserver_subscribe)
+{
+    CTestWorkSource source;
+    CWorkSession session(source);
+    vector<string> vSend;
+
+    // Nothing to submit to before logging in, and no push either
+    BOOST_CHECK_EQUAL(ErrorCode(Submit(session, "1", string(256, '0'))), WORK_UNAUTHORIZED);
+    session.Notify(true, vSend);
+    BOOST_CHECK(vSend.empty());
+
+    BOOST_CHECK(session.ProcessLine("{\"id\": 1, \"method\": \"mining.subscribe\", \"params\": []}", vSend));
+    BOOST_REQUIRE_EQUAL(vSend.size(), 1U);
+    BOOST_CHECK(find_value(ReadLine(vSend[0]), "result").get_bool());
+    session.Notify(true, vSend);
+    BOOST_CHECK_EQUAL(vSend.size(), 1U);
+
+    vSend.clear();
+    BOOST_CHECK(session.ProcessLine("{\"id\": 2, \"method\": \"mining.authorize\", \"params\": [\"miner\", \"secret\"]}", vSend));
+    BOOST_REQUIRE_EQUAL(vSend.size(), 2U);
+    BOOST_CHECK(find_value(ReadLine(vSend[0]), "result").get_bool());
+    BOOST_CHECK(session.IsAuthorized());
+    Object notify = ReadLine(vSend[1]);
+    BOOST_CHECK_EQUAL(find_value(notify, "method").get_str(), "mining.notify");
+    const Array& params = find_value(notify, "params").get_array();
+    BOOST_REQUIRE_EQUAL(params.size(), 4U);
+    BOOST_CHECK_EQUAL(params[1].get_str().size(), 256U);
+    BOOST_CHECK(params[3].get_bool());
+    BOOST_CHECK(session.IsSubscribed());
+
+    vSend.clear();
+    BOOST_CHECK(session.ProcessLine("{\"id\": 3, \"method\": \"mining.unknown\"}", vSend));
+    BOOST_CHECK_EQUAL(ErrorCode(vSend[0]), RPC_METHOD_NOT_FOUND);
+
+    // Garbage ends the connection
+    BOOST_CHECK(!session.ProcessLine("not json", vSend));
+}
+
+BOOST_AUTO_TEST_CASE(workserver_authorize)
+{
+    CTestWorkSource source;
+    CWorkSession session(source);
+    vector<string> vSend;
+
+    // Wrong credentials are answered, then the connection is dropped
+    BOOST_CHECK(!session.ProcessLine("{\"id\": 1, \"method\": \"mining.authorize\", \"params\": [\"miner\", \"guess\"]}", vSend));
+    BOOST_REQUIRE_EQUAL(vSend.size(), 1U);
+    BOOST_CHECK_EQUAL(ErrorCode(vSend[0]), WORK_UNAUTHORIZED);
+    BOOST_CHECK(!session.IsAuthorized());
+    vSend.clear();
+    BOOST_CHECK(!session.ProcessLine("{\"id\": 2, \"method\": \"mining.authorize\"}", vSend));
+    BOOST_CHECK_EQUAL(ErrorCode(vSend[0]), WORK_UNAUTHORIZED);
+
+    // Logged in first, the job comes with the subscription
+    vSend.clear();
+    BOOST_CHECK(session.ProcessLine("{\"id\": 3, \"method\": \"mining.authorize\", \"params\": [\"miner\", \"secret\"]}", vSend));
+    BOOST_CHECK_EQUAL(vSend.size(), 1U);
+    BOOST_CHECK(session.ProcessLine("{\"id\": 4, \"method\": \"mining.subscribe\"}", vSend));
+    BOOST_REQUIRE_EQUAL(vSend.size(), 3U);
+    BOOST_CHECK_EQUAL(find_value(ReadLine(vSend[2]), "method").get_str(), "mining.notify");
+}
+
+BOOST_AUTO_TEST_CASE(workserver_submit)
+{
+    CTestWorkSource source;
+    CWorkSession session(source, 2);
+    vector<string> vSend;
+    Object notify = Login(session);
+    const Array& params = find_value(notify, "params").get_array();
+    string strJobId = params[0].get_str();
+    string strData = params[1].get_str();
+
+    string strLow = WithNonce(strData, FindNonce(source, strData, false, false));
+    BOOST_CHECK_EQUAL(ErrorCode(Submit(session, strJobId, strLow)), WORK_LOW_DIFFICULTY);
+
+    string strShare = WithNonce(strData, FindNonce(source, strData, true, false));
+    BOOST_CHECK_EQUAL(ErrorCode(Submit(session, strJobId, strShare)), 0);
+    BOOST_CHECK_EQUAL(ErrorCode(Submit(session, strJobId, strShare)), WORK_DUPLICATE_SHARE);
+    BOOST_CHECK(source.vBlocks.empty());
+
+    string strBlock = WithNonce(strData, FindNonce(source, strData, true, true));
+    BOOST_CHECK_EQUAL(ErrorCode(Submit(session, strJobId, strBlock)), 0);
+    BOOST_REQUIRE_EQUAL(source.vBlocks.size(), 1U);
+    BOOST_CHECK(source.vBlocks[0].hashPrevBlock == source.hashTip);
+    BOOST_CHECK(CBigNum(source.vBlocks[0].GetPoWHash()) <= CBigNum().SetCompact(source.nBits));
+
+    // Data of another job is not taken for this one
+    vSend.clear();
+    session.Notify(false, vSend);
+    string strOtherData = find_value(ReadLine(vSend[0]), "params").get_array()[1].get_str();
+    BOOST_CHECK_EQUAL(ErrorCode(Submit(session, strJobId, WithNonce(strOtherData, 1))), WORK_OTHER);
+
+    BOOST_CHECK_EQUAL(session.stats.nJobs, 2U);
+    BOOST_CHECK_EQUAL(session.stats.nShares, 2U);
+    BOOST_CHECK_EQUAL(session.stats.nBlocks, 1U);
+    BOOST_CHECK_EQUAL(session.stats.nRejected, 3U);
+}
+
+BOOST_AUTO_TEST_CASE(workserver_stale)
+{
+    CTestWorkSource source;
+    CWorkSession session(source);
+    vector<string> vSend;
+    Object notify = Login(session);
+    const Array& params = find_value(notify, "params").get_array();
+    string strJobId = params[0].get_str();
+    string strData = WithNonce(params[1].get_str(), FindNonce(source, params[1].get_str(), true, true));
+
+    // A new tip makes the job stale before the client has heard of it
+    source.hashTip = 2;
+    BOOST_CHECK_EQUAL(ErrorCode(Submit(session, strJobId, strData)), WORK_JOB_NOT_FOUND);
+
+    // and a clean job push forgets it
+    vSend.clear();
+    session.Notify(true, vSend);
+    BOOST_CHECK(find_value(ReadLine(vSend[0]), "params").get_array()[3].get_bool());
+    source.hashTip = 1;
+    BOOST_CHECK_EQUAL(ErrorCode(Submit(session, strJobId, strData)), WORK_JOB_NOT_FOUND);
+    BOOST_CHECK_EQUAL(session.stats.nStale, 2U);
+    BOOST_CHECK(source.vBlocks.empty());
+}
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -9,7 +9,23 @@
 
 using namespace std;
 
-CTxMemPool::CTxMemPool()
+CTxMemPoolEntry::CTxMemPoolEntry() :
+    nTxSize(0), nSigOps(0), nFee(0), nPayloadFee(0), nRegisterFee(0), nPowDonation(0), nPosDonation(0),
+    nValueIn(0), nChainInputValue(0), dEntryPriority(0), nHeight(0), nTime(0)
+{
+}
+
+CTxMemPoolEntry::CTxMemPoolEntry(const CTransaction& tx, int nHeightIn, int64_t nTimeIn) :
+    nSigOps(0), nFee(0), nValueIn(0), nChainInputValue(0), dEntryPriority(0), nHeight(nHeightIn), nTime(nTimeIn)
+{
+    nTxSize = ::GetSerializeSize(tx, SER_NETWORK, PROTOCOL_VERSION);
+    nPayloadFee = tx.GetPayloadFee();
+    nRegisterFee = tx.GetRegisterFee();
+    nPowDonation = tx.GetPowDonation();
+    nPosDonation = tx.GetPosDonation();
+}
+
+CTxMemPool::CTxMemPool() : nTransactionsUpdated(0), nTotalTxSize(0)
 {
 }
 
@@ -67,7 +83,7 @@ bool CTxMemPool::IsExsistAssetMsg(int64_t nAssetIdIn, std::string engNameIn, std
     return false;
 }
 
-bool CTxMemPool::addUnchecked(const uint256& hash, CTransaction &tx)
+bool CTxMemPool::addUnchecked(const uint256& hash, CTransaction &tx, const CTxMemPoolEntry& entryIn)
 {
     // Add to memory pool without checking anything.
     // Used by main.cpp AcceptToMemoryPool(), which DOES do
@@ -77,6 +93,32 @@ bool CTxMemPool::addUnchecked(const uint256& hash, CTransaction &tx)
         mapTx[hash] = tx;
         for (unsigned int i = 0; i < tx.vin.size(); i++)
             mapNextTx[tx.vin[i].prevout] = CInPoint(&mapTx[hash], i);
+
+        CTxMemPoolEntry& entry = mapEntry[hash];
+        entry = entryIn;
+        entry.setParents.clear();
+        entry.setChildren.clear();
+        BOOST_FOREACH(const CTxIn& txin, tx.vin)
+        {
+            map<uint256, CTxMemPoolEntry>::iterator mi = mapEntry.find(txin.prevout.hash);
+            if (mi == mapEntry.end())
+                continue;
+            entry.setParents.insert(txin.prevout.hash);
+            (*mi).second.setChildren.insert(hash);
+        }
+        // After a reorganisation, pool transactions may already spend it
+        for (unsigned int i = 0; i < tx.vout.size(); i++)
+        {
+            map<COutPoint, CInPoint>::iterator it = mapNextTx.find(COutPoint(hash, i));
+            if (it == mapNextTx.end())
+                continue;
+            uint256 hashChild = it->second.ptx->GetHash();
+            entry.setChildren.insert(hashChild);
+            mapEntry[hashChild].setParents.insert(hash);
+        }
+        nTotalTxSize += entry.nTxSize;
+        setByFeeRate.insert(make_pair(entry.GetFeePerKb(), hash));
+        setByTime.insert(make_pair(entry.nTime, hash));
         nTransactionsUpdated++;
     }
     return true;
@@ -99,6 +141,21 @@ bool CTxMemPool::remove(const CTransaction &tx, bool fRecursive)
             }
             BOOST_FOREACH(const CTxIn& txin, tx.vin)
                 mapNextTx.erase(txin.prevout);
+
+            // Children left behind now spend a confirmed transaction
+            map<uint256, CTxMemPoolEntry>::iterator mi = mapEntry.find(hash);
+            if (mi != mapEntry.end())
+            {
+                const CTxMemPoolEntry& entry = (*mi).second;
+                BOOST_FOREACH(const uint256& hashParent, entry.setParents)
+                    mapEntry[hashParent].setChildren.erase(hash);
+                BOOST_FOREACH(const uint256& hashChild, entry.setChildren)
+                    mapEntry[hashChild].setParents.erase(hash);
+                nTotalTxSize -= entry.nTxSize;
+                setByFeeRate.erase(make_pair(entry.GetFeePerKb(), hash));
+                setByTime.erase(make_pair(entry.nTime, hash));
+                mapEntry.erase(mi);
+            }
             mapTx.erase(hash);
             nTransactionsUpdated++;
         }
@@ -121,10 +178,46 @@ bool CTxMemPool::removeConflicts(const CTransaction &tx)
     return true;
 }
 
+void CTxMemPool::TrimToSize(uint64_t nSizeLimit, std::vector<uint256>& vRemoved)
+{
+    LOCK(cs);
+    while (nTotalTxSize > nSizeLimit && !setByFeeRate.empty())
+        removeWithDescendants(setByFeeRate.begin()->second, vRemoved);
+}
+
+void CTxMemPool::Expire(int64_t nCutoff, std::vector<uint256>& vRemoved)
+{
+    LOCK(cs);
+    while (!setByTime.empty() && setByTime.begin()->first < nCutoff)
+        removeWithDescendants(setByTime.begin()->second, vRemoved);
+}
+
+void CTxMemPool::removeWithDescendants(uint256 hash, std::vector<uint256>& vRemoved)
+{
+    // remove() takes what spends it along
+    std::set<uint256> setRemove;
+    std::vector<uint256> vStack(1, hash);
+    while (!vStack.empty())
+    {
+        uint256 hashNext = vStack.back();
+        vStack.pop_back();
+        if (!setRemove.insert(hashNext).second)
+            continue;
+        const std::set<uint256>& setChildren = mapEntry[hashNext].setChildren;
+        vStack.insert(vStack.end(), setChildren.begin(), setChildren.end());
+    }
+    remove(mapTx[hash], true);
+    vRemoved.insert(vRemoved.end(), setRemove.begin(), setRemove.end());
+}
+
 void CTxMemPool::clear()
 {
     LOCK(cs);
     mapTx.clear();
+    mapEntry.clear();
+    setByFeeRate.clear();
+    setByTime.clear();
+    nTotalTxSize = 0;
     mapNextTx.clear();
     ++nTransactionsUpdated;
 }
@@ -147,3 +240,12 @@ bool CTxMemPool::lookup(uint256 hash, CTransaction& result) const
     result = i->second;
     return true;
 }
+
+bool CTxMemPool::lookup(uint256 hash, CTxMemPoolEntry& result) const
+{
+    LOCK(cs);
+    std::map<uint256, CTxMemPoolEntry>::const_iterator i = mapEntry.find(hash);
+    if (i == mapEntry.end()) return false;
+    result = i->second;
+    return true;
+}
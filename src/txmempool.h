@@ -8,6 +8,45 @@
 #include "core.h"
 #include "sync.h"
 
+#include <set>
+#include <utility>
+
+/** What AcceptToMemoryPool() found out about a pool transaction, kept next to it so
+ * that block templates, eviction and getrawmempool need not work it out again.
+ * The parent and child links are kept up to date by the pool. */
+class CTxMemPoolEntry
+{
+public:
+    unsigned int nTxSize;
+    unsigned int nSigOps;           // legacy and pay-to-script-hash
+    int64_t nFee;                   // inputs minus outputs, including the amounts below
+    int64_t nPayloadFee;
+    int64_t nRegisterFee;
+    int64_t nPowDonation;
+    int64_t nPosDonation;
+    int64_t nValueIn;               // icoshares in
+    int64_t nChainInputValue;       // amounts spent from confirmed transactions, for priority
+    double dEntryPriority;
+    int nHeight;                    // best height when it entered the pool
+    int64_t nTime;
+    std::set<uint256> setParents;   // pool transactions it spends
+    std::set<uint256> setChildren;  // pool transactions spending it
+
+    CTxMemPoolEntry();
+    /** Size and fee components of tx; the rest is up to the caller */
+    CTxMemPoolEntry(const CTransaction& tx, int nHeightIn, int64_t nTimeIn);
+
+    int64_t GetNotFeeChange() const { return nPayloadFee + nRegisterFee + nPowDonation + nPosDonation; }
+    /** What a block including it earns in fees */
+    int64_t GetMinerFee() const { return nFee - GetNotFeeChange(); }
+    double GetFeePerKb() const { return double(GetMinerFee()) / (double(nTxSize) / 1000.0); }
+    /** Priority with the best chain at nBestHeightIn; inputs age by one block per block */
+    double GetPriority(int nBestHeightIn) const
+    {
+        return dEntryPriority + (double)nChainInputValue * (nBestHeightIn - nHeight) / nTxSize;
+    }
+};
+
 /*
  * CTxMemPool stores valid-according-to-the-current-best-chain
  * transactions that may be included in the next block.
@@ -22,17 +61,28 @@ class CTxMemPool
 {
 private:
     unsigned int nTransactionsUpdated;
+    uint64_t nTotalTxSize;
+    std::set<std::pair<double, uint256> > setByFeeRate;  // eviction order
+    std::set<std::pair<int64_t, uint256> > setByTime;    // expiry order
+
+    void removeWithDescendants(uint256 hash, std::vector<uint256>& vRemoved);
 
 public:
     mutable CCriticalSection cs;
     std::map<uint256, CTransaction> mapTx;
+    std::map<uint256, CTxMemPoolEntry> mapEntry;     // same keys as mapTx
     std::map<COutPoint, CInPoint> mapNextTx;
 
     CTxMemPool();
 
-    bool addUnchecked(const uint256& hash, CTransaction &tx);
+    /** Add tx with what is known about it; links to parents and children in the pool are filled in */
+    bool addUnchecked(const uint256& hash, CTransaction &tx, const CTxMemPoolEntry& entry);
     bool remove(const CTransaction &tx, bool fRecursive = false);
     bool removeConflicts(const CTransaction &tx);
+    /** Evict the lowest fee rates, with what spends them, until the transactions take at most nSizeLimit bytes */
+    void TrimToSize(uint64_t nSizeLimit, std::vector<uint256>& vRemoved);
+    /** Remove what entered the pool before nCutoff, with what spends it */
+    void Expire(int64_t nCutoff, std::vector<uint256>& vRemoved);
     void clear();
     void queryHashes(std::vector<uint256>& vtxid);
     unsigned int GetTransactionsUpdated() const;
@@ -53,6 +103,20 @@ public:
     }
 
     bool lookup(uint256 hash, CTransaction& result) const;
+    bool lookup(uint256 hash, CTxMemPoolEntry& result) const;
+
+    uint64_t GetTotalTxSize() const
+    {
+        LOCK(cs);
+        return nTotalTxSize;
+    }
+
+    /** Fee rate TrimToSize() evicts first, 0 when the pool is empty */
+    double GetLowestFeePerKb() const
+    {
+        LOCK(cs);
+        return setByFeeRate.empty() ? 0 : setByFeeRate.begin()->first;
+    }
 };
 
 #endif /* BITCOIN_TXMEMPOOL_H */
@@ -556,4 +556,33 @@ template <typename Callable> void TraceThread(const char* name,  Callable func)
     }
 }
 
+template <typename Callable> void ParallelForWorker(Callable func, unsigned int nItems, unsigned int nWorker, unsigned int nWorkers)
+{
+    for (unsigned int i = nWorker; i < nItems; i += nWorkers)
+        func(i);
+}
+
+// Call func(i) for every i below nItems on up to nMaxThreads threads (as many as
+// the hardware runs when 0), the calling one included, giving each thread at
+// least nGrain items. For work that takes no lock. Returns the threads used.
+// Use it like:
+//   ParallelFor(vRecord.size(), 256, boost::bind(&DecodeRecord, &vRecord, _1));
+template <typename Callable> unsigned int ParallelFor(unsigned int nItems, unsigned int nGrain, Callable func, unsigned int nMaxThreads = 0)
+{
+    if (nMaxThreads == 0)
+        nMaxThreads = boost::thread::hardware_concurrency();
+    unsigned int nWorkers = std::max(1U, std::min(nMaxThreads, nItems / std::max(1U, nGrain)));
+    boost::thread_group workers;
+    for (unsigned int i = 1; i < nWorkers; i++)
+        workers.create_thread(boost::bind(&ParallelForWorker<Callable>, func, nItems, i, nWorkers));
+    try {
+        ParallelForWorker(func, nItems, 0, nWorkers);
+    } catch (...) {
+        workers.join_all();
+        throw;
+    }
+    workers.join_all();
+    return nWorkers;
+}
+
 #endif
@@ -7,6 +7,7 @@
 
 #include "base58.h"
 #include "coincontrol.h"
+#include "init.h"
 #include "kernel.h"
 #include "net.h"
 #include "timedata.h"
@@ -15,6 +16,7 @@
 #include "walletdb.h"
 
 #include <boost/algorithm/string/replace.hpp>
+#include <boost/bind.hpp>
 
 using namespace std;
 
@@ -71,9 +73,12 @@ bool CWallet::AddKeyPubKey(const CKey& secret, const CPubKey &pubkey)
     AssertLockHeld(cs_wallet); // mapKeyMetadata
     if (!CCryptoKeyStore::AddKeyPubKey(secret, pubkey))
         return false;
+    mineFilter.AddKey(pubkey.GetID());
     if (!fFileBacked)
         return true;
     if (!IsCrypted()) {
+        if (pwalletdbEncryption)
+            return pwalletdbEncryption->WriteKey(pubkey, secret.GetPrivKey(), mapKeyMetadata[pubkey.GetID()]);
         return CWalletDB(strWalletFile).WriteKey(pubkey, secret.GetPrivKey(), mapKeyMetadata[pubkey.GetID()]);
     }
     return true;
@@ -83,6 +88,7 @@ bool CWallet::AddCryptedKey(const CPubKey &vchPubKey, const vector<unsigned char
 {
     if (!CCryptoKeyStore::AddCryptedKey(vchPubKey, vchCryptedSecret))
         return false;
+    mineFilter.AddKey(vchPubKey.GetID());
     if (!fFileBacked)
         return true;
     {
@@ -107,16 +113,22 @@ bool CWallet::LoadKeyMetadata(const CPubKey &pubkey, const CKeyMetadata &meta)
 
 bool CWallet::LoadCryptedKey(const CPubKey &vchPubKey, const std::vector<unsigned char> &vchCryptedSecret)
 {
-    return CCryptoKeyStore::AddCryptedKey(vchPubKey, vchCryptedSecret);
+    if (!CCryptoKeyStore::AddCryptedKey(vchPubKey, vchCryptedSecret))
+        return false;
+    mineFilter.AddKey(vchPubKey.GetID());
+    return true;
 }
 
 bool CWallet::AddCScript(const CScript& redeemScript)
 {
     if (!CCryptoKeyStore::AddCScript(redeemScript))
         return false;
+    mineFilter.AddScript(redeemScript.GetID());
+    // Existing outputs to the script are ours now
+    BuildUnspentIndex();
     if (!fFileBacked)
         return true;
-    return CWalletDB(strWalletFile).WriteCScript(Hash160(redeemScript), redeemScript);
+    return CWalletDB(strWalletFile).WriteCScript(Hash160(redeemScript.begin(), redeemScript.end()), redeemScript);
 }
 
 // optional setting to unlock wallet for staking only
@@ -137,7 +149,10 @@ bool CWallet::LoadCScript(const CScript& redeemScript)
         return true;
     }
 
-    return CCryptoKeyStore::AddCScript(redeemScript);
+    if (!CCryptoKeyStore::AddCScript(redeemScript))
+        return false;
+    mineFilter.AddScript(redeemScript.GetID());
+    return true;
 }
 
 bool CWallet::Unlock(const SecureString& strWalletPassphrase)
@@ -344,29 +359,126 @@ int64_t CWallet::IncOrderPosNext(CWalletDB *pwalletdb)
     return nRet;
 }
 
-CWallet::TxItems CWallet::OrderedTxItems(std::list<CAccountingEntry>& acentries, std::string strAccount)
+// Remove one entry from an activity log multimap
+static void EraseTxItem(CWallet::TxItems& txItems, int64_t nOrderPos, const CWallet::TxPair& item)
 {
-    AssertLockHeld(cs_wallet); // mapWallet
-    CWalletDB walletdb(strWalletFile);
+    std::pair<CWallet::TxItems::iterator, CWallet::TxItems::iterator> range = txItems.equal_range(nOrderPos);
+    for (CWallet::TxItems::iterator it = range.first; it != range.second; ++it)
+    {
+        if ((*it).second == item)
+        {
+            txItems.erase(it);
+            return;
+        }
+    }
+}
 
-    // First: get all CWalletTx and CAccountingEntry into a sorted-by-order multimap.
-    TxItems txOrdered;
+void CWallet::IndexAccountTxItem(CWalletTx* pwtx, CAccountingEntry* pacentry)
+{
+    AssertLockHeld(cs_wallet); // mapAccountTxOrdered, mapAddressBook
+    if (pacentry)
+    {
+        mapAccountTxOrdered[pacentry->strAccount].insert(make_pair(pacentry->nOrderPos, TxPair((CWalletTx*)0, pacentry)));
+        return;
+    }
+
+    // The sending account, and the address book label of every output, with
+    // unlabelled outputs under "", as ListTransactions attributes them
+    set<string> setAccounts;
+    setAccounts.insert(pwtx->strFromAccount);
+    BOOST_FOREACH(const CTxOut& txout, pwtx->vout)
+    {
+        CTxDestination address;
+        if (!ExtractDestination(txout.scriptPubKey, address))
+            continue;
+        map<CTxDestination, string>::const_iterator mi = mapAddressBook.find(address);
+        setAccounts.insert(mi != mapAddressBook.end() ? (*mi).second : string(""));
+    }
+    BOOST_FOREACH(const string& strAccount, setAccounts)
+        mapAccountTxOrdered[strAccount].insert(make_pair(pwtx->nOrderPos, TxPair(pwtx, (CAccountingEntry*)0)));
+}
+
+void CWallet::IndexOrderedTxItem(CWalletTx* pwtx, CAccountingEntry* pacentry)
+{
+    AssertLockHeld(cs_wallet); // wtxOrdered
+    int64_t nOrderPos = pwtx ? pwtx->nOrderPos : pacentry->nOrderPos;
+    TxPair item(pwtx, pacentry);
+    wtxOrdered.insert(make_pair(nOrderPos, item));
+
+    if (!fAccountTxOrderedDirty)
+        IndexAccountTxItem(pwtx, pacentry);
+
+    // icochain: 按资产索引, 转账记录只涉及ICS
+    if (pacentry)
+    {
+        mapAssetTxOrdered[0].insert(make_pair(nOrderPos, item));
+        return;
+    }
+    set<int64_t> setAssets;
+    BOOST_FOREACH(const CTxOut& txout, pwtx->vout)
+    {
+        if (!txout.scriptPubKey.empty())
+            setAssets.insert(txout.nAssetId);
+    }
+    BOOST_FOREACH(int64_t nAssetId, setAssets)
+        mapAssetTxOrdered[nAssetId].insert(make_pair(nOrderPos, item));
+}
+
+void CWallet::BuildOrderedTxIndex()
+{
+    LOCK(cs_wallet);
+    wtxOrdered.clear();
+    mapAccountTxOrdered.clear();
+    mapAssetTxOrdered.clear();
+    fAccountTxOrderedDirty = false;
 
-    // Note: maintaining indices in the database of (account,time) --> txid and (account, time) --> acentry
-    // would make this much faster for applications that do this a lot.
     for (map<uint256, CWalletTx>::iterator it = mapWallet.begin(); it != mapWallet.end(); ++it)
+        IndexOrderedTxItem(&((*it).second), (CAccountingEntry*)0);
+    BOOST_FOREACH(CAccountingEntry& entry, laccentries)
+        IndexOrderedTxItem((CWalletTx*)0, &entry);
+}
+
+const CWallet::TxItems& CWallet::OrderedTxItems(const std::string& strAccount, int64_t nAssetId)
+{
+    AssertLockHeld(cs_wallet); // wtxOrdered
+    static const TxItems txEmpty;
+
+    if (strAccount != "*")
     {
-        CWalletTx* wtx = &((*it).second);
-        txOrdered.insert(make_pair(wtx->nOrderPos, TxPair(wtx, (CAccountingEntry*)0)));
+        // Labels are looked up when an entry is indexed, so relabelling
+        // an address means indexing everything again
+        if (fAccountTxOrderedDirty)
+        {
+            mapAccountTxOrdered.clear();
+            fAccountTxOrderedDirty = false;
+            for (TxItems::iterator it = wtxOrdered.begin(); it != wtxOrdered.end(); ++it)
+                IndexAccountTxItem((*it).second.first, (*it).second.second);
+        }
+        map<string, TxItems>::const_iterator mi = mapAccountTxOrdered.find(strAccount);
+        return mi != mapAccountTxOrdered.end() ? (*mi).second : txEmpty;
     }
-    acentries.clear();
-    walletdb.ListAccountCreditDebit(strAccount, acentries);
-    BOOST_FOREACH(CAccountingEntry& entry, acentries)
+    if (nAssetId != -1)
     {
-        txOrdered.insert(make_pair(entry.nOrderPos, TxPair((CWalletTx*)0, &entry)));
+        map<int64_t, TxItems>::const_iterator mi = mapAssetTxOrdered.find(nAssetId);
+        return mi != mapAssetTxOrdered.end() ? (*mi).second : txEmpty;
     }
+    return wtxOrdered;
+}
+
+bool CWallet::AddAccountingEntry(const CAccountingEntry& acentry, CWalletDB& walletdb)
+{
+    CAccountingEntry entry = acentry;
+    if (!walletdb.WriteAccountingEntry(entry))
+        return false;
+    IndexAccountingEntry(entry);
+    return true;
+}
 
-    return txOrdered;
+void CWallet::IndexAccountingEntry(const CAccountingEntry& acentry)
+{
+    AssertLockHeld(cs_wallet); // laccentries
+    laccentries.push_back(acentry);
+    IndexOrderedTxItem((CWalletTx*)0, &laccentries.back());
 }
 
 void CWallet::WalletUpdateSpent(const CTransaction &tx, bool fBlock)
@@ -389,6 +501,7 @@ void CWallet::WalletUpdateSpent(const CTransaction &tx, bool fBlock)
                     LogPrintf("WalletUpdateSpent found spent coin %s ICS %s\n", FormatMoney(wtx.GetCredit(0)), wtx.GetHash().ToString());
                     wtx.MarkSpent(txin.prevout.n);
                     wtx.WriteToDisk();
+                    UpdateUnspentIndex(wtx);
                     NotifyTransactionChanged(this, txin.prevout.hash, CT_UPDATED);
                 }
             }
@@ -409,6 +522,7 @@ void CWallet::WalletUpdateSpent(const CTransaction &tx, bool fBlock)
                     NotifyTransactionChanged(this, hash, CT_UPDATED);
                 }
             }
+            UpdateUnspentIndex(wtx);
         }
 
     }
@@ -420,70 +534,123 @@ void CWallet::MarkDirty()
         LOCK(cs_wallet);
         BOOST_FOREACH(PAIRTYPE(const uint256, CWalletTx)& item, mapWallet)
             item.second.MarkDirty();
+        // Keys may have been added, outputs can have become ours
+        BuildUnspentIndex();
     }
 }
 
-bool CWallet::AddToWallet(const CWalletTx& wtxIn)
+void CWallet::InitNewWalletTx(CWalletTx& wtx, int64_t nOrderPos, const CBlock* pblock)
 {
-    uint256 hash = wtxIn.GetHash();
+    AssertLockHeld(cs_wallet); // wtxOrdered
+    wtx.BindWallet(this);
+    wtx.nTimeReceived = GetAdjustedTime();
+    wtx.nOrderPos = nOrderPos;
+
+    wtx.nTimeSmart = wtx.nTimeReceived;
+    if (wtx.hashBlock != 0)
     {
-        LOCK(cs_wallet);
-        // Inserts only if not already there, returns tx inserted or tx found
-        pair<map<uint256, CWalletTx>::iterator, bool> ret = mapWallet.insert(make_pair(hash, wtxIn));
-        CWalletTx& wtx = (*ret.first).second;
-        wtx.BindWallet(this);
-        bool fInsertedNew = ret.second;
-        if (fInsertedNew)
+        // Block notifications may be applied without cs_main (-walletasync), they bring the block
+        unsigned int blocktime = 0;
+        if (pblock && pblock->GetHash() == wtx.hashBlock)
+            blocktime = pblock->nTime;
+        else if (mapBlockIndex.count(wtx.hashBlock))
+            blocktime = mapBlockIndex[wtx.hashBlock]->nTime;
+        if (blocktime)
         {
-            wtx.nTimeReceived = GetAdjustedTime();
-            wtx.nOrderPos = IncOrderPosNext();
-
-            wtx.nTimeSmart = wtx.nTimeReceived;
-            if (wtxIn.hashBlock != 0)
+            unsigned int latestNow = wtx.nTimeReceived;
+            unsigned int latestEntry = 0;
             {
-                if (mapBlockIndex.count(wtxIn.hashBlock))
+                // Tolerate times up to the last timestamp in the wallet not more than 5 minutes into the future
+                int64_t latestTolerated = latestNow + 300;
+                for (TxItems::reverse_iterator it = wtxOrdered.rbegin(); it != wtxOrdered.rend(); ++it)
                 {
-                    unsigned int latestNow = wtx.nTimeReceived;
-                    unsigned int latestEntry = 0;
+                    CWalletTx *const pwtx = (*it).second.first;
+                    if (pwtx == &wtx)
+                        continue;
+                    CAccountingEntry *const pacentry = (*it).second.second;
+                    int64_t nSmartTime;
+                    if (pwtx)
                     {
-                        // Tolerate times up to the last timestamp in the wallet not more than 5 minutes into the future
-                        int64_t latestTolerated = latestNow + 300;
-                        std::list<CAccountingEntry> acentries;
-                        TxItems txOrdered = OrderedTxItems(acentries);
-                        for (TxItems::reverse_iterator it = txOrdered.rbegin(); it != txOrdered.rend(); ++it)
-                        {
-                            CWalletTx *const pwtx = (*it).second.first;
-                            if (pwtx == &wtx)
-                                continue;
-                            CAccountingEntry *const pacentry = (*it).second.second;
-                            int64_t nSmartTime;
-                            if (pwtx)
-                            {
-                                nSmartTime = pwtx->nTimeSmart;
-                                if (!nSmartTime)
-                                    nSmartTime = pwtx->nTimeReceived;
-                            }
-                            else
-                                nSmartTime = pacentry->nTime;
-                            if (nSmartTime <= latestTolerated)
-                            {
-                                latestEntry = nSmartTime;
-                                if (nSmartTime > latestNow)
-                                    latestNow = nSmartTime;
-                                break;
-                            }
-                        }
+                        nSmartTime = pwtx->nTimeSmart;
+                        if (!nSmartTime)
+                            nSmartTime = pwtx->nTimeReceived;
+                    }
+                    else
+                        nSmartTime = pacentry->nTime;
+                    if (nSmartTime <= latestTolerated)
+                    {
+                        latestEntry = nSmartTime;
+                        if (nSmartTime > latestNow)
+                            latestNow = nSmartTime;
+                        break;
                     }
+                }
+            }
+
+            wtx.nTimeSmart = std::max(latestEntry, std::min(blocktime, latestNow));
+        }
+        else
+            LogPrintf("AddToWallet() : found %s in block %s not in index\n",
+                     wtx.GetHash().ToString(),
+                     wtx.hashBlock.ToString());
+    }
+}
 
-                    unsigned int& blocktime = mapBlockIndex[wtxIn.hashBlock]->nTime;
-                    wtx.nTimeSmart = std::max(latestEntry, std::min(blocktime, latestNow));
+void CWallet::WalletTxWritten(CWalletTx& wtx, bool fInsertedNew)
+{
+    AssertLockHeld(cs_wallet);
+    if (fInsertedNew)
+        IndexOrderedTxItem(&wtx, (CAccountingEntry*)0);
+
+    if (!fHaveGUI) {
+        // If default receiving address gets used, replace it with a new one
+        if (vchDefaultKey.IsValid()) {
+            CScript scriptDefaultKey;
+            scriptDefaultKey.SetDestination(vchDefaultKey.GetID());
+            BOOST_FOREACH(const CTxOut& txout, wtx.vout)
+            {
+                if (txout.scriptPubKey == scriptDefaultKey)
+                {
+                    CPubKey newDefaultKey;
+                    if (GetKeyFromPool(newDefaultKey))
+                    {
+                        SetDefaultKey(newDefaultKey);
+                        SetAddressBookName(vchDefaultKey.GetID(), "");
+                    }
                 }
-                else
-                    LogPrintf("AddToWallet() : found %s in block %s not in index\n",
-                             wtxIn.GetHash().ToString(),
-                             wtxIn.hashBlock.ToString());
             }
         }
+    }
+    UpdateUnspentIndex(wtx);
+
+    // since AddToWallet is called directly for self-originating transactions, check for consumption of own coins
+    WalletUpdateSpent(wtx, (wtx.hashBlock != 0));
+
+    // Notify UI of new or updated transaction
+    NotifyTransactionChanged(this, wtx.GetHash(), fInsertedNew ? CT_NEW : CT_UPDATED);
+
+    // notify an external script when a wallet transaction comes in or is updated
+    std::string strCmd = GetArg("-walletnotify", "");
+
+    if ( !strCmd.empty())
+    {
+        boost::replace_all(strCmd, "%s", wtx.GetHash().GetHex());
+        boost::thread t(runCommand, strCmd); // thread runs free
+    }
+}
+
+bool CWallet::AddToWallet(const CWalletTx& wtxIn, const CBlock* pblock)
+{
+    uint256 hash = wtxIn.GetHash();
+    {
+        LOCK(cs_wallet);
+        // Inserts only if not already there, returns tx inserted or tx found
+        pair<map<uint256, CWalletTx>::iterator, bool> ret = mapWallet.insert(make_pair(hash, wtxIn));
+        CWalletTx& wtx = (*ret.first).second;
+        wtx.BindWallet(this);
+        bool fInsertedNew = ret.second;
+        if (fInsertedNew)
+            InitNewWalletTx(wtx, IncOrderPosNext(), pblock);
 
         bool fUpdated = false;
         if (!fInsertedNew)
@@ -513,43 +680,17 @@ bool CWallet::AddToWallet(const CWalletTx& wtxIn)
 
         // Write to disk
         if (fInsertedNew || fUpdated)
+        {
+            wtx.fCoinStateCached = false;
             if (!wtx.WriteToDisk())
+            {
+                if (fInsertedNew)
+                    mapWallet.erase(ret.first);
                 return false;
-
-        if (!fHaveGUI) {
-            // If default receiving address gets used, replace it with a new one
-            if (vchDefaultKey.IsValid()) {
-                CScript scriptDefaultKey;
-                scriptDefaultKey.SetDestination(vchDefaultKey.GetID());
-                BOOST_FOREACH(const CTxOut& txout, wtx.vout)
-                {
-                    if (txout.scriptPubKey == scriptDefaultKey)
-                    {
-                        CPubKey newDefaultKey;
-                        if (GetKeyFromPool(newDefaultKey))
-                        {
-                            SetDefaultKey(newDefaultKey);
-                            SetAddressBookName(vchDefaultKey.GetID(), "");
-                        }
-                    }
-                }
             }
         }
-        // since AddToWallet is called directly for self-originating transactions, check for consumption of own coins
-        WalletUpdateSpent(wtx, (wtxIn.hashBlock != 0));
-
-        // Notify UI of new or updated transaction
-        NotifyTransactionChanged(this, hash, fInsertedNew ? CT_NEW : CT_UPDATED);
-
-        // notify an external script when a wallet transaction comes in or is updated
-        std::string strCmd = GetArg("-walletnotify", "");
-
-        if ( !strCmd.empty())
-        {
-            boost::replace_all(strCmd, "%s", wtxIn.GetHash().GetHex());
-            boost::thread t(runCommand, strCmd); // thread runs free
-        }
 
+        WalletTxWritten(wtx, fInsertedNew);
     }
     return true;
 }
@@ -569,8 +710,8 @@ bool CWallet::AddToWalletIfInvolvingMe(const CTransaction& tx, const CBlock* pbl
             CWalletTx wtx(this,tx);
             // Get merkle branch if transaction was found in a block
             if (pblock)
-                wtx.SetMerkleBranch(pblock);
-            return AddToWallet(wtx);
+                wtx.SetMerkleBranchInBlock(*pblock);
+            return AddToWallet(wtx, pblock);
         }
         else
             WalletUpdateSpent(tx);
@@ -599,8 +740,20 @@ void CWallet::EraseFromWallet(const uint256 &hash)
         return;
     {
         LOCK(cs_wallet);
-        if (mapWallet.erase(hash))
+        map<uint256, CWalletTx>::iterator mi = mapWallet.find(hash);
+        if (mi != mapWallet.end())
+        {
+            CWalletTx* pwtx = &(*mi).second;
+            TxPair item(pwtx, (CAccountingEntry*)0);
+            EraseTxItem(wtxOrdered, pwtx->nOrderPos, item);
+            for (map<string, TxItems>::iterator it = mapAccountTxOrdered.begin(); it != mapAccountTxOrdered.end(); ++it)
+                EraseTxItem((*it).second, pwtx->nOrderPos, item);
+            for (map<int64_t, TxItems>::iterator it = mapAssetTxOrdered.begin(); it != mapAssetTxOrdered.end(); ++it)
+                EraseTxItem((*it).second, pwtx->nOrderPos, item);
+            UpdateUnspentIndex(*pwtx, false);
+            mapWallet.erase(mi);
             CWalletDB(strWalletFile).EraseTx(hash);
+        }
     }
     return;
 }
@@ -608,6 +761,8 @@ void CWallet::EraseFromWallet(const uint256 &hash)
 
 bool CWallet::IsMine(const CTxIn &txin) const
 {
+    if (!mineFilter.MayBeMine(txin.prevout))
+        return false;
     {
         LOCK(cs_wallet);
         map<uint256, CWalletTx>::const_iterator mi = mapWallet.find(txin.prevout.hash);
@@ -624,6 +779,8 @@ bool CWallet::IsMine(const CTxIn &txin) const
 
 int64_t CWallet::GetDebit(const CTxIn &txin, int64_t nAssetId) const
 {
+    if (!mineFilter.MayBeMine(txin.prevout))
+        return 0;
     {
         LOCK(cs_wallet);
         map<uint256, CWalletTx>::const_iterator mi = mapWallet.find(txin.prevout.hash);
@@ -858,98 +1015,292 @@ void CWalletTx::GetAccountAmounts(const string& strAccount, int64_t& nReceived,
 
 void CWalletTx::AddSupportingTransactions(CTxDB& txdb)
 {
+    vector<CMerkleTx> vtxSupporting;
+    GetSupportingTransactions(txdb, vtxSupporting);
+
+    // Parents in the wallet can be found again, keep copies of the others only
+    LOCK(pwallet->cs_wallet);
     vtxPrev.clear();
+    BOOST_FOREACH(const CMerkleTx& tx, vtxSupporting)
+        if (!pwallet->mapWallet.count(tx.GetHash()))
+            vtxPrev.push_back(tx);
+}
 
-    const int COPY_DEPTH = 3;
-    if (SetMerkleBranch() < COPY_DEPTH)
-    {
-        vector<uint256> vWorkQueue;
-        BOOST_FOREACH(const CTxIn& txin, vin)
-            vWorkQueue.push_back(txin.prevout.hash);
+const CMerkleTx* CWalletTx::GetSupportingTransaction(const uint256& hash) const
+{
+    map<uint256, CWalletTx>::const_iterator mi = pwallet->mapWallet.find(hash);
+    if (mi != pwallet->mapWallet.end())
+        return &(*mi).second;
+    BOOST_FOREACH(const CMerkleTx& tx, vtxPrev)
+        if (tx.GetHash() == hash)
+            return &tx;
+    return NULL;
+}
 
-        // This critsect is OK because txdb is already open
-        {
-            LOCK(pwallet->cs_wallet);
-            map<uint256, const CMerkleTx*> mapWalletPrev;
-            set<uint256> setAlreadyDone;
-            for (unsigned int i = 0; i < vWorkQueue.size(); i++)
-            {
-                uint256 hash = vWorkQueue[i];
-                if (setAlreadyDone.count(hash))
-                    continue;
-                setAlreadyDone.insert(hash);
+void CWalletTx::GetSupportingTransactions(CTxDB& txdb, vector<CMerkleTx>& vtxRet) const
+{
+    vtxRet.clear();
 
-                CMerkleTx tx;
-                map<uint256, CWalletTx>::const_iterator mi = pwallet->mapWallet.find(hash);
-                if (mi != pwallet->mapWallet.end())
-                {
-                    tx = (*mi).second;
-                    BOOST_FOREACH(const CMerkleTx& txWalletPrev, (*mi).second.vtxPrev)
-                        mapWalletPrev[txWalletPrev.GetHash()] = &txWalletPrev;
-                }
-                else if (mapWalletPrev.count(hash))
-                {
-                    tx = *mapWalletPrev[hash];
-                }
-                else if (txdb.ReadDiskTx(hash, tx))
-                {
-                    ;
-                }
-                else
-                {
-                    LogPrintf("ERROR: AddSupportingTransactions() : unsupported transaction\n");
-                    continue;
-                }
+    vector<uint256> vWorkQueue;
+    BOOST_FOREACH(const CTxIn& txin, vin)
+        vWorkQueue.push_back(txin.prevout.hash);
+
+    // This critsect is OK because txdb is already open
+    {
+        LOCK(pwallet->cs_wallet);
+        map<uint256, const CMerkleTx*> mapWalletPrev;
+        set<uint256> setAlreadyDone;
+        for (unsigned int i = 0; i < vWorkQueue.size(); i++)
+        {
+            uint256 hash = vWorkQueue[i];
+            if (setAlreadyDone.count(hash))
+                continue;
+            setAlreadyDone.insert(hash);
 
-                int nDepth = tx.SetMerkleBranch();
-                vtxPrev.push_back(tx);
+            // Confirmed transactions, and so everything before them, are in the block chain
+            if (txdb.ContainsTx(hash))
+                continue;
 
-                if (nDepth < COPY_DEPTH)
-                {
-                    BOOST_FOREACH(const CTxIn& txin, tx.vin)
-                        vWorkQueue.push_back(txin.prevout.hash);
-                }
+            CMerkleTx tx;
+            map<uint256, CWalletTx>::const_iterator mi = pwallet->mapWallet.find(hash);
+            if (mi != pwallet->mapWallet.end())
+            {
+                tx = (*mi).second;
+                BOOST_FOREACH(const CMerkleTx& txWalletPrev, (*mi).second.vtxPrev)
+                    mapWalletPrev[txWalletPrev.GetHash()] = &txWalletPrev;
+            }
+            else if (const CMerkleTx* ptx = GetSupportingTransaction(hash))
+            {
+                tx = *ptx;
+            }
+            else if (mapWalletPrev.count(hash))
+            {
+                tx = *mapWalletPrev[hash];
             }
+            else if (mempool.lookup(hash, tx))
+            {
+                ;
+            }
+            else
+            {
+                LogPrintf("ERROR: GetSupportingTransactions() : unsupported transaction\n");
+                continue;
+            }
+
+            vtxRet.push_back(tx);
+            BOOST_FOREACH(const CTxIn& txin, tx.vin)
+                vWorkQueue.push_back(txin.prevout.hash);
         }
     }
 
-    reverse(vtxPrev.begin(), vtxPrev.end());
+    reverse(vtxRet.begin(), vtxRet.end());
 }
 
-bool CWalletTx::WriteToDisk()
+bool CWalletTx::CompactSupportingTransactions(CTxDB& txdb)
 {
+    if (vtxPrev.empty())
+        return false;
+
+    // Once this transaction is in a block, all of its parents are too
+    if (hashBlock != 0 && txdb.ContainsTx(GetHash()))
+    {
+        vtxPrev.clear();
+        return true;
+    }
+
+    vector<CMerkleTx> vtxKeep;
+    BOOST_FOREACH(const CMerkleTx& tx, vtxPrev)
+    {
+        uint256 hash = tx.GetHash();
+        if (!pwallet->mapWallet.count(hash) && !txdb.ContainsTx(hash))
+            vtxKeep.push_back(tx);
+    }
+    if (vtxKeep.size() == vtxPrev.size())
+        return false;
+    vtxPrev.swap(vtxKeep);
+    return true;
+}
+
+bool CWalletTx::WriteToDisk(CWalletDB* pwalletdb)
+{
+    if (pwalletdb)
+        return pwalletdb->WriteTx(GetHash(), *this);
     return CWalletDB(pwallet->strWalletFile).WriteTx(GetHash(), *this);
 }
 
+CWalletScanFilter::CWalletScanFilter(const CBasicKeyStore& keystore)
+{
+    std::set<CKeyID> setKeys;
+    keystore.GetKeys(setKeys);
+    setKeyIDs.insert(setKeys.begin(), setKeys.end());
+
+    std::set<CScriptID> setScripts;
+    keystore.GetCScripts(setScripts);
+    setScriptIDs.insert(setScripts.begin(), setScripts.end());
+}
+
+bool CWalletScanFilter::IsRelevant(const CTxOut& txout) const
+{
+    const CScript& script = txout.scriptPubKey;
+
+    // Pay to pubkey hash: OP_DUP OP_HASH160 <20 bytes> OP_EQUALVERIFY OP_CHECKSIG
+    if (script.size() == 25 && script[0] == OP_DUP && script[1] == OP_HASH160 && script[2] == 20 &&
+        script[23] == OP_EQUALVERIFY && script[24] == OP_CHECKSIG)
+        return setKeyIDs.count(uint160(vector<unsigned char>(script.begin() + 3, script.begin() + 23))) > 0;
+
+    // Pay to script hash: OP_HASH160 <20 bytes> OP_EQUAL
+    if (script.IsPayToScriptHash())
+        return setScriptIDs.count(uint160(vector<unsigned char>(script.begin() + 2, script.begin() + 22))) > 0;
+
+    // Pay to pubkey: <33 or 65 byte key> OP_CHECKSIG
+    if ((script.size() == 35 || script.size() == 67) && script[0] == script.size() - 2 && script[script.size() - 1] == OP_CHECKSIG)
+        return setKeyIDs.count(Hash160(script.begin() + 1, script.end() - 1)) > 0;
+
+    // Coinstake markers and data carriers pay nobody
+    if (script.empty() || script[0] == OP_RETURN)
+        return false;
+
+    // Multisig and anything unusual is left to IsMine()
+    return true;
+}
+
+bool CWalletScanFilter::IsRelevant(const CTransaction& tx) const
+{
+    BOOST_FOREACH(const CTxOut& txout, tx.vout)
+        if (IsRelevant(txout))
+            return true;
+    return false;
+}
+
+CWalletScanProgress CWallet::GetScanProgress() const
+{
+    LOCK(cs_scan);
+    return scanProgress;
+}
+
+// Blocks read per round of ScanForWalletTransactions; the locks are released between rounds
+static const unsigned int WALLET_SCAN_BATCH_SIZE = 200;
+
+// A block read by a rescan worker, with the hashes of its transactions and
+// which of them pay to the wallet according to the filter
+class CWalletScanBlock
+{
+public:
+    CBlock block;
+    std::vector<uint256> vHash;
+    std::vector<char> vMatch;
+};
+
+static void ReadScanBlock(const CWalletScanFilter* pfilter, const std::vector<CBlockIndex*>* pvIndex,
+                          std::vector<CWalletScanBlock>* pvBlocks, unsigned int i)
+{
+    CWalletScanBlock& scan = (*pvBlocks)[i];
+    if (!scan.block.ReadFromDisk((*pvIndex)[i], true))
+        scan.block.vtx.clear();
+    scan.vHash.reserve(scan.block.vtx.size());
+    scan.vMatch.reserve(scan.block.vtx.size());
+    BOOST_FOREACH(const CTransaction& tx, scan.block.vtx)
+    {
+        scan.vHash.push_back(tx.GetHash());
+        scan.vMatch.push_back(pfilter->IsRelevant(tx));
+    }
+}
+
 // Scan the block chain (starting in pindexStart) for transactions
 // from or to us. If fUpdate is true, found transactions that already
 // exist in the wallet will be updated.
 int CWallet::ScanForWalletTransactions(CBlockIndex* pindexStart, bool fUpdate)
 {
     int ret = 0;
+    int64_t nStart = GetTimeMillis();
+    int nBlocks = 0;
+
+    int64_t nTimeBirth;
+    {
+        LOCK(cs_wallet);
+        nTimeBirth = nTimeFirstKey;
+    }
+    // Keys added after this point are only seen by the full IsMine() check
+    CWalletScanFilter filter(*this);
+
+    int nWorkers = GetArg("-rescanthreads", boost::thread::hardware_concurrency());
+    nWorkers = std::max(1, std::min(nWorkers, 16));
+
+    {
+        LOCK2(cs_main, cs_scan);
+        scanProgress = CWalletScanProgress();
+        scanProgress.fScanning = true;
+        scanProgress.nStartHeight = pindexStart ? pindexStart->nHeight : nBestHeight;
+        scanProgress.nHeight = scanProgress.nStartHeight;
+        scanProgress.nStopHeight = nBestHeight;
+        scanProgress.nStartTime = GetTime();
+    }
 
     CBlockIndex* pindex = pindexStart;
+    while (pindex && !ShutdownRequested())
     {
-        LOCK2(cs_main, cs_wallet);
-        while (pindex)
+        std::vector<CBlockIndex*> vIndex;
         {
-            // no need to read and scan block, if block was created before
-            // our wallet birthday (as adjusted for block time variability)
-            if (nTimeFirstKey && (pindex->nTime < (nTimeFirstKey - 7200))) {
-                pindex = pindex->pnext;
-                continue;
+            LOCK(cs_main);
+            for (; pindex && vIndex.size() < WALLET_SCAN_BATCH_SIZE; pindex = pindex->pnext)
+            {
+                // no need to read and scan block, if block was created before
+                // our wallet birthday (as adjusted for block time variability)
+                if (nTimeBirth && (pindex->nTime < (nTimeBirth - 7200)))
+                    continue;
+                vIndex.push_back(pindex);
+            }
+        }
+        if (vIndex.empty())
+            break;
+
+        // Read and prefilter the batch without holding any lock
+        std::vector<CWalletScanBlock> vBlocks(vIndex.size());
+        ParallelFor(vIndex.size(), 1, boost::bind(&ReadScanBlock, &filter, &vIndex, &vBlocks, _1), nWorkers);
+
+        // Apply in chain order, so spends of coins found earlier in the scan are seen
+        {
+            LOCK2(cs_main, cs_wallet);
+            unsigned int i = 0;
+            for (; i < vIndex.size() && vIndex[i]->IsInMainChain(); i++)
+            {
+                const CWalletScanBlock& scan = vBlocks[i];
+                for (unsigned int nTx = 0; nTx < scan.block.vtx.size(); nTx++)
+                {
+                    const CTransaction& tx = scan.block.vtx[nTx];
+                    bool fInvolved = scan.vMatch[nTx] || mapWallet.count(scan.vHash[nTx]);
+                    for (unsigned int nIn = 0; nIn < tx.vin.size() && !fInvolved; nIn++)
+                        fInvolved = mapWallet.count(tx.vin[nIn].prevout.hash) > 0;
+                    if (fInvolved && AddToWalletIfInvolvingMe(tx, &scan.block, fUpdate))
+                        ret++;
+                }
             }
+            nBlocks += i;
 
-            CBlock block;
-            block.ReadFromDisk(pindex, true);
-            BOOST_FOREACH(CTransaction& tx, block.vtx)
+            if (i < vIndex.size())
             {
-                if (AddToWalletIfInvolvingMe(tx, &block, fUpdate))
-                    ret++;
+                // The chain was reorganised while the batch was read: go on from the fork
+                CBlockIndex* pfork = vIndex[i];
+                while (pfork && !pfork->IsInMainChain())
+                    pfork = pfork->pprev;
+                pindex = pfork ? pfork->pnext : pindexGenesisBlock;
             }
-            pindex = pindex->pnext;
+            else
+                pindex = vIndex.back()->pnext;
+
+            LOCK(cs_scan);
+            scanProgress.nHeight = i > 0 ? vIndex[i - 1]->nHeight : scanProgress.nHeight;
+            scanProgress.nStopHeight = nBestHeight;
+            scanProgress.nFound = ret;
         }
     }
+
+    {
+        LOCK(cs_scan);
+        scanProgress.fScanning = false;
+    }
+    LogPrintf("ScanForWalletTransactions : scanned %d blocks with %d threads, %d transactions found in %dms\n",
+              nBlocks, nWorkers, ret, GetTimeMillis() - nStart);
     return ret;
 }
 
@@ -994,6 +1345,7 @@ void CWallet::ReacceptWalletTransactions()
                     LogPrintf("ReacceptWalletTransactions found spent coin %s ICS %s\n", FormatMoney(wtx.GetCredit(0)), wtx.GetHash().ToString()); // icochain: 根据不同币种
                     wtx.MarkDirty();
                     wtx.WriteToDisk();
+                    UpdateUnspentIndex(wtx);
                 }
             }
             else
@@ -1014,7 +1366,9 @@ void CWallet::ReacceptWalletTransactions()
 
 void CWalletTx::RelayWalletTransaction(CTxDB& txdb)
 {
-    BOOST_FOREACH(const CMerkleTx& tx, vtxPrev)
+    vector<CMerkleTx> vtxSupporting;
+    GetSupportingTransactions(txdb, vtxSupporting);
+    BOOST_FOREACH(const CMerkleTx& tx, vtxSupporting)
     {
         if (!(tx.IsCoinBase() || tx.IsCoinStake()))
         {
@@ -1219,125 +1573,204 @@ int64_t CWallet::GetImmatureBalance(int64_t nAssetId) const
     return nTotal;
 }
 
-// populate vCoins with vector of spendable COutputs
-void CWallet::AvailableCoins(vector<COutput>& vCoins, bool fOnlyConfirmed, const CCoinControl *coinControl) const
+void CWalletTx::GetCoinState(int& nDepth, int& nBlocksToMaturity, bool& fTrusted) const
 {
-    vCoins.clear();
+    unsigned int nUpdated = mempool.GetTransactionsUpdated();
+    if (!fCoinStateCached || nCoinStateUpdated != nUpdated)
+    {
+        nDepthCached = GetDepthInMainChain();
+        nBlocksToMaturityCached = (IsCoinBase() || IsCoinStake()) ? max(0, (nCoinbaseMaturity+1) - nDepthCached) : 0;
+        fTrustedCached = IsTrusted();
+        nCoinStateUpdated = nUpdated;
+        // Time based lock times can become final without any update
+        fCoinStateCached = (nLockTime == 0);
+    }
+    nDepth = nDepthCached;
+    nBlocksToMaturity = nBlocksToMaturityCached;
+    fTrusted = fTrustedCached;
+}
 
+void CWallet::UpdateUnspentIndex(const CWalletTx& wtx, bool fInWallet)
+{
+    AssertLockHeld(cs_wallet); // mapUnspentByAsset
+    uint256 hash = wtx.GetHash();
+    for (unsigned int i = 0; i < wtx.vout.size(); i++)
     {
-        LOCK2(cs_main, cs_wallet);
-        for (map<uint256, CWalletTx>::const_iterator it = mapWallet.begin(); it != mapWallet.end(); ++it)
+        const CTxOut& txout = wtx.vout[i];
+        bool fMine = fInWallet && IsMine(txout);
+        if (fMine)
+            mineFilter.AddCoin(COutPoint(hash, i));
+        else
+            mineFilter.RemoveCoin(COutPoint(hash, i));
+        if (fMine && !wtx.IsSpent(i))
         {
-            const CWalletTx* pcoin = &(*it).second;
-
-            if (!IsFinalTx(*pcoin))
-                continue;
-
-            if (fOnlyConfirmed && !pcoin->IsTrusted())
-                continue;
+            mapUnspentByAsset[txout.nAssetId][COutPoint(hash, i)] = &wtx;
+            continue;
+        }
+        map<int64_t, UnspentOutputs>::iterator mi = mapUnspentByAsset.find(txout.nAssetId);
+        if (mi == mapUnspentByAsset.end())
+            continue;
+        (*mi).second.erase(COutPoint(hash, i));
+        if ((*mi).second.empty())
+            mapUnspentByAsset.erase(mi);
+    }
+}
 
-            if (pcoin->IsCoinBase() && pcoin->GetBlocksToMaturity() > 0)
-                continue;
+void CWallet::BuildUnspentIndex()
+{
+    LOCK(cs_wallet);
+    mapUnspentByAsset.clear();
+    mineFilter.ClearCoins();
+    for (map<uint256, CWalletTx>::const_iterator it = mapWallet.begin(); it != mapWallet.end(); ++it)
+        UpdateUnspentIndex((*it).second);
+}
 
-            if(pcoin->IsCoinStake() && pcoin->GetBlocksToMaturity() > 0)
-                continue;
+void CWallet::CompactSupportingTransactions()
+{
+    int64_t nStart = GetTimeMillis();
+    CTxDB txdb("r");
+    CWalletDB walletdb(strWalletFile);
+    LOCK(cs_wallet);
+    unsigned int nCompacted = 0, nDropped = 0;
+    for (map<uint256, CWalletTx>::iterator it = mapWallet.begin(); it != mapWallet.end(); ++it)
+    {
+        CWalletTx& wtx = (*it).second;
+        unsigned int nPrev = wtx.vtxPrev.size();
+        if (!wtx.CompactSupportingTransactions(txdb))
+            continue;
+        nDropped += nPrev - wtx.vtxPrev.size();
+        nCompacted++;
+        walletdb.WriteTx((*it).first, wtx);
+    }
+    if (nCompacted > 0)
+        LogPrintf("CompactSupportingTransactions: dropped %u copies from %u transactions %dms\n",
+                  nDropped, nCompacted, GetTimeMillis() - nStart);
+}
 
-            int nDepth = pcoin->GetDepthInMainChain();
-            if (nDepth < 0)
-                continue;
+// Heap held by a transaction, roughly: its vectors, scripts and strings
+static uint64_t MerkleTxMemoryUsage(const CMerkleTx& tx)
+{
+    uint64_t nBytes = tx.vin.capacity() * sizeof(CTxIn) + tx.vout.capacity() * sizeof(CTxOut) +
+                      tx.vPayload.capacity() * sizeof(string) + tx.vMerkleBranch.capacity() * sizeof(uint256);
+    BOOST_FOREACH(const CTxIn& txin, tx.vin)
+        nBytes += txin.scriptSig.capacity();
+    BOOST_FOREACH(const CTxOut& txout, tx.vout)
+        nBytes += txout.scriptPubKey.capacity();
+    BOOST_FOREACH(const string& str, tx.vPayload)
+        nBytes += str.capacity();
+    return nBytes;
+}
 
-            for (unsigned int i = 0; i < pcoin->vout.size(); i++)
-                if (!(pcoin->IsSpent(i)) && IsMine(pcoin->vout[i]) && pcoin->vout[i].nValue >= nMinimumInputValue &&
-                (!coinControl || !coinControl->HasSelected() || coinControl->IsSelected((*it).first, i)))
-                    vCoins.push_back(COutput(pcoin, i, nDepth));
+void CWallet::GetMemoryUsage(CWalletMemoryUsage& usage) const
+{
+    // A std::map node: three pointers and a colour besides the value
+    static const size_t MAP_NODE_SIZE = 4 * sizeof(void*);
 
-        }
+    LOCK(cs_wallet);
+    for (map<uint256, CWalletTx>::const_iterator it = mapWallet.begin(); it != mapWallet.end(); ++it)
+    {
+        const CWalletTx& wtx = (*it).second;
+        usage.nTransactions++;
+        usage.nTxBytes += MAP_NODE_SIZE + sizeof(uint256) + sizeof(CWalletTx) + MerkleTxMemoryUsage(wtx) +
+                          wtx.vfSpent.capacity() + wtx.strFromAccount.capacity();
+        BOOST_FOREACH(const PAIRTYPE(const string, string)& item, wtx.mapValue)
+            usage.nMapValueBytes += MAP_NODE_SIZE + 2 * sizeof(string) + item.first.capacity() + item.second.capacity();
+        BOOST_FOREACH(const PAIRTYPE(string, string)& item, wtx.vOrderForm)
+            usage.nMapValueBytes += 2 * sizeof(string) + item.first.capacity() + item.second.capacity();
+        usage.nSupportingTxs += wtx.vtxPrev.size();
+        usage.nSupportingBytes += wtx.vtxPrev.capacity() * sizeof(CMerkleTx);
+        BOOST_FOREACH(const CMerkleTx& tx, wtx.vtxPrev)
+            usage.nSupportingBytes += MerkleTxMemoryUsage(tx);
     }
 }
 
-// populate vCoins with vector of spendable COutputs
-// icochain: 根据id选出所有未花费的资产
-void CWallet::AvailableCoinsForTransAsset(vector<COutput>& vCoins, int64_t& nAssetId, const CCoinControl *coinControl) const
+// Append the outputs of one asset that are spendable now to vCoins, in
+// mapWallet order
+static void AvailableUnspent(vector<COutput>& vCoins, const CWallet::UnspentOutputs& outputs, bool fOnlyConfirmed, const CCoinControl *coinControl)
 {
-    vCoins.clear();
-
+    for (CWallet::UnspentOutputs::const_iterator it = outputs.begin(); it != outputs.end(); ++it)
     {
-        LOCK2(cs_main, cs_wallet);
-        for (map<uint256, CWalletTx>::const_iterator it = mapWallet.begin(); it != mapWallet.end(); ++it)
-        {
-            const CWalletTx* pcoin = &(*it).second;
+        const CWalletTx* pcoin = (*it).second;
+        unsigned int i = (*it).first.n;
 
-            if (!IsFinalTx(*pcoin))
-                continue;
+        if (pcoin->IsSpent(i) || pcoin->vout[i].nValue < nMinimumInputValue)
+            continue;
+        if (coinControl && coinControl->HasSelected() && !coinControl->IsSelected((*it).first.hash, i))
+            continue;
 
-            if (!pcoin->IsTrusted())
-                continue;
+        int nDepth, nBlocksToMaturity;
+        bool fTrusted;
+        pcoin->GetCoinState(nDepth, nBlocksToMaturity, fTrusted);
 
-            if (pcoin->IsCoinBase() && pcoin->GetBlocksToMaturity() > 0)
-                continue;
+        if (fOnlyConfirmed ? !fTrusted : !IsFinalTx(*pcoin))
+            continue;
 
-            if(pcoin->IsCoinStake() && pcoin->GetBlocksToMaturity() > 0)
-                continue;
+        if (nBlocksToMaturity > 0)
+            continue;
 
-            int nDepth = pcoin->GetDepthInMainChain();
-            if (nDepth < 0)
-                continue;
+        if (nDepth < 0)
+            continue;
 
-            for (unsigned int i = 0; i < pcoin->vout.size(); i++)
-                if (!(pcoin->IsSpent(i)) && IsMine(pcoin->vout[i]) && pcoin->vout[i].nValue >= nMinimumInputValue &&
-                (!coinControl || !coinControl->HasSelected() || coinControl->IsSelected((*it).first, i))&&
-                (pcoin->vout[i].nAssetId == nAssetId))
-                    vCoins.push_back(COutput(pcoin, i, nDepth));
-        }
+        vCoins.push_back(COutput(pcoin, i, nDepth));
     }
 }
 
-void CWallet::AvailableCoinsForSeoAsset(std::vector<COutput>& vCoins, std::string publisher, bool isSelect, int64_t& nPublisherValue) const
+// populate vCoins with vector of spendable COutputs
+void CWallet::AvailableCoins(vector<COutput>& vCoins, bool fOnlyConfirmed, const CCoinControl *coinControl) const
 {
-    nPublisherValue = 0;
     vCoins.clear();
 
     {
         LOCK2(cs_main, cs_wallet);
-        for (map<uint256, CWalletTx>::const_iterator it = mapWallet.begin(); it != mapWallet.end(); ++it)
-        {
-            const CWalletTx* pcoin = &(*it).second;
-
-            if (!IsFinalTx(*pcoin))
-                continue;
+        for (map<int64_t, UnspentOutputs>::const_iterator it = mapUnspentByAsset.begin(); it != mapUnspentByAsset.end(); ++it)
+            AvailableUnspent(vCoins, (*it).second, fOnlyConfirmed, coinControl);
+    }
+}
 
-            if (!pcoin->IsTrusted())
-                continue;
+// populate vCoins with vector of spendable COutputs
+// icochain: 根据id选出所有未花费的资产
+void CWallet::AvailableCoinsForTransAsset(vector<COutput>& vCoins, int64_t& nAssetId, const CCoinControl *coinControl) const
+{
+    vCoins.clear();
 
-            if (pcoin->IsCoinBase() && pcoin->GetBlocksToMaturity() > 0)
-                continue;
+    {
+        LOCK2(cs_main, cs_wallet);
+        map<int64_t, UnspentOutputs>::const_iterator mi = mapUnspentByAsset.find(nAssetId);
+        if (mi != mapUnspentByAsset.end())
+            AvailableUnspent(vCoins, (*mi).second, true, coinControl);
+    }
+}
 
-            if(pcoin->IsCoinStake() && pcoin->GetBlocksToMaturity() > 0)
-                continue;
+void CWallet::AvailableCoinsForSeoAsset(std::vector<COutput>& vCoins, std::string publisher, bool isSelect, int64_t& nPublisherValue) const
+{
+    nPublisherValue = 0;
+    vCoins.clear();
 
-            int nDepth = pcoin->GetDepthInMainChain();
-            if (nDepth < 0)
-                continue;
+    {
+        LOCK2(cs_main, cs_wallet);
+        // icochain: 只在小企股中选取
+        vector<COutput> vCandidates;
+        map<int64_t, UnspentOutputs>::const_iterator mi = mapUnspentByAsset.find(0);
+        if (mi != mapUnspentByAsset.end())
+            AvailableUnspent(vCandidates, (*mi).second, true, NULL);
 
-            for (unsigned int i = 0; i < pcoin->vout.size(); i++)
-                if (!(pcoin->IsSpent(i)) && IsMine(pcoin->vout[i]) && pcoin->vout[i].nValue >= nMinimumInputValue && pcoin->vout[i].nAssetId ==0)
-                {
-                    const CTxOut& txout = pcoin->vout[i];
-                    CTxDestination address;
-                    if (!ExtractDestination(txout.scriptPubKey, address))
-                       continue;
-
-                    if(isSelect){
-                        if(CBitcoinAddress(address).ToString() == publisher){
-                            nPublisherValue += txout.nValue;
-                            vCoins.push_back(COutput(pcoin, i, nDepth));
-                        }
-                    }
-                    else {
-                        if(CBitcoinAddress(address).ToString() != publisher)
-                            vCoins.push_back(COutput(pcoin, i, nDepth));
-                    }
+        BOOST_FOREACH(const COutput& out, vCandidates)
+        {
+            const CTxOut& txout = out.tx->vout[out.i];
+            CTxDestination address;
+            if (!ExtractDestination(txout.scriptPubKey, address))
+               continue;
+
+            if(isSelect){
+                if(CBitcoinAddress(address).ToString() == publisher){
+                    nPublisherValue += txout.nValue;
+                    vCoins.push_back(out);
                 }
+            }
+            else {
+                if(CBitcoinAddress(address).ToString() != publisher)
+                    vCoins.push_back(out);
+            }
         }
     }
 }
@@ -1348,23 +1781,31 @@ void CWallet::AvailableCoinsForStaking(vector<COutput>& vCoins, unsigned int nSp
 
     {
         LOCK2(cs_main, cs_wallet);
-        for (map<uint256, CWalletTx>::const_iterator it = mapWallet.begin(); it != mapWallet.end(); ++it)
+        map<int64_t, UnspentOutputs>::const_iterator mi = mapUnspentByAsset.find(0); //icochain: 只选取小企股
+        if (mi == mapUnspentByAsset.end())
+            return;
+        for (UnspentOutputs::const_iterator it = (*mi).second.begin(); it != (*mi).second.end(); ++it)
         {
-            const CWalletTx* pcoin = &(*it).second;
+            const CWalletTx* pcoin = (*it).second;
+            unsigned int i = (*it).first.n;
+
+            if (pcoin->IsSpent(i) || pcoin->vout[i].nValue < nMinimumInputValue)
+                continue;
+
+            int nDepth, nBlocksToMaturity;
+            bool fTrusted;
+            pcoin->GetCoinState(nDepth, nBlocksToMaturity, fTrusted);
 
-            int nDepth = pcoin->GetDepthInMainChain();
             if (nDepth < 1)
                 continue;
 
             if (nDepth < nStakeMinConfirmations)
                 continue;
 
-            if (pcoin->GetBlocksToMaturity() > 0)
+            if (nBlocksToMaturity > 0)
                 continue;
 
-            for (unsigned int i = 0; i < pcoin->vout.size(); i++)
-                if (!(pcoin->IsSpent(i)) && IsMine(pcoin->vout[i]) && pcoin->vout[i].nValue >= nMinimumInputValue && pcoin->vout[i].nAssetId ==0) //icochain: 只选取小企股
-                    vCoins.push_back(COutput(pcoin, i, nDepth));
+            vCoins.push_back(COutput(pcoin, i, nDepth));
         }
     }
 }
@@ -1415,6 +1856,75 @@ static void ApproximateBestSubset(vector<pair<int64_t, pair<const CWalletTx*,uns
     }
 }
 
+// Stop the branch and bound search after this many steps
+static const int BNB_MAX_TRIES = 100000;
+// Changeless matches must still fit a standard transaction; a signed
+// pay-to-pubkey-hash input is about 180 bytes
+static const unsigned int BNB_MAX_INPUTS = MAX_STANDARD_TX_SIZE / 180;
+
+bool SelectCoinsBnB(const vector<pair<int64_t, pair<const CWalletTx*,unsigned int> > >& vValue, int64_t nTargetValue,
+                    vector<char>& vfBest)
+{
+    vector<char> vfSelection; // decisions for vValue[0, vfSelection.size())
+    vfSelection.reserve(vValue.size());
+    unsigned int nSelected = 0;
+    unsigned int nBestSelected = BNB_MAX_INPUTS + 1;
+    int64_t nValue = 0;
+    int64_t nAvailable = 0; // total of the coins not decided yet
+    for (unsigned int i = 0; i < vValue.size(); i++)
+        nAvailable += vValue[i].first;
+
+    vfBest.clear();
+    for (int nTries = 0; nTries < BNB_MAX_TRIES && nBestSelected > 1; nTries++)
+    {
+        bool fBacktrack = false;
+        if (nValue == nTargetValue)
+        {
+            if (nSelected < nBestSelected)
+            {
+                nBestSelected = nSelected;
+                vfBest = vfSelection;
+                vfBest.resize(vValue.size(), false);
+            }
+            fBacktrack = true;
+        }
+        else if (nValue > nTargetValue || nValue + nAvailable < nTargetValue || nSelected + 1 >= nBestSelected)
+            fBacktrack = true;
+
+        if (fBacktrack)
+        {
+            // Give back the trailing excluded coins, then exclude the last included one
+            while (!vfSelection.empty() && !vfSelection.back())
+            {
+                vfSelection.pop_back();
+                nAvailable += vValue[vfSelection.size()].first;
+            }
+            if (vfSelection.empty())
+                break; // whole tree searched
+            vfSelection.back() = false;
+            nValue -= vValue[vfSelection.size() - 1].first;
+            nSelected--;
+        }
+        else
+        {
+            unsigned int i = vfSelection.size();
+            nAvailable -= vValue[i].first;
+            // Including a coin right after excluding one of the same value
+            // only repeats sums that were already tried
+            if (!vfSelection.empty() && !vfSelection.back() && vValue[i].first == vValue[i - 1].first)
+                vfSelection.push_back(false);
+            else
+            {
+                vfSelection.push_back(true);
+                nValue += vValue[i].first;
+                nSelected++;
+            }
+        }
+    }
+
+    return !vfBest.empty();
+}
+
 // ppcoin: total coins staked (non-spendable until maturity)
 int64_t CWallet::GetStake() const
 {
@@ -1509,11 +2019,24 @@ bool CWallet::SelectCoinsMinConf(int64_t nTargetValue, unsigned int nSpendTime,
         return true;
     }
 
-    // Solve subset sum by stochastic approximation
     sort(vValue.rbegin(), vValue.rend(), CompareValueOnly());
     vector<char> vfBest;
     int64_t nBest;
 
+    // Prefer an exact match, which needs no change output
+    if (SelectCoinsBnB(vValue, nTargetValue, vfBest))
+    {
+        for (unsigned int i = 0; i < vValue.size(); i++)
+            if (vfBest[i])
+            {
+                setCoinsRet.insert(vValue[i].second);
+                nValueRet += vValue[i].first;
+            }
+        LogPrint("selectcoins", "SelectCoins() branch and bound: %u inputs, no change\n", setCoinsRet.size());
+        return true;
+    }
+
+    // Solve subset sum by stochastic approximation
     ApproximateBestSubset(vValue, nTotalLower, nTargetValue, vfBest, nBest, 1000);
     if (nBest != nTargetValue && nTotalLower >= nTargetValue + CENT)
         ApproximateBestSubset(vValue, nTotalLower, nTargetValue + CENT, vfBest, nBest, 1000);
@@ -1804,7 +2327,7 @@ bool CWallet::CreateTxForTransferAsset(const vector<pair<CScript, int64_t> >& ve
                     continue;
                 }
 
-                // Fill vtxPrev by copying from previous transactions vtxPrev
+                // Fill vtxPrev with the unconfirmed parents the wallet cannot look up
                 wtxNew.AddSupportingTransactions(txdb);
                 wtxNew.fTimeReceivedIsTxTime = true;
 
@@ -1956,7 +2479,7 @@ bool CWallet::CreateTransaction(const vector<pair<CScript, int64_t> >& vecSend,
                     continue;
                 }
 
-                // Fill vtxPrev by copying from previous transactions vtxPrev
+                // Fill vtxPrev with the unconfirmed parents the wallet cannot look up
                 wtxNew.AddSupportingTransactions(txdb);
                 wtxNew.fTimeReceivedIsTxTime = true;
 
@@ -2079,7 +2602,7 @@ bool CWallet::CreateRegisterAssetTx(const CScript& scriptPubKey, const int64_t&
                     continue;
                 }
 
-                // Fill vtxPrev by copying from previous transactions vtxPrev
+                // Fill vtxPrev with the unconfirmed parents the wallet cannot look up
                 wtxNew.AddSupportingTransactions(txdb);
                 wtxNew.fTimeReceivedIsTxTime = true;
 
@@ -2198,7 +2721,7 @@ bool CWallet::CreateRegisterAssetTx(const CScript& scriptPubKey, const int64_t&
                      continue;
                  }
 
-                 // Fill vtxPrev by copying from previous transactions vtxPrev
+                 // Fill vtxPrev with the unconfirmed parents the wallet cannot look up
                  wtxNew.AddSupportingTransactions(txdb);
                  wtxNew.fTimeReceivedIsTxTime = true;
 
@@ -2321,7 +2844,7 @@ bool CWallet::CreateRegisterAliasTx(const CScript& scriptPubKey, CWalletTx& wtxN
                     continue;
                 }
 
-                // Fill vtxPrev by copying from previous transactions vtxPrev
+                // Fill vtxPrev with the unconfirmed parents the wallet cannot look up
                 wtxNew.AddSupportingTransactions(txdb);
                 wtxNew.fTimeReceivedIsTxTime = true;
 
@@ -2590,6 +3113,7 @@ bool CWallet::CommitTransaction(CWalletTx& wtxNew, CReserveKey& reservekey)
                 coin.BindWallet(this);
                 coin.MarkSpent(txin.prevout.n);
                 coin.WriteToDisk();
+                UpdateUnspentIndex(coin);
                 NotifyTransactionChanged(this, coin.GetHash(), CT_UPDATED);
             }
 
@@ -2614,6 +3138,357 @@ bool CWallet::CommitTransaction(CWalletTx& wtxNew, CReserveKey& reservekey)
 
 
 
+// SelectCoins() over candidates already gathered, with the same confirmation fallbacks
+static bool SelectPayoutCoins(const CWallet* pwallet, int64_t nTargetValue, unsigned int nSpendTime, const vector<COutput>& vCoins,
+                              set<pair<const CWalletTx*,unsigned int> >& setCoinsRet, int64_t& nValueRet)
+{
+    return (pwallet->SelectCoinsMinConf(nTargetValue, nSpendTime, 1, 10, vCoins, setCoinsRet, nValueRet) ||
+            pwallet->SelectCoinsMinConf(nTargetValue, nSpendTime, 1, 1, vCoins, setCoinsRet, nValueRet) ||
+            pwallet->SelectCoinsMinConf(nTargetValue, nSpendTime, 0, 1, vCoins, setCoinsRet, nValueRet));
+}
+
+// Take the coins one payout transaction spends out of the candidates of the next ones
+static void RemoveSelectedCoins(vector<COutput>& vCoins, const set<pair<const CWalletTx*,unsigned int> >& setSelected)
+{
+    vector<COutput> vLeft;
+    vLeft.reserve(vCoins.size());
+    BOOST_FOREACH(const COutput& out, vCoins)
+        if (!setSelected.count(make_pair(out.tx, (unsigned int)out.i)))
+            vLeft.push_back(out);
+    vCoins.swap(vLeft);
+}
+
+static void SignPayout(const CWallet* pwallet, vector<CWalletTx>* pvwtx, const vector<vector<pair<const CWalletTx*,unsigned int> > >* pvCoins,
+                       vector<char>* pvSigned, unsigned int i)
+{
+    const vector<pair<const CWalletTx*,unsigned int> >& vCoins = (*pvCoins)[i];
+    bool fSigned = true;
+    for (unsigned int nIn = 0; nIn < vCoins.size() && fSigned; nIn++)
+        fSigned = SignSignature(*pwallet, *vCoins[nIn].first, (*pvwtx)[i], nIn);
+    (*pvSigned)[i] = fSigned;
+}
+
+// icochain: 批量分发资产，每笔交易的输出顺序与 CreateTxForTransferAsset 相同
+bool CWallet::BuildAssetPayout(int64_t nAssetId, const vector<pair<CScript, int64_t> >& vecSend,
+                               vector<COutput> vAssetCoins, vector<COutput> vFeeCoins, const CScript& scriptChange,
+                               vector<CWalletTx>& vwtxNew, vector<vector<pair<const CWalletTx*,unsigned int> > >& vTxCoins,
+                               int64_t& nFeeRet, string& strFailReason, unsigned int nMaxTxBytes) const
+{
+    vwtxNew.clear();
+    vTxCoins.clear();
+    nFeeRet = 0;
+    if (nAssetId <= 0)
+    {
+        strFailReason = _("Payouts are for assets, use sendmany for ICS");
+        return false;
+    }
+    // icochain: 不可分离资产一笔交易只能有一个资产输入和一个资产输出，不能批量分发
+    int nSuffix = nAssetId % 100;
+    if (nSuffix == 1 || nSuffix == 3)
+    {
+        strFailReason = _("Indivisible assets can only be sent one coin per transaction");
+        return false;
+    }
+    if (vecSend.empty())
+    {
+        strFailReason = _("No recipients");
+        return false;
+    }
+    BOOST_FOREACH (const PAIRTYPE(CScript, int64_t)& s, vecSend)
+    {
+        if (s.second <= 0)
+        {
+            strFailReason = _("Invalid amount");
+            return false;
+        }
+    }
+
+    unsigned int nNext = 0;
+    while (nNext < vecSend.size())
+    {
+        CWalletTx wtxNew;
+        wtxNew.BindWallet(const_cast<CWallet*>(this));
+        wtxNew.setTxType(CTransaction::TX_TYPE_TRANSFER_ASSET);
+        wtxNew.nLockTime = std::max(0, nBestHeight - 10);
+        wtxNew.fFromMe = true;
+
+        // Recipients until their outputs take half the size allowed, the rest is for inputs
+        vector<CTxOut> vPayees;
+        int64_t nAssetValue = 0;
+        unsigned int nPayeeBytes = 0;
+        while (nNext < vecSend.size())
+        {
+            CTxOut txout(nAssetId, vecSend[nNext].second, vecSend[nNext].first);
+            unsigned int nOutBytes = ::GetSerializeSize(txout, SER_NETWORK, PROTOCOL_VERSION);
+            if (!vPayees.empty() && nPayeeBytes + nOutBytes > nMaxTxBytes / 2)
+                break;
+            vPayees.push_back(txout);
+            nPayeeBytes += nOutBytes;
+            nAssetValue += txout.nValue;
+            nNext++;
+        }
+
+        set<pair<const CWalletTx*,unsigned int> > setAssets, setFee;
+        int64_t nAssetValueIn = 0;
+        int64_t nFeeIn = 0;
+        if (!SelectPayoutCoins(this, nAssetValue, wtxNew.nTime, vAssetCoins, setAssets, nAssetValueIn))
+        {
+            strFailReason = _("Insufficient asset funds");
+            vwtxNew.clear();
+            return false;
+        }
+
+        vector<pair<const CWalletTx*,unsigned int> > vCoins;
+        int64_t nFee = nTransactionFee;
+        while (true)
+        {
+            setFee.clear();
+            nFeeIn = 0;
+            if (!SelectPayoutCoins(this, nFee, wtxNew.nTime, vFeeCoins, setFee, nFeeIn))
+            {
+                strFailReason = _("Insufficient funds for the transaction fees");
+                vwtxNew.clear();
+                return false;
+            }
+
+            // 第一个输出为手续费找零，第二个为资产找零
+            wtxNew.vout.clear();
+            if (nFeeIn > nFee)
+                wtxNew.vout.push_back(CTxOut(0, nFeeIn - nFee, scriptChange));
+            if (nAssetValueIn > nAssetValue)
+                wtxNew.vout.push_back(CTxOut(nAssetId, nAssetValueIn - nAssetValue, scriptChange));
+            wtxNew.vout.insert(wtxNew.vout.end(), vPayees.begin(), vPayees.end());
+
+            vCoins.assign(setFee.begin(), setFee.end());
+            vCoins.insert(vCoins.end(), setAssets.begin(), setAssets.end());
+            wtxNew.vin.clear();
+            BOOST_FOREACH(const PAIRTYPE(const CWalletTx*,unsigned int)& coin, vCoins)
+                wtxNew.vin.push_back(CTxIn(coin.first->GetHash(),coin.second,CScript(),
+                                          std::numeric_limits<unsigned int>::max()-1));
+
+            // Not signed yet: count every input with the largest pay-to-pubkey-hash signature
+            unsigned int nBytes = ::GetSerializeSize(*(CTransaction*)&wtxNew, SER_NETWORK, PROTOCOL_VERSION) + wtxNew.vin.size() * 107;
+            if (nBytes >= MAX_STANDARD_TX_SIZE)
+            {
+                strFailReason = _("Transaction too large, the inputs are too small");
+                vwtxNew.clear();
+                return false;
+            }
+
+            // Check that enough fee is included
+            int64_t nPayFee = nTransactionFee * (1 + (int64_t)nBytes / 1000);
+            int64_t nMinFee = GetMinTxChange(wtxNew, nBytes);
+            if (nFee >= max(nPayFee, nMinFee))
+                break;
+            nFee = max(nPayFee, nMinFee);
+        }
+
+        RemoveSelectedCoins(vAssetCoins, setAssets);
+        RemoveSelectedCoins(vFeeCoins, setFee);
+        vTxCoins.push_back(vCoins);
+        vwtxNew.push_back(wtxNew);
+        nFeeRet += nFee;
+    }
+    return true;
+}
+
+bool CWallet::CreateAssetPayout(int64_t nAssetId, const vector<pair<CScript, int64_t> >& vecSend, vector<CWalletTx>& vwtxNew,
+                                CReserveKey& reservekey, int64_t& nFeeRet, string& strFailReason, unsigned int nMaxTxBytes)
+{
+    LOCK2(cs_main, cs_wallet);
+    // txdb must be opened before the mapWallet lock
+    CTxDB txdb("r");
+
+    // One pass over the unspent index for all the transactions
+    vector<COutput> vAssetCoins, vFeeCoins;
+    int64_t nFeeAssetId = 0;
+    AvailableCoinsForTransAsset(vAssetCoins, nAssetId);
+    AvailableCoinsForTransAsset(vFeeCoins, nFeeAssetId);
+
+    CPubKey vchChangeKey;
+    bool ret = reservekey.GetReservedKey(vchChangeKey);
+    assert(ret); // should never fail, as we just unlocked
+    CScript scriptChange;
+    scriptChange.SetDestination(vchChangeKey.GetID());
+
+    vector<vector<pair<const CWalletTx*,unsigned int> > > vTxCoins;
+    if (!BuildAssetPayout(nAssetId, vecSend, vAssetCoins, vFeeCoins, scriptChange, vwtxNew, vTxCoins,
+                          nFeeRet, strFailReason, nMaxTxBytes))
+    {
+        reservekey.ReturnKey();
+        return false;
+    }
+    bool fChange = false;
+    BOOST_FOREACH(const CWalletTx& wtx, vwtxNew)
+        BOOST_FOREACH(const CTxOut& txout, wtx.vout)
+            if (txout.scriptPubKey == scriptChange)
+                fChange = true;
+    if (!fChange)
+        reservekey.ReturnKey();
+
+    // Signing only reads the keys, so the transactions are signed on all cores
+    vector<char> vSigned(vwtxNew.size(), 0);
+    ParallelFor(vwtxNew.size(), 1, boost::bind(&SignPayout, this, &vwtxNew, &vTxCoins, &vSigned, _1));
+
+    for (unsigned int i = 0; i < vwtxNew.size(); i++)
+    {
+        if (!vSigned[i])
+        {
+            strFailReason = _("Signing transaction failed");
+            vwtxNew.clear();
+            return false;
+        }
+        // Fill vtxPrev by copying from previous transactions vtxPrev
+        vwtxNew[i].AddSupportingTransactions(txdb);
+        vwtxNew[i].fTimeReceivedIsTxTime = true;
+    }
+    return true;
+}
+
+// The checks AcceptToMemoryPool() and ConnectInputs() make, run before a payout is recorded
+static bool CheckPayoutTransaction(CTxDB& txdb, CTransaction& tx)
+{
+    uint256 hash = tx.GetHash();
+    if (!tx.CheckTransaction())
+        return error("CheckPayoutTransaction() : CheckTransaction failed for %s", hash.ToString());
+    string reason;
+    if (!TestNet() && !IsStandardTx(tx, reason))
+        return error("CheckPayoutTransaction() : nonstandard transaction %s: %s", hash.ToString(), reason);
+    {
+        LOCK(mempool.cs); // protect mempool.mapNextTx
+        BOOST_FOREACH(const CTxIn& txin, tx.vin)
+            if (mempool.mapNextTx.count(txin.prevout))
+                return error("CheckPayoutTransaction() : %s spends a coin already spent in the memory pool", hash.ToString());
+    }
+
+    MapPrevTx mapInputs;
+    map<uint256, CTxIndex> mapUnused;
+    bool fInvalid = false;
+    if (!tx.FetchInputs(txdb, mapUnused, false, false, mapInputs, fInvalid))
+        return error("CheckPayoutTransaction() : FetchInputs failed for %s", hash.ToString());
+    BOOST_FOREACH(const CTxIn& txin, tx.vin)
+    {
+        const CTxIndex& txindex = mapInputs[txin.prevout.hash].first;
+        if (txin.prevout.n < txindex.vSpent.size() && !txindex.vSpent[txin.prevout.n].IsNull())
+            return error("CheckPayoutTransaction() : %s spends a coin already spent in the chain", hash.ToString());
+    }
+    if (!tx.CheckIoValue(mapInputs))
+        return error("CheckPayoutTransaction() : CheckIoValue failed for %s", hash.ToString());
+    for (unsigned int i = 0; i < tx.vin.size(); i++)
+    {
+        const CTransaction& txPrev = mapInputs[tx.vin[i].prevout.hash].second;
+        if (!VerifySignature(txPrev, tx, i, STANDARD_SCRIPT_VERIFY_FLAGS, 0))
+            return error("CheckPayoutTransaction() : VerifySignature failed for %s input %u", hash.ToString(), i);
+    }
+    return true;
+}
+
+bool CWallet::CommitTransactions(vector<CWalletTx>& vwtxNew, CReserveKey& reservekey)
+{
+    vector<CTransaction> vRelay;
+    bool fAllAccepted = true;
+    {
+        LOCK2(cs_main, cs_wallet);
+        CTxDB txdb("r");
+
+        // Everything is checked and written before the wallet in memory is touched, so a
+        // failure leaves both as they were.
+        set<COutPoint> setSpends;
+        BOOST_FOREACH(CWalletTx& wtxNew, vwtxNew)
+        {
+            if (mapWallet.count(wtxNew.GetHash()))
+                return error("CommitTransactions() : %s is already in the wallet", wtxNew.GetHash().ToString());
+            BOOST_FOREACH(const CTxIn& txin, wtxNew.vin)
+            {
+                if (!setSpends.insert(txin.prevout).second)
+                    return error("CommitTransactions() : %s spends %s twice in the batch",
+                                 wtxNew.GetHash().ToString(), txin.prevout.ToString());
+                if (!mapWallet.count(txin.prevout.hash))
+                    return error("CommitTransactions() : %s spends a coin that is not in the wallet", wtxNew.GetHash().ToString());
+            }
+            if (!CheckPayoutTransaction(txdb, wtxNew))
+                return false;
+        }
+
+        // The records as they will be in mapWallet
+        int64_t nOrderPos = nOrderPosNext;
+        vector<CWalletTx> vRecords(vwtxNew);
+        BOOST_FOREACH(CWalletTx& wtx, vRecords)
+        {
+            InitNewWalletTx(wtx, nOrderPos++, NULL);
+            wtx.fCoinStateCached = false;
+        }
+        map<uint256, CWalletTx> mapCoins;
+        BOOST_FOREACH(const COutPoint& prevout, setSpends)
+        {
+            if (!mapCoins.count(prevout.hash))
+                mapCoins.insert(make_pair(prevout.hash, mapWallet[prevout.hash]));
+            mapCoins[prevout.hash].MarkSpent(prevout.n);
+        }
+
+        if (fFileBacked)
+        {
+            CWalletDB walletdb(strWalletFile);
+            if (!walletdb.TxnBegin())
+                return error("CommitTransactions() : TxnBegin failed");
+            bool fWritten = walletdb.WriteOrderPosNext(nOrderPos);
+            for (map<uint256, CWalletTx>::iterator it = mapCoins.begin(); fWritten && it != mapCoins.end(); ++it)
+                fWritten = (*it).second.WriteToDisk(&walletdb);
+            for (unsigned int i = 0; fWritten && i < vRecords.size(); i++)
+                fWritten = vRecords[i].WriteToDisk(&walletdb);
+            if (!fWritten)
+            {
+                walletdb.TxnAbort();
+                return error("CommitTransactions() : writing the batch failed");
+            }
+            if (!walletdb.TxnCommit())
+                return error("CommitTransactions() : TxnCommit failed");
+        }
+
+        // Take key pair from key pool so it won't be used again
+        reservekey.KeepKey();
+
+        nOrderPosNext = nOrderPos;
+        for (map<uint256, CWalletTx>::iterator it = mapCoins.begin(); it != mapCoins.end(); ++it)
+        {
+            CWalletTx& coin = mapWallet[(*it).first];
+            coin.BindWallet(this);
+            coin.UpdateSpent((*it).second.vfSpent);
+            UpdateUnspentIndex(coin);
+        }
+        for (map<uint256, CWalletTx>::iterator it = mapCoins.begin(); it != mapCoins.end(); ++it)
+            NotifyTransactionChanged(this, (*it).first, CT_UPDATED);
+        BOOST_FOREACH(const CWalletTx& wtxRecord, vRecords)
+        {
+            LogPrintf("CommitTransactions:\n%s", wtxRecord.ToString());
+            CWalletTx& wtx = mapWallet.insert(make_pair(wtxRecord.GetHash(), wtxRecord)).first->second;
+            wtx.BindWallet(this);
+            WalletTxWritten(wtx, true);
+        }
+
+        BOOST_FOREACH(CWalletTx& wtxNew, vwtxNew)
+        {
+            // Track how many getdata requests our transaction gets
+            mapRequestCount[wtxNew.GetHash()] = 0;
+
+            // The transactions are recorded now; the ones the pool takes are relayed, the
+            // rest are rebroadcast with the other wallet transactions.
+            if (!wtxNew.AcceptToMemoryPool(true))
+            {
+                LogPrintf("CommitTransactions() : Error: Transaction %s not accepted\n", wtxNew.GetHash().ToString());
+                fAllAccepted = false;
+                continue;
+            }
+            vRelay.push_back(wtxNew);
+        }
+    }
+    // Broadcast
+    RelayTransactions(vRelay);
+    return fAllAccepted;
+}
+
+
+
 // TODO 这个函数需要完善关于资产的转账
 string CWallet::SendMoney(const int64_t nAssetId, CScript scriptPubKey, int64_t nValue, CWalletTx& wtxNew, bool fAskFee)
 {
@@ -2693,6 +3568,12 @@ DBErrors CWallet::LoadWallet(bool& fFirstRunRet)
         return nLoadWalletRet;
     fFirstRunRet = !vchDefaultKey.IsValid();
 
+    int64_t nStart = GetTimeMillis();
+    BuildUnspentIndex();
+    LogPrintf("LoadWallet: indexed unspent outputs %dms\n", GetTimeMillis() - nStart);
+
+    CompactSupportingTransactions();
+
     return DB_LOAD_OK;
 }
 
@@ -2705,6 +3586,7 @@ bool CWallet::SetAddressBookName(const CTxDestination& address, const string& st
         std::map<CTxDestination, std::string>::iterator mi = mapAddressBook.find(address);
         fUpdated = mi != mapAddressBook.end();
         mapAddressBook[address] = strName;
+        fAccountTxOrderedDirty = true;
     }
     NotifyAddressBookChanged(this, address, strName, ::IsMine(*this, address),
                              (fUpdated ? CT_UPDATED : CT_NEW) );
@@ -2719,6 +3601,7 @@ bool CWallet::DelAddressBookName(const CTxDestination& address)
         LOCK(cs_wallet); // mapAddressBook
 
         mapAddressBook.erase(address);
+        fAccountTxOrderedDirty = true;
     }
 
     NotifyAddressBookChanged(this, address, "", ::IsMine(*this, address), CT_DELETED);
@@ -2755,49 +3638,203 @@ bool CWallet::NewKeyPool()
         if (IsLocked())
             return false;
 
-        int64_t nKeys = max(GetArg("-keypool", 100), (int64_t)0);
-        for (int i = 0; i < nKeys; i++)
-        {
-            int64_t nIndex = i+1;
-            walletdb.WritePool(nIndex, CKeyPool(GenerateNewKey()));
-            setKeyPool.insert(nIndex);
-        }
-        LogPrintf("CWallet::NewKeyPool wrote %d new keys\n", nKeys);
+        TopUpKeyPool();
+        LogPrintf("CWallet::NewKeyPool wrote %d new keys\n", setKeyPool.size());
     }
     return true;
 }
 
+// Keys committed to the key pool per database transaction
+static const unsigned int KEYPOOL_BATCH_SIZE = 1000;
+
+static void GenerateKey(std::vector<CKey>* pvKey, std::vector<CPubKey>* pvPubKey, bool fCompressed, unsigned int i)
+{
+    (*pvKey)[i].MakeNewKey(fCompressed);
+    (*pvPubKey)[i] = (*pvKey)[i].GetPubKey();
+}
+
+// Key generation needs no wallet state, so it runs on all cores without any lock
+static void GenerateKeys(unsigned int nKeys, bool fCompressed, std::vector<CKey>& vKey, std::vector<CPubKey>& vPubKey)
+{
+    RandAddSeedPerfmon();
+    vKey.resize(nKeys);
+    vPubKey.resize(nKeys);
+
+    ParallelFor(nKeys, 16, boost::bind(&GenerateKey, &vKey, &vPubKey, fCompressed, _1));
+}
+
 bool CWallet::TopUpKeyPool(unsigned int nSize)
 {
+    // Top up key pool
+    unsigned int nTargetSize;
+    if (nSize > 0)
+        nTargetSize = nSize;
+    else
+        nTargetSize = max(GetArg("-keypool", 100), (int64_t)0);
+
+    bool fCompressed;
+    unsigned int nMissing;
     {
         LOCK(cs_wallet);
 
         if (IsLocked())
             return false;
 
-        CWalletDB walletdb(strWalletFile);
+        fCompressed = CanSupportFeature(FEATURE_COMPRPUBKEY); // default to compressed public keys if we want 0.6.0 wallets
+        nMissing = nTargetSize + 1 - min((unsigned int)setKeyPool.size(), nTargetSize + 1);
+    }
 
-        // Top up key pool
-        unsigned int nTargetSize;
-        if (nSize > 0)
-            nTargetSize = nSize;
-        else
-            nTargetSize = max(GetArg("-keypool", 100), (int64_t)0);
+    while (nMissing > 0)
+    {
+        std::vector<CKey> vKey;
+        std::vector<CPubKey> vPubKey;
+        GenerateKeys(min(nMissing, KEYPOOL_BATCH_SIZE), fCompressed, vKey, vPubKey);
+
+        // Encrypted wallets get the whole batch encrypted here too, rather than key by key
+        // under cs_wallet
+        std::vector<std::vector<unsigned char> > vCryptedSecret;
+        if (IsCrypted() && !EncryptSecrets(vKey, vPubKey, vCryptedSecret))
+            vCryptedSecret.clear();
 
-        while (setKeyPool.size() < (nTargetSize + 1))
         {
-            int64_t nEnd = 1;
-            if (!setKeyPool.empty())
-                nEnd = *(--setKeyPool.end()) + 1;
-            if (!walletdb.WritePool(nEnd, CKeyPool(GenerateNewKey())))
+            LOCK(cs_wallet);
+
+            // The wallet may have been locked, or the pool refilled by someone else, meanwhile
+            if (IsLocked())
+                return false;
+            nMissing = nTargetSize + 1 - min((unsigned int)setKeyPool.size(), nTargetSize + 1);
+            unsigned int nAdd = min(nMissing, (unsigned int)vKey.size());
+            if (nAdd == 0)
+                break;
+
+            // Compressed public keys were introduced in version 0.6.0
+            if (fCompressed)
+                SetMinVersion(FEATURE_COMPRPUBKEY);
+
+            vKey.resize(nAdd);
+            vPubKey.resize(nAdd);
+            if (!vCryptedSecret.empty())
+                vCryptedSecret.resize(nAdd);
+            if (!AddKeysToPool(vKey, vPubKey, vCryptedSecret))
                 throw runtime_error("TopUpKeyPool() : writing generated key failed");
-            setKeyPool.insert(nEnd);
-            LogPrintf("keypool added key %d, size=%u\n", nEnd, setKeyPool.size());
+            nMissing -= nAdd;
+            LogPrintf("keypool added %u keys, size=%u\n", nAdd, setKeyPool.size());
         }
+        boost::this_thread::interruption_point();
     }
     return true;
 }
 
+bool CWallet::AddKeysToPool(const std::vector<CKey>& vKey, const std::vector<CPubKey>& vPubKey,
+                            const std::vector<std::vector<unsigned char> >& vCryptedSecret)
+{
+    AssertLockHeld(cs_wallet);
+
+    // Keys, their encryption and the pool entries go to disk in one transaction
+    CWalletDB walletdb(strWalletFile);
+    if (!walletdb.TxnBegin())
+        return false;
+    pwalletdbEncryption = &walletdb;
+
+    std::vector<int64_t> vIndex;
+    int64_t nCreationTime = GetTime();
+    int64_t nTimeFirstKeyPrev = nTimeFirstKey;
+    unsigned int nAdded = 0;
+    bool fOk = true;
+    for (unsigned int i = 0; i < vKey.size() && fOk; i++)
+    {
+        CKeyID keyID = vPubKey[i].GetID();
+        if (HaveKey(keyID))
+        {
+            fOk = false;
+            break;
+        }
+        mapKeyMetadata[keyID] = CKeyMetadata(nCreationTime);
+        if (!nTimeFirstKey || nCreationTime < nTimeFirstKey)
+            nTimeFirstKey = nCreationTime;
+        nAdded++;
+
+        int64_t nEnd = 1;
+        if (!setKeyPool.empty())
+            nEnd = *(--setKeyPool.end()) + 1;
+        if (i < vCryptedSecret.size() && !vCryptedSecret[i].empty())
+            fOk = AddCryptedKey(vPubKey[i], vCryptedSecret[i]);
+        else
+            fOk = AddKeyPubKey(vKey[i], vPubKey[i]);
+        fOk = fOk && walletdb.WritePool(nEnd, CKeyPool(vPubKey[i]));
+        setKeyPool.insert(nEnd);
+        vIndex.push_back(nEnd);
+    }
+
+    pwalletdbEncryption = NULL;
+    if (fOk && walletdb.TxnCommit())
+        return true;
+
+    // Take back whatever of the batch reached memory
+    walletdb.TxnAbort();
+    BOOST_FOREACH(int64_t nIndex, vIndex)
+        setKeyPool.erase(nIndex);
+    for (unsigned int i = 0; i < nAdded; i++)
+    {
+        CKeyID keyID = vPubKey[i].GetID();
+        CCryptoKeyStore::RemoveKey(keyID);
+        mineFilter.RemoveKey(keyID);
+        mapKeyMetadata.erase(keyID);
+    }
+    nTimeFirstKey = nTimeFirstKeyPrev;
+    return false;
+}
+
+void CWallet::ThreadKeyPoolRefill()
+{
+    RenameThread("Icochain-keypool");
+    try
+    {
+        TopUpKeyPool();
+    }
+    catch (boost::thread_interrupted)
+    {
+    }
+    catch (std::exception& e)
+    {
+        PrintExceptionContinue(&e, "ThreadKeyPoolRefill()");
+    }
+    LOCK(cs_wallet);
+    fKeyPoolRefilling = false;
+}
+
+// Refill the key pool in a background thread, unless one is running already
+void CWallet::StartKeyPoolRefill()
+{
+    LOCK(cs_wallet);
+    if (fKeyPoolRefilling || IsLocked())
+        return;
+    if (pthreadKeyPoolRefill)
+    {
+        // finished, it cleared fKeyPoolRefilling on its way out
+        pthreadKeyPoolRefill->join();
+        delete pthreadKeyPoolRefill;
+    }
+    fKeyPoolRefilling = true;
+    pthreadKeyPoolRefill = new boost::thread(boost::bind(&CWallet::ThreadKeyPoolRefill, this));
+}
+
+void CWallet::StopKeyPoolRefill()
+{
+    boost::thread* pthread;
+    {
+        LOCK(cs_wallet);
+        pthread = pthreadKeyPoolRefill;
+        pthreadKeyPoolRefill = NULL;
+    }
+    if (pthread)
+    {
+        pthread->interrupt();
+        pthread->join();
+        delete pthread;
+    }
+}
+
 void CWallet::ReserveKeyFromKeyPool(int64_t& nIndex, CKeyPool& keypool)
 {
     nIndex = -1;
@@ -2805,8 +3842,21 @@ void CWallet::ReserveKeyFromKeyPool(int64_t& nIndex, CKeyPool& keypool)
     {
         LOCK(cs_wallet);
 
+        // Refill in the background once the pool falls to the low-water mark. A pool that
+        // has run dry gets one new key for this caller, the rest comes from the refill.
         if (!IsLocked())
-            TopUpKeyPool();
+        {
+            int64_t nLowWater = GetArg("-keypoolmin", max(GetArg("-keypool", 100), (int64_t)0) / 2);
+            if (setKeyPool.empty())
+            {
+                CKeyPool keypoolNew(GenerateNewKey());
+                if (!CWalletDB(strWalletFile).WritePool(1, keypoolNew))
+                    throw runtime_error("ReserveKeyFromKeyPool() : writing generated key failed");
+                setKeyPool.insert(1);
+            }
+            if ((int64_t)setKeyPool.size() <= nLowWater)
+                StartKeyPoolRefill();
+        }
 
         // Get the oldest key
         if(setKeyPool.empty())
@@ -3047,6 +4097,7 @@ void CWallet::FixSpentCoins(int& nMismatchFound, int64_t& nBalanceInQuestion, bo
                 {
                     pcoin->MarkUnspent(n);
                     pcoin->WriteToDisk();
+                    UpdateUnspentIndex(*pcoin);
                 }
             }
             else if (IsMine(pcoin->vout[n]) && !pcoin->IsSpent(n) && (txindex.vSpent.size() > n && !txindex.vSpent[n].IsNull()))
@@ -3059,6 +4110,7 @@ void CWallet::FixSpentCoins(int& nMismatchFound, int64_t& nBalanceInQuestion, bo
                 {
                     pcoin->MarkSpent(n);
                     pcoin->WriteToDisk();
+                    UpdateUnspentIndex(*pcoin);
                 }
             }
         }
@@ -3082,6 +4134,7 @@ void CWallet::DisableTransaction(const CTransaction &tx)
             {
                 prev.MarkUnspent(txin.prevout.n);
                 prev.WriteToDisk();
+                UpdateUnspentIndex(prev);
             }
         }
     }
@@ -12,6 +12,8 @@
 
 #include <stdlib.h>
 
+#include <boost/unordered_set.hpp>
+
 #include "crypter.h"
 #include "main.h"
 #include "key.h"
@@ -72,6 +74,145 @@ public:
     )
 };
 
+/** Look for a subset of vValue, sorted by descending value, that adds up to
+ * exactly nTargetValue so the transaction needs no change output. Depth-first
+ * branch and bound with a bounded number of steps, preferring fewer inputs.
+ * @return true and the chosen coins in vfBest if a match was found
+ */
+bool SelectCoinsBnB(const std::vector<std::pair<int64_t, std::pair<const CWalletTx*,unsigned int> > >& vValue, int64_t nTargetValue,
+                    std::vector<char>& vfBest);
+
+/** Prefilter for wallet rescans. Holds the key and script IDs of a keystore so
+ * block outputs can be tested with a hash lookup instead of Solver() and IsMine().
+ * It may report outputs that are not ours, but never misses one paying a key or
+ * script that was in the keystore when the filter was built.
+ */
+class CWalletScanFilter
+{
+private:
+    struct CheapHasher
+    {
+        size_t operator()(const uint160& hash) const { return hash.GetCheapHash(); }
+    };
+    boost::unordered_set<uint160, CheapHasher> setKeyIDs;
+    boost::unordered_set<uint160, CheapHasher> setScriptIDs;
+
+public:
+    CWalletScanFilter() {}
+    explicit CWalletScanFilter(const CBasicKeyStore& keystore);
+    void AddKey(const CKeyID& keyID) { setKeyIDs.insert(keyID); }
+    void RemoveKey(const CKeyID& keyID) { setKeyIDs.erase(keyID); }
+    void AddScript(const CScriptID& scriptID) { setScriptIDs.insert(scriptID); }
+    size_t KeyCount() const { return setKeyIDs.size(); }
+    size_t ScriptCount() const { return setScriptIDs.size(); }
+    bool IsRelevant(const CTxOut& txout) const;
+    bool IsRelevant(const CTransaction& tx) const;
+};
+
+/** Approximate memory held by the wallet transactions, for getwalletmemoryinfo */
+class CWalletMemoryUsage
+{
+public:
+    uint64_t nTransactions;
+    uint64_t nTxBytes;           // the transactions themselves and their CWalletTx fields
+    uint64_t nMapValueBytes;     // mapValue and vOrderForm strings
+    uint64_t nSupportingTxs;     // copies held in vtxPrev
+    uint64_t nSupportingBytes;
+
+    CWalletMemoryUsage() : nTransactions(0), nTxBytes(0), nMapValueBytes(0), nSupportingTxs(0), nSupportingBytes(0) {}
+
+    uint64_t GetTotal() const { return nTxBytes + nMapValueBytes + nSupportingBytes; }
+};
+
+/** Counters of CWalletMineFilter, for getinfo */
+class CWalletMineFilterStats
+{
+public:
+    uint64_t nOutputChecks;
+    uint64_t nOutputsRejected;   // turned away without IsMine()
+    uint64_t nFalsePositives;    // let through, but IsMine() said no
+    uint64_t nInputChecks;
+    uint64_t nInputsRejected;    // turned away without searching mapWallet
+    size_t nKeys;
+    size_t nScripts;
+    size_t nCoins;
+
+    CWalletMineFilterStats() : nOutputChecks(0), nOutputsRejected(0), nFalsePositives(0),
+                               nInputChecks(0), nInputsRejected(0), nKeys(0), nScripts(0), nCoins(0) {}
+};
+
+/** The wallet's own scan filter, kept up to date as keys and scripts are added, plus
+ * the outpoints of all outputs of mapWallet that are ours. Lets IsMine() and GetDebit()
+ * turn away the outputs and inputs of other people's transactions, which is nearly all
+ * of what SyncWithWallets() sees, without Solver() or a mapWallet search.
+ */
+class CWalletMineFilter
+{
+private:
+    struct OutPointHasher
+    {
+        size_t operator()(const COutPoint& outpoint) const { return outpoint.hash.GetCheapHash() ^ outpoint.n; }
+    };
+    mutable CCriticalSection cs_filter;
+    CWalletScanFilter filter;
+    boost::unordered_set<COutPoint, OutPointHasher> setCoins;
+    mutable CWalletMineFilterStats stats;
+
+public:
+    void AddKey(const CKeyID& keyID) { LOCK(cs_filter); filter.AddKey(keyID); }
+    void RemoveKey(const CKeyID& keyID) { LOCK(cs_filter); filter.RemoveKey(keyID); }
+    void AddScript(const CScriptID& scriptID) { LOCK(cs_filter); filter.AddScript(scriptID); }
+    void AddCoin(const COutPoint& outpoint) { LOCK(cs_filter); setCoins.insert(outpoint); }
+    void RemoveCoin(const COutPoint& outpoint) { LOCK(cs_filter); setCoins.erase(outpoint); }
+    void ClearCoins() { LOCK(cs_filter); setCoins.clear(); }
+
+    bool MayBeMine(const CTxOut& txout) const
+    {
+        LOCK(cs_filter);
+        stats.nOutputChecks++;
+        if (filter.IsRelevant(txout))
+            return true;
+        stats.nOutputsRejected++;
+        return false;
+    }
+
+    bool MayBeMine(const COutPoint& prevout) const
+    {
+        LOCK(cs_filter);
+        stats.nInputChecks++;
+        if (setCoins.count(prevout))
+            return true;
+        stats.nInputsRejected++;
+        return false;
+    }
+
+    void CountFalsePositive() const { LOCK(cs_filter); stats.nFalsePositives++; }
+
+    CWalletMineFilterStats GetStats() const
+    {
+        LOCK(cs_filter);
+        CWalletMineFilterStats ret = stats;
+        ret.nKeys = filter.KeyCount();
+        ret.nScripts = filter.ScriptCount();
+        ret.nCoins = setCoins.size();
+        return ret;
+    }
+};
+
+/** Where a running ScanForWalletTransactions() has got to, for getrescaninfo */
+class CWalletScanProgress
+{
+public:
+    bool fScanning;
+    int nStartHeight;
+    int nHeight;
+    int nStopHeight;
+    int nFound;
+    int64_t nStartTime;
+
+    CWalletScanProgress() : fScanning(false), nStartHeight(0), nHeight(0), nStopHeight(0), nFound(0), nStartTime(0) {}
+};
+
 /** A CWallet is an extension of a keystore, which also maintains a set of transactions and balances,
  * and provides the ability to create new transactions.
  */
@@ -84,6 +225,7 @@ private:
     bool SelectCoinsForSeoTx(int64_t nTargetValue, unsigned int nSpendTime, std::set<std::pair<const CWalletTx*,unsigned int> >& setCoinsRet, int64_t& nValueRet, std::string publisher, bool isSelect) const;
 
 
+    // open database transaction of EncryptWallet() or TopUpKeyPool(), key writes go through it
     CWalletDB *pwalletdbEncryption;
 
     // the current wallet version: clients below this version are not able to load the wallet
@@ -92,6 +234,21 @@ private:
     // the maximum wallet format version: memory-only variable that specifies to what version this wallet may be upgraded
     int nWalletMaxVersion;
 
+    // mapAccountTxOrdered must be rebuilt, address book labels changed
+    bool fAccountTxOrderedDirty;
+
+    void IndexOrderedTxItem(CWalletTx* pwtx, CAccountingEntry* pacentry);
+    void IndexAccountTxItem(CWalletTx* pwtx, CAccountingEntry* pacentry);
+
+    // background key pool refill, started by ReserveKeyFromKeyPool() at the low-water mark
+    boost::thread* pthreadKeyPoolRefill;
+    bool fKeyPoolRefilling;
+    void ThreadKeyPoolRefill();
+
+    // progress of the running rescan, readable without cs_main or cs_wallet
+    mutable CCriticalSection cs_scan;
+    CWalletScanProgress scanProgress;
+
 public:
     /// Main wallet lock.
     /// This lock protects all the fields added by CWallet
@@ -129,8 +286,11 @@ public:
         fFileBacked = false;
         nMasterKeyMaxID = 0;
         pwalletdbEncryption = NULL;
+        pthreadKeyPoolRefill = NULL;
+        fKeyPoolRefilling = false;
         nOrderPosNext = 0;
         nTimeFirstKey = 0;
+        fAccountTxOrderedDirty = false;
     }
 
     std::map<uint256, CWalletTx> mapWallet;
@@ -145,6 +305,21 @@ public:
     // check whether we are allowed to upgrade (or already support) to the named feature
     bool CanSupportFeature(enum WalletFeature wf) { AssertLockHeld(cs_wallet); return nWalletMaxVersion >= wf; }
 
+    // icochain: 按资产分类的未花费输出, 选币时只需遍历这里
+    // Outputs that are mine and not spent, by asset id. Kept up to date
+    // wherever mapWallet or the spent flags change.
+    typedef std::map<COutPoint, const CWalletTx*> UnspentOutputs;
+    std::map<int64_t, UnspentOutputs> mapUnspentByAsset;
+
+    // Keys, scripts and coins of this wallet, maintained alongside the keystore and mapUnspentByAsset
+    CWalletMineFilter mineFilter;
+
+    void UpdateUnspentIndex(const CWalletTx& wtx, bool fInWallet = true);
+    void BuildUnspentIndex();
+    /** Drop supporting transaction copies that older versions stored with every wallet transaction */
+    void CompactSupportingTransactions();
+    void GetMemoryUsage(CWalletMemoryUsage& usage) const;
+
     void AvailableCoinsForStaking(std::vector<COutput>& vCoins, unsigned int nSpendTime) const;
     void AvailableCoinsForTransAsset(std::vector<COutput>& vCoins ,int64_t& nAssetId, const CCoinControl *coinControl=NULL) const;
     void AvailableCoins(std::vector<COutput>& vCoins, bool fOnlyConfirmed=true, const CCoinControl *coinControl=NULL) const;
@@ -159,7 +334,13 @@ public:
     // Adds a key to the store, and saves it to disk.
     bool AddKeyPubKey(const CKey& key, const CPubKey &pubkey);
     // Adds a key to the store, without saving it to disk (used by LoadWallet)
-    bool LoadKey(const CKey& key, const CPubKey &pubkey) { return CCryptoKeyStore::AddKeyPubKey(key, pubkey); }
+    bool LoadKey(const CKey& key, const CPubKey &pubkey)
+    {
+        if (!CCryptoKeyStore::AddKeyPubKey(key, pubkey))
+            return false;
+        mineFilter.AddKey(pubkey.GetID());
+        return true;
+    }
     // Load metadata (used by LoadWallet)
     bool LoadKeyMetadata(const CPubKey &pubkey, const CKeyMetadata &metadata);
 
@@ -187,19 +368,48 @@ public:
     typedef std::pair<CWalletTx*, CAccountingEntry*> TxPair;
     typedef std::multimap<int64_t, TxPair > TxItems;
 
+    // Activity log: every CWalletTx and CAccountingEntry keyed by nOrderPos,
+    // plus the same entries per account and per asset id. Kept up to date by
+    // AddToWallet, EraseFromWallet and AddAccountingEntry.
+    TxItems wtxOrdered;
+    std::map<std::string, TxItems> mapAccountTxOrdered;
+    std::map<int64_t, TxItems> mapAssetTxOrdered;
+    std::list<CAccountingEntry> laccentries;
+
     /** Get the wallet's activity log
-        @return multimap of ordered transactions and accounting entries
-        @warning Returned pointers are *only* valid within the scope of passed acentries
+        @param[in] strAccount  only entries that may belong to this account, "*" for all
+        @param[in] nAssetId    only entries with outputs of this asset, -1 for all
+        @return multimap of ordered transactions and accounting entries, a superset of
+                what ListTransactions reports for the filter. Valid while cs_wallet is held.
      */
-    TxItems OrderedTxItems(std::list<CAccountingEntry>& acentries, std::string strAccount = "");
+    const TxItems& OrderedTxItems(const std::string& strAccount = "*", int64_t nAssetId = -1);
+    /** Rebuild the activity log from mapWallet and laccentries, e.g. after nOrderPos values changed */
+    void BuildOrderedTxIndex();
+    /** Write acentry and add it to the activity log. Inside a walletdb transaction
+        write the entries with CWalletDB::WriteAccountingEntry and call
+        IndexAccountingEntry once the transaction has committed. */
+    bool AddAccountingEntry(const CAccountingEntry& acentry, CWalletDB& walletdb);
+    void IndexAccountingEntry(const CAccountingEntry& acentry);
 
     void MarkDirty();
-    bool AddToWallet(const CWalletTx& wtxIn);
+    /** pblock is the block wtxIn was found in, if known; its time is used without the block index */
+    bool AddToWallet(const CWalletTx& wtxIn, const CBlock* pblock = NULL);
+    /** Receive time, order position and smart time of a transaction new to the wallet */
+    void InitNewWalletTx(CWalletTx& wtx, int64_t nOrderPos, const CBlock* pblock);
+    /** Indexes and notifications for a transaction in mapWallet that was just written,
+        new to the wallet if fInsertedNew. Shared by AddToWallet and CommitTransactions. */
+    void WalletTxWritten(CWalletTx& wtx, bool fInsertedNew);
     void SyncTransaction(const CTransaction& tx, const CBlock* pblock, bool fConnect = true);
     bool AddToWalletIfInvolvingMe(const CTransaction& tx, const CBlock* pblock, bool fUpdate);
     void EraseFromWallet(const uint256 &hash);
     void WalletUpdateSpent(const CTransaction& prevout, bool fBlock = false);
+    /** Rescan the chain from pindexStart for transactions from or to us. Blocks are read and
+        prefiltered in batches by -rescanthreads workers without holding any lock; matches are
+        applied in chain order under cs_main and cs_wallet, which are released between batches.
+        @return number of transactions added or updated
+     */
     int ScanForWalletTransactions(CBlockIndex* pindexStart, bool fUpdate = false);
+    CWalletScanProgress GetScanProgress() const;
     void ReacceptWalletTransactions();
     void ResendWalletTransactions(bool fForce = false);
     int64_t GetBalance(int64_t nAssetId) const;
@@ -215,6 +425,21 @@ public:
     bool CreateTxForTransferAsset(const std::vector<std::pair<CScript, int64_t> >& vecSend, CWalletTx& wtxNew, CReserveKey& reservekey, int64_t& nFeeRet, int64_t nAssetId);
     bool CreateTransaction(CScript scriptPubKey, int64_t nValue, CWalletTx& wtxNew, CReserveKey& reservekey, int64_t& nFeeRet, int64_t nAssetId, const CCoinControl *coinControl=NULL);
     bool CommitTransaction(CWalletTx& wtxNew, CReserveKey& reservekey);
+    /** Pay nAssetId to many recipients in transactions of at most about nMaxTxBytes each.
+     *  Asset and fee inputs for all of them come from one pass over the unspent index, and
+     *  the transactions are signed in parallel. Nothing is created unless all of them are. */
+    bool CreateAssetPayout(int64_t nAssetId, const std::vector<std::pair<CScript, int64_t> >& vecSend, std::vector<CWalletTx>& vwtxNew,
+                           CReserveKey& reservekey, int64_t& nFeeRet, std::string& strFailReason, unsigned int nMaxTxBytes = MAX_STANDARD_TX_SIZE / 2);
+    /** The unsigned transactions of CreateAssetPayout() and the coins each one spends, in input order.
+     *  Indivisible assets are refused: they can only move one coin per transaction. */
+    bool BuildAssetPayout(int64_t nAssetId, const std::vector<std::pair<CScript, int64_t> >& vecSend,
+                          std::vector<COutput> vAssetCoins, std::vector<COutput> vFeeCoins, const CScript& scriptChange,
+                          std::vector<CWalletTx>& vwtxNew, std::vector<std::vector<std::pair<const CWalletTx*,unsigned int> > >& vTxCoins,
+                          int64_t& nFeeRet, std::string& strFailReason, unsigned int nMaxTxBytes = MAX_STANDARD_TX_SIZE / 2) const;
+    /** CommitTransaction() for many transactions. They are all checked and written in a single wallet
+     *  database transaction before the wallet in memory changes; nothing is recorded if any of it fails.
+     *  Returns false if the memory pool refused some of them, the ones it took are relayed. */
+    bool CommitTransactions(std::vector<CWalletTx>& vwtxNew, CReserveKey& reservekey);
 
     bool CreateRegisterAliasTx(const CScript& scriptPubKey, CWalletTx& wtxNew, CReserveKey& reservekey, int64_t& nFeeRet);
 
@@ -228,7 +453,18 @@ public:
     std::string SendMoneyToDestination(const int64_t nAssetId, const CTxDestination &address, int64_t nValue, CWalletTx& wtxNew, bool fAskFee=false);
 
     bool NewKeyPool();
+    /** Fill the key pool up to nSize (default -keypool) keys plus one. Keys are generated on
+        all cores without cs_wallet and committed in batches, each in one database transaction.
+     */
     bool TopUpKeyPool(unsigned int nSize = 0);
+    /** Add generated keys to the key pool in one database transaction. vCryptedSecret holds
+        their secrets encrypted ahead of time, or is empty. On failure nothing of the batch is
+        left behind, in memory or on disk.
+     */
+    bool AddKeysToPool(const std::vector<CKey>& vKey, const std::vector<CPubKey>& vPubKey,
+                       const std::vector<std::vector<unsigned char> >& vCryptedSecret);
+    void StartKeyPoolRefill();
+    void StopKeyPoolRefill();
     int64_t AddReserveKey(const CKeyPool& keypool);
     void ReserveKeyFromKeyPool(int64_t& nIndex, CKeyPool& keypool);
     void KeepKey(int64_t nIndex);
@@ -244,7 +480,12 @@ public:
     int64_t GetDebit(const CTxIn& txin, int64_t nAssetId) const;
     bool IsMine(const CTxOut& txout) const
     {
-        return ::IsMine(*this, txout.scriptPubKey);
+        if (!mineFilter.MayBeMine(txout))
+            return false;
+        if (::IsMine(*this, txout.scriptPubKey))
+            return true;
+        mineFilter.CountFalsePositive();
+        return false;
     }
     int64_t GetCredit(const CTxOut& txout, int64_t nAssetId) const
     {
@@ -411,6 +652,10 @@ private:
     const CWallet* pwallet;
 
 public:
+    // Copies of the unconfirmed parents that are not in the wallet, such as
+    // foreign transactions our coins came from. Wallet parents and anything
+    // already in the block chain are looked up when needed instead, see
+    // GetSupportingTransactions().
     std::vector<CMerkleTx> vtxPrev;
     mapValue_t mapValue;
     std::vector<std::pair<std::string, std::string> > vOrderForm;
@@ -431,6 +676,11 @@ public:
     mutable int64_t nCreditCached;
     mutable int64_t nAvailableCreditCached;
     mutable int64_t nChangeCached;
+    mutable bool fCoinStateCached;
+    mutable unsigned int nCoinStateUpdated; // mempool.GetTransactionsUpdated() when cached
+    mutable int nDepthCached;
+    mutable int nBlocksToMaturityCached;
+    mutable bool fTrustedCached;
 
     CWalletTx()
     {
@@ -472,6 +722,11 @@ public:
         nCreditCached = 0;
         nAvailableCreditCached = 0;
         nChangeCached = 0;
+        fCoinStateCached = false;
+        nCoinStateUpdated = 0;
+        nDepthCached = 0;
+        nBlocksToMaturityCached = 0;
+        fTrustedCached = false;
         nOrderPos = -1;
     }
 
@@ -559,6 +814,7 @@ public:
         fAvailableCreditCached = false;
         fDebitCached = false;
         fChangeCached = false;
+        fCoinStateCached = false;
     }
 
     void BindWallet(CWallet *pwalletIn)
@@ -670,6 +926,10 @@ public:
     void GetAccountAmounts(const std::string& strAccount, int64_t& nReceived,
                            int64_t& nSent, int64_t& nFee) const;
 
+    // Depth, blocks to maturity and IsTrusted() for coin selection, cached
+    // until the chain tip or the memory pool changes
+    void GetCoinState(int& nDepth, int& nBlocksToMaturity, bool& fTrusted) const;
+
     bool IsFromMe() const
     {
         return (GetDebit(0) > 0); // icochain: 暂时只判断小企股
@@ -690,9 +950,7 @@ public:
 
         // If no confirmations but it's from us, we can still
         // consider it confirmed if all dependencies are confirmed
-        std::map<uint256, const CMerkleTx*> mapPrev;
         std::vector<const CMerkleTx*> vWorkQueue;
-        vWorkQueue.reserve(vtxPrev.size()+1);
         vWorkQueue.push_back(this);
         for (unsigned int i = 0; i < vWorkQueue.size(); i++)
         {
@@ -708,29 +966,31 @@ public:
             if (!pwallet->IsFromMe(*ptx))
                 return false;
 
-            if (mapPrev.empty())
-            {
-                BOOST_FOREACH(const CMerkleTx& tx, vtxPrev)
-                    mapPrev[tx.GetHash()] = &tx;
-            }
-
             BOOST_FOREACH(const CTxIn& txin, ptx->vin)
             {
-                if (!mapPrev.count(txin.prevout.hash))
+                const CMerkleTx* pprev = GetSupportingTransaction(txin.prevout.hash);
+                if (pprev == NULL)
                     return false;
-                vWorkQueue.push_back(mapPrev[txin.prevout.hash]);
+                vWorkQueue.push_back(pprev);
             }
         }
 
         return true;
     }
 
-    bool WriteToDisk();
+    bool WriteToDisk(CWalletDB* pwalletdb = NULL);
 
     int64_t GetTxTime() const;
     int GetRequestCount() const;
 
     void AddSupportingTransactions(CTxDB& txdb);
+    /** Unconfirmed transactions this one depends on, ancestors first, read from
+     * the wallet, the copies in vtxPrev or the memory pool */
+    void GetSupportingTransactions(CTxDB& txdb, std::vector<CMerkleTx>& vtxRet) const;
+    /** A parent from the wallet or from vtxPrev, without copying it */
+    const CMerkleTx* GetSupportingTransaction(const uint256& hash) const;
+    /** Drop copies in vtxPrev that the wallet or the block chain can provide; true if any went */
+    bool CompactSupportingTransactions(CTxDB& txdb);
 
     bool AcceptWalletTransaction(CTxDB& txdb);
     bool AcceptWalletTransaction();
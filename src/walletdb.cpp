@@ -11,8 +11,10 @@
 #include "sync.h"
 #include "wallet.h"
 
+#include <boost/bind.hpp>
 #include <boost/filesystem.hpp>
 #include <boost/foreach.hpp>
+#include <boost/thread.hpp>
 
 using namespace std;
 using namespace boost;
@@ -162,9 +164,10 @@ bool CWalletDB::WriteAccountingEntry(const uint64_t nAccEntryNum, const CAccount
     return Write(boost::make_tuple(string("acentry"), acentry.strAccount, nAccEntryNum), acentry);
 }
 
-bool CWalletDB::WriteAccountingEntry(const CAccountingEntry& acentry)
+bool CWalletDB::WriteAccountingEntry(CAccountingEntry& acentry)
 {
-    return WriteAccountingEntry(++nAccountingEntryNumber, acentry);
+    acentry.nEntryNo = ++nAccountingEntryNumber;
+    return WriteAccountingEntry(acentry.nEntryNo, acentry);
 }
 
 int64_t CWalletDB::GetAccountCreditDebit(const string& strAccount)
@@ -183,7 +186,7 @@ void CWalletDB::ListAccountCreditDebit(const string& strAccount, list<CAccountin
 {
     bool fAllAccounts = (strAccount == "*");
 
-    Dbc* pcursor = GetCursor();
+    CDBCursor* pcursor = GetCursor();
     if (!pcursor)
         throw runtime_error("CWalletDB::ListAccountCreditDebit() : cannot create DB cursor");
     unsigned int fFlags = DB_SET_RANGE;
@@ -240,9 +243,7 @@ CWalletDB::ReorderTransactions(CWallet* pwallet)
         CWalletTx* wtx = &((*it).second);
         txByTime.insert(make_pair(wtx->nTimeReceived, TxPair(wtx, (CAccountingEntry*)0)));
     }
-    list<CAccountingEntry> acentries;
-    ListAccountCreditDebit("", acentries);
-    BOOST_FOREACH(CAccountingEntry& entry, acentries)
+    BOOST_FOREACH(CAccountingEntry& entry, pwallet->laccentries)
     {
         txByTime.insert(make_pair(entry.nTime, TxPair((CWalletTx*)0, &entry)));
     }
@@ -296,10 +297,21 @@ CWalletDB::ReorderTransactions(CWallet* pwallet)
         }
     }
     WriteOrderPosNext(nOrderPosNext);
+    pwallet->BuildOrderedTxIndex();
 
     return DB_LOAD_OK;
 }
 
+// Records of one type seen by LoadWallet and the time spent on them
+class CWalletLoadTiming {
+public:
+    unsigned int nRecords;
+    uint64_t nBytes;
+    int64_t nMicros;
+
+    CWalletLoadTiming() : nRecords(0), nBytes(0), nMicros(0) {}
+};
+
 class CWalletScanState {
 public:
     unsigned int nKeys;
@@ -309,6 +321,7 @@ public:
     bool fAnyUnordered;
     int nFileVersion;
     vector<uint256> vWalletUpgrade;
+    map<string, CWalletLoadTiming> mapTiming;
 
     CWalletScanState() {
         nKeys = nCKeys = nKeyMeta = 0;
@@ -318,6 +331,44 @@ public:
     }
 };
 
+// Take a decoded transaction into the wallet, or drop it if it failed validation
+static bool
+LoadWalletTx(CWallet* pwallet, const uint256& hash, CWalletTx& wtx, CDataStream& ssValue, bool fValid,
+             CWalletScanState &wss, string& strErr)
+{
+    if (fValid)
+        wtx.BindWallet(pwallet);
+    else
+    {
+        pwallet->mapWallet.erase(hash);
+        return false;
+    }
+
+    // Undo serialize changes in 31600
+    if (31404 <= wtx.fTimeReceivedIsTxTime && wtx.fTimeReceivedIsTxTime <= 31703)
+    {
+        if (!ssValue.empty())
+        {
+            char fTmp;
+            char fUnused;
+            ssValue >> fTmp >> fUnused >> wtx.strFromAccount;
+            strErr = strprintf("LoadWallet() upgrading tx ver=%d %d '%s' %s",
+                               wtx.fTimeReceivedIsTxTime, fTmp, wtx.strFromAccount, hash.ToString());
+            wtx.fTimeReceivedIsTxTime = fTmp;
+        }
+        else
+        {
+            strErr = strprintf("LoadWallet() repairing tx ver=%d %s", wtx.fTimeReceivedIsTxTime, hash.ToString());
+            wtx.fTimeReceivedIsTxTime = 0;
+        }
+        wss.vWalletUpgrade.push_back(hash);
+    }
+
+    if (wtx.nOrderPos == -1)
+        wss.fAnyUnordered = true;
+    return true;
+}
+
 bool
 ReadKeyValue(CWallet* pwallet, CDataStream& ssKey, CDataStream& ssValue,
              CWalletScanState &wss, string& strType, string& strErr)
@@ -339,36 +390,8 @@ ReadKeyValue(CWallet* pwallet, CDataStream& ssKey, CDataStream& ssValue,
             ssKey >> hash;
             CWalletTx& wtx = pwallet->mapWallet[hash];
             ssValue >> wtx;
-            if (wtx.CheckTransaction() && (wtx.GetHash() == hash))
-                wtx.BindWallet(pwallet);
-            else
-            {
-                pwallet->mapWallet.erase(hash);
+            if (!LoadWalletTx(pwallet, hash, wtx, ssValue, wtx.CheckTransaction() && wtx.GetHash() == hash, wss, strErr))
                 return false;
-            }
-
-            // Undo serialize changes in 31600
-            if (31404 <= wtx.fTimeReceivedIsTxTime && wtx.fTimeReceivedIsTxTime <= 31703)
-            {
-                if (!ssValue.empty())
-                {
-                    char fTmp;
-                    char fUnused;
-                    ssValue >> fTmp >> fUnused >> wtx.strFromAccount;
-                    strErr = strprintf("LoadWallet() upgrading tx ver=%d %d '%s' %s",
-                                       wtx.fTimeReceivedIsTxTime, fTmp, wtx.strFromAccount, hash.ToString());
-                    wtx.fTimeReceivedIsTxTime = fTmp;
-                }
-                else
-                {
-                    strErr = strprintf("LoadWallet() repairing tx ver=%d %s", wtx.fTimeReceivedIsTxTime, hash.ToString());
-                    wtx.fTimeReceivedIsTxTime = 0;
-                }
-                wss.vWalletUpgrade.push_back(hash);
-            }
-
-            if (wtx.nOrderPos == -1)
-                wss.fAnyUnordered = true;
 
             //// debug print
             //LogPrintf("LoadWallet  %s\n", wtx.GetHash().ToString());
@@ -387,13 +410,14 @@ ReadKeyValue(CWallet* pwallet, CDataStream& ssKey, CDataStream& ssValue,
             if (nNumber > nAccountingEntryNumber)
                 nAccountingEntryNumber = nNumber;
 
-            if (!wss.fAnyUnordered)
-            {
-                CAccountingEntry acentry;
-                ssValue >> acentry;
-                if (acentry.nOrderPos == -1)
-                    wss.fAnyUnordered = true;
-            }
+            // Kept in memory for the activity log, see CWallet::OrderedTxItems
+            CAccountingEntry acentry;
+            ssValue >> acentry;
+            acentry.strAccount = strAccount;
+            acentry.nEntryNo = nNumber;
+            if (acentry.nOrderPos == -1)
+                wss.fAnyUnordered = true;
+            pwallet->laccentries.push_back(acentry);
         }
         else if (strType == "key" || strType == "wkey")
         {
@@ -558,6 +582,29 @@ static bool IsKeyType(string strType)
             strType == "mkey" || strType == "ckey");
 }
 
+// A "tx" record read by the cursor, its body decoded and checked later on any core
+class CWalletTxRecord
+{
+public:
+    uint256 hash;
+    CWalletTx* pwtx;
+    CSerializeData vchValue; // the record, after decoding what followed the transaction
+    bool fValid;
+};
+
+static void DecodeWalletTx(vector<CWalletTxRecord>* pvRecord, unsigned int i)
+{
+    CWalletTxRecord& record = (*pvRecord)[i];
+    try {
+        CDataStream ssValue(record.vchValue, SER_DISK, CLIENT_VERSION);
+        ssValue >> *record.pwtx;
+        record.fValid = record.pwtx->CheckTransaction() && record.pwtx->GetHash() == record.hash;
+        record.vchValue.assign(ssValue.begin(), ssValue.end());
+    } catch (...) {
+        record.fValid = false;
+    }
+}
+
 DBErrors CWalletDB::LoadWallet(CWallet* pwallet)
 {
     pwallet->vchDefaultKey = CPubKey();
@@ -576,13 +623,17 @@ DBErrors CWalletDB::LoadWallet(CWallet* pwallet)
         }
 
         // Get cursor
-        Dbc* pcursor = GetCursor();
+        CDBCursor* pcursor = GetCursor();
         if (!pcursor)
         {
             LogPrintf("Error getting wallet database cursor\n");
             return DB_CORRUPT;
         }
 
+        // Cursor stage: keys and everything else are loaded as they come,
+        // transaction bodies are only collected
+        vector<CWalletTxRecord> vTxRecord;
+        int64_t nCursorStart = GetTimeMicros();
         while (true)
         {
             // Read next record
@@ -594,12 +645,35 @@ DBErrors CWalletDB::LoadWallet(CWallet* pwallet)
             else if (ret != 0)
             {
                 LogPrintf("Error reading next record from wallet database\n");
+                pcursor->close();
                 return DB_CORRUPT;
             }
 
-            // Try to be tolerant of single corrupt records:
+            int64_t nStart = GetTimeMicros();
+            unsigned int nBytes = ssKey.size() + ssValue.size();
             string strType, strErr;
-            if (!ReadKeyValue(pwallet, ssKey, ssValue, wss, strType, strErr))
+            if (ssKey.size() > 3 && memcmp(&ssKey[0], "\x02tx", 3) == 0)
+            {
+                CWalletTxRecord record;
+                ssKey >> strType >> record.hash;
+                record.pwtx = &pwallet->mapWallet[record.hash];
+                record.vchValue.assign(ssValue.begin(), ssValue.end());
+                record.fValid = false;
+                vTxRecord.push_back(record);
+                CWalletLoadTiming& timing = wss.mapTiming[strType];
+                timing.nRecords++;
+                timing.nBytes += nBytes;
+                timing.nMicros += GetTimeMicros() - nStart;
+                continue;
+            }
+
+            // Try to be tolerant of single corrupt records:
+            bool fLoaded = ReadKeyValue(pwallet, ssKey, ssValue, wss, strType, strErr);
+            CWalletLoadTiming& timing = wss.mapTiming[strType];
+            timing.nRecords++;
+            timing.nBytes += nBytes;
+            timing.nMicros += GetTimeMicros() - nStart;
+            if (!fLoaded)
             {
                 // losing keys is considered a catastrophic error, anything else
                 // we assume the user can live with:
@@ -618,6 +692,32 @@ DBErrors CWalletDB::LoadWallet(CWallet* pwallet)
                 LogPrintf("%s\n", strErr);
         }
         pcursor->close();
+        int64_t nCursorMicros = GetTimeMicros() - nCursorStart;
+
+        // Decode stage: map entries already exist, so the workers only fill them in
+        int64_t nDecodeStart = GetTimeMicros();
+        unsigned int nWorkers = ParallelFor(vTxRecord.size(), 256, boost::bind(&DecodeWalletTx, &vTxRecord, _1));
+        BOOST_FOREACH(CWalletTxRecord& record, vTxRecord)
+        {
+            string strErr;
+            CDataStream ssValue(record.vchValue, SER_DISK, CLIENT_VERSION);
+            if (!LoadWalletTx(pwallet, record.hash, *record.pwtx, ssValue, record.fValid, wss, strErr))
+            {
+                // Rescan if there is a bad transaction record:
+                fNoncriticalErrors = true;
+                SoftSetBoolArg("-rescan", true);
+            }
+            if (!strErr.empty())
+                LogPrintf("%s\n", strErr);
+        }
+        int64_t nDecodeMicros = GetTimeMicros() - nDecodeStart;
+        wss.mapTiming["tx"].nMicros += nDecodeMicros;
+
+        LogPrintf("LoadWallet: cursor %.2fms, %u transactions decoded on %u threads in %.2fms\n",
+                  nCursorMicros * 0.001, vTxRecord.size(), nWorkers, nDecodeMicros * 0.001);
+        for (map<string, CWalletLoadTiming>::const_iterator it = wss.mapTiming.begin(); it != wss.mapTiming.end(); ++it)
+            LogPrintf("LoadWallet: %-12s %8u records %11u bytes %9.2fms\n",
+                      it->first, it->second.nRecords, it->second.nBytes, it->second.nMicros * 0.001);
     }
     catch (boost::thread_interrupted) {
         throw;
@@ -654,8 +754,12 @@ DBErrors CWalletDB::LoadWallet(CWallet* pwallet)
     if (wss.nFileVersion < CLIENT_VERSION) // Update
         WriteVersion(CLIENT_VERSION);
 
+    int64_t nStart = GetTimeMillis();
     if (wss.fAnyUnordered)
         result = ReorderTransactions(pwallet);
+    else
+        pwallet->BuildOrderedTxIndex();
+    LogPrintf("LoadWallet: %s transactions %dms\n", wss.fAnyUnordered ? "reordered" : "indexed", GetTimeMillis() - nStart);
 
     return result;
 }
@@ -687,6 +791,20 @@ void ThreadFlushWalletDB(const string& strFile)
 
         if (nLastFlushed != nWalletDBUpdated && GetTime() - nLastWalletUpdate >= 2)
         {
+            if (fWalletJournal)
+            {
+                // Journal handles need no closing, only the file needs syncing
+                CWalletJournal* pjournal = CWalletJournal::Get(strFile);
+                if (pjournal)
+                {
+                    int64_t nStart = GetTimeMillis();
+                    nLastFlushed = nWalletDBUpdated;
+                    pjournal->Flush(true);
+                    LogPrint("db", "Flushed %s journal %dms\n", strFile, GetTimeMillis() - nStart);
+                }
+                continue;
+            }
+
             TRY_LOCK(bitdb.cs_db,lockDb);
             if (lockDb)
             {
@@ -726,6 +844,28 @@ bool BackupWallet(const CWallet& wallet, const string& strDest)
 {
     if (!wallet.fFileBacked)
         return false;
+    if (fWalletJournal)
+    {
+        // A fresh snapshot holds the whole wallet; it is restored as <wallet>.snapshot
+        CWalletJournal* pjournal = CWalletJournal::Get(wallet.strWalletFile);
+        if (!pjournal || !pjournal->Compact())
+            return false;
+        filesystem::path pathDest(strDest);
+        if (filesystem::is_directory(pathDest))
+            pathDest /= wallet.strWalletFile + ".snapshot";
+        try {
+#if BOOST_VERSION >= 104000
+            filesystem::copy_file(pjournal->GetSnapshotPath(), pathDest, filesystem::copy_option::overwrite_if_exists);
+#else
+            filesystem::copy_file(pjournal->GetSnapshotPath(), pathDest);
+#endif
+            LogPrintf("copied %s to %s\n", pjournal->GetSnapshotPath().string(), pathDest.string());
+            return true;
+        } catch(const filesystem::filesystem_error &e) {
+            LogPrintf("error copying %s to %s - %s\n", pjournal->GetSnapshotPath().string(), pathDest.string(), e.what());
+            return false;
+        }
+    }
     while (true)
     {
         {
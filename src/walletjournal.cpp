@@ -0,0 +1,448 @@
+// Copyright (c) 2016 The Bitcoin developers
+// Distributed under the MIT/X11 software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "walletjournal.h"
+
+#include "util.h"
+
+#include <boost/crc.hpp>
+#include <boost/filesystem.hpp>
+#include <boost/foreach.hpp>
+
+using namespace std;
+
+bool fWalletJournal = false;
+
+static const char JOURNAL_MAGIC[8] = { 'I', 'C', 'O', 'W', 'J', 'N', 'L', 1 };
+static const unsigned char JOURNAL_PUT = 1;
+static const unsigned char JOURNAL_ERASE = 2;
+static const unsigned int JOURNAL_HEADER_SIZE = 8; // batch size and checksum
+
+static uint32_t BatchChecksum(const char* pbegin, size_t nSize)
+{
+    boost::crc_32_type crc;
+    crc.process_bytes(pbegin, nSize);
+    return crc.checksum();
+}
+// Journal size from which Flush(true) compacts, if also several times the snapshot
+static const uint64_t JOURNAL_COMPACT_SIZE = 1 << 20;
+
+CWalletJournal::CWalletJournal(const boost::filesystem::path& pathSnapshotIn, const boost::filesystem::path& pathJournalIn) :
+    pathSnapshot(pathSnapshotIn), pathJournal(pathJournalIn), fileJournal(NULL),
+    nJournalSize(0), nSnapshotSize(0)
+{
+}
+
+CWalletJournal::~CWalletJournal()
+{
+    if (fileJournal)
+    {
+        WritePending(true);
+        fclose(fileJournal);
+    }
+}
+
+void CWalletJournal::AppendBatch(const CWalletJournalBatch& batch)
+{
+    if (batch.nOps == 0)
+        return;
+    uint32_t nSize = batch.ssOps.size();
+    uint32_t nCrc = BatchChecksum(&batch.ssOps[0], nSize);
+    CDataStream ssHeader(SER_DISK, CLIENT_VERSION);
+    ssHeader << nSize << nCrc;
+    vchPending.insert(vchPending.end(), ssHeader.begin(), ssHeader.end());
+    vchPending.insert(vchPending.end(), batch.ssOps.begin(), batch.ssOps.end());
+}
+
+bool CWalletJournal::WritePending(bool fSync)
+{
+    if (!fileJournal)
+        return false;
+    if (!vchPending.empty())
+    {
+        // One write for everything buffered since the last one
+        if (fwrite(&vchPending[0], 1, vchPending.size(), fileJournal) != vchPending.size())
+            return error("CWalletJournal::WritePending() : write to %s failed", pathJournal.string());
+        nJournalSize += vchPending.size();
+        vchPending.clear();
+        fflush(fileJournal);
+    }
+    if (fSync)
+        FileCommit(fileJournal);
+    return true;
+}
+
+bool CWalletJournal::ReadFile(const boost::filesystem::path& path, bool& fTorn)
+{
+    FILE* file = fopen(path.string().c_str(), "rb");
+    if (!file)
+        return error("CWalletJournal::ReadFile() : cannot open %s", path.string());
+    CSerializeData vch(boost::filesystem::file_size(path));
+    size_t nRead = vch.empty() ? 0 : fread(&vch[0], 1, vch.size(), file);
+    fclose(file);
+    if (nRead != vch.size() || vch.size() < sizeof(JOURNAL_MAGIC) || memcmp(&vch[0], JOURNAL_MAGIC, sizeof(JOURNAL_MAGIC)) != 0)
+        return error("CWalletJournal::ReadFile() : %s is not a wallet journal", path.string());
+
+    size_t nPos = sizeof(JOURNAL_MAGIC);
+    while (nPos < vch.size())
+    {
+        // A batch cut short or garbled by a crash ends the file
+        uint32_t nSize, nCrc;
+        if (vch.size() - nPos < JOURNAL_HEADER_SIZE)
+        {
+            fTorn = true;
+            break;
+        }
+        CDataStream ssHeader(&vch[nPos], &vch[nPos] + JOURNAL_HEADER_SIZE, SER_DISK, CLIENT_VERSION);
+        ssHeader >> nSize >> nCrc;
+        nPos += JOURNAL_HEADER_SIZE;
+        if (nSize == 0 || vch.size() - nPos < nSize || BatchChecksum(&vch[nPos], nSize) != nCrc)
+        {
+            fTorn = true;
+            break;
+        }
+
+        try {
+            CDataStream ssOps(&vch[nPos], &vch[nPos] + nSize, SER_DISK, CLIENT_VERSION);
+            while (!ssOps.empty())
+            {
+                unsigned char nOp;
+                CSerializeData key;
+                ssOps >> nOp >> key;
+                if (nOp == JOURNAL_PUT)
+                    ssOps >> mapData[key];
+                else if (nOp == JOURNAL_ERASE)
+                    mapData.erase(key);
+                else
+                    return error("CWalletJournal::ReadFile() : unknown operation %d in %s", nOp, path.string());
+            }
+        }
+        catch (std::exception &e) {
+            return error("CWalletJournal::ReadFile() : corrupt batch in %s", path.string());
+        }
+        nPos += nSize;
+    }
+    return true;
+}
+
+bool CWalletJournal::WriteSnapshot()
+{
+    CWalletJournalBatch batch;
+    for (JournalMap::const_iterator it = mapData.begin(); it != mapData.end(); ++it)
+    {
+        batch.ssOps << JOURNAL_PUT << it->first << it->second;
+        batch.nOps++;
+    }
+
+    // Written aside and renamed over the old snapshot, so there always is a complete one
+    boost::filesystem::path pathTmp = pathSnapshot.string() + ".new";
+    FILE* file = fopen(pathTmp.string().c_str(), "wb");
+    if (!file)
+        return error("CWalletJournal::WriteSnapshot() : cannot create %s", pathTmp.string());
+    CSerializeData vchSave;
+    vchSave.swap(vchPending);
+    AppendBatch(batch);
+    vchPending.swap(vchSave);
+    bool fOk = fwrite(JOURNAL_MAGIC, 1, sizeof(JOURNAL_MAGIC), file) == sizeof(JOURNAL_MAGIC) &&
+               (vchSave.empty() || fwrite(&vchSave[0], 1, vchSave.size(), file) == vchSave.size());
+    FileCommit(file);
+    fclose(file);
+    if (!fOk || !RenameOver(pathTmp, pathSnapshot))
+        return error("CWalletJournal::WriteSnapshot() : writing %s failed", pathSnapshot.string());
+    nSnapshotSize = sizeof(JOURNAL_MAGIC) + vchSave.size();
+    return true;
+}
+
+bool CWalletJournal::OpenJournal(bool fTruncate)
+{
+    if (fileJournal)
+    {
+        fclose(fileJournal);
+        fileJournal = NULL;
+    }
+    if (fTruncate)
+    {
+        // The empty journal is written aside and renamed over the old one, so there always is
+        // a complete one
+        boost::filesystem::path pathTmp = pathJournal.string() + ".new";
+        FILE* file = fopen(pathTmp.string().c_str(), "wb");
+        if (!file)
+            return error("CWalletJournal::OpenJournal() : cannot create %s", pathTmp.string());
+        bool fOk = fwrite(JOURNAL_MAGIC, 1, sizeof(JOURNAL_MAGIC), file) == sizeof(JOURNAL_MAGIC);
+        FileCommit(file);
+        fclose(file);
+        if (!fOk || !RenameOver(pathTmp, pathJournal))
+            return error("CWalletJournal::OpenJournal() : writing %s failed", pathJournal.string());
+    }
+    fileJournal = fopen(pathJournal.string().c_str(), "ab");
+    if (!fileJournal)
+        return error("CWalletJournal::OpenJournal() : cannot open %s", pathJournal.string());
+    nJournalSize = boost::filesystem::file_size(pathJournal);
+    if (nJournalSize == 0)
+    {
+        if (fwrite(JOURNAL_MAGIC, 1, sizeof(JOURNAL_MAGIC), fileJournal) != sizeof(JOURNAL_MAGIC))
+            return error("CWalletJournal::OpenJournal() : write to %s failed", pathJournal.string());
+        FileCommit(fileJournal);
+        nJournalSize = sizeof(JOURNAL_MAGIC);
+    }
+    return true;
+}
+
+bool CWalletJournal::Open()
+{
+    LOCK(cs_journal);
+    mapData.clear();
+    vchPending.clear();
+
+    bool fTorn = false;
+    if (boost::filesystem::exists(pathSnapshot))
+    {
+        if (!ReadFile(pathSnapshot, fTorn) || fTorn)
+            return error("CWalletJournal::Open() : %s is corrupt", pathSnapshot.string());
+        nSnapshotSize = boost::filesystem::file_size(pathSnapshot);
+    }
+    else if (!WriteSnapshot())
+        return false;
+
+    if (boost::filesystem::exists(pathJournal) && !ReadFile(pathJournal, fTorn))
+        return false;
+
+    // Start a clean journal after a torn batch, so new batches do not follow the garbage
+    if (fTorn)
+    {
+        LogPrintf("CWalletJournal::Open() : dropped incomplete batch at the end of %s\n", pathJournal.string());
+        return WriteSnapshot() && OpenJournal(true);
+    }
+    return OpenJournal(false);
+}
+
+bool CWalletJournal::Lookup(const CSerializeData& key, CSerializeData* pvalue, const CWalletJournalBatch* pbatch) const
+{
+    AssertLockHeld(cs_journal);
+    if (pbatch)
+    {
+        map<CSerializeData, pair<bool, CSerializeData>, CJournalKeyCompare>::const_iterator it = pbatch->mapPending.find(key);
+        if (it != pbatch->mapPending.end())
+        {
+            if (it->second.first && pvalue)
+                *pvalue = it->second.second;
+            return it->second.first;
+        }
+    }
+    JournalMap::const_iterator it = mapData.find(key);
+    if (it == mapData.end())
+        return false;
+    if (pvalue)
+        *pvalue = it->second;
+    return true;
+}
+
+bool CWalletJournal::Read(const CSerializeData& key, CSerializeData& value, const CWalletJournalBatch* pbatch) const
+{
+    LOCK(cs_journal);
+    return Lookup(key, &value, pbatch);
+}
+
+bool CWalletJournal::Exists(const CSerializeData& key, const CWalletJournalBatch* pbatch) const
+{
+    LOCK(cs_journal);
+    return Lookup(key, NULL, pbatch);
+}
+
+bool CWalletJournal::Write(const CSerializeData& key, const CSerializeData& value, bool fOverwrite, CWalletJournalBatch* pbatch)
+{
+    LOCK(cs_journal);
+    if (!fOverwrite && Lookup(key, NULL, pbatch))
+        return false;
+    if (pbatch)
+    {
+        pbatch->mapPending[key] = make_pair(true, value);
+        return true;
+    }
+
+    CWalletJournalBatch batch;
+    batch.ssOps << JOURNAL_PUT << key << value;
+    batch.nOps++;
+    mapData[key] = value;
+    AppendBatch(batch);
+    return true;
+}
+
+bool CWalletJournal::Erase(const CSerializeData& key, CWalletJournalBatch* pbatch)
+{
+    LOCK(cs_journal);
+    if (!Lookup(key, NULL, pbatch))
+        return true;
+    if (pbatch)
+    {
+        pbatch->mapPending[key] = make_pair(false, CSerializeData());
+        return true;
+    }
+
+    CWalletJournalBatch batch;
+    batch.ssOps << JOURNAL_ERASE << key;
+    batch.nOps++;
+    mapData.erase(key);
+    AppendBatch(batch);
+    return true;
+}
+
+void CWalletJournal::Begin(CWalletJournalBatch& batch)
+{
+    batch.mapPending.clear();
+}
+
+bool CWalletJournal::Commit(CWalletJournalBatch& batch)
+{
+    LOCK(cs_journal);
+    // Merged under the lock, so other handles see all of the batch or none of it
+    map<CSerializeData, pair<bool, CSerializeData>, CJournalKeyCompare>::const_iterator it;
+    for (it = batch.mapPending.begin(); it != batch.mapPending.end(); ++it)
+    {
+        if (it->second.first)
+        {
+            batch.ssOps << JOURNAL_PUT << it->first << it->second.second;
+            mapData[it->first] = it->second.second;
+        }
+        else
+        {
+            batch.ssOps << JOURNAL_ERASE << it->first;
+            mapData.erase(it->first);
+        }
+        batch.nOps++;
+    }
+    batch.mapPending.clear();
+    AppendBatch(batch);
+    return WritePending(false);
+}
+
+void CWalletJournal::Abort(CWalletJournalBatch& batch)
+{
+    // Nothing of the batch has reached the records
+    batch.mapPending.clear();
+}
+
+bool CWalletJournal::Seek(CSerializeData& key, CSerializeData& value, bool fAfter, const CWalletJournalBatch* pbatch) const
+{
+    LOCK(cs_journal);
+    CJournalKeyCompare less;
+    while (true)
+    {
+        JournalMap::const_iterator it = fAfter ? mapData.upper_bound(key) : mapData.lower_bound(key);
+        bool fData = it != mapData.end();
+        if (pbatch)
+        {
+            map<CSerializeData, pair<bool, CSerializeData>, CJournalKeyCompare>::const_iterator pit =
+                fAfter ? pbatch->mapPending.upper_bound(key) : pbatch->mapPending.lower_bound(key);
+            // A pending write comes first, and hides the record of the same key
+            if (pit != pbatch->mapPending.end() && (!fData || !less(it->first, pit->first)))
+            {
+                key = pit->first;
+                if (pit->second.first)
+                {
+                    value = pit->second.second;
+                    return true;
+                }
+                // Erased in the batch, look past it
+                fAfter = true;
+                continue;
+            }
+        }
+        if (!fData)
+            return false;
+        key = it->first;
+        value = it->second;
+        return true;
+    }
+}
+
+bool CWalletJournal::Flush(bool fSync)
+{
+    LOCK(cs_journal);
+    if (!WritePending(fSync))
+        return false;
+    if (fSync && nJournalSize > max(JOURNAL_COMPACT_SIZE, 4 * nSnapshotSize))
+        return Compact();
+    return true;
+}
+
+bool CWalletJournal::Compact(const char* pszSkip)
+{
+    LOCK(cs_journal);
+    // Open batches keep their writes to themselves, the snapshot only has committed records
+    int64_t nStart = GetTimeMillis();
+    vector<CSerializeData> vSkip;
+    if (pszSkip)
+    {
+        size_t nSkip = strlen(pszSkip);
+        for (JournalMap::const_iterator it = mapData.begin(); it != mapData.end(); ++it)
+            if (it->first.size() >= nSkip && memcmp(&it->first[0], pszSkip, nSkip) == 0)
+                vSkip.push_back(it->first);
+    }
+
+    // The drops reach the journal on disk before the new snapshot replaces the old one. A
+    // crash before the rename replays them over the old snapshot, one after it replays the
+    // old journal over a snapshot that has them already.
+    CWalletJournalBatch batchSkip;
+    BOOST_FOREACH(const CSerializeData& key, vSkip)
+    {
+        batchSkip.ssOps << JOURNAL_ERASE << key;
+        batchSkip.nOps++;
+    }
+    AppendBatch(batchSkip);
+    if (!WritePending(true))
+        return false;
+    BOOST_FOREACH(const CSerializeData& key, vSkip)
+        mapData.erase(key);
+
+    if (!WriteSnapshot() || !OpenJournal(true))
+        return false;
+    LogPrint("db", "CWalletJournal::Compact() : %u records, snapshot %u bytes, %dms\n",
+             mapData.size(), nSnapshotSize, GetTimeMillis() - nStart);
+    return true;
+}
+
+size_t CWalletJournal::size() const
+{
+    LOCK(cs_journal);
+    return mapData.size();
+}
+
+static CCriticalSection cs_mapJournals;
+static map<string, CWalletJournal*> mapJournals;
+
+CWalletJournal* CWalletJournal::Get(const string& strFile)
+{
+    LOCK(cs_mapJournals);
+    map<string, CWalletJournal*>::iterator it = mapJournals.find(strFile);
+    if (it != mapJournals.end())
+        return it->second;
+
+    CWalletJournal* pjournal = new CWalletJournal(GetDataDir() / (strFile + ".snapshot"), GetDataDir() / (strFile + ".journal"));
+    if (!pjournal->Open())
+    {
+        delete pjournal;
+        return NULL;
+    }
+    mapJournals[strFile] = pjournal;
+    return pjournal;
+}
+
+bool CWalletJournal::HaveJournal(const string& strFile)
+{
+    return boost::filesystem::exists(GetDataDir() / (strFile + ".snapshot"));
+}
+
+void CWalletJournal::FlushAll(bool fShutdown)
+{
+    LOCK(cs_mapJournals);
+    for (map<string, CWalletJournal*>::iterator it = mapJournals.begin(); it != mapJournals.end(); ++it)
+    {
+        it->second->Flush(true);
+        if (fShutdown)
+            delete it->second;
+    }
+    if (fShutdown)
+        mapJournals.clear();
+}
@@ -0,0 +1,115 @@
+// Copyright (c) 2016 The Bitcoin developers
+// Distributed under the MIT/X11 software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+#ifndef BITCOIN_WALLETJOURNAL_H
+#define BITCOIN_WALLETJOURNAL_H
+
+#include "serialize.h"
+#include "sync.h"
+#include "version.h"
+
+#include <algorithm>
+#include <map>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include <boost/filesystem/path.hpp>
+
+/** Store wallets in a CWalletJournal instead of Berkeley DB (-walletjournal) */
+extern bool fWalletJournal;
+
+/** Orders keys by unsigned bytes, as the Berkeley DB btree does */
+struct CJournalKeyCompare
+{
+    bool operator()(const CSerializeData& a, const CSerializeData& b) const
+    {
+        return std::lexicographical_compare((const unsigned char*)a.data(), (const unsigned char*)a.data() + a.size(),
+                                            (const unsigned char*)b.data(), (const unsigned char*)b.data() + b.size());
+    }
+};
+
+typedef std::map<CSerializeData, CSerializeData, CJournalKeyCompare> JournalMap;
+
+/** Writes of one CDB transaction. They stay here, seen only through the handle that made
+ * them, until Commit() merges them into the journal; Abort() just forgets them. */
+class CWalletJournalBatch
+{
+public:
+    CDataStream ssOps;      // encoded operations, as they go to the file
+    unsigned int nOps;
+    /** Pending writes by key: true and the new value, or false for an erase */
+    std::map<CSerializeData, std::pair<bool, CSerializeData>, CJournalKeyCompare> mapPending;
+
+    CWalletJournalBatch() : ssOps(SER_DISK, CLIENT_VERSION), nOps(0) {}
+};
+
+/** Append-only key/value store backing a wallet file, as an alternative to Berkeley DB.
+ *
+ * All records are kept in memory, in the same key order as the Berkeley DB btree. On disk,
+ * <file>.snapshot holds a compacted copy and <file>.journal the batches written since. A
+ * batch is [size][crc32][operations] and is only applied on replay if complete and intact,
+ * so a torn write at the end of the journal loses at most the batches that were in flight.
+ *
+ * Writes are buffered and reach the file together (group commit) when a CDB handle closes or
+ * commits; Flush(true) also syncs them to disk. Once the journal has grown to several times
+ * the snapshot, Flush() folds it into a new snapshot. Records dropped by a compaction are
+ * journaled first, and the journal is replaced by renaming, so a crash at any point leaves
+ * files that load to either the old or the new state.
+ */
+class CWalletJournal
+{
+private:
+    mutable CCriticalSection cs_journal;
+    JournalMap mapData;
+    boost::filesystem::path pathSnapshot;
+    boost::filesystem::path pathJournal;
+    FILE* fileJournal;
+    CSerializeData vchPending;   // encoded batches not yet handed to the OS
+    uint64_t nJournalSize;
+    uint64_t nSnapshotSize;
+
+    /** The value of key as pbatch sees it; pvalue may be NULL */
+    bool Lookup(const CSerializeData& key, CSerializeData* pvalue, const CWalletJournalBatch* pbatch) const;
+    void AppendBatch(const CWalletJournalBatch& batch);
+    bool WritePending(bool fSync);
+    bool ReadFile(const boost::filesystem::path& path, bool& fTorn);
+    bool WriteSnapshot();
+    bool OpenJournal(bool fTruncate);
+
+public:
+    CWalletJournal(const boost::filesystem::path& pathSnapshotIn, const boost::filesystem::path& pathJournalIn);
+    ~CWalletJournal();
+
+    /** Load the snapshot and replay the journal, creating both if missing */
+    bool Open();
+
+    /** Reads see the committed records, overlaid with the pending writes of pbatch if given */
+    bool Read(const CSerializeData& key, CSerializeData& value, const CWalletJournalBatch* pbatch = NULL) const;
+    bool Exists(const CSerializeData& key, const CWalletJournalBatch* pbatch = NULL) const;
+    /** Apply a write at once if pbatch is NULL, else keep it in pbatch until Commit() */
+    bool Write(const CSerializeData& key, const CSerializeData& value, bool fOverwrite, CWalletJournalBatch* pbatch);
+    bool Erase(const CSerializeData& key, CWalletJournalBatch* pbatch);
+    void Begin(CWalletJournalBatch& batch);
+    bool Commit(CWalletJournalBatch& batch);
+    void Abort(CWalletJournalBatch& batch);
+
+    /** First record with a key not below (fAfter: above) key, for cursors */
+    bool Seek(CSerializeData& key, CSerializeData& value, bool fAfter, const CWalletJournalBatch* pbatch = NULL) const;
+
+    /** Hand buffered batches to the OS; fSync also waits for the disk and compacts if worthwhile */
+    bool Flush(bool fSync);
+    /** Fold the journal into a new snapshot, dropping records whose key starts with pszSkip */
+    bool Compact(const char* pszSkip = NULL);
+
+    size_t size() const;
+    const boost::filesystem::path& GetSnapshotPath() const { return pathSnapshot; }
+
+    /** The journal of a wallet file in the data directory, opened on first use */
+    static CWalletJournal* Get(const std::string& strFile);
+    /** Whether the wallet file has been created as, or migrated to, a journal */
+    static bool HaveJournal(const std::string& strFile);
+    static void FlushAll(bool fShutdown);
+};
+
+#endif // BITCOIN_WALLETJOURNAL_H
@@ -0,0 +1,541 @@
+// Copyright (c) 2016 The Bitcoin developers
+// Distributed under the MIT/X11 software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "workserver.h"
+
+#include "chainparams.h"
+#include "init.h"
+#include "miner.h"
+#include "rpcprotocol.h"
+#include "ui_interface.h"
+#include "util.h"
+#include "wallet.h"
+
+#include <boost/asio.hpp>
+#include <boost/bind.hpp>
+#include <boost/enable_shared_from_this.hpp>
+#include <boost/shared_ptr.hpp>
+
+using namespace boost::asio;
+using namespace json_spirit;
+using namespace std;
+
+bool ClientAllowed(const boost::asio::ip::address& address);
+
+/** Lines a client may fall behind on before it is dropped */
+static const unsigned int MAX_WORK_SEND_QUEUE = 64;
+
+CWorkSession::CWorkSession(CWorkSource& sourceIn, unsigned int nShareFactorIn) :
+    source(sourceIn), nShareFactor(std::max(nShareFactorIn, 1U)), fSubscribed(false), fAuthorized(false), nNextJob(1)
+{
+}
+
+static string WorkLine(const Object& obj)
+{
+    return write_string(Value(obj), false) + "\n";
+}
+
+bool CWorkSession::ProcessLine(const string& strLine, vector<string>& vSend)
+{
+    Value valRequest;
+    if (!read_string(strLine, valRequest) || valRequest.type() != obj_type)
+    {
+        vSend.push_back(WorkLine(JSONRPCReplyObj(Value::null, JSONRPCError(RPC_PARSE_ERROR, "Parse error"), Value::null)));
+        return false;
+    }
+    const Object& request = valRequest.get_obj();
+    Value id = find_value(request, "id");
+    Value result = Value::null;
+    Value error = Value::null;
+    bool fFirstJob = false;
+    bool fKeep = true;
+    try
+    {
+        const Value& valMethod = find_value(request, "method");
+        if (valMethod.type() != str_type)
+            throw JSONRPCError(RPC_INVALID_REQUEST, "Method must be a string");
+        const string& strMethod = valMethod.get_str();
+
+        Array params;
+        const Value& valParams = find_value(request, "params");
+        if (valParams.type() == array_type)
+            params = valParams.get_array();
+        else if (valParams.type() != null_type)
+            throw JSONRPCError(RPC_INVALID_REQUEST, "Params must be an array");
+
+        if (strMethod == "mining.subscribe")
+        {
+            fFirstJob = !fSubscribed && fAuthorized;
+            fSubscribed = true;
+            result = true;
+        }
+        else if (strMethod == "mining.authorize")
+        {
+            // The RPC credentials, on top of the address check at accept time
+            if (params.size() != 2 || params[0].type() != str_type || params[1].type() != str_type ||
+                !source.Authorize(params[0].get_str(), params[1].get_str()))
+            {
+                fKeep = false;
+                throw JSONRPCError(WORK_UNAUTHORIZED, "Unauthorized worker");
+            }
+            fFirstJob = fSubscribed && !fAuthorized;
+            fAuthorized = true;
+            result = true;
+        }
+        else if (strMethod == "mining.submit")
+            result = Submit(params);
+        else
+            throw JSONRPCError(RPC_METHOD_NOT_FOUND, "Method not found");
+    }
+    catch (Object& objError)
+    {
+        result = Value::null;
+        error = objError;
+    }
+    vSend.push_back(WorkLine(JSONRPCReplyObj(result, error, id)));
+
+    // The first job follows the reply, so the client knows it is subscribed
+    if (fFirstJob)
+        Notify(true, vSend);
+    return fKeep;
+}
+
+Value CWorkSession::Submit(const Array& params)
+{
+    if (!fAuthorized)
+        throw JSONRPCError(WORK_UNAUTHORIZED, "Unauthorized worker");
+    if (!fSubscribed)
+        throw JSONRPCError(WORK_NOT_SUBSCRIBED, "Not subscribed");
+    if (params.size() != 2 || params[0].type() != str_type || params[1].type() != str_type)
+        throw JSONRPCError(RPC_INVALID_PARAMS, "mining.submit takes a job id and the block data");
+
+    map<string, CWorkJob>::iterator mi = mapJobs.find(params[0].get_str());
+    if (mi == mapJobs.end() || !source.IsCurrent((*mi).second.block.hashPrevBlock))
+    {
+        stats.nStale++;
+        throw JSONRPCError(WORK_JOB_NOT_FOUND, "Job not found or stale");
+    }
+    CWorkJob& job = (*mi).second;
+
+    // getwork format: the header in 32-bit words of swapped byte order
+    vector<unsigned char> vchData = ParseHex(params[1].get_str());
+    if (vchData.size() != 128)
+    {
+        stats.nRejected++;
+        throw JSONRPCError(RPC_INVALID_PARAMETER, "Invalid block data");
+    }
+    for (unsigned int i = 0; i < 128/4; i++)
+        ((unsigned int*)&vchData[0])[i] = ByteReverse(((unsigned int*)&vchData[0])[i]);
+    uint256 hashPrevBlock, hashMerkleRoot;
+    unsigned int nTime, nNonce;
+    memcpy(hashPrevBlock.begin(), &vchData[4], 32);
+    memcpy(hashMerkleRoot.begin(), &vchData[36], 32);
+    memcpy(&nTime, &vchData[68], 4);
+    memcpy(&nNonce, &vchData[76], 4);
+
+    if (hashPrevBlock != job.block.hashPrevBlock || hashMerkleRoot != job.block.hashMerkleRoot)
+    {
+        stats.nRejected++;
+        throw JSONRPCError(WORK_OTHER, "Block data does not match the job");
+    }
+    if (!job.setSubmitted.insert(make_pair(nTime, nNonce)).second)
+    {
+        stats.nRejected++;
+        throw JSONRPCError(WORK_DUPLICATE_SHARE, "Duplicate share");
+    }
+
+    job.block.nTime = nTime;
+    job.block.nNonce = nNonce;
+    CBigNum bnHash(job.block.GetPoWHash());
+    CBigNum bnTarget;
+    bnTarget.SetCompact(job.block.nBits);
+    if (bnHash > bnTarget * nShareFactor)
+    {
+        stats.nRejected++;
+        throw JSONRPCError(WORK_LOW_DIFFICULTY, "Low difficulty share");
+    }
+    stats.nShares++;
+
+    if (bnHash <= bnTarget)
+    {
+        // Submit a copy, the job stays for further shares
+        CBlock block(job.block);
+        if (source.SubmitBlock(block))
+            stats.nBlocks++;
+    }
+    return true;
+}
+
+void CWorkSession::Notify(bool fClean, vector<string>& vSend)
+{
+    if (!fSubscribed || !fAuthorized)
+        return;
+
+    CWorkJob job;
+    if (!source.CreateJob(job.block))
+        return;
+    if (fClean)
+    {
+        mapJobs.clear();
+        vJobOrder.clear();
+    }
+    while (vJobOrder.size() >= MAX_WORK_JOBS)
+    {
+        mapJobs.erase(vJobOrder.front());
+        vJobOrder.pop_front();
+    }
+    string strJobId = strprintf("%x", nNextJob++);
+    CWorkJob& jobNew = mapJobs[strJobId];
+    jobNew.block = job.block;
+    vJobOrder.push_back(strJobId);
+    stats.nJobs++;
+
+    char pmidstate[32];
+    char pdata[128];
+    char phash1[64];
+    FormatHashBuffers(&jobNew.block, pmidstate, pdata, phash1);
+
+    CBigNum bnShareTarget;
+    bnShareTarget.SetCompact(jobNew.block.nBits);
+    bnShareTarget *= nShareFactor;
+    if (bnShareTarget > CBigNum(~uint256(0)))
+        bnShareTarget = CBigNum(~uint256(0));
+    uint256 hashTarget = bnShareTarget.getuint256();
+
+    Array params;
+    params.push_back(strJobId);
+    params.push_back(HexStr(BEGIN(pdata), END(pdata)));
+    params.push_back(HexStr(BEGIN(hashTarget), END(hashTarget)));
+    params.push_back(fClean);
+
+    Object notify;
+    notify.push_back(Pair("id", Value::null));
+    notify.push_back(Pair("method", "mining.notify"));
+    notify.push_back(Pair("params", params));
+    vSend.push_back(WorkLine(notify));
+}
+
+/** Jobs from the shared mining template, which pays the template's own key */
+class CMinerWorkSource : public CWorkSource
+{
+private:
+    unsigned int nExtraNonce;
+
+public:
+    CMinerWorkSource() : nExtraNonce(0) {}
+
+    bool CreateJob(CBlock& block)
+    {
+        LOCK(cs_main);
+        // No work while catching up, as getwork
+        if (IsInitialBlockDownload())
+            return false;
+        CMiningTemplateRef ptemplate = GetMiningTemplate();
+        if (!ptemplate)
+            return false;
+        block = ptemplate->block;
+        block.UpdateTime(pindexBest);
+        block.nNonce = 0;
+
+        // A counter of our own, tagged so no job repeats a getwork coinbase
+        unsigned int nHeight = pindexBest->nHeight+1;
+        block.vtx[0].vin[0].scriptSig = (CScript() << nHeight << CBigNum(++nExtraNonce) << OP_1) + COINBASE_FLAGS;
+        assert(block.vtx[0].vin[0].scriptSig.size() <= 100);
+        block.hashMerkleRoot = block.BuildMerkleTree();
+        return true;
+    }
+
+    bool IsCurrent(const uint256& hashPrevBlock)
+    {
+        CChainTipSnapshotRef ptip = GetChainTipSnapshot();
+        return ptip && ptip->hashBlock == hashPrevBlock;
+    }
+
+    bool SubmitBlock(CBlock& block)
+    {
+        return CheckMiningTemplateWork(&block);
+    }
+
+    bool Authorize(const string& strUser, const string& strPassword)
+    {
+        string strRPCUserColonPass = mapArgs["-rpcuser"] + ":" + mapArgs["-rpcpassword"];
+        if (mapArgs["-rpcpassword"].empty())
+            return false;
+        return TimingResistantEqual(strUser + ":" + strPassword, strRPCUserColonPass);
+    }
+};
+
+// Created by StartWorkServer, destroyed in StopWorkServer. Connections are only
+// touched on the work server's io thread.
+static io_service* work_io_service = NULL;
+static boost::thread_group* work_threads = NULL;
+static CMinerWorkSource* pworkSource = NULL;
+static boost::shared_ptr<ip::tcp::acceptor> workAcceptor;
+static unsigned int nWorkShareFactor = 1;
+
+static CCriticalSection cs_workStats;
+static CWorkServerStats workStats;
+
+static void ReportWorkStats(const CWorkSessionStats& before, const CWorkSessionStats& after)
+{
+    LOCK(cs_workStats);
+    workStats.sessions.nJobs += after.nJobs - before.nJobs;
+    workStats.sessions.nShares += after.nShares - before.nShares;
+    workStats.sessions.nStale += after.nStale - before.nStale;
+    workStats.sessions.nRejected += after.nRejected - before.nRejected;
+    workStats.sessions.nBlocks += after.nBlocks - before.nBlocks;
+}
+
+class CWorkConnection;
+static set<boost::shared_ptr<CWorkConnection> > setWorkConnections;
+
+class CWorkConnection : public boost::enable_shared_from_this<CWorkConnection>
+{
+private:
+    boost::asio::streambuf bufRecv;
+    deque<string> vSendQueue;
+    bool fWriting;
+    bool fDisconnect;
+    CWorkSession session;
+
+    void ReadLine()
+    {
+        async_read_until(socket, bufRecv, '\n',
+            boost::bind(&CWorkConnection::HandleRead, shared_from_this(), boost::asio::placeholders::error));
+    }
+
+    void HandleRead(const boost::system::error_code& error)
+    {
+        // Also fails once a line outgrows MAX_WORK_LINE
+        if (error)
+        {
+            Close();
+            return;
+        }
+        istream stream(&bufRecv);
+        string strLine;
+        getline(stream, strLine);
+
+        vector<string> vSend;
+        CWorkSessionStats before = session.stats;
+        if (!session.ProcessLine(strLine, vSend))
+            fDisconnect = true;
+        ReportWorkStats(before, session.stats);
+        Send(vSend);
+        if (!fDisconnect)
+            ReadLine();
+    }
+
+    void Send(const vector<string>& vSend)
+    {
+        vSendQueue.insert(vSendQueue.end(), vSend.begin(), vSend.end());
+        if (vSendQueue.size() > MAX_WORK_SEND_QUEUE)
+        {
+            LogPrint("workserver", "work server client not reading, disconnecting\n");
+            Close();
+            return;
+        }
+        if (!fWriting)
+            WriteNext();
+    }
+
+    void WriteNext()
+    {
+        if (vSendQueue.empty())
+        {
+            fWriting = false;
+            if (fDisconnect)
+                Close();
+            return;
+        }
+        fWriting = true;
+        async_write(socket, buffer(vSendQueue.front()),
+            boost::bind(&CWorkConnection::HandleWrite, shared_from_this(), boost::asio::placeholders::error));
+    }
+
+    void HandleWrite(const boost::system::error_code& error)
+    {
+        if (error)
+        {
+            Close();
+            return;
+        }
+        vSendQueue.pop_front();
+        WriteNext();
+    }
+
+public:
+    ip::tcp::socket socket;
+
+    CWorkConnection(io_service& io, CWorkSource& source, unsigned int nShareFactor) :
+        bufRecv(MAX_WORK_LINE), fWriting(false), fDisconnect(false), session(source, nShareFactor), socket(io)
+    {
+    }
+
+    void Start()
+    {
+        ReadLine();
+    }
+
+    void Notify(bool fClean)
+    {
+        vector<string> vSend;
+        CWorkSessionStats before = session.stats;
+        session.Notify(fClean, vSend);
+        ReportWorkStats(before, session.stats);
+        Send(vSend);
+    }
+
+    void Close()
+    {
+        if (!socket.is_open())
+            return;
+        boost::system::error_code ec;
+        socket.close(ec);
+        setWorkConnections.erase(shared_from_this());
+        LOCK(cs_workStats);
+        workStats.nConnections--;
+    }
+};
+
+static void WorkAccept();
+
+static void WorkAcceptHandler(boost::shared_ptr<CWorkConnection> conn, const boost::system::error_code& error)
+{
+    if (error == error::operation_aborted || !workAcceptor || !workAcceptor->is_open())
+        return;
+    WorkAccept();
+    if (error)
+        return;
+
+    boost::system::error_code ec;
+    ip::tcp::endpoint peer = conn->socket.remote_endpoint(ec);
+    if (ec || !ClientAllowed(peer.address()) || setWorkConnections.size() >= (unsigned int)MAX_WORK_CONNECTIONS)
+    {
+        conn->socket.close(ec);
+        return;
+    }
+    LogPrint("workserver", "work server connection from %s\n", peer.address().to_string());
+    setWorkConnections.insert(conn);
+    {
+        LOCK(cs_workStats);
+        workStats.nConnections++;
+    }
+    conn->Start();
+}
+
+static void WorkAccept()
+{
+    boost::shared_ptr<CWorkConnection> conn(new CWorkConnection(*work_io_service, *pworkSource, nWorkShareFactor));
+    workAcceptor->async_accept(conn->socket, boost::bind(&WorkAcceptHandler, conn, boost::asio::placeholders::error));
+}
+
+static void WorkNotifyAll(bool fClean)
+{
+    // Close() may drop a connection from the set while we go through it
+    set<boost::shared_ptr<CWorkConnection> > setConnections = setWorkConnections;
+    BOOST_FOREACH(const boost::shared_ptr<CWorkConnection>& conn, setConnections)
+        conn->Notify(fClean);
+    LOCK(cs_workStats);
+    workStats.nNotifies++;
+}
+
+// Wake up on every new tip, and when the memory pool has moved on for a while
+static void ThreadWorkNotify()
+{
+    RenameThread("Icochain-worknotify");
+    while (true)
+    {
+        CChainTipSnapshotRef ptip = GetChainTipSnapshot();
+        uint256 hashTip = ptip ? ptip->hashBlock : 0;
+        unsigned int nTransactionsUpdated = mempool.GetTransactionsUpdated();
+        if (!WaitForMiningTemplate(hashTip, nTransactionsUpdated))
+            return;
+        ptip = GetChainTipSnapshot();
+        bool fClean = !ptip || ptip->hashBlock != hashTip;
+        work_io_service->post(boost::bind(&WorkNotifyAll, fClean));
+    }
+}
+
+static void ThreadWorkServer()
+{
+    RenameThread("Icochain-workserver");
+    work_io_service->run();
+}
+
+void StartWorkServer()
+{
+    if (!GetBoolArg("-workserver", false) || !pwalletMain)
+        return;
+
+    assert(work_io_service == NULL);
+    work_io_service = new io_service();
+    pworkSource = new CMinerWorkSource();
+    nWorkShareFactor = std::max((int64_t)1, GetArg("-workservershare", 1));
+
+    // Pool front-ends normally run on the same machine; others need -workserverbind
+    // and -rpcallowip
+    ip::address bindAddress = ip::address_v4::loopback();
+    if (mapArgs.count("-workserverbind"))
+    {
+        boost::system::error_code ec;
+        bindAddress = ip::address::from_string(mapArgs["-workserverbind"], ec);
+        if (ec)
+        {
+            uiInterface.ThreadSafeMessageBox(strprintf(_("Invalid -workserverbind address: '%s'"), mapArgs["-workserverbind"]),
+                                             "", CClientUIInterface::MSG_ERROR);
+            StopWorkServer();
+            return;
+        }
+    }
+    ip::tcp::endpoint endpoint(bindAddress, GetArg("-workserverport", Params().RPCPort() + 2));
+    try
+    {
+        workAcceptor.reset(new ip::tcp::acceptor(*work_io_service));
+        workAcceptor->open(endpoint.protocol());
+        workAcceptor->set_option(ip::tcp::acceptor::reuse_address(true));
+        workAcceptor->bind(endpoint);
+        workAcceptor->listen(socket_base::max_connections);
+    }
+    catch(boost::system::system_error &e)
+    {
+        uiInterface.ThreadSafeMessageBox(strprintf(_("An error occurred while setting up the work server port %u for listening: %s"), endpoint.port(), e.what()),
+                                         "", CClientUIInterface::MSG_ERROR);
+        StopWorkServer();
+        return;
+    }
+    LogPrintf("Work server listening on port %u\n", endpoint.port());
+    WorkAccept();
+
+    work_threads = new boost::thread_group();
+    work_threads->create_thread(&ThreadWorkServer);
+    work_threads->create_thread(&ThreadWorkNotify);
+}
+
+void StopWorkServer()
+{
+    if (work_io_service == NULL)
+        return;
+
+    work_io_service->stop();
+    if (work_threads != NULL)
+    {
+        work_threads->interrupt_all();
+        work_threads->join_all();
+    }
+    delete work_threads; work_threads = NULL;
+    setWorkConnections.clear();
+    workAcceptor.reset();
+    delete work_io_service; work_io_service = NULL;
+    delete pworkSource; pworkSource = NULL;
+}
+
+bool GetWorkServerStats(CWorkServerStats& stats)
+{
+    if (work_io_service == NULL)
+        return false;
+    LOCK(cs_workStats);
+    stats = workStats;
+    return true;
+}
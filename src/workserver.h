@@ -0,0 +1,124 @@
+// Copyright (c) 2016 The Bitcoin developers
+// Distributed under the MIT/X11 software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+#ifndef BITCOIN_WORKSERVER_H
+#define BITCOIN_WORKSERVER_H
+
+#include "main.h"
+#include "json/json_spirit_value.h"
+
+#include <deque>
+#include <map>
+#include <set>
+#include <string>
+#include <utility>
+#include <vector>
+
+/** Jobs a session remembers for submissions; older ones are dropped first */
+static const unsigned int MAX_WORK_JOBS = 16;
+/** Longest request line a work server client may send */
+static const unsigned int MAX_WORK_LINE = 16 * 1024;
+static const int MAX_WORK_CONNECTIONS = 64;
+
+/** Stratum style error codes returned by mining.submit */
+enum WorkErrorCode
+{
+    WORK_OTHER             = 20,
+    WORK_JOB_NOT_FOUND     = 21,    // unknown or stale job
+    WORK_DUPLICATE_SHARE   = 22,
+    WORK_LOW_DIFFICULTY    = 23,
+    WORK_UNAUTHORIZED      = 24,
+    WORK_NOT_SUBSCRIBED    = 25,
+};
+
+/** Where a work session gets its jobs and sends its blocks */
+class CWorkSource
+{
+public:
+    virtual ~CWorkSource() {}
+    /** A copy of the current template with a coinbase of its own; false if there is none */
+    virtual bool CreateJob(CBlock& block) = 0;
+    /** Whether work on hashPrevBlock can still become a block */
+    virtual bool IsCurrent(const uint256& hashPrevBlock) = 0;
+    virtual bool SubmitBlock(CBlock& block) = 0;
+    /** Whether the credentials of mining.authorize may mine */
+    virtual bool Authorize(const std::string& strUser, const std::string& strPassword) = 0;
+};
+
+class CWorkSessionStats
+{
+public:
+    uint64_t nJobs;
+    uint64_t nShares;
+    uint64_t nStale;
+    uint64_t nRejected;
+    uint64_t nBlocks;
+
+    CWorkSessionStats() : nJobs(0), nShares(0), nStale(0), nRejected(0), nBlocks(0) {}
+};
+
+/** The protocol side of one work server connection, independent of the socket.
+ *
+ * Every line is a JSON-RPC 1.0 object. A client sends
+ *   {"id": 1, "method": "mining.subscribe", "params": []}
+ *   {"id": 2, "method": "mining.authorize", "params": [user, password]}
+ * with the RPC credentials, and once both succeeded is pushed
+ *   {"id": null, "method": "mining.notify", "params": [job_id, data, target, clean_jobs]}
+ * whenever the tip or the template changes, data and target being in getwork format and
+ * clean_jobs telling that earlier jobs are stale. Solutions come back as
+ *   {"id": 2, "method": "mining.submit", "params": [job_id, data]}
+ * of which only nTime and nNonce are taken. The reply is true for a share that meets the
+ * share target; one that also meets the block target goes to CWorkSource::SubmitBlock().
+ */
+class CWorkSession
+{
+private:
+    class CWorkJob
+    {
+    public:
+        CBlock block;
+        std::set<std::pair<unsigned int, unsigned int> > setSubmitted;  // (nTime, nNonce)
+    };
+
+    CWorkSource& source;
+    unsigned int nShareFactor;
+    bool fSubscribed;
+    bool fAuthorized;
+    unsigned int nNextJob;
+    std::map<std::string, CWorkJob> mapJobs;
+    std::deque<std::string> vJobOrder;
+
+    json_spirit::Value Submit(const json_spirit::Array& params);
+
+public:
+    CWorkSessionStats stats;
+
+    /** Shares are accepted at nShareFactorIn times the block target */
+    CWorkSession(CWorkSource& sourceIn, unsigned int nShareFactorIn = 1);
+
+    /** Handle one request line, appending replies and notifications to vSend.
+     * False if the client is to be disconnected. */
+    bool ProcessLine(const std::string& strLine, std::vector<std::string>& vSend);
+    /** Push a new job to a subscribed and authorized session; fClean forgets the earlier ones */
+    void Notify(bool fClean, std::vector<std::string>& vSend);
+    bool IsSubscribed() const { return fSubscribed; }
+    bool IsAuthorized() const { return fAuthorized; }
+};
+
+class CWorkServerStats
+{
+public:
+    int nConnections;
+    uint64_t nNotifies;
+    CWorkSessionStats sessions;
+
+    CWorkServerStats() : nConnections(0), nNotifies(0) {}
+};
+
+/** Start the push work server if -workserver is set */
+void StartWorkServer();
+void StopWorkServer();
+/** False if the work server is not running */
+bool GetWorkServerStats(CWorkServerStats& stats);
+
+#endif // BITCOIN_WORKSERVER_H